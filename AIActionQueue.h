@@ -0,0 +1,110 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** Delayed one-shot controller actions. Each maps to a case in AEnemyAIController::ExecuteScheduledAction; multi-step combat behaviours run as FAICombatTask coroutines instead. */
+enum class EAIScheduledAction : uint8
+{
+	None,
+	RevealMesh,
+	StartBehaviorTree,
+	EndGazeOverride,
+	EndTargetSelectionCooldown,
+	ProcessPerception,
+};
+
+struct FAIScheduledAction
+{
+	float FireTime = 0;
+	TWeakObjectPtr<AActor> Target;
+	// optional data for the action, unused by the current actions
+	FVector Payload = FVector::ZeroVector;
+	EAIScheduledAction Type = EAIScheduledAction::None;
+};
+
+/**
+ * Fixed-capacity queue of delayed actions owned by a controller and ticked by the AI scheduler.
+ * Storage is inline so scheduling never allocates, and the whole queue is dropped when the pawn dies.
+ */
+class FAIActionQueue
+{
+public:
+	static constexpr int32 Capacity = 16;
+	typedef TArray<FAIScheduledAction, TFixedAllocator<Capacity>> FActionArray;
+
+	/** Adds an action; returns false if the queue is full. */
+	bool Schedule(EAIScheduledAction Type, float FireTime, AActor* Target = nullptr, const FVector& Payload = FVector::ZeroVector)
+	{
+		if (Actions.Num() >= Capacity) return false;
+		FAIScheduledAction& Action = Actions.AddDefaulted_GetRef();
+		Action.Type = Type;
+		Action.FireTime = FireTime;
+		Action.Target = Target;
+		Action.Payload = Payload;
+		NextFireTime = FMath::Min(NextFireTime, FireTime);
+		return true;
+	}
+
+	/** Replaces any pending action of the same type, the way re-setting a timer handle would. */
+	bool Reschedule(EAIScheduledAction Type, float FireTime, AActor* Target = nullptr, const FVector& Payload = FVector::ZeroVector)
+	{
+		Cancel(Type);
+		return Schedule(Type, FireTime, Target, Payload);
+	}
+
+	/** Pushes a pending action back by ExtraDelay. Returns false if none of that type is scheduled. */
+	bool Postpone(EAIScheduledAction Type, float ExtraDelay)
+	{
+		FAIScheduledAction* Action = Actions.FindByPredicate([Type](const FAIScheduledAction& Action) {return Action.Type == Type;});
+		if (!Action) return false;
+		Action->FireTime += ExtraDelay;
+		// NextFireTime may now be early; PopDue recomputes it, so that only costs one extra scan
+		return true;
+	}
+
+	void Cancel(EAIScheduledAction Type)
+	{
+		Actions.RemoveAllSwap([Type](const FAIScheduledAction& Action) {return Action.Type == Type;});
+	}
+
+	void Reset()
+	{
+		Actions.Reset();
+		NextFireTime = MAX_flt;
+	}
+
+	bool IsScheduled(EAIScheduledAction Type) const
+	{
+		return Actions.ContainsByPredicate([Type](const FAIScheduledAction& Action) {return Action.Type == Type;});
+	}
+
+	/** Moves every action due at Now into OUT_Due in firing order. */
+	int32 PopDue(float Now, FActionArray& OUT_Due)
+	{
+		OUT_Due.Reset();
+		if (Now < NextFireTime) return 0;
+		NextFireTime = MAX_flt;
+		for (int32 i = Actions.Num() - 1; i >= 0; i--)
+		{
+			if (Actions[i].FireTime <= Now)
+			{
+				OUT_Due.Add(Actions[i]);
+				Actions.RemoveAtSwap(i, 1, false);
+			}
+			else
+			{
+				NextFireTime = FMath::Min(NextFireTime, Actions[i].FireTime);
+			}
+		}
+		OUT_Due.Sort([](const FAIScheduledAction& A, const FAIScheduledAction& B) {return A.FireTime < B.FireTime;});
+		return OUT_Due.Num();
+	}
+
+	int32 Num() const {return Actions.Num();}
+
+private:
+	FActionArray Actions;
+	float NextFireTime = MAX_flt;
+};
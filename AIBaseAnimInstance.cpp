@@ -0,0 +1,60 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "AIBaseAnimInstance.h"
+#include "AIBaseCharacter.h"
+
+namespace AIGaze
+{
+	// meshes not rendered in this long keep their last gaze
+	static constexpr float RecentlyRenderedTolerance = .2f;
+}
+
+void UAIBaseAnimInstance::NativeInitializeAnimation()
+{
+	Super::NativeInitializeAnimation();
+
+	Character = Cast<AAIBaseCharacter>(TryGetPawnOwner());
+	// gaze is cosmetic; a dedicated server has nobody to show it to
+	bIsDedicatedServer = IsRunningDedicatedServer();
+	if (Character.IsValid()) GazeFocusLocation = Character->GetActorLocation() + Character->GetActorForwardVector() * 100.f;
+}
+
+void UAIBaseAnimInstance::NativeUpdateAnimation(float DeltaSeconds)
+{
+	Super::NativeUpdateAnimation(DeltaSeconds);
+
+	GazeInputs.bHasFocus = false;
+	const AAIBaseCharacter* Owner = Character.Get();
+	if (!Owner || bIsDedicatedServer || Owner->bIsHurt || Owner->bIsDead) return;
+	if (!GetOwningComponent()->WasRecentlyRendered(AIGaze::RecentlyRenderedTolerance)) return;
+	const AActor* Focus = Owner->GazeFocusActor;
+	if (!Focus) return;
+	GazeInputs.Location = Owner->GetActorLocation();
+	GazeInputs.Forward = Owner->GetActorForwardVector();
+	GazeInputs.FocusLocation = Focus->GetActorLocation();
+	GazeInputs.bOverride = Owner->bOverrideProceduralGaze;
+	GazeInputs.bHasFocus = true;
+}
+
+void UAIBaseAnimInstance::NativeThreadSafeUpdateAnimation(float DeltaSeconds)
+{
+	Super::NativeThreadSafeUpdateAnimation(DeltaSeconds);
+
+	if (!GazeInputs.bHasFocus) return;
+	// a fresh sighting snaps the head round to the new enemy
+	if (GazeInputs.bOverride)
+	{
+		GazeFocusLocation = GazeInputs.FocusLocation;
+		return;
+	}
+	const FVector ToFocus = (GazeInputs.FocusLocation - GazeInputs.Location).GetSafeNormal();
+	if (ToFocus.Dot(GazeInputs.Forward) > InFrontDot)
+	{
+		GazeFocusLocation = FMath::VInterpTo(GazeFocusLocation, GazeInputs.FocusLocation, DeltaSeconds, GazeInterpSpeed);
+	}
+	else
+	{
+		GazeFocusLocation = GazeInputs.Location + GazeInputs.Forward * 100.f;
+	}
+}
@@ -0,0 +1,50 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Animation/AnimInstance.h"
+#include "AIBaseAnimInstance.generated.h"
+
+class AAIBaseCharacter;
+
+/**
+ * Anim instance parent for AI characters. Works out the procedural head gaze on the animation worker
+ * thread from the focus actor the controller publishes on the character. The game thread only copies a
+ * few locations and flags per update, and dedicated servers, or meshes nobody has seen lately, skip gaze.
+ */
+UCLASS()
+class EALOND_API UAIBaseAnimInstance : public UAnimInstance
+{
+	GENERATED_BODY()
+
+public:
+	/** Where the head look-at aims, in world space. */
+	UPROPERTY(BlueprintReadOnly, Category = "Gaze")
+	FVector GazeFocusLocation = FVector::ZeroVector;
+
+	// interp speed towards a focus in front of the character, as the controller used
+	static constexpr float GazeInterpSpeed = 4.f;
+	// dot of the forward vector and the direction to the focus above which the focus counts as in front
+	static constexpr float InFrontDot = .2f;
+
+protected:
+	virtual void NativeInitializeAnimation() override;
+	virtual void NativeUpdateAnimation(float DeltaSeconds) override;
+	virtual void NativeThreadSafeUpdateAnimation(float DeltaSeconds) override;
+
+private:
+	/** Game thread copy of what the gaze needs, read on the worker thread. */
+	struct FGazeInputs
+	{
+		FVector Location = FVector::ZeroVector;
+		FVector Forward = FVector::ForwardVector;
+		FVector FocusLocation = FVector::ZeroVector;
+		bool bHasFocus = false;
+		bool bOverride = false;
+	};
+
+	TWeakObjectPtr<AAIBaseCharacter> Character;
+	FGazeInputs GazeInputs;
+	bool bIsDedicatedServer = false;
+};
@@ -0,0 +1,107 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "AIBrainBenchmarkSubsystem.h"
+#include "EnemyAIController.h"
+#include "EnemyBrainComponents.h"
+#include "EngineUtils.h"
+
+namespace AIBrainBenchmark
+{
+	bool bRecording = false;
+
+	// brain ticks run on the game thread, so plain accumulators are enough
+	static double TickSeconds[int32(EAIBrainKind::MAX)] = {};
+	static int64 NumTicks[int32(EAIBrainKind::MAX)] = {};
+	// AI counts are sampled, not tracked; spawns and deaths between samples don't matter over a long window
+	static constexpr float SampleInterval = .5f;
+
+	void RecordTick(EAIBrainKind Kind, double Seconds)
+	{
+		TickSeconds[int32(Kind)] += Seconds;
+		++NumTicks[int32(Kind)];
+	}
+
+	static const TCHAR* GetKindName(EAIBrainKind Kind)
+	{
+		return Kind == EAIBrainKind::StateTree ? TEXT("state tree") : TEXT("behaviour tree");
+	}
+}
+
+void UAIBrainBenchmarkSubsystem::Deinitialize()
+{
+	if (IsRunning()) Finish();
+
+	Super::Deinitialize();
+}
+
+TStatId UAIBrainBenchmarkSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UAIBrainBenchmarkSubsystem, STATGROUP_Tickables);
+}
+
+void UAIBrainBenchmarkSubsystem::Start(float Seconds)
+{
+	if (IsRunning() || AIBrainBenchmark::bRecording)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("AI brain benchmark: already running"));
+		return;
+	}
+	FMemory::Memzero(AIBrainBenchmark::TickSeconds);
+	FMemory::Memzero(AIBrainBenchmark::NumTicks);
+	FMemory::Memzero(AISeconds);
+	StartTime = FPlatformTime::Seconds();
+	EndTime = StartTime + FMath::Max(Seconds, 1.f);
+	NextSampleTime = StartTime;
+	AIBrainBenchmark::bRecording = true;
+	UE_LOG(LogTemp, Log, TEXT("AI brain benchmark: recording for %.0f s"), EndTime - StartTime);
+}
+
+void UAIBrainBenchmarkSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	if (!IsRunning()) return;
+	const double Now = FPlatformTime::Seconds();
+	if (Now >= NextSampleTime)
+	{
+		SampleBrains(AIBrainBenchmark::SampleInterval);
+		NextSampleTime += AIBrainBenchmark::SampleInterval;
+	}
+	if (Now >= EndTime) Finish();
+}
+
+void UAIBrainBenchmarkSubsystem::SampleBrains(float SampleSeconds)
+{
+	for (TActorIterator<AEnemyAIController> It(GetWorld()); It; ++It)
+	{
+		const UBrainComponent* Brain = It->GetBrainComponent();
+		if (!Brain || !Brain->IsRunning()) continue;
+		if (Brain->IsA<UEnemyStateTreeComponent>()) AISeconds[int32(EAIBrainKind::StateTree)] += SampleSeconds;
+		else if (Brain->IsA<UEnemyBehaviorTreeComponent>()) AISeconds[int32(EAIBrainKind::BehaviorTree)] += SampleSeconds;
+	}
+}
+
+void UAIBrainBenchmarkSubsystem::Finish()
+{
+	AIBrainBenchmark::bRecording = false;
+	const double Elapsed = FPlatformTime::Seconds() - StartTime;
+	EndTime = 0;
+	for (int32 Kind = 0; Kind < int32(EAIBrainKind::MAX); Kind++)
+	{
+		const double TickMs = AIBrainBenchmark::TickSeconds[Kind] * 1000.0;
+		// CPU microseconds spent per AI for every second it was alive
+		const double UsPerAIPerSecond = AISeconds[Kind] > 0 ? AIBrainBenchmark::TickSeconds[Kind] * 1000000.0 / AISeconds[Kind] : 0;
+		UE_LOG(LogTemp, Log, TEXT("AI brain benchmark: %s, %.1f AI on average, %lld ticks, %.2f ms total, %.2f us per AI per second"),
+			AIBrainBenchmark::GetKindName(EAIBrainKind(Kind)), AISeconds[Kind] / Elapsed, AIBrainBenchmark::NumTicks[Kind], TickMs, UsPerAIPerSecond);
+	}
+}
+
+static FAutoConsoleCommandWithWorldAndArgs CVarRunAIBrainBenchmark(
+	TEXT("ai.Brain.Benchmark"),
+	TEXT("Time every AI brain tick for a while and log CPU per AI per second for each kind of brain. Optional arg: seconds (default 60)."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			UAIBrainBenchmarkSubsystem* Benchmark = World ? World->GetSubsystem<UAIBrainBenchmarkSubsystem>() : nullptr;
+			if (Benchmark) Benchmark->Start(Args.Num() ? FCString::Atof(*Args[0]) : 60.f);
+		}));
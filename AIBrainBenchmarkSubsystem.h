@@ -0,0 +1,70 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "AIBrainBenchmarkSubsystem.generated.h"
+
+class UBrainComponent;
+
+enum class EAIBrainKind : uint8
+{
+	BehaviorTree,
+	StateTree,
+	MAX,
+};
+
+namespace AIBrainBenchmark
+{
+	// set while a benchmark window is open; brain ticks only pay for a clock read when it is
+	extern EALOND_API bool bRecording;
+	EALOND_API void RecordTick(EAIBrainKind Kind, double Seconds);
+}
+
+/** Times one brain tick into the running benchmark, if there is one. */
+struct FAIBrainTickScope
+{
+	explicit FAIBrainTickScope(EAIBrainKind InKind)
+		: Kind(InKind)
+		, StartTime(AIBrainBenchmark::bRecording ? FPlatformTime::Seconds() : 0)
+	{
+	}
+
+	~FAIBrainTickScope()
+	{
+		if (AIBrainBenchmark::bRecording && StartTime > 0) AIBrainBenchmark::RecordTick(Kind, FPlatformTime::Seconds() - StartTime);
+	}
+
+	EAIBrainKind Kind;
+	double StartTime;
+};
+
+/**
+ * Measures what the AI brains cost. While a window is open, every brain tick is timed and the number of
+ * AI running each kind of brain is sampled. At the end, CPU per AI per second is logged for the
+ * behaviour tree and the state tree brain side by side. Meant for a headless server on a siege map; see ai.Brain.Benchmark.
+ */
+UCLASS()
+class EALOND_API UAIBrainBenchmarkSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	void Start(float Seconds);
+	bool IsRunning() const {return EndTime > 0;}
+
+private:
+	void SampleBrains(float SampleSeconds);
+	void Finish();
+
+	double StartTime = 0;
+	double EndTime = 0;
+	double NextSampleTime = 0;
+	// AI running each kind of brain, integrated over the window
+	double AISeconds[int32(EAIBrainKind::MAX)] = {};
+};
@@ -0,0 +1,157 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "AICombatTask.h"
+#include "AITraceSubsystem.h"
+#include "Animation/AnimInstance.h"
+#include "Animation/AnimMontage.h"
+
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("AI combat task frames live"), STAT_AICombatFramesLive, STATGROUP_EalondAI);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("AI combat task frames pooled"), STAT_AICombatFramesPooled, STATGROUP_EalondAI);
+
+namespace AICombatTaskPool
+{
+	// frames are bucketed into a few size classes and recycled through intrusive free lists; game thread only
+	static constexpr int32 NumSizeClasses = 4;
+	static constexpr SIZE_T SizeClasses[NumSizeClasses] = {256, 512, 1024, 2048};
+
+	struct FFreeBlock
+	{
+		FFreeBlock* Next;
+	};
+
+	static FFreeBlock* FreeLists[NumSizeClasses] = {};
+
+	static int32 GetSizeClass(SIZE_T Size)
+	{
+		for (int32 i = 0; i < NumSizeClasses; i++)
+		{
+			if (Size <= SizeClasses[i]) return i;
+		}
+		return INDEX_NONE;
+	}
+
+	static void* Allocate(SIZE_T Size)
+	{
+		check(IsInGameThread());
+		INC_DWORD_STAT(STAT_AICombatFramesLive);
+		const int32 SizeClass = GetSizeClass(Size);
+		if (SizeClass == INDEX_NONE) return FMemory::Malloc(Size);
+		if (FFreeBlock* Block = FreeLists[SizeClass])
+		{
+			FreeLists[SizeClass] = Block->Next;
+			DEC_DWORD_STAT(STAT_AICombatFramesPooled);
+			return Block;
+		}
+		return FMemory::Malloc(SizeClasses[SizeClass]);
+	}
+
+	static void Free(void* Ptr, SIZE_T Size)
+	{
+		check(IsInGameThread());
+		DEC_DWORD_STAT(STAT_AICombatFramesLive);
+		const int32 SizeClass = GetSizeClass(Size);
+		if (SizeClass == INDEX_NONE)
+		{
+			FMemory::Free(Ptr);
+			return;
+		}
+		FFreeBlock* Block = static_cast<FFreeBlock*>(Ptr);
+		Block->Next = FreeLists[SizeClass];
+		FreeLists[SizeClass] = Block;
+		INC_DWORD_STAT(STAT_AICombatFramesPooled);
+	}
+}
+
+void* FAICombatTask::promise_type::operator new(size_t Size)
+{
+	return AICombatTaskPool::Allocate(Size);
+}
+
+void FAICombatTask::promise_type::operator delete(void* Ptr, size_t Size)
+{
+	AICombatTaskPool::Free(Ptr, Size);
+}
+
+void FAICombatTaskRunner::Start(EAICombatTaskSlot Slot, FAICombatTask&& Task, float Now)
+{
+	FAICombatTask& SlotTask = Tasks[int32(Slot)];
+	if (!ensureMsgf(&SlotTask != ResumingTask, TEXT("Combat task tried to replace itself"))) return;
+	SlotTask = MoveTemp(Task);
+	Resume(SlotTask, Now);
+}
+
+void FAICombatTaskRunner::Cancel(EAICombatTaskSlot Slot)
+{
+	FAICombatTask& SlotTask = Tasks[int32(Slot)];
+	if (!ensureMsgf(&SlotTask != ResumingTask, TEXT("Combat task tried to cancel itself"))) return;
+	SlotTask.Reset();
+}
+
+void FAICombatTaskRunner::CancelAll()
+{
+	for (FAICombatTask& Task : Tasks)
+	{
+		if (&Task != ResumingTask) Task.Reset();
+	}
+}
+
+bool FAICombatTaskRunner::IsRunning(EAICombatTaskSlot Slot) const
+{
+	return !Tasks[int32(Slot)].IsDone();
+}
+
+int32 FAICombatTaskRunner::Tick(float Now)
+{
+	int32 NumResumed = 0;
+	for (FAICombatTask& Task : Tasks)
+	{
+		if (Task.IsDone()) continue;
+		if (IsWaitSatisfied(Task.Handle.promise().Wait, Now))
+		{
+			Resume(Task, Now);
+			++NumResumed;
+		}
+	}
+	return NumResumed;
+}
+
+void FAICombatTaskRunner::Resume(FAICombatTask& Task, float Now)
+{
+	if (Task.IsDone()) return;
+	Task.Handle.promise().Wait = FAICombatWait();
+	{
+		// a task can start or resume another from inside itself; put the outer guard back afterwards
+		TGuardValue<const FAICombatTask*> ResumingGuard(ResumingTask, &Task);
+		Task.Handle.resume();
+	}
+	if (Task.IsDone())
+	{
+		Task.Reset();
+		return;
+	}
+	// arm whatever the task suspended on against the time it suspended
+	FAICombatWait& Wait = Task.Handle.promise().Wait;
+	Wait.StartTime = Now;
+	Wait.WakeTime = Now + Wait.Duration;
+}
+
+bool FAICombatTaskRunner::IsWaitSatisfied(FAICombatWait& Wait, float Now)
+{
+	switch (Wait.Type)
+	{
+	case FAICombatWait::EType::Delay:
+		return Now >= Wait.WakeTime;
+	case FAICombatWait::EType::Montage:
+	{
+		UAnimInstance* AnimInstance = Wait.AnimInstance.Get();
+		if (!AnimInstance || !Wait.Montage.IsValid() || Now >= Wait.WakeTime) return true;
+		bool bIsPlaying = AnimInstance->Montage_IsPlaying(Wait.Montage.Get());
+		if (bIsPlaying) Wait.bMontageStarted = true;
+		// montages played through an RPC can start a frame late; give them a moment before treating not-playing as finished
+		return Wait.bMontageStarted ? !bIsPlaying : Now - Wait.StartTime > .25f;
+	}
+	default:
+		return true;
+	}
+}
@@ -0,0 +1,156 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <coroutine>
+
+class UAnimInstance;
+class UAnimMontage;
+
+/** What a suspended combat task is waiting on. Checked by FAICombatTaskRunner every scheduler tick. */
+struct FAICombatWait
+{
+	enum class EType : uint8
+	{
+		None,
+		Delay,
+		Montage,
+	};
+
+	EType Type = EType::None;
+	// seconds to wait (delay) or the longest to wait (montage); turned into WakeTime when the task suspends
+	float Duration = 0;
+	float WakeTime = -1.f;
+	float StartTime = 0;
+	bool bMontageStarted = false;
+	TWeakObjectPtr<UAnimInstance> AnimInstance;
+	TWeakObjectPtr<const UAnimMontage> Montage;
+};
+
+/**
+ * Coroutine return type for enemy combat behaviours. Tasks start suspended, are resumed only by the
+ * runner on the game thread, and take their frames from a pooled allocator. Destroying the task
+ * (cancel, death, unpossess) destroys the frame at its current suspension point.
+ */
+class FAICombatTask
+{
+public:
+	struct promise_type
+	{
+		FAICombatWait Wait;
+
+		FAICombatTask get_return_object() {return FAICombatTask(std::coroutine_handle<promise_type>::from_promise(*this));}
+		std::suspend_always initial_suspend() noexcept {return {};}
+		std::suspend_always final_suspend() noexcept {return {};}
+		void return_void() {}
+		void unhandled_exception() {checkNoEntry();}
+
+		static void* operator new(size_t Size);
+		static void operator delete(void* Ptr, size_t Size);
+	};
+
+	FAICombatTask() = default;
+	explicit FAICombatTask(std::coroutine_handle<promise_type> InHandle) : Handle(InHandle) {}
+	FAICombatTask(FAICombatTask&& Other) : Handle(Other.Handle) {Other.Handle = nullptr;}
+	FAICombatTask& operator=(FAICombatTask&& Other)
+	{
+		if (this != &Other)
+		{
+			Reset();
+			Handle = Other.Handle;
+			Other.Handle = nullptr;
+		}
+		return *this;
+	}
+	FAICombatTask(const FAICombatTask&) = delete;
+	FAICombatTask& operator=(const FAICombatTask&) = delete;
+	~FAICombatTask() {Reset();}
+
+	bool IsValid() const {return bool(Handle);}
+	bool IsDone() const {return !Handle || Handle.done();}
+	/** Destroys the frame wherever it is suspended; nothing after the current co_await runs. */
+	void Reset()
+	{
+		if (Handle)
+		{
+			Handle.destroy();
+			Handle = nullptr;
+		}
+	}
+
+private:
+	friend class FAICombatTaskRunner;
+	std::coroutine_handle<promise_type> Handle;
+};
+
+/** co_await FAIDelay(Seconds) */
+struct FAIDelay
+{
+	float Seconds;
+
+	explicit FAIDelay(float InSeconds) : Seconds(InSeconds) {}
+	bool await_ready() const {return Seconds <= 0;}
+	void await_suspend(std::coroutine_handle<FAICombatTask::promise_type> Handle) const
+	{
+		FAICombatWait& Wait = Handle.promise().Wait;
+		Wait = FAICombatWait();
+		Wait.Type = FAICombatWait::EType::Delay;
+		Wait.Duration = Seconds;
+	}
+	void await_resume() const {}
+};
+
+/** co_await FAIWaitMontage(AnimInstance, Montage, MaxWait): resumes when the montage stops, or after MaxWait. */
+struct FAIWaitMontage
+{
+	UAnimInstance* AnimInstance;
+	const UAnimMontage* Montage;
+	float MaxWait;
+
+	FAIWaitMontage(UAnimInstance* InAnimInstance, const UAnimMontage* InMontage, float InMaxWait) : AnimInstance(InAnimInstance), Montage(InMontage), MaxWait(InMaxWait) {}
+	bool await_ready() const {return !AnimInstance || !Montage;}
+	void await_suspend(std::coroutine_handle<FAICombatTask::promise_type> Handle) const
+	{
+		FAICombatWait& Wait = Handle.promise().Wait;
+		Wait = FAICombatWait();
+		Wait.Type = FAICombatWait::EType::Montage;
+		Wait.Duration = MaxWait;
+		Wait.AnimInstance = AnimInstance;
+		Wait.Montage = Montage;
+	}
+	void await_resume() const {}
+};
+
+/** Combat task slots; starting a task in a slot cancels whatever was running there. */
+enum class EAICombatTaskSlot : uint8
+{
+	Dodge,
+	Block,
+	Attack,
+	// the leader's engage animation; apart from Recover, since a kill recovery can start an engage
+	Engage,
+	Recover,
+	MAX,
+};
+
+/** Per-controller host for combat tasks, ticked from the AI scheduler. Fixed slot storage, no allocation beyond the pooled frames. */
+class FAICombatTaskRunner
+{
+public:
+	/** Cancels the slot's current task and runs the new one up to its first suspension. */
+	void Start(EAICombatTaskSlot Slot, FAICombatTask&& Task, float Now);
+	void Cancel(EAICombatTaskSlot Slot);
+	void CancelAll();
+	bool IsRunning(EAICombatTaskSlot Slot) const;
+	/** Resumes every task whose wait has been satisfied. Returns the number resumed. */
+	int32 Tick(float Now);
+
+private:
+	void Resume(FAICombatTask& Task, float Now);
+	static bool IsWaitSatisfied(FAICombatWait& Wait, float Now);
+
+	FAICombatTask Tasks[int32(EAICombatTaskSlot::MAX)];
+	// task currently being resumed; it can't be cancelled or replaced from inside itself
+	const FAICombatTask* ResumingTask = nullptr;
+};
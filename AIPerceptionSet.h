@@ -0,0 +1,124 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Algo/BinarySearch.h"
+#include "Algo/Sort.h"
+#include "Algo/Unique.h"
+#include "UObject/ObjectKey.h"
+
+/** What a perceived actor means to the controller, worked out once when it is first seen. */
+enum class EAIPerceivedKind : uint8
+{
+	Other,
+	Enemy,
+	Building,
+	MAX,
+};
+
+/**
+ * Sorted set of the actors a controller currently sees. Perception updates only queue the actors they
+ * touched. Apply merges the queue into the set in one linear walk and reports which actors were newly
+ * seen and which were lost. Reacting to a batch therefore costs in proportion to what changed, not to
+ * everything in view.
+ */
+class FAIPerceptionSet
+{
+public:
+	struct FEntry
+	{
+		TObjectKey<AActor> Actor;
+		EAIPerceivedKind Kind = EAIPerceivedKind::Other;
+	};
+
+	/** Queues actors whose stimuli changed; several updates in a frame collapse into one Apply. */
+	void AddPending(const TArray<AActor*>& UpdatedActors)
+	{
+		for (AActor* Actor : UpdatedActors)
+		{
+			if (Actor) Pending.Add(TObjectKey<AActor>(Actor));
+		}
+	}
+
+	bool HasPending() const {return Pending.Num() > 0;}
+
+	/**
+	 * Merges queued actors into the set. IsSensed(AActor*) says whether a queued actor is still seen,
+	 * Classify(AActor*) gives the kind of one seen for the first time. Actors destroyed while in view drop out silently.
+	 */
+	template<typename SensedFunc, typename ClassifyFunc>
+	void Apply(SensedFunc&& IsSensed, ClassifyFunc&& Classify, TArray<AActor*>& OUT_NewlySeen, TArray<AActor*>& OUT_NewlyLost)
+	{
+		Algo::Sort(Pending);
+		Pending.SetNum(Algo::Unique(Pending), false);
+		Merged.Reset(Entries.Num() + Pending.Num());
+		int32 i = 0;
+		int32 j = 0;
+		while (i < Entries.Num() || j < Pending.Num())
+		{
+			if (j == Pending.Num() || (i < Entries.Num() && Entries[i].Actor < Pending[j]))
+			{
+				// untouched by this batch
+				if (Entries[i].Actor.ResolveObjectPtr()) Merged.Add(Entries[i]);
+				else --Counts[int32(Entries[i].Kind)];
+				++i;
+			}
+			else if (i == Entries.Num() || Pending[j] < Entries[i].Actor)
+			{
+				AActor* Actor = Pending[j].ResolveObjectPtr();
+				if (Actor && IsSensed(Actor))
+				{
+					const EAIPerceivedKind Kind = Classify(Actor);
+					Merged.Add(FEntry{Pending[j], Kind});
+					++Counts[int32(Kind)];
+					OUT_NewlySeen.Add(Actor);
+				}
+				++j;
+			}
+			else
+			{
+				AActor* Actor = Pending[j].ResolveObjectPtr();
+				if (Actor && IsSensed(Actor)) Merged.Add(Entries[i]);
+				else
+				{
+					--Counts[int32(Entries[i].Kind)];
+					if (Actor) OUT_NewlyLost.Add(Actor);
+				}
+				++i;
+				++j;
+			}
+		}
+		Swap(Entries, Merged);
+		Pending.Reset();
+	}
+
+	bool Contains(const AActor* Actor) const
+	{
+		return Algo::BinarySearchBy(Entries, TObjectKey<AActor>(Actor), &FEntry::Actor) != INDEX_NONE;
+	}
+
+	/** Kind the actor was given when first seen, or MAX if it isn't in view. */
+	EAIPerceivedKind GetKind(const AActor* Actor) const
+	{
+		const int32 Index = Algo::BinarySearchBy(Entries, TObjectKey<AActor>(Actor), &FEntry::Actor);
+		return Index != INDEX_NONE ? Entries[Index].Kind : EAIPerceivedKind::MAX;
+	}
+
+	int32 Num(EAIPerceivedKind Kind) const {return Counts[int32(Kind)];}
+	int32 Num() const {return Entries.Num();}
+
+	void Reset()
+	{
+		Entries.Reset();
+		Pending.Reset();
+		FMemory::Memzero(Counts);
+	}
+
+private:
+	// sorted by actor key
+	TArray<FEntry> Entries;
+	TArray<FEntry> Merged;
+	TArray<TObjectKey<AActor>> Pending;
+	int32 Counts[int32(EAIPerceivedKind::MAX)] = {};
+};
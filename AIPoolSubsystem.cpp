@@ -0,0 +1,220 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "AIPoolSubsystem.h"
+#include "AIBaseCharacter.h"
+#include "AITraceSubsystem.h"
+#include "EnemyAIController.h"
+#include "StatusEffectSubsystem.h"
+#include "Components/CapsuleComponent.h"
+#include "GameFramework/CharacterMovementComponent.h"
+
+DECLARE_CYCLE_STAT(TEXT("AI pool acquire"), STAT_AIPoolAcquire, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("AI pool hits"), STAT_AIPoolHits, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("AI pool misses"), STAT_AIPoolMisses, STATGROUP_EalondAI);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("AI pool dormant"), STAT_AIPoolDormant, STATGROUP_EalondAI);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("AI spawn latency (ms)"), STAT_AISpawnLatencyMs, STATGROUP_EalondAI);
+
+namespace AIPool
+{
+	// dormant pairs spawned per frame while prewarming
+	static constexpr int32 MaxSpawnsPerTick = 2;
+	// dormant pawns wait out of sight below the world
+	static const FVector DormantLocation(0, 0, -100000.f);
+}
+
+void UAIPoolSubsystem::Deinitialize()
+{
+	Dormant.Empty();
+	PrewarmQueue.Empty();
+	PendingReleases.Empty();
+
+	Super::Deinitialize();
+}
+
+TStatId UAIPoolSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UAIPoolSubsystem, STATGROUP_Tickables);
+}
+
+void UAIPoolSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	const float Now = GetWorld()->GetTimeSeconds();
+	for (int32 i = PendingReleases.Num() - 1; i >= 0; i--)
+	{
+		if (PendingReleases[i].ReleaseTime > Now) continue;
+		const FPooledPair Pair = PendingReleases[i].Pair;
+		PendingReleases.RemoveAtSwap(i);
+		if (!Pair.Pawn.IsValid() || !Pair.Controller.IsValid()) continue;
+		MakeDormant(Pair);
+		Dormant.FindOrAdd(Pair.Pawn->GetClass()).Add(Pair);
+	}
+
+	int32 NumSpawned = 0;
+	for (auto It = PrewarmQueue.CreateIterator(); It && NumSpawned < AIPool::MaxSpawnsPerTick; ++It)
+	{
+		while (It.Value() > 0 && NumSpawned < AIPool::MaxSpawnsPerTick)
+		{
+			--It.Value();
+			++NumSpawned;
+			if (!SpawnDormant(It.Key())) It.Value() = 0;
+		}
+		if (It.Value() <= 0) It.RemoveCurrent();
+	}
+
+	int32 NumDormant = 0;
+	for (const TPair<UClass*, TArray<FPooledPair>>& Pair : Dormant)
+	{
+		NumDormant += Pair.Value.Num();
+	}
+	SET_DWORD_STAT(STAT_AIPoolDormant, NumDormant);
+}
+
+void UAIPoolSubsystem::Prewarm(TSubclassOf<AAIBaseCharacter> PawnClass, int32 Count)
+{
+	if (PawnClass && Count > 0) PrewarmQueue.FindOrAdd(PawnClass) += Count;
+}
+
+int32 UAIPoolSubsystem::GetNumDormant(TSubclassOf<AAIBaseCharacter> PawnClass) const
+{
+	const TArray<FPooledPair>* Pairs = Dormant.Find(PawnClass);
+	return Pairs ? Pairs->Num() : 0;
+}
+
+int32 UAIPoolSubsystem::GetNumPrewarming(TSubclassOf<AAIBaseCharacter> PawnClass) const
+{
+	const int32* Count = PrewarmQueue.Find(PawnClass);
+	return Count ? FMath::Max(*Count, 0) : 0;
+}
+
+bool UAIPoolSubsystem::SpawnDormant(UClass* PawnClass)
+{
+	UWorld* World = GetWorld();
+	// spawn without auto possession; possessing runs the full OnPossess setup, which waits for Acquire
+	AAIBaseCharacter* Pawn = World->SpawnActorDeferred<AAIBaseCharacter>(PawnClass, FTransform(AIPool::DormantLocation), nullptr, nullptr, ESpawnActorCollisionHandlingMethod::AlwaysSpawn);
+	if (!Pawn) return false;
+	Pawn->AutoPossessAI = EAutoPossessAI::Disabled;
+	Pawn->FinishSpawning(FTransform(AIPool::DormantLocation));
+	FActorSpawnParameters Params;
+	Params.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	AEnemyAIController* Controller = World->SpawnActor<AEnemyAIController>(Pawn->AIControllerClass ? *Pawn->AIControllerClass : AEnemyAIController::StaticClass(), Params);
+	if (!Controller)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("AI pool: %s has no enemy AI controller class, not pooling it"), *PawnClass->GetName());
+		Pawn->Destroy();
+		return false;
+	}
+	FPooledPair Pair;
+	Pair.Pawn = Pawn;
+	Pair.Controller = Controller;
+	MakeDormant(Pair);
+	Dormant.FindOrAdd(PawnClass).Add(Pair);
+	return true;
+}
+
+void UAIPoolSubsystem::MakeDormant(const FPooledPair& Pair)
+{
+	AAIBaseCharacter* Pawn = Pair.Pawn.Get();
+	AEnemyAIController* Controller = Pair.Controller.Get();
+	if (Controller->GetPawn()) Controller->UnPossess();
+	Controller->ResetForPool(Pawn);
+	Pawn->SetActorHiddenInGame(true);
+	Pawn->SetActorEnableCollision(false);
+	Pawn->GetCharacterMovement()->StopMovementImmediately();
+	Pawn->GetCharacterMovement()->DisableMovement();
+	// corpses are usually ragdolled; put the mesh back on the capsule as the class defaults have it
+	USkeletalMeshComponent* Mesh = Pawn->GetMesh();
+	const AAIBaseCharacter* Defaults = Pawn->GetClass()->GetDefaultObject<AAIBaseCharacter>();
+	Mesh->SetSimulatePhysics(false);
+	Mesh->AttachToComponent(Pawn->GetCapsuleComponent(), FAttachmentTransformRules::SnapToTargetNotIncludingScale);
+	Mesh->SetRelativeTransform(Defaults->GetMesh()->GetRelativeTransform());
+	Pawn->SetActorLocation(AIPool::DormantLocation, false, nullptr, ETeleportType::ResetPhysics);
+	Pawn->SetActorTickEnabled(false);
+	for (UActorComponent* Component : Pawn->GetComponents())
+	{
+		Component->SetComponentTickEnabled(false);
+	}
+}
+
+void UAIPoolSubsystem::Activate(const FPooledPair& Pair, const FTransform& SpawnTransform)
+{
+	AAIBaseCharacter* Pawn = Pair.Pawn.Get();
+	Pawn->SetActorTransform(SpawnTransform, false, nullptr, ETeleportType::ResetPhysics);
+	Pawn->SetActorHiddenInGame(false);
+	Pawn->SetActorEnableCollision(true);
+	Pawn->SetActorTickEnabled(true);
+	for (UActorComponent* Component : Pawn->GetComponents())
+	{
+		if (Component->PrimaryComponentTick.bStartWithTickEnabled) Component->SetComponentTickEnabled(true);
+	}
+	Pawn->GetCharacterMovement()->SetDefaultMovementMode();
+	// OnPossess hides the mesh again and plays the spawn animation, the same as for a fresh spawn
+	Pair.Controller->Possess(Pawn);
+}
+
+AAIBaseCharacter* UAIPoolSubsystem::Acquire(TSubclassOf<AAIBaseCharacter> PawnClass, const FTransform& SpawnTransform)
+{
+	SCOPE_CYCLE_COUNTER(STAT_AIPoolAcquire);
+	if (!PawnClass) return nullptr;
+	const double StartTime = FPlatformTime::Seconds();
+	if (TArray<FPooledPair>* Pairs = Dormant.Find(PawnClass))
+	{
+		while (Pairs->Num())
+		{
+			const FPooledPair Pair = Pairs->Pop(false);
+			if (!Pair.Pawn.IsValid() || !Pair.Controller.IsValid()) continue;
+			Activate(Pair, SpawnTransform);
+			const double LatencyMs = (FPlatformTime::Seconds() - StartTime) * 1000.0;
+			PooledLatency.Add(LatencyMs);
+			INC_DWORD_STAT(STAT_AIPoolHits);
+			INC_FLOAT_STAT_BY(STAT_AISpawnLatencyMs, LatencyMs);
+			return Pair.Pawn.Get();
+		}
+	}
+	// pool empty: spawn the old way; the pair joins the pool when it dies
+	FActorSpawnParameters Params;
+	Params.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButAlwaysSpawn;
+	AAIBaseCharacter* Pawn = GetWorld()->SpawnActor<AAIBaseCharacter>(PawnClass, SpawnTransform, Params);
+	if (Pawn && !Pawn->GetController()) Pawn->SpawnDefaultController();
+	const double LatencyMs = (FPlatformTime::Seconds() - StartTime) * 1000.0;
+	SpawnedLatency.Add(LatencyMs);
+	INC_DWORD_STAT(STAT_AIPoolMisses);
+	INC_FLOAT_STAT_BY(STAT_AISpawnLatencyMs, LatencyMs);
+	return Pawn;
+}
+
+void UAIPoolSubsystem::Release(AAIBaseCharacter* Pawn, AEnemyAIController* Controller, float Delay)
+{
+	if (!Pawn || !Controller) return;
+	// a dormant pawn mustn't keep burning, or keep its effect FX attached while hidden
+	if (UStatusEffectSubsystem* StatusEffects = GetWorld()->GetSubsystem<UStatusEffectSubsystem>()) StatusEffects->ClearEffects(Pawn);
+	FPendingRelease& Release = PendingReleases.AddDefaulted_GetRef();
+	Release.Pair.Pawn = Pawn;
+	Release.Pair.Controller = Controller;
+	Release.ReleaseTime = GetWorld()->GetTimeSeconds() + Delay;
+}
+
+void UAIPoolSubsystem::DumpStats() const
+{
+	for (const TPair<UClass*, TArray<FPooledPair>>& Pair : Dormant)
+	{
+		UE_LOG(LogTemp, Log, TEXT("AI pool: %s, %d dormant"), *Pair.Key->GetName(), Pair.Value.Num());
+	}
+	UE_LOG(LogTemp, Log, TEXT("AI pool: %d pending release"), PendingReleases.Num());
+	auto LogLatency = [](const TCHAR* Label, const FSpawnLatency& Latency)
+	{
+		UE_LOG(LogTemp, Log, TEXT("AI pool: %s spawns %d, avg %.3f ms, max %.3f ms"), Label, Latency.Count, Latency.Count ? Latency.TotalMs / Latency.Count : 0.0, Latency.MaxMs);
+	};
+	LogLatency(TEXT("pooled"), PooledLatency);
+	LogLatency(TEXT("fresh"), SpawnedLatency);
+}
+
+static FAutoConsoleCommandWithWorld CVarDumpAIPoolStats(
+	TEXT("ai.Pool.Stats"),
+	TEXT("Log AI pool sizes and spawn latency for pooled and freshly spawned AI."),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+		{
+			if (UAIPoolSubsystem* Pool = World ? World->GetSubsystem<UAIPoolSubsystem>() : nullptr) Pool->DumpStats();
+		}));
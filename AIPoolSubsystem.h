@@ -0,0 +1,80 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "AIPoolSubsystem.generated.h"
+
+class AAIBaseCharacter;
+class AEnemyAIController;
+
+/**
+ * Pool of dormant enemy pawn and controller pairs. Pairs are pre-spawned a few per frame, handed out by
+ * Acquire with their health, death state, memory, team and blackboard state reset, and taken back a while
+ * after the pawn dies instead of being destroyed. Acquire falls back to a normal spawn when the pool for a
+ * class is empty.
+ */
+UCLASS()
+class EALOND_API UAIPoolSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/** Queues Count dormant pairs of the class; they are spawned over the next frames. */
+	void Prewarm(TSubclassOf<AAIBaseCharacter> PawnClass, int32 Count);
+
+	/** Activates a dormant pair at the transform and possesses it, or spawns a new one if none is ready. */
+	AAIBaseCharacter* Acquire(TSubclassOf<AAIBaseCharacter> PawnClass, const FTransform& SpawnTransform);
+
+	/** Takes the dead pawn and its controller back into the pool once the corpse has lingered for Delay seconds. */
+	void Release(AAIBaseCharacter* Pawn, AEnemyAIController* Controller, float Delay = 10.f);
+
+	int32 GetNumDormant(TSubclassOf<AAIBaseCharacter> PawnClass) const;
+	/** Pairs of the class queued by Prewarm and not spawned yet. */
+	int32 GetNumPrewarming(TSubclassOf<AAIBaseCharacter> PawnClass) const;
+	/** Logs pool sizes and spawn latency for pooled and freshly spawned AI. */
+	void DumpStats() const;
+
+private:
+	struct FPooledPair
+	{
+		TWeakObjectPtr<AAIBaseCharacter> Pawn;
+		TWeakObjectPtr<AEnemyAIController> Controller;
+	};
+
+	struct FPendingRelease
+	{
+		FPooledPair Pair;
+		float ReleaseTime = 0;
+	};
+
+	struct FSpawnLatency
+	{
+		int32 Count = 0;
+		double TotalMs = 0;
+		double MaxMs = 0;
+
+		void Add(double Ms)
+		{
+			++Count;
+			TotalMs += Ms;
+			MaxMs = FMath::Max(MaxMs, Ms);
+		}
+	};
+
+	bool SpawnDormant(UClass* PawnClass);
+	void MakeDormant(const FPooledPair& Pair);
+	void Activate(const FPooledPair& Pair, const FTransform& SpawnTransform);
+
+	TMap<UClass*, TArray<FPooledPair>> Dormant;
+	TMap<UClass*, int32> PrewarmQueue;
+	TArray<FPendingRelease> PendingReleases;
+
+	FSpawnLatency PooledLatency;
+	FSpawnLatency SpawnedLatency;
+};
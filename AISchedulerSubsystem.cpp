@@ -0,0 +1,61 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "AISchedulerSubsystem.h"
+#include "AITraceSubsystem.h"
+#include "EnemyAIController.h"
+
+DECLARE_CYCLE_STAT(TEXT("AI scheduled actions"), STAT_AIScheduledActions, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("AI scheduled actions fired"), STAT_AIScheduledActionsFired, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("AI path requests/sec"), STAT_AIPathRequestsPerSecond, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("AI squad follow moves/sec"), STAT_AISquadFollowsPerSecond, STATGROUP_EalondAI);
+
+void UAISchedulerSubsystem::Deinitialize()
+{
+	Controllers.Empty();
+
+	Super::Deinitialize();
+}
+
+TStatId UAISchedulerSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UAISchedulerSubsystem, STATGROUP_Tickables);
+}
+
+void UAISchedulerSubsystem::RegisterController(AEnemyAIController* Controller)
+{
+	if (Controller) Controllers.AddUnique(Controller);
+}
+
+void UAISchedulerSubsystem::UnregisterController(AEnemyAIController* Controller)
+{
+	Controllers.RemoveSwap(Controller);
+}
+
+void UAISchedulerSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	SCOPE_CYCLE_COUNTER(STAT_AIScheduledActions);
+	const float Now = GetWorld()->GetTimeSeconds();
+	if (Now - PathStatsWindowStart >= 1.0)
+	{
+		LastPathRequestsPerSecond = PathRequests;
+		LastSquadFollowsPerSecond = SquadFollows;
+		PathRequests = 0;
+		SquadFollows = 0;
+		PathStatsWindowStart = Now;
+	}
+	SET_DWORD_STAT(STAT_AIPathRequestsPerSecond, LastPathRequestsPerSecond);
+	SET_DWORD_STAT(STAT_AISquadFollowsPerSecond, LastSquadFollowsPerSecond);
+	for (int32 i = Controllers.Num() - 1; i >= 0; i--)
+	{
+		AEnemyAIController* Controller = Controllers[i].Get();
+		if (!Controller)
+		{
+			Controllers.RemoveAtSwap(i);
+			continue;
+		}
+		INC_DWORD_STAT_BY(STAT_AIScheduledActionsFired, Controller->TickScheduledActions(Now));
+	}
+}
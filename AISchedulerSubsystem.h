@@ -0,0 +1,43 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "AISchedulerSubsystem.generated.h"
+
+class AEnemyAIController;
+
+/**
+ * Single game-thread tick for per-controller scheduled work. Controllers register on possess and
+ * unregister on death or unpossess; their action queues are drained here in one pass. Also keeps the
+ * world's one-second window of path requests and squad follow moves.
+ */
+UCLASS()
+class EALOND_API UAISchedulerSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	void RegisterController(AEnemyAIController* Controller);
+	void UnregisterController(AEnemyAIController* Controller);
+
+	void RecordPathRequest() {++PathRequests;}
+	void RecordSquadFollow() {++SquadFollows;}
+	/** Counts over the last full second. */
+	int32 GetPathRequestsPerSecond() const {return LastPathRequestsPerSecond;}
+	int32 GetSquadFollowsPerSecond() const {return LastSquadFollowsPerSecond;}
+
+private:
+	TArray<TWeakObjectPtr<AEnemyAIController>> Controllers;
+
+	double PathStatsWindowStart = 0;
+	int32 PathRequests = 0;
+	int32 SquadFollows = 0;
+	int32 LastPathRequestsPerSecond = 0;
+	int32 LastSquadFollowsPerSecond = 0;
+};
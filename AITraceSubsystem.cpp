@@ -0,0 +1,140 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "AITraceSubsystem.h"
+#include "Engine/World.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("AI async traces submitted"), STAT_AITracesSubmitted, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("AI trace batches submitted"), STAT_AITraceBatchesSubmitted, STATGROUP_EalondAI);
+
+void UAITraceSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	TraceDelegate.BindUObject(this, &UAITraceSubsystem::OnTraceCompleted);
+}
+
+void UAITraceSubsystem::Deinitialize()
+{
+	Batches.Empty();
+	QueuedBatchIds.Empty();
+	TraceDelegate.Unbind();
+
+	Super::Deinitialize();
+}
+
+TStatId UAITraceSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UAITraceSubsystem, STATGROUP_Tickables);
+}
+
+void UAITraceSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	// submit everything queued this frame; results are delivered once the world resolves its async traces next frame
+	for (uint32 BatchId : QueuedBatchIds)
+	{
+		if (FTraceBatch* Batch = Batches.Find(BatchId))
+		{
+			SubmitBatch(BatchId, *Batch);
+		}
+	}
+	QueuedBatchIds.Reset();
+}
+
+uint32 UAITraceSubsystem::RequestTraces(const TArray<FAITraceRequest>& Requests, const FCollisionQueryParams& Params, FOnAITraceBatchComplete OnComplete, const FCollisionResponseParams& ResponseParams)
+{
+	if (Requests.IsEmpty() || Requests.Num() > MaxTracesPerBatch)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("AI trace subsystem: batch of %d traces rejected"), Requests.Num());
+		return 0;
+	}
+	// batch id lives in the upper 24 bits of the trace user data
+	const uint32 BatchId = NextBatchId;
+	NextBatchId = NextBatchId >= 0xFFFFFF ? 1 : NextBatchId + 1;
+
+	FTraceBatch& Batch = Batches.Add(BatchId);
+	Batch.Requests = Requests;
+	Batch.Params = Params;
+	Batch.ResponseParams = ResponseParams;
+	Batch.OnComplete = OnComplete;
+	Batch.bPolled = !OnComplete.IsBound();
+	Batch.Results.SetNum(Requests.Num());
+	QueuedBatchIds.Add(BatchId);
+	return BatchId;
+}
+
+void UAITraceSubsystem::SubmitBatch(uint32 BatchId, FTraceBatch& Batch)
+{
+	UWorld* World = GetWorld();
+	if (!World) return;
+	for (int32 i = 0; i < Batch.Requests.Num(); i++)
+	{
+		const FAITraceRequest& Request = Batch.Requests[i];
+		const uint32 UserData = (BatchId << 8) | uint32(i);
+		if (Request.Shape.IsLine())
+		{
+			World->AsyncLineTraceByChannel(EAsyncTraceType::Single, Request.Start, Request.End, Request.Channel, Batch.Params, Batch.ResponseParams, &TraceDelegate, UserData);
+		}
+		else
+		{
+			World->AsyncSweepByChannel(EAsyncTraceType::Single, Request.Start, Request.End, Request.Rotation, Request.Channel, Request.Shape, Batch.Params, Batch.ResponseParams, &TraceDelegate, UserData);
+		}
+	}
+	Batch.Outstanding = Batch.Requests.Num();
+	Batch.bSubmitted = true;
+	INC_DWORD_STAT_BY(STAT_AITracesSubmitted, Batch.Requests.Num());
+	INC_DWORD_STAT(STAT_AITraceBatchesSubmitted);
+}
+
+void UAITraceSubsystem::OnTraceCompleted(const FTraceHandle& Handle, FTraceDatum& Datum)
+{
+	const uint32 BatchId = Datum.UserData >> 8;
+	const int32 RayIndex = int32(Datum.UserData & 0xFF);
+	FTraceBatch* Batch = Batches.Find(BatchId);
+	// batch was cancelled while its traces were in flight
+	if (!Batch || !Batch->Results.IsValidIndex(RayIndex)) return;
+
+	if (Datum.OutHits.Num())
+	{
+		Batch->Results[RayIndex] = Datum.OutHits[0];
+	}
+	else
+	{
+		// misses still carry the ray so callers can reuse its end point
+		Batch->Results[RayIndex].TraceStart = Datum.Start;
+		Batch->Results[RayIndex].TraceEnd = Datum.End;
+	}
+	if (--Batch->Outstanding > 0) return;
+
+	Batch->bComplete = true;
+	if (!Batch->bPolled)
+	{
+		// remove before executing so the callback can safely queue a follow-up batch; the owner may have died since the request
+		FTraceBatch Finished = MoveTemp(*Batch);
+		Batches.Remove(BatchId);
+		Finished.OnComplete.ExecuteIfBound(Finished.Results);
+	}
+}
+
+bool UAITraceSubsystem::IsBatchPending(uint32 BatchId) const
+{
+	const FTraceBatch* Batch = Batches.Find(BatchId);
+	return Batch && !Batch->bComplete;
+}
+
+bool UAITraceSubsystem::ConsumeResults(uint32 BatchId, TArray<FHitResult>& OutResults)
+{
+	FTraceBatch* Batch = Batches.Find(BatchId);
+	if (!Batch || !Batch->bComplete) return false;
+	OutResults = MoveTemp(Batch->Results);
+	Batches.Remove(BatchId);
+	return true;
+}
+
+void UAITraceSubsystem::CancelBatch(uint32 BatchId)
+{
+	Batches.Remove(BatchId);
+	QueuedBatchIds.Remove(BatchId);
+}
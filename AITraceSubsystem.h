@@ -0,0 +1,82 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "WorldCollision.h"
+#include "AITraceSubsystem.generated.h"
+
+DECLARE_STATS_GROUP(TEXT("EalondAI"), STATGROUP_EalondAI, STATCAT_Advanced);
+
+DECLARE_DELEGATE_OneParam(FOnAITraceBatchComplete, const TArray<FHitResult>& /*Results*/);
+
+struct FAITraceRequest
+{
+	FVector Start;
+	FVector End;
+	ECollisionChannel Channel;
+	// line by default; anything else is submitted as a sweep
+	FCollisionShape Shape;
+	FQuat Rotation = FQuat::Identity;
+
+	FAITraceRequest(const FVector& InStart, const FVector& InEnd, ECollisionChannel InChannel)
+		: Start(InStart), End(InEnd), Channel(InChannel)
+	{}
+
+	FAITraceRequest(const FVector& InStart, const FVector& InEnd, ECollisionChannel InChannel, const FCollisionShape& InShape, const FQuat& InRotation = FQuat::Identity)
+		: Start(InStart), End(InEnd), Channel(InChannel), Shape(InShape), Rotation(InRotation)
+	{}
+};
+
+/**
+ * Collects line traces and shape sweeps requested during the frame and submits them as async traces.
+ * Results come back the following frame, either through the delegate passed in with the batch or by
+ * polling the returned handle with ConsumeResults.
+ */
+UCLASS()
+class EALOND_API UAITraceSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/** Queue a batch of traces sharing the same query and response params. Returns 0 if the batch could not be queued. */
+	uint32 RequestTraces(const TArray<FAITraceRequest>& Requests, const FCollisionQueryParams& Params, FOnAITraceBatchComplete OnComplete = FOnAITraceBatchComplete(),
+		const FCollisionResponseParams& ResponseParams = FCollisionResponseParams::DefaultResponseParam);
+
+	bool IsBatchPending(uint32 BatchId) const;
+	/** Moves the results of a completed batch with no delegate bound into OutResults. Returns false if still pending or unknown. */
+	bool ConsumeResults(uint32 BatchId, TArray<FHitResult>& OutResults);
+	void CancelBatch(uint32 BatchId);
+
+	// a single batch can hold this many traces; ray index is packed into the low byte of the async trace user data
+	static constexpr int32 MaxTracesPerBatch = 255;
+
+private:
+	struct FTraceBatch
+	{
+		TArray<FAITraceRequest> Requests;
+		TArray<FHitResult> Results;
+		FCollisionQueryParams Params;
+		FCollisionResponseParams ResponseParams;
+		FOnAITraceBatchComplete OnComplete;
+		int32 Outstanding = 0;
+		// no delegate given; results are kept until ConsumeResults is called
+		bool bPolled = false;
+		bool bSubmitted = false;
+		bool bComplete = false;
+	};
+
+	void SubmitBatch(uint32 BatchId, FTraceBatch& Batch);
+	void OnTraceCompleted(const FTraceHandle& Handle, FTraceDatum& Datum);
+
+	TMap<uint32, FTraceBatch> Batches;
+	TArray<uint32> QueuedBatchIds;
+	FTraceDelegate TraceDelegate;
+	uint32 NextBatchId = 1;
+};
@@ -0,0 +1,165 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ArmorResistanceTable.h"
+
+namespace ArmorResistance
+{
+	static const EDamageType DamageTypes[] = {EDT_NULL, EDT_FireDamage, EDT_BluntDamage, EDT_PiercingDamage, EDT_SlashDamage, EDT_PoisonDamage, EDT_ChoppingDamage};
+
+	static float GetStat(const UGearItem* Piece, EDamageType DamageType)
+	{
+		switch (DamageType)
+		{
+		case EDT_FireDamage: return Piece->ArmorResistanceStats.FireResistance;
+		case EDT_BluntDamage: return Piece->ArmorResistanceStats.BluntResistance;
+		case EDT_PiercingDamage: return Piece->ArmorResistanceStats.PierceResistance;
+		case EDT_SlashDamage: return Piece->ArmorResistanceStats.SlashResistance;
+		case EDT_PoisonDamage: return Piece->ArmorResistanceStats.PoisonResistance;
+		case EDT_ChoppingDamage: return Piece->ArmorResistanceStats.ChoppingResistance;
+		default: return 0;
+		}
+	}
+
+	/** The per-hit switch UPlayerDamageComponent::CalculateIncomingDamage used, without status effects, for checking the table against. */
+	static float ReferenceIncomingDamage(float BaseDamage, float TypeDamage, EDamageType DamageType, const UGearItem* ArmorHit, const UGearItem* ChestPiece)
+	{
+		if (!ArmorHit) return BaseDamage;
+		if (DamageType == EDT_NULL) return BaseDamage + TypeDamage;
+		float Resistance = GetStat(ArmorHit, DamageType);
+		if (ArmorHit->Slot == EEquippableSlot::EIS_Shoulders && ChestPiece)
+		{
+			Resistance = FMath::Clamp(GetStat(ChestPiece, DamageType) + Resistance, -1.f, 1.f);
+		}
+		return BaseDamage + (TypeDamage - TypeDamage * Resistance);
+	}
+}
+
+void FArmorResistanceTable::Build(TConstArrayView<const UGearItem*> Gear, const UGearItem* ChestPiece)
+{
+	NumRows = 1;
+	for (int32 Column = 0; Column < NumColumns; Column++)
+	{
+		Resistances[Column] = 0;
+		DamageScales[Column] = 0;
+	}
+	for (const UGearItem* Piece : Gear)
+	{
+		if (!Piece || NumRows == MaxRows || FindRow(Piece) != INDEX_NONE) continue;
+		const int32 Row = NumRows++;
+		Pieces[Row] = Piece;
+		const bool bAddChest = Piece->Slot == EEquippableSlot::EIS_Shoulders && ChestPiece;
+		for (int32 Column = 0; Column < NumColumns; Column++)
+		{
+			Resistances[Row * NumColumns + Column] = 0;
+		}
+		for (EDamageType DamageType : ArmorResistance::DamageTypes)
+		{
+			float Resistance = ArmorResistance::GetStat(Piece, DamageType);
+			if (bAddChest && DamageType != EDT_NULL) Resistance = FMath::Clamp(Resistance + ArmorResistance::GetStat(ChestPiece, DamageType), -1.f, 1.f);
+			Resistances[GetCell(Row, DamageType)] = Resistance;
+		}
+		for (int32 Column = 0; Column < NumColumns; Column++)
+		{
+			DamageScales[Row * NumColumns + Column] = 1.f - Resistances[Row * NumColumns + Column];
+		}
+	}
+}
+
+int32 FArmorResistanceTable::FindRow(const UGearItem* Piece) const
+{
+	if (!Piece) return 0;
+	for (int32 Row = 1; Row < NumRows; Row++)
+	{
+		if (Pieces[Row] == Piece) return Row;
+	}
+	return INDEX_NONE;
+}
+
+int32 FArmorResistanceTable::GetColumn(EDamageType DamageType)
+{
+	switch (DamageType)
+	{
+	case EDT_FireDamage: return 1;
+	case EDT_BluntDamage: return 2;
+	case EDT_PiercingDamage: return 3;
+	case EDT_SlashDamage: return 4;
+	case EDT_PoisonDamage: return 5;
+	case EDT_ChoppingDamage: return 6;
+	default: return 0;
+	}
+}
+
+void FArmorResistanceTable::CalculateIncomingDamage(TConstArrayView<float> BaseDamage, TConstArrayView<float> TypeDamage, TConstArrayView<int32> Cells, TArrayView<float> OUT_Damage) const
+{
+	const int32 Num = OUT_Damage.Num();
+	check(BaseDamage.Num() == Num && TypeDamage.Num() == Num && Cells.Num() == Num);
+	int32 i = 0;
+	for (; i + 4 <= Num; i += 4)
+	{
+		const VectorRegister4Float Scale = MakeVectorRegisterFloat(DamageScales[Cells[i]], DamageScales[Cells[i + 1]], DamageScales[Cells[i + 2]], DamageScales[Cells[i + 3]]);
+		VectorStore(VectorMultiplyAdd(VectorLoad(&TypeDamage[i]), Scale, VectorLoad(&BaseDamage[i])), &OUT_Damage[i]);
+	}
+	for (; i < Num; i++)
+	{
+		OUT_Damage[i] = CalculateIncomingDamage(BaseDamage[i], TypeDamage[i], Cells[i]);
+	}
+}
+
+static FAutoConsoleCommand CVarVerifyArmorResistanceTable(
+	TEXT("combat.Armor.VerifyTable"),
+	TEXT("Check incoming damage from the packed armor resistance table against the per-hit switch it replaced, on random gear and hits. Optional arg: hits (default 100000)."),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+		{
+			const int32 NumHits = FMath::Max(Args.Num() ? FCString::Atoi(*Args[0]) : 100000, 1);
+			FRandomStream Random(0x5eed);
+			auto MakePiece = [&Random](EEquippableSlot Slot)
+			{
+				UGearItem* Piece = NewObject<UGearItem>(GetTransientPackage());
+				Piece->Slot = Slot;
+				// past -1 and 1 too, so the shoulder plus chest clamp is exercised
+				Piece->ArmorResistanceStats.FireResistance = Random.FRandRange(-1.5f, 1.5f);
+				Piece->ArmorResistanceStats.BluntResistance = Random.FRandRange(-1.5f, 1.5f);
+				Piece->ArmorResistanceStats.PierceResistance = Random.FRandRange(-1.5f, 1.5f);
+				Piece->ArmorResistanceStats.SlashResistance = Random.FRandRange(-1.5f, 1.5f);
+				Piece->ArmorResistanceStats.PoisonResistance = Random.FRandRange(-1.5f, 1.5f);
+				Piece->ArmorResistanceStats.ChoppingResistance = Random.FRandRange(-1.5f, 1.5f);
+				return Piece;
+			};
+			// the chest's own slot doesn't matter to either path, only that it isn't shoulders
+			const UGearItem* Chest = MakePiece(EEquippableSlot::EIS_Shield);
+			const UGearItem* Shoulders = MakePiece(EEquippableSlot::EIS_Shoulders);
+			const UGearItem* Other = MakePiece(EEquippableSlot::EIS_Shield);
+			const UGearItem* HitPieces[] = {nullptr, Chest, Shoulders, Other};
+
+			int32 NumMismatches = 0;
+			float MaxError = 0;
+			for (const UGearItem* ChestPiece : {Chest, static_cast<const UGearItem*>(nullptr)})
+			{
+				FArmorResistanceTable Table;
+				const UGearItem* Gear[] = {Chest, Shoulders, Other};
+				Table.Build(Gear, ChestPiece);
+
+				TArray<float> BaseDamage, TypeDamage, Expected, Damage;
+				TArray<int32> Cells;
+				for (int32 i = 0; i < NumHits; i++)
+				{
+					const UGearItem* ArmorHit = HitPieces[Random.RandHelper(UE_ARRAY_COUNT(HitPieces))];
+					const EDamageType DamageType = ArmorResistance::DamageTypes[Random.RandHelper(UE_ARRAY_COUNT(ArmorResistance::DamageTypes))];
+					BaseDamage.Add(Random.FRandRange(0.f, 100.f));
+					TypeDamage.Add(Random.FRandRange(0.f, 50.f));
+					Cells.Add(Table.GetCell(Table.FindRow(ArmorHit), DamageType));
+					Expected.Add(ArmorResistance::ReferenceIncomingDamage(BaseDamage.Last(), TypeDamage.Last(), DamageType, ArmorHit, ChestPiece));
+				}
+				Damage.SetNumUninitialized(NumHits);
+				Table.CalculateIncomingDamage(BaseDamage, TypeDamage, Cells, Damage);
+				for (int32 i = 0; i < NumHits; i++)
+				{
+					// the two round TypeDamage * (1 - R) differently, by an ulp or so
+					const float Error = FMath::Abs(Damage[i] - Expected[i]);
+					MaxError = FMath::Max(MaxError, Error);
+					if (Error > 1e-3f * FMath::Max(1.f, FMath::Abs(Expected[i]))) NumMismatches++;
+				}
+			}
+			UE_LOG(LogTemp, Log, TEXT("Armor resistance table: %d hits with and without a chest piece, %d mismatches, max error %g"), NumHits * 2, NumMismatches, MaxError);
+		}));
@@ -0,0 +1,39 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "../Items/GearItem.h"
+
+/**
+ * A character's armor resistances packed as one row per equipped gear piece and one column per damage
+ * type, rebuilt when the gear changes rather than looked up per hit. Row 0 stands for no armor. A
+ * shoulder row already holds shoulder plus chest, clamped to [-1, 1]. Damage for a batch of hits is one
+ * gather and multiply-add per four hits: Base + TypeDamage * (1 - Resistance).
+ */
+class EALOND_API FArmorResistanceTable
+{
+public:
+	static constexpr int32 NumColumns = 8;
+	static constexpr int32 MaxRows = 16;
+
+	/** Rows for each piece (shoulders combined with ChestPiece, if any); pieces past MaxRows are dropped. */
+	void Build(TConstArrayView<const UGearItem*> Gear, const UGearItem* ChestPiece);
+	/** Row of the piece, 0 for none, INDEX_NONE if it wasn't in the gear the table was built from. */
+	int32 FindRow(const UGearItem* Piece) const;
+	static int32 GetColumn(EDamageType DamageType);
+	int32 GetCell(int32 Row, EDamageType DamageType) const {return Row * NumColumns + GetColumn(DamageType);}
+
+	float GetResistance(int32 Cell) const {return Resistances[Cell];}
+	float GetDamageScale(int32 Cell) const {return DamageScales[Cell];}
+	float CalculateIncomingDamage(float BaseDamage, float TypeDamage, int32 Cell) const {return BaseDamage + TypeDamage * DamageScales[Cell];}
+	/** Damage before status effects for every hit, from the cells they landed on; all views the same length. */
+	void CalculateIncomingDamage(TConstArrayView<float> BaseDamage, TConstArrayView<float> TypeDamage, TConstArrayView<int32> Cells, TArrayView<float> OUT_Damage) const;
+
+private:
+	// identity only, never dereferenced after Build
+	const UGearItem* Pieces[MaxRows] = {};
+	int32 NumRows = 1;
+	alignas(16) float Resistances[MaxRows * NumColumns] = {};
+	alignas(16) float DamageScales[MaxRows * NumColumns] = {};
+};
@@ -0,0 +1,148 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "CombatHitDescriptor.h"
+#include "Components/SkeletalMeshComponent.h"
+#include "Engine/NetSerialization.h"
+#include "GameFramework/Character.h"
+#include "GameFramework/GameStateBase.h"
+
+namespace CombatHit
+{
+	// hit bones come from the hitbox world, which reads a character's main mesh
+	static USkeletalMeshComponent* GetHitMesh(const AActor* Actor)
+	{
+		if (const ACharacter* Character = Cast<ACharacter>(Actor)) return Character->GetMesh();
+		return Actor ? Actor->FindComponentByClass<USkeletalMeshComponent>() : nullptr;
+	}
+
+	static uint16 PackTimestamp(double Seconds)
+	{
+		return uint16(FMath::FloorToInt64(Seconds * 1000.0) & 0xFFFF);
+	}
+}
+
+FCombatHitDescriptor FCombatHitDescriptor::Make(const FHitResult& Hit, float Damage, ECombatHitType Type, const UWorld* World)
+{
+	FCombatHitDescriptor Descriptor;
+	Descriptor.Target = Hit.GetActor();
+	Descriptor.ImpactPoint = Hit.ImpactPoint;
+	Descriptor.ImpactNormal = Hit.ImpactNormal;
+	const USkeletalMeshComponent* Mesh = Hit.BoneName.IsNone() ? nullptr : CombatHit::GetHitMesh(Hit.GetActor());
+	Descriptor.BoneIndex = Mesh ? Mesh->GetBoneIndex(Hit.BoneName) : INDEX_NONE;
+	Descriptor.Damage = Damage;
+	Descriptor.Type = Type;
+	const AGameStateBase* GameState = World ? World->GetGameState() : nullptr;
+	Descriptor.Timestamp = CombatHit::PackTimestamp(GameState ? GameState->GetServerWorldTimeSeconds() : (World ? World->GetTimeSeconds() : 0));
+	return Descriptor;
+}
+
+FName FCombatHitDescriptor::GetBoneName() const
+{
+	const USkeletalMeshComponent* Mesh = BoneIndex != INDEX_NONE ? CombatHit::GetHitMesh(Target.Get()) : nullptr;
+	return Mesh ? Mesh->GetBoneName(BoneIndex) : NAME_None;
+}
+
+double FCombatHitDescriptor::GetTimestampSeconds(double Now) const
+{
+	// signed, so a client whose clock runs a little ahead doesn't read as a minute behind
+	const int16 BehindMs = int16(uint16(CombatHit::PackTimestamp(Now) - Timestamp));
+	return Now - BehindMs / 1000.0;
+}
+
+bool FCombatHitDescriptor::NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess)
+{
+	UObject* TargetObject = Target.Get();
+	bOutSuccess = Map && Map->SerializeObject(Ar, AActor::StaticClass(), TargetObject);
+	bOutSuccess &= SerializePackedVector<10, 24>(ImpactPoint, Ar);
+	bOutSuccess &= SerializeFixedVector<1, 8>(ImpactNormal, Ar);
+
+	uint32 PackedBone = uint32(BoneIndex + 1);
+	Ar.SerializeIntPacked(PackedBone);
+	uint32 PackedDamage = uint32(FMath::Clamp(FMath::RoundToInt(Damage * DamageScale), 0, MAX_int32));
+	Ar.SerializeIntPacked(PackedDamage);
+	uint8 PackedType = uint8(Type);
+	Ar.SerializeBits(&PackedType, 2);
+	Ar << Timestamp;
+
+	if (Ar.IsLoading())
+	{
+		Target = Cast<AActor>(TargetObject);
+		BoneIndex = int32(PackedBone) - 1;
+		Damage = PackedDamage / DamageScale;
+		Type = ECombatHitType(FMath::Min(PackedType, uint8(ECombatHitType::Ranged)));
+	}
+	return true;
+}
+
+bool UCombatHitBenchmarkPackageMap::SerializeObject(FArchive& Ar, UClass* InClass, UObject*& Obj, FNetworkGUID* OutNetGUID)
+{
+	uint32 Index = 0;
+	if (Ar.IsSaving() && Obj)
+	{
+		Index = Objects.AddUnique(Obj) + 1;
+	}
+	Ar.SerializeIntPacked(Index);
+	if (Ar.IsLoading())
+	{
+		Obj = Objects.IsValidIndex(int32(Index) - 1) ? Objects[Index - 1].Get() : nullptr;
+	}
+	return true;
+}
+
+static FAutoConsoleCommand CVarRunHitRPCBenchmark(
+	TEXT("combat.HitRPC.Benchmark"),
+	TEXT("Serialize and read back hit RPC parameters, as a full FHitResult plus direction and damage and as a combat hit descriptor, and log bytes per hit and hits per second for each. Optional arg: hits (default 100000)."),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+		{
+			const int32 NumHits = FMath::Max(Args.Num() ? FCString::Atoi(*Args[0]) : 100000, 1);
+			UCombatHitBenchmarkPackageMap* Map = NewObject<UCombatHitBenchmarkPackageMap>();
+			ACharacter* Target = GetMutableDefault<ACharacter>();
+
+			FHitResult Hit(Target, Target->GetMesh(), FVector(12345.6, -6789.1, 234.5), FVector(.6, .8, 0));
+			Hit.ImpactPoint = FVector(12340.2, -6796.3, 234.5);
+			Hit.ImpactNormal = Hit.Normal;
+			Hit.TraceStart = FVector(12300.4, -6850.2, 240.1);
+			Hit.TraceEnd = FVector(12400.8, -6720.6, 228.7);
+			Hit.Time = .42f;
+			Hit.Distance = 68.3f;
+			Hit.BoneName = TEXT("spine_02");
+			const FVector Direction(.6, .8, 0);
+			const float Damage = 37.5f;
+			FCombatHitDescriptor Descriptor = FCombatHitDescriptor::Make(Hit, Damage, ECombatHitType::Melee, nullptr);
+			// the default character has no skeleton to look the bone up on
+			Descriptor.BoneIndex = 42;
+
+			auto Run = [NumHits, Map](const TCHAR* Name, TFunctionRef<void(FArchive&)> Serialize)
+			{
+				int64 NumBits = 0;
+				const double Start = FPlatformTime::Seconds();
+				for (int32 i = 0; i < NumHits; i++)
+				{
+					FNetBitWriter Writer(Map, 8192);
+					Serialize(Writer);
+					NumBits = Writer.GetNumBits();
+					FNetBitReader Reader(Map, Writer.GetData(), NumBits);
+					Serialize(Reader);
+				}
+				const double Seconds = FMath::Max(FPlatformTime::Seconds() - Start, UE_SMALL_NUMBER);
+				UE_LOG(LogTemp, Log, TEXT("Hit RPC benchmark: %s, %lld bytes per hit, %.0f hits per second written and read"),
+					Name, (NumBits + 7) / 8, NumHits / Seconds);
+			};
+			Run(TEXT("FHitResult + direction + damage"), [&Hit, &Direction, Damage, Map](FArchive& Ar)
+				{
+					bool bSuccess = true;
+					FHitResult HitCopy = Hit;
+					FVector DirectionCopy = Direction;
+					float DamageCopy = Damage;
+					HitCopy.NetSerialize(Ar, Map, bSuccess);
+					DirectionCopy.NetSerialize(Ar, Map, bSuccess);
+					Ar << DamageCopy;
+				});
+			Run(TEXT("combat hit descriptor"), [&Descriptor, Map](FArchive& Ar)
+				{
+					bool bSuccess = true;
+					FCombatHitDescriptor DescriptorCopy = Descriptor;
+					DescriptorCopy.NetSerialize(Ar, Map, bSuccess);
+				});
+		}));
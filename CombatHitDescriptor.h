@@ -0,0 +1,70 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/CoreNet.h"
+#include "CombatHitDescriptor.generated.h"
+
+UENUM()
+enum class ECombatHitType : uint8
+{
+	Melee,
+	Tool,
+	Ranged,
+};
+
+/**
+ * What a client sends the server for one hit, in place of a full FHitResult. The target goes as its net
+ * GUID, the impact point to a tenth of a unit, the normal to 8 bits an axis, the bone as its index on the
+ * target's mesh, and the send time as the low 16 bits of the client's estimate of server time in ms.
+ */
+USTRUCT()
+struct EALOND_API FCombatHitDescriptor
+{
+	GENERATED_BODY()
+
+	TWeakObjectPtr<AActor> Target;
+	FVector ImpactPoint = FVector::ZeroVector;
+	FVector ImpactNormal = FVector::ZeroVector;
+	// on the target's skeletal mesh, INDEX_NONE for none
+	int32 BoneIndex = INDEX_NONE;
+	float Damage = 0;
+	ECombatHitType Type = ECombatHitType::Melee;
+	uint16 Timestamp = 0;
+
+	static FCombatHitDescriptor Make(const FHitResult& Hit, float Damage, ECombatHitType Type, const UWorld* World);
+	FName GetBoneName() const;
+	/** Server world time the hit was sent at, from its 16 bit stamp and the server's time now. */
+	double GetTimestampSeconds(double Now) const;
+
+	bool NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess);
+
+	// damage goes over the wire in tenths
+	static constexpr float DamageScale = 10.f;
+};
+
+template<>
+struct TStructOpsTypeTraits<FCombatHitDescriptor> : public TStructOpsTypeTraitsBase2<FCombatHitDescriptor>
+{
+	enum
+	{
+		WithNetSerializer = true,
+	};
+};
+
+/**
+ * Stand-in package map for combat.HitRPC.Benchmark, so hits can be serialized without a connection.
+ * Objects go as a packed index, about what a real connection writes for a GUID it has already exported.
+ */
+UCLASS(Transient)
+class UCombatHitBenchmarkPackageMap : public UPackageMap
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool SerializeObject(FArchive& Ar, UClass* InClass, UObject*& Obj, FNetworkGUID* OutNetGUID = nullptr) override;
+
+private:
+	TArray<TWeakObjectPtr<UObject>> Objects;
+};
@@ -0,0 +1,897 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "CombatHitboxSubsystem.h"
+#include "AITraceSubsystem.h"
+#include "CombatSocketCache.h"
+#include "EngineUtils.h"
+#include "Components/CapsuleComponent.h"
+#include "Engine/NetDriver.h"
+#include "GameFramework/Character.h"
+#include "PhysicalMaterials/PhysicalMaterial.h"
+#include "../Buildings/Building.h"
+#include "../World/ResourceActor.h"
+
+DECLARE_CYCLE_STAT(TEXT("Combat hitbox update"), STAT_CombatHitboxUpdate, STATGROUP_EalondAI);
+DECLARE_CYCLE_STAT(TEXT("Combat hitbox query"), STAT_CombatHitboxQuery, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Combat hitbox queries"), STAT_CombatHitboxQueries, STATGROUP_EalondAI);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Combat hitbox shapes"), STAT_CombatHitboxShapes, STATGROUP_EalondAI);
+DECLARE_CYCLE_STAT(TEXT("Combat hitbox record"), STAT_CombatHitboxRecord, STATGROUP_EalondAI);
+DECLARE_CYCLE_STAT(TEXT("Combat hitbox rewind"), STAT_CombatHitboxRewind, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Combat hitbox rewinds"), STAT_CombatHitboxRewinds, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Combat hitbox rewinds rejected"), STAT_CombatHitboxRewindsRejected, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Combat hitbox rewind capsule tests"), STAT_CombatHitboxRewindTests, STATGROUP_EalondAI);
+DECLARE_MEMORY_STAT(TEXT("Combat hitbox history"), STAT_CombatHitboxHistoryMemory, STATGROUP_EalondAI);
+
+static TAutoConsoleVariable<bool> CVarCombatHitboxEnable(
+	TEXT("combat.Hitbox.Enable"),
+	true,
+	TEXT("Run damage traces against the combat hitbox world instead of the physics scene."));
+
+static TAutoConsoleVariable<bool> CVarCombatHitboxPhysicsFallback(
+	TEXT("combat.Hitbox.PhysicsFallback"),
+	false,
+	TEXT("Also sweep static world geometry in the physics scene, so walls and rocks stop damage traces."));
+
+namespace CombatHitbox
+{
+	struct FBoneGroup
+	{
+		const TCHAR* BoneA;
+		const TCHAR* BoneB;
+		const TCHAR* HitBone;
+		// fraction of the movement capsule radius
+		float Radius;
+		float Extend;
+	};
+
+	// mannequin-style skeleton; groups whose bones a mesh lacks are skipped
+	static const FBoneGroup BoneGroups[] =
+	{
+		{TEXT("neck_01"), TEXT("head"), TEXT("head"), .4f, 1.f},
+		{TEXT("pelvis"), TEXT("neck_01"), TEXT("spine_02"), .75f, 0},
+		{TEXT("upperarm_l"), TEXT("lowerarm_l"), TEXT("upperarm_l"), .25f, 0},
+		{TEXT("lowerarm_l"), TEXT("hand_l"), TEXT("lowerarm_l"), .22f, 0},
+		{TEXT("upperarm_r"), TEXT("lowerarm_r"), TEXT("upperarm_r"), .25f, 0},
+		{TEXT("lowerarm_r"), TEXT("hand_r"), TEXT("lowerarm_r"), .22f, 0},
+		{TEXT("thigh_l"), TEXT("calf_l"), TEXT("thigh_l"), .3f, 0},
+		{TEXT("calf_l"), TEXT("foot_l"), TEXT("calf_l"), .25f, 0},
+		{TEXT("thigh_r"), TEXT("calf_r"), TEXT("thigh_r"), .3f, 0},
+		{TEXT("calf_r"), TEXT("foot_r"), TEXT("calf_r"), .25f, 0},
+	};
+
+	static FBox CapsuleBounds(const FVector& A, const FVector& B, float Radius)
+	{
+		FBox Bounds(A.ComponentMin(B), A.ComponentMax(B));
+		return Bounds.ExpandBy(Radius);
+	}
+
+	static FBox BoxBounds(const FVector& Centre, const FQuat& Rotation, const FVector& Extent)
+	{
+		const FVector WorldExtent = Rotation.GetAxisX().GetAbs() * Extent.X + Rotation.GetAxisY().GetAbs() * Extent.Y + Rotation.GetAxisZ().GetAbs() * Extent.Z;
+		return FBox(Centre - WorldExtent, Centre + WorldExtent);
+	}
+
+	/** Ray O + D * t, t in [0, 1], against a capsule. Starting inside counts as a hit at 0. */
+	static bool RayCapsule(const FVector& O, const FVector& D, const FVector& A, const FVector& B, float R, float& OUT_Time, FVector& OUT_Normal)
+	{
+		const FVector StartClosest = FMath::ClosestPointOnSegment(O, A, B);
+		if (FVector::DistSquared(O, StartClosest) <= R * R)
+		{
+			OUT_Time = 0;
+			OUT_Normal = (O - StartClosest).GetSafeNormal();
+			if (OUT_Normal.IsZero()) OUT_Normal = -D.GetSafeNormal();
+			return true;
+		}
+		const float Length = D.Size();
+		if (Length < KINDA_SMALL_NUMBER) return false;
+		const FVector Dir = D / Length;
+		float Best = MAX_flt;
+
+		// cylinder body
+		const FVector BA = B - A;
+		const FVector OA = O - A;
+		const float BABA = BA | BA;
+		const float BARD = BA | Dir;
+		const float BAOA = BA | OA;
+		const float QA = BABA - BARD * BARD;
+		if (QA > KINDA_SMALL_NUMBER)
+		{
+			const float QB = BABA * (Dir | OA) - BAOA * BARD;
+			const float QC = BABA * (OA | OA) - BAOA * BAOA - R * R * BABA;
+			const float H = QB * QB - QA * QC;
+			if (H >= 0)
+			{
+				const float T = (-QB - FMath::Sqrt(H)) / QA;
+				const float Y = BAOA + T * BARD;
+				if (T >= 0 && Y > 0 && Y < BABA) Best = T;
+			}
+		}
+		// end caps
+		for (const FVector& Centre : {A, B})
+		{
+			const FVector OC = O - Centre;
+			const float QB = OC | Dir;
+			const float H = QB * QB - ((OC | OC) - R * R);
+			if (H < 0) continue;
+			const float T = -QB - FMath::Sqrt(H);
+			if (T >= 0 && T < Best) Best = T;
+		}
+		if (Best > Length) return false;
+		const FVector Point = O + Dir * Best;
+		OUT_Time = Best / Length;
+		OUT_Normal = (Point - FMath::ClosestPointOnSegment(Point, A, B)).GetSafeNormal();
+		return true;
+	}
+
+	/** Ray O + D * t, t in [0, 1], against an oriented box. Starting inside counts as a hit at 0. */
+	static bool RayBox(const FVector& O, const FVector& D, const FVector& Centre, const FQuat& Rotation, const FVector& Extent, float& OUT_Time, FVector& OUT_Normal)
+	{
+		const FVector LocalO = Rotation.UnrotateVector(O - Centre);
+		const FVector LocalD = Rotation.UnrotateVector(D);
+		float Enter = -MAX_flt;
+		float Exit = MAX_flt;
+		int32 EnterAxis = INDEX_NONE;
+		for (int32 Axis = 0; Axis < 3; Axis++)
+		{
+			if (FMath::Abs(LocalD[Axis]) < KINDA_SMALL_NUMBER)
+			{
+				if (FMath::Abs(LocalO[Axis]) > Extent[Axis]) return false;
+				continue;
+			}
+			float Near = (-Extent[Axis] - LocalO[Axis]) / LocalD[Axis];
+			float Far = (Extent[Axis] - LocalO[Axis]) / LocalD[Axis];
+			if (Near > Far) Swap(Near, Far);
+			if (Near > Enter)
+			{
+				Enter = Near;
+				EnterAxis = Axis;
+			}
+			Exit = FMath::Min(Exit, Far);
+			if (Enter > Exit) return false;
+		}
+		if (Exit < 0 || Enter > 1) return false;
+		if (Enter <= 0 || EnterAxis == INDEX_NONE)
+		{
+			OUT_Time = 0;
+			OUT_Normal = -D.GetSafeNormal();
+			return true;
+		}
+		FVector LocalNormal = FVector::ZeroVector;
+		LocalNormal[EnterAxis] = LocalD[EnterAxis] > 0 ? -1.f : 1.f;
+		OUT_Time = Enter;
+		OUT_Normal = Rotation.RotateVector(LocalNormal);
+		return true;
+	}
+
+	static bool IsIgnored(const AActor* Actor, const TArray<AActor*>& IgnoredActors)
+	{
+		return IgnoredActors.Contains(Actor);
+	}
+
+	// history blocks reserved up front, enough for a full wave without growing the pool mid-fight
+	static constexpr int32 ReservedHistoryBlocks = 64;
+
+	static int16 Quantize(double Value)
+	{
+		return int16(FMath::Clamp(FMath::RoundToInt(Value / UCombatHitboxSubsystem::HistoryQuantum), -MAX_int16, MAX_int16));
+	}
+}
+
+void UCombatHitboxSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	ActorSpawnedHandle = InWorld.AddOnActorSpawnedHandler(FOnActorSpawned::FDelegate::CreateUObject(this, &UCombatHitboxSubsystem::OnActorSpawned));
+	for (TActorIterator<ABuilding> It(&InWorld); It; ++It)
+	{
+		RegisterStaticBox(*It, ECombatHitboxCategory::Building);
+	}
+	for (TActorIterator<AResourceActor> It(&InWorld); It; ++It)
+	{
+		RegisterStaticBox(*It, ECombatHitboxCategory::Resource);
+	}
+	for (TActorIterator<ACharacter> It(&InWorld); It; ++It)
+	{
+		if (It->CanBeDamaged()) RegisterCharacter(*It);
+	}
+
+	// only a server has clients whose hits need checking against the past
+	const ENetMode NetMode = InWorld.GetNetMode();
+	bRecordHistory = NetMode == NM_DedicatedServer || NetMode == NM_ListenServer;
+	if (bRecordHistory)
+	{
+		const UNetDriver* NetDriver = InWorld.GetNetDriver();
+		const int32 TickRate = NetDriver && NetDriver->GetNetServerMaxTickRate() > 0 ? NetDriver->GetNetServerMaxTickRate() : 60;
+		RecordInterval = 1.0 / TickRate;
+		HistoryCapacity = FMath::Clamp(FMath::CeilToInt(HistorySeconds * TickRate) + 1, 2, MaxHistoryFrames);
+		MaxCapsules = UE_ARRAY_COUNT(CombatHitbox::BoneGroups);
+		FrameTimes.SetNumZeroed(HistoryCapacity);
+		FrameSerials.SetNumZeroed(HistoryCapacity);
+		HistoryOrigins.Reserve(CombatHitbox::ReservedHistoryBlocks * HistoryCapacity);
+		HistorySerials.Reserve(CombatHitbox::ReservedHistoryBlocks * HistoryCapacity);
+		HistoryPoints.Reserve(CombatHitbox::ReservedHistoryBlocks * HistoryCapacity * MaxCapsules * 2);
+	}
+}
+
+void UCombatHitboxSubsystem::Deinitialize()
+{
+	if (GetWorld()) GetWorld()->RemoveOnActorSpawnedHandler(ActorSpawnedHandle);
+	Shapes.Empty();
+	FreeShapes.Empty();
+	StaticShapes.Empty();
+	Characters.Empty();
+	Nodes.Empty();
+	HistoryOrigins.Empty();
+	HistoryPoints.Empty();
+	HistorySerials.Empty();
+	FreeHistoryBlocks.Empty();
+	FrameTimes.Empty();
+	FrameSerials.Empty();
+	HistoryHead = INDEX_NONE;
+	bRecordHistory = false;
+
+	Super::Deinitialize();
+}
+
+TStatId UCombatHitboxSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UCombatHitboxSubsystem, STATGROUP_Tickables);
+}
+
+void UCombatHitboxSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	// once per net tick, after every actor has moved and posed
+	const double Now = GetWorld()->GetTimeSeconds();
+	if (!bRecordHistory || Now < NextRecordTime) return;
+	// a little slack, so a server running right at its tick rate doesn't skip every other frame
+	NextRecordTime = Now + RecordInterval * .9;
+	EnsureUpToDate();
+	RecordHistory();
+}
+
+UCombatHitboxSubsystem* UCombatHitboxSubsystem::GetActive(const UWorld* World)
+{
+	return World && CVarCombatHitboxEnable.GetValueOnGameThread() ? World->GetSubsystem<UCombatHitboxSubsystem>() : nullptr;
+}
+
+int32 UCombatHitboxSubsystem::AllocateShape()
+{
+	const int32 ShapeIndex = FreeShapes.Num() ? FreeShapes.Pop(false) : Shapes.AddDefaulted();
+	Shapes[ShapeIndex] = FShape();
+	Shapes[ShapeIndex].bInUse = true;
+	bTopologyDirty = true;
+	return ShapeIndex;
+}
+
+void UCombatHitboxSubsystem::FreeShape(int32 ShapeIndex)
+{
+	if (!Shapes.IsValidIndex(ShapeIndex) || !Shapes[ShapeIndex].bInUse) return;
+	Shapes[ShapeIndex] = FShape();
+	FreeShapes.Add(ShapeIndex);
+	bTopologyDirty = true;
+}
+
+void UCombatHitboxSubsystem::RegisterCharacter(ACharacter* Character, FCombatSocketCache& SocketCache, const UObject* CacheOwner)
+{
+	if (!Character) return;
+	Unregister(Character);
+	USkeletalMeshComponent* Mesh = Character->GetMesh();
+	const float CapsuleRadius = Character->GetCapsuleComponent() ? Character->GetCapsuleComponent()->GetScaledCapsuleRadius() : 40.f;
+
+	FCharacterHitboxes& Entry = Characters.AddDefaulted_GetRef();
+	Entry.Character = Character;
+	Entry.CacheOwner = CacheOwner;
+	Entry.SocketCache = &SocketCache;
+	for (const CombatHitbox::FBoneGroup& Group : CombatHitbox::BoneGroups)
+	{
+		if (!Mesh || Mesh->GetBoneIndex(Group.BoneA) == INDEX_NONE || Mesh->GetBoneIndex(Group.BoneB) == INDEX_NONE) continue;
+		FBoneCapsule& Capsule = Entry.Capsules.AddDefaulted_GetRef();
+		Capsule.Shape = AllocateShape();
+		Capsule.BoneA = Group.BoneA;
+		Capsule.BoneB = Group.BoneB;
+		Capsule.Extend = Group.Extend;
+		SocketCache.Register(Mesh, Capsule.BoneA);
+		SocketCache.Register(Mesh, Capsule.BoneB);
+		FShape& Shape = Shapes[Capsule.Shape];
+		Shape.Type = EShapeType::Capsule;
+		Shape.Category = ECombatHitboxCategory::Character;
+		Shape.Actor = Character;
+		Shape.Component = Mesh;
+		Shape.Bone = Group.HitBone;
+		Shape.Radius = CapsuleRadius * Group.Radius;
+	}
+	if (Entry.Capsules.IsEmpty())
+	{
+		Entry.BodyShape = AllocateShape();
+		FShape& Shape = Shapes[Entry.BodyShape];
+		Shape.Type = EShapeType::Capsule;
+		Shape.Category = ECombatHitboxCategory::Character;
+		Shape.Actor = Character;
+		Shape.Component = Mesh ? static_cast<UPrimitiveComponent*>(Mesh) : Character->GetCapsuleComponent();
+		Shape.Radius = CapsuleRadius;
+	}
+}
+
+void UCombatHitboxSubsystem::RegisterCharacter(ACharacter* Character)
+{
+	if (!Character || Characters.ContainsByPredicate([Character](const FCharacterHitboxes& Entry) {return Entry.Character.Get() == Character;})) return;
+	// villagers, animals and anything else without a damage component would otherwise be unhittable
+	TUniquePtr<FCombatSocketCache> SocketCache = MakeUnique<FCombatSocketCache>();
+	RegisterCharacter(Character, *SocketCache, this);
+	Characters.Last().OwnedSocketCache = MoveTemp(SocketCache);
+	Character->OnDestroyed.AddUniqueDynamic(this, &UCombatHitboxSubsystem::OnRegisteredActorDestroyed);
+}
+
+void UCombatHitboxSubsystem::Unregister(AActor* Actor)
+{
+	for (int32 i = Characters.Num() - 1; i >= 0; i--)
+	{
+		if (Characters[i].Character.Get() != Actor) continue;
+		for (const FBoneCapsule& Capsule : Characters[i].Capsules)
+		{
+			FreeShape(Capsule.Shape);
+		}
+		FreeShape(Characters[i].BodyShape);
+		if (Characters[i].HistoryBlock != INDEX_NONE) FreeHistoryBlocks.Add(Characters[i].HistoryBlock);
+		Characters.RemoveAtSwap(i);
+	}
+	int32 StaticShape = INDEX_NONE;
+	if (StaticShapes.RemoveAndCopyValue(Actor, StaticShape)) FreeShape(StaticShape);
+}
+
+void UCombatHitboxSubsystem::RegisterStaticBox(AActor* Actor, ECombatHitboxCategory Category)
+{
+	if (!Actor || StaticShapes.Contains(Actor)) return;
+	const FBox LocalBounds = Actor->CalculateComponentsBoundingBoxInLocalSpace();
+	if (!LocalBounds.IsValid) return;
+	const FTransform ActorTransform = Actor->GetActorTransform();
+
+	const int32 ShapeIndex = AllocateShape();
+	FShape& Shape = Shapes[ShapeIndex];
+	Shape.Type = EShapeType::Box;
+	Shape.Category = Category;
+	Shape.Actor = Actor;
+	Shape.Component = Cast<UPrimitiveComponent>(Actor->GetRootComponent());
+	Shape.A = ActorTransform.TransformPosition(LocalBounds.GetCenter());
+	Shape.Rotation = ActorTransform.GetRotation();
+	Shape.Extent = LocalBounds.GetExtent() * ActorTransform.GetScale3D().GetAbs();
+	Shape.Bounds = CombatHitbox::BoxBounds(Shape.A, Shape.Rotation, Shape.Extent);
+	StaticShapes.Add(Actor, ShapeIndex);
+	Actor->OnDestroyed.AddUniqueDynamic(this, &UCombatHitboxSubsystem::OnRegisteredActorDestroyed);
+}
+
+void UCombatHitboxSubsystem::OnActorSpawned(AActor* SpawnedActor)
+{
+	if (!SpawnedActor) return;
+	if (SpawnedActor->IsA(ABuilding::StaticClass())) RegisterStaticBox(SpawnedActor, ECombatHitboxCategory::Building);
+	else if (SpawnedActor->IsA(AResourceActor::StaticClass())) RegisterStaticBox(SpawnedActor, ECombatHitboxCategory::Resource);
+	else if (ACharacter* Character = Cast<ACharacter>(SpawnedActor); Character && Character->CanBeDamaged()) RegisterCharacter(Character);
+}
+
+void UCombatHitboxSubsystem::OnRegisteredActorDestroyed(AActor* DestroyedActor)
+{
+	Unregister(DestroyedActor);
+}
+
+void UCombatHitboxSubsystem::EnsureUpToDate()
+{
+	if (UpdatedFrame == GFrameCounter) return;
+	SCOPE_CYCLE_COUNTER(STAT_CombatHitboxUpdate);
+	UpdatedFrame = GFrameCounter;
+
+	UpdateCharacterShapes();
+	// refitting keeps the tree valid but it loosens as characters wander from where they were sorted
+	const double Now = GetWorld()->GetTimeSeconds();
+	if (bTopologyDirty || Now - LastRebuildTime > RebuildInterval)
+	{
+		Rebuild();
+		LastRebuildTime = Now;
+		bTopologyDirty = false;
+	}
+	Refit();
+	SET_DWORD_STAT(STAT_CombatHitboxShapes, Shapes.Num() - FreeShapes.Num());
+}
+
+void UCombatHitboxSubsystem::UpdateCharacterShapes()
+{
+	for (int32 i = Characters.Num() - 1; i >= 0; i--)
+	{
+		FCharacterHitboxes& Entry = Characters[i];
+		ACharacter* Character = Entry.Character.Get();
+		// the owning damage component went away without unregistering; its cache is gone with it
+		if (!Character || !Entry.CacheOwner.IsValid())
+		{
+			for (const FBoneCapsule& Capsule : Entry.Capsules) FreeShape(Capsule.Shape);
+			FreeShape(Entry.BodyShape);
+			if (Entry.HistoryBlock != INDEX_NONE) FreeHistoryBlocks.Add(Entry.HistoryBlock);
+			Characters.RemoveAtSwap(i);
+			continue;
+		}
+		const bool bEnabled = !Character->IsHidden() && Character->GetActorEnableCollision();
+		USkeletalMeshComponent* Mesh = Character->GetMesh();
+		for (const FBoneCapsule& Capsule : Entry.Capsules)
+		{
+			FShape& Shape = Shapes[Capsule.Shape];
+			Shape.bEnabled = bEnabled;
+			if (!bEnabled) continue;
+			Shape.A = Entry.SocketCache->GetSocketLocation(Mesh, Capsule.BoneA);
+			Shape.B = Entry.SocketCache->GetSocketLocation(Mesh, Capsule.BoneB);
+			Shape.B += (Shape.B - Shape.A) * Capsule.Extend;
+			Shape.Bounds = CombatHitbox::CapsuleBounds(Shape.A, Shape.B, Shape.Radius);
+		}
+		if (Entry.BodyShape != INDEX_NONE)
+		{
+			FShape& Shape = Shapes[Entry.BodyShape];
+			Shape.bEnabled = bEnabled;
+			const UCapsuleComponent* Capsule = Character->GetCapsuleComponent();
+			if (!bEnabled || !Capsule) continue;
+			const FVector HalfSegment = Capsule->GetUpVector() * Capsule->GetScaledCapsuleHalfHeight_WithoutHemisphere();
+			Shape.A = Capsule->GetComponentLocation() - HalfSegment;
+			Shape.B = Capsule->GetComponentLocation() + HalfSegment;
+			Shape.Bounds = CombatHitbox::CapsuleBounds(Shape.A, Shape.B, Shape.Radius);
+		}
+	}
+	for (FShape& Shape : Shapes)
+	{
+		if (Shape.bInUse && Shape.Type == EShapeType::Box)
+		{
+			const AActor* Actor = Shape.Actor.Get();
+			Shape.bEnabled = Actor && Actor->GetActorEnableCollision();
+		}
+	}
+}
+
+void UCombatHitboxSubsystem::Rebuild()
+{
+	Nodes.Reset();
+	TArray<int32> Order;
+	Order.Reserve(Shapes.Num());
+	for (int32 i = 0; i < Shapes.Num(); i++)
+	{
+		if (Shapes[i].bInUse) Order.Add(i);
+	}
+	if (Order.Num()) BuildNode(Order, 0, Order.Num());
+}
+
+int32 UCombatHitboxSubsystem::BuildNode(TArray<int32>& Order, int32 Begin, int32 Count)
+{
+	// children always come after their parent, so Refit can run back to front
+	const int32 NodeIndex = Nodes.AddUninitialized();
+	for (int32 Slot = 0; Slot < 4; Slot++)
+	{
+		Nodes[NodeIndex].Children[Slot] = EmptyChild;
+	}
+	if (Count <= 4)
+	{
+		for (int32 Slot = 0; Slot < Count; Slot++)
+		{
+			Nodes[NodeIndex].Children[Slot] = ~Order[Begin + Slot];
+		}
+		return NodeIndex;
+	}
+	// split into four runs along the longest axis of the centroids
+	FBox CentroidBounds(ForceInit);
+	for (int32 i = Begin; i < Begin + Count; i++)
+	{
+		CentroidBounds += Shapes[Order[i]].Bounds.GetCenter();
+	}
+	const FVector Size = CentroidBounds.GetSize();
+	const int32 Axis = Size.X >= Size.Y && Size.X >= Size.Z ? 0 : (Size.Y >= Size.Z ? 1 : 2);
+	TArrayView<int32>(Order.GetData() + Begin, Count).Sort([this, Axis](int32 Left, int32 Right)
+		{
+			return Shapes[Left].Bounds.GetCenter()[Axis] < Shapes[Right].Bounds.GetCenter()[Axis];
+		});
+	for (int32 Slot = 0; Slot < 4; Slot++)
+	{
+		const int32 RunBegin = Begin + Count * Slot / 4;
+		const int32 RunCount = Begin + Count * (Slot + 1) / 4 - RunBegin;
+		const int32 Child = RunCount == 1 ? ~Order[RunBegin] : BuildNode(Order, RunBegin, RunCount);
+		Nodes[NodeIndex].Children[Slot] = Child;
+	}
+	return NodeIndex;
+}
+
+void UCombatHitboxSubsystem::Refit()
+{
+	for (int32 NodeIndex = Nodes.Num() - 1; NodeIndex >= 0; NodeIndex--)
+	{
+		FNode& Node = Nodes[NodeIndex];
+		for (int32 Slot = 0; Slot < 4; Slot++)
+		{
+			const int32 Child = Node.Children[Slot];
+			FBox Bounds(ForceInit);
+			if (Child >= 0)
+			{
+				const FNode& ChildNode = Nodes[Child];
+				for (int32 ChildSlot = 0; ChildSlot < 4; ChildSlot++)
+				{
+					if (ChildNode.Children[ChildSlot] == EmptyChild) continue;
+					Bounds += FBox(FVector(ChildNode.MinX[ChildSlot], ChildNode.MinY[ChildSlot], ChildNode.MinZ[ChildSlot]),
+						FVector(ChildNode.MaxX[ChildSlot], ChildNode.MaxY[ChildSlot], ChildNode.MaxZ[ChildSlot]));
+				}
+			}
+			else if (Child != EmptyChild)
+			{
+				Bounds = Shapes[~Child].Bounds;
+			}
+			if (!Bounds.IsValid) Bounds = FBox(FVector::ZeroVector, FVector::ZeroVector);
+			Node.MinX[Slot] = Bounds.Min.X;
+			Node.MinY[Slot] = Bounds.Min.Y;
+			Node.MinZ[Slot] = Bounds.Min.Z;
+			Node.MaxX[Slot] = Bounds.Max.X;
+			Node.MaxY[Slot] = Bounds.Max.Y;
+			Node.MaxZ[Slot] = Bounds.Max.Z;
+		}
+	}
+}
+
+void UCombatHitboxSubsystem::Query(const FSweep& Sweep, ECombatHitboxCategory Categories, const TArray<AActor*>& IgnoredActors, bool bSingle, TArray<FCandidateHit>& OUT_Hits) const
+{
+	OUT_Hits.Reset();
+	if (Nodes.IsEmpty()) return;
+	const FVector Delta = Sweep.End - Sweep.Start;
+	// node bounds are grown by the swept shape's own half size, so the ray test is conservative
+	const FVector Grow = Sweep.BoxExtent.IsZero() ? FVector(Sweep.Radius)
+		: CombatHitbox::BoxBounds(FVector::ZeroVector, Sweep.BoxRotation, Sweep.BoxExtent).Max;
+	auto SafeInverse = [](double Value) {return FMath::Abs(Value) > KINDA_SMALL_NUMBER ? 1.0 / Value : (Value >= 0 ? BIG_NUMBER : -BIG_NUMBER);};
+
+	const VectorRegister4Float OriginX = VectorSetFloat1(float(Sweep.Start.X));
+	const VectorRegister4Float OriginY = VectorSetFloat1(float(Sweep.Start.Y));
+	const VectorRegister4Float OriginZ = VectorSetFloat1(float(Sweep.Start.Z));
+	const VectorRegister4Float InvX = VectorSetFloat1(float(SafeInverse(Delta.X)));
+	const VectorRegister4Float InvY = VectorSetFloat1(float(SafeInverse(Delta.Y)));
+	const VectorRegister4Float InvZ = VectorSetFloat1(float(SafeInverse(Delta.Z)));
+	const VectorRegister4Float GrowX = VectorSetFloat1(float(Grow.X));
+	const VectorRegister4Float GrowY = VectorSetFloat1(float(Grow.Y));
+	const VectorRegister4Float GrowZ = VectorSetFloat1(float(Grow.Z));
+	float MaxTime = 1.f;
+
+	TArray<int32, TInlineAllocator<64>> Stack;
+	Stack.Add(0);
+	while (Stack.Num())
+	{
+		const FNode& Node = Nodes[Stack.Pop(false)];
+		// slab test of the ray against all four children at once
+		const VectorRegister4Float NearX = VectorMultiply(VectorSubtract(VectorSubtract(VectorLoadAligned(Node.MinX), GrowX), OriginX), InvX);
+		const VectorRegister4Float FarX = VectorMultiply(VectorSubtract(VectorAdd(VectorLoadAligned(Node.MaxX), GrowX), OriginX), InvX);
+		const VectorRegister4Float NearY = VectorMultiply(VectorSubtract(VectorSubtract(VectorLoadAligned(Node.MinY), GrowY), OriginY), InvY);
+		const VectorRegister4Float FarY = VectorMultiply(VectorSubtract(VectorAdd(VectorLoadAligned(Node.MaxY), GrowY), OriginY), InvY);
+		const VectorRegister4Float NearZ = VectorMultiply(VectorSubtract(VectorSubtract(VectorLoadAligned(Node.MinZ), GrowZ), OriginZ), InvZ);
+		const VectorRegister4Float FarZ = VectorMultiply(VectorSubtract(VectorAdd(VectorLoadAligned(Node.MaxZ), GrowZ), OriginZ), InvZ);
+		const VectorRegister4Float Enter = VectorMax(VectorMax(VectorMin(NearX, FarX), VectorMin(NearY, FarY)), VectorMax(VectorMin(NearZ, FarZ), VectorZeroFloat()));
+		const VectorRegister4Float Exit = VectorMin(VectorMin(VectorMax(NearX, FarX), VectorMax(NearY, FarY)), VectorMin(VectorMax(NearZ, FarZ), VectorSetFloat1(MaxTime)));
+		const int32 HitMask = VectorMaskBits(VectorCompareLE(Enter, Exit));
+
+		for (int32 Slot = 0; Slot < 4; Slot++)
+		{
+			const int32 Child = Node.Children[Slot];
+			if (Child == EmptyChild || !(HitMask & (1 << Slot))) continue;
+			if (Child >= 0)
+			{
+				Stack.Add(Child);
+				continue;
+			}
+			const int32 ShapeIndex = ~Child;
+			const FShape& Shape = Shapes[ShapeIndex];
+			if (!Shape.bEnabled || !EnumHasAnyFlags(Shape.Category, Categories)) continue;
+			const AActor* Actor = Shape.Actor.Get();
+			if (!Actor || CombatHitbox::IsIgnored(Actor, IgnoredActors)) continue;
+			float Time;
+			FVector Normal;
+			if (!TestShape(Shape, Sweep, Time, Normal) || Time > MaxTime) continue;
+			if (bSingle)
+			{
+				// anything further than this can no longer win
+				MaxTime = Time;
+				OUT_Hits.Reset();
+			}
+			OUT_Hits.Add({ShapeIndex, Time, Normal});
+		}
+	}
+	if (!bSingle) OUT_Hits.Sort([](const FCandidateHit& Left, const FCandidateHit& Right) {return Left.Time < Right.Time;});
+}
+
+bool UCombatHitboxSubsystem::TestShape(const FShape& Shape, const FSweep& Sweep, float& OUT_Time, FVector& OUT_Normal) const
+{
+	const FVector Delta = Sweep.End - Sweep.Start;
+	if (Shape.Type == EShapeType::Capsule)
+	{
+		// a swept box is taken as its bounding sphere against round shapes
+		const float Grow = Sweep.BoxExtent.IsZero() ? Sweep.Radius : Sweep.BoxExtent.Size();
+		return CombatHitbox::RayCapsule(Sweep.Start, Delta, Shape.A, Shape.B, Shape.Radius + Grow, OUT_Time, OUT_Normal);
+	}
+	FVector Grow(Sweep.Radius);
+	if (!Sweep.BoxExtent.IsZero())
+	{
+		// swept box extent projected onto the target box's axes
+		const FQuat Relative = Shape.Rotation.Inverse() * Sweep.BoxRotation;
+		Grow = CombatHitbox::BoxBounds(FVector::ZeroVector, Relative, Sweep.BoxExtent).Max;
+	}
+	return CombatHitbox::RayBox(Sweep.Start, Delta, Shape.A, Shape.Rotation, Shape.Extent + Grow, OUT_Time, OUT_Normal);
+}
+
+FHitResult UCombatHitboxSubsystem::MakeHitResult(const FCandidateHit& Candidate, const FSweep& Sweep) const
+{
+	const FShape& Shape = Shapes[Candidate.Shape];
+	const FVector Location = FMath::Lerp(Sweep.Start, Sweep.End, Candidate.Time);
+	FHitResult Hit(Shape.Actor.Get(), Shape.Component.Get(), Location, Candidate.Normal);
+	Hit.bBlockingHit = true;
+	Hit.bStartPenetrating = Candidate.Time <= 0;
+	Hit.Time = Candidate.Time;
+	Hit.Distance = FVector::Distance(Sweep.Start, Location);
+	Hit.TraceStart = Sweep.Start;
+	Hit.TraceEnd = Sweep.End;
+	Hit.ImpactPoint = Location - Candidate.Normal * (Sweep.BoxExtent.IsZero() ? Sweep.Radius : 0.f);
+	Hit.ImpactNormal = Candidate.Normal;
+	Hit.BoneName = Shape.Bone;
+	// what a physics sweep would report, so impact FX and sounds still pick by surface
+	if (const UPrimitiveComponent* Component = Shape.Component.Get())
+	{
+		if (const FBodyInstance* Body = Component->GetBodyInstance(Shape.Bone)) Hit.PhysMaterial = Body->GetSimplePhysicalMaterial();
+	}
+	return Hit;
+}
+
+bool UCombatHitboxSubsystem::SweepStaticGeometry(const FSweep& Sweep, const TArray<AActor*>& IgnoredActors, FHitResult& OUT_Hit) const
+{
+	if (!CVarCombatHitboxPhysicsFallback.GetValueOnGameThread()) return false;
+	FCollisionQueryParams Params(SCENE_QUERY_STAT(CombatHitboxStatic), false);
+	Params.AddIgnoredActors(IgnoredActors);
+	const FCollisionShape Shape = Sweep.BoxExtent.IsZero() ? FCollisionShape::MakeSphere(Sweep.Radius) : FCollisionShape::MakeBox(Sweep.BoxExtent);
+	return GetWorld()->SweepSingleByObjectType(OUT_Hit, Sweep.Start, Sweep.End, Sweep.BoxRotation, FCollisionObjectQueryParams(ECC_WorldStatic), Shape, Params);
+}
+
+bool UCombatHitboxSubsystem::SweepSphereSingle(const FVector& Start, const FVector& End, float Radius, ECombatHitboxCategory Categories, const TArray<AActor*>& IgnoredActors, FHitResult& OUT_Hit)
+{
+	FSweep Sweep;
+	Sweep.Start = Start;
+	Sweep.End = End;
+	Sweep.Radius = Radius;
+	EnsureUpToDate();
+	SCOPE_CYCLE_COUNTER(STAT_CombatHitboxQuery);
+	INC_DWORD_STAT(STAT_CombatHitboxQueries);
+
+	TArray<FCandidateHit> Candidates;
+	Query(Sweep, Categories, IgnoredActors, true, Candidates);
+	const bool bHit = Candidates.Num() > 0;
+	if (bHit) OUT_Hit = MakeHitResult(Candidates[0], Sweep);
+	FHitResult StaticHit;
+	if (SweepStaticGeometry(Sweep, IgnoredActors, StaticHit) && (!bHit || StaticHit.Time < OUT_Hit.Time))
+	{
+		OUT_Hit = StaticHit;
+		return true;
+	}
+	return bHit;
+}
+
+bool UCombatHitboxSubsystem::SweepBoxSingle(const FVector& Start, const FVector& End, const FVector& HalfExtent, const FQuat& Rotation, ECombatHitboxCategory Categories, const TArray<AActor*>& IgnoredActors, FHitResult& OUT_Hit)
+{
+	FSweep Sweep;
+	Sweep.Start = Start;
+	Sweep.End = End;
+	// flat boxes (zero depth) still need some thickness to be a box sweep
+	Sweep.BoxExtent = HalfExtent.ComponentMax(FVector(1.f));
+	Sweep.BoxRotation = Rotation;
+	EnsureUpToDate();
+	SCOPE_CYCLE_COUNTER(STAT_CombatHitboxQuery);
+	INC_DWORD_STAT(STAT_CombatHitboxQueries);
+
+	TArray<FCandidateHit> Candidates;
+	Query(Sweep, Categories, IgnoredActors, true, Candidates);
+	const bool bHit = Candidates.Num() > 0;
+	if (bHit) OUT_Hit = MakeHitResult(Candidates[0], Sweep);
+	FHitResult StaticHit;
+	if (SweepStaticGeometry(Sweep, IgnoredActors, StaticHit) && (!bHit || StaticHit.Time < OUT_Hit.Time))
+	{
+		OUT_Hit = StaticHit;
+		return true;
+	}
+	return bHit;
+}
+
+bool UCombatHitboxSubsystem::SweepSphereMulti(const FVector& Start, const FVector& End, float Radius, ECombatHitboxCategory Categories, const TArray<AActor*>& IgnoredActors, TArray<FHitResult>& OUT_Hits)
+{
+	FSweep Sweep;
+	Sweep.Start = Start;
+	Sweep.End = End;
+	Sweep.Radius = Radius;
+	EnsureUpToDate();
+	SCOPE_CYCLE_COUNTER(STAT_CombatHitboxQuery);
+	INC_DWORD_STAT(STAT_CombatHitboxQueries);
+
+	TArray<FCandidateHit> Candidates;
+	Query(Sweep, Categories, IgnoredActors, false, Candidates);
+	OUT_Hits.Reset();
+	FHitResult StaticHit;
+	const bool bStaticHit = SweepStaticGeometry(Sweep, IgnoredActors, StaticHit);
+	for (const FCandidateHit& Candidate : Candidates)
+	{
+		// like a physics multi sweep, nothing past the first static blocker
+		if (bStaticHit && Candidate.Time > StaticHit.Time) break;
+		OUT_Hits.Add(MakeHitResult(Candidate, Sweep));
+	}
+	if (bStaticHit) OUT_Hits.Add(StaticHit);
+	return OUT_Hits.Num() > 0;
+}
+
+int32 UCombatHitboxSubsystem::AllocateHistoryBlock()
+{
+	int32 Block = INDEX_NONE;
+	if (FreeHistoryBlocks.Num())
+	{
+		Block = FreeHistoryBlocks.Pop(false);
+	}
+	else
+	{
+		// the pool only grows when more characters are alive at once than ever before
+		Block = HistoryOrigins.Num() / HistoryCapacity;
+		HistoryOrigins.AddZeroed(HistoryCapacity);
+		HistorySerials.AddZeroed(HistoryCapacity);
+		HistoryPoints.AddZeroed(HistoryCapacity * MaxCapsules * 2);
+		SET_MEMORY_STAT(STAT_CombatHitboxHistoryMemory, HistoryOrigins.GetAllocatedSize() + HistorySerials.GetAllocatedSize() + HistoryPoints.GetAllocatedSize());
+	}
+	// whatever the last owner recorded must not pass for this character's past
+	for (int32 Frame = 0; Frame < HistoryCapacity; Frame++)
+	{
+		HistorySerials[GetHistoryIndex(Block, Frame)] = 0;
+	}
+	return Block;
+}
+
+void UCombatHitboxSubsystem::RecordHistory()
+{
+	SCOPE_CYCLE_COUNTER(STAT_CombatHitboxRecord);
+	HistoryHead = (HistoryHead + 1) % HistoryCapacity;
+	RecordSerial++;
+	FrameTimes[HistoryHead] = GetWorld()->GetTimeSeconds();
+	FrameSerials[HistoryHead] = RecordSerial;
+
+	for (FCharacterHitboxes& Entry : Characters)
+	{
+		if (Entry.HistoryBlock == INDEX_NONE) Entry.HistoryBlock = AllocateHistoryBlock();
+		const int32 Index = GetHistoryIndex(Entry.HistoryBlock, HistoryHead);
+		const ACharacter* Character = Entry.Character.Get();
+		// hidden or without collision: nothing to hit at this instant
+		if (!Character || !Shapes[Entry.GetShape(0)].bEnabled)
+		{
+			HistorySerials[Index] = 0;
+			continue;
+		}
+		const FVector Origin = Character->GetActorLocation();
+		HistoryOrigins[Index] = FVector3f(Origin);
+		HistorySerials[Index] = RecordSerial;
+		FQuantizedPoint* Points = &HistoryPoints[Index * MaxCapsules * 2];
+		for (int32 i = 0; i < Entry.NumShapes(); i++)
+		{
+			const FShape& Shape = Shapes[Entry.GetShape(i)];
+			for (int32 End = 0; End < 2; End++)
+			{
+				const FVector Offset = (End ? Shape.B : Shape.A) - Origin;
+				Points[i * 2 + End] = {CombatHitbox::Quantize(Offset.X), CombatHitbox::Quantize(Offset.Y), CombatHitbox::Quantize(Offset.Z)};
+			}
+		}
+	}
+}
+
+FVector UCombatHitboxSubsystem::GetHistoryPoint(int32 Block, int32 Frame, int32 Capsule, int32 End) const
+{
+	const int32 Index = GetHistoryIndex(Block, Frame);
+	const FQuantizedPoint& Point = HistoryPoints[(Index * MaxCapsules + Capsule) * 2 + End];
+	return FVector(HistoryOrigins[Index]) + FVector(Point.X, Point.Y, Point.Z) * HistoryQuantum;
+}
+
+bool UCombatHitboxSubsystem::ValidateRewoundHit(const AActor* Target, const FVector& Start, const FVector& End, float Radius, float RewindSeconds)
+{
+	EnsureUpToDate();
+	SCOPE_CYCLE_COUNTER(STAT_CombatHitboxRewind);
+	INC_DWORD_STAT(STAT_CombatHitboxRewinds);
+	const FCharacterHitboxes* Entry = Characters.FindByPredicate([Target](const FCharacterHitboxes& Candidate) {return Candidate.Character.Get() == Target;});
+	if (!Entry) return true;
+
+	int32 Older, Newer;
+	float Alpha;
+	FindRewoundFrames(*Entry, RewindSeconds, Older, Newer, Alpha);
+
+	const FVector Delta = End - Start;
+	for (int32 i = 0; i < Entry->NumShapes(); i++)
+	{
+		const FShape& Shape = Shapes[Entry->GetShape(i)];
+		FVector A = Shape.A;
+		FVector B = Shape.B;
+		// no history yet (registered this tick): the present pose
+		if (Older != INDEX_NONE)
+		{
+			const int32 Next = Newer != INDEX_NONE ? Newer : Older;
+			A = FMath::Lerp(GetHistoryPoint(Entry->HistoryBlock, Older, i, 0), GetHistoryPoint(Entry->HistoryBlock, Next, i, 0), Alpha);
+			B = FMath::Lerp(GetHistoryPoint(Entry->HistoryBlock, Older, i, 1), GetHistoryPoint(Entry->HistoryBlock, Next, i, 1), Alpha);
+		}
+		else if (!Shape.bEnabled)
+		{
+			continue;
+		}
+		INC_DWORD_STAT(STAT_CombatHitboxRewindTests);
+		float Time;
+		FVector Normal;
+		if (CombatHitbox::RayCapsule(Start, Delta, A, B, Shape.Radius + Radius, Time, Normal)) return true;
+	}
+	INC_DWORD_STAT(STAT_CombatHitboxRewindsRejected);
+	return false;
+}
+
+bool UCombatHitboxSubsystem::GetRewoundLocation(const AActor* Character, float RewindSeconds, FVector& OUT_Location) const
+{
+	const FCharacterHitboxes* Entry = Characters.FindByPredicate([Character](const FCharacterHitboxes& Candidate) {return Candidate.Character.Get() == Character;});
+	int32 Older, Newer;
+	float Alpha;
+	if (!Entry || !FindRewoundFrames(*Entry, RewindSeconds, Older, Newer, Alpha)) return false;
+	const FVector OlderOrigin(HistoryOrigins[GetHistoryIndex(Entry->HistoryBlock, Older)]);
+	OUT_Location = Newer != INDEX_NONE ? FMath::Lerp(OlderOrigin, FVector(HistoryOrigins[GetHistoryIndex(Entry->HistoryBlock, Newer)]), Alpha) : OlderOrigin;
+	return true;
+}
+
+bool UCombatHitboxSubsystem::FindRewoundFrames(const FCharacterHitboxes& Entry, float RewindSeconds, int32& OUT_Older, int32& OUT_Newer, float& OUT_Alpha) const
+{
+	// newest recorded frame at or before the rewound time, and the one after it
+	OUT_Older = INDEX_NONE;
+	OUT_Newer = INDEX_NONE;
+	OUT_Alpha = 0;
+	const double TargetTime = GetWorld()->GetTimeSeconds() - FMath::Max(RewindSeconds, 0.f);
+	if (Entry.HistoryBlock == INDEX_NONE || HistoryHead == INDEX_NONE) return false;
+	for (int32 Step = 0; Step < HistoryCapacity; Step++)
+	{
+		const int32 Frame = (HistoryHead - Step + HistoryCapacity) % HistoryCapacity;
+		if (!FrameSerials[Frame] || HistorySerials[GetHistoryIndex(Entry.HistoryBlock, Frame)] != FrameSerials[Frame]) continue;
+		if (FrameTimes[Frame] <= TargetTime)
+		{
+			OUT_Older = Frame;
+			break;
+		}
+		OUT_Newer = Frame;
+	}
+	// further back than the buffer reaches: the oldest pose there is
+	if (OUT_Older == INDEX_NONE) Swap(OUT_Older, OUT_Newer);
+	if (OUT_Older != INDEX_NONE && OUT_Newer != INDEX_NONE)
+	{
+		OUT_Alpha = float((TargetTime - FrameTimes[OUT_Older]) / FMath::Max(FrameTimes[OUT_Newer] - FrameTimes[OUT_Older], UE_SMALL_NUMBER));
+	}
+	return OUT_Older != INDEX_NONE;
+}
+
+int32 UCombatHitboxSubsystem::VerifyShapeQueries()
+{
+	int32 Missed = 0;
+	int32 Tested = 0;
+	TArray<FHitResult> Hits;
+	for (int32 ShapeIndex = 0; ShapeIndex < Shapes.Num(); ShapeIndex++)
+	{
+		const FShape& Shape = Shapes[ShapeIndex];
+		if (!Shape.bInUse || !Shape.bEnabled || !Shape.Actor.IsValid()) continue;
+		++Tested;
+		// ends exactly on the centre, so the shape is hit however thin it is
+		const FVector Centre = Shape.Type == EShapeType::Capsule ? (Shape.A + Shape.B) / 2.f : Shape.A;
+		const FVector Start(Centre.X, Centre.Y, Shape.Bounds.Max.Z + 100.f);
+		SweepSphereMulti(Start, Centre, 1.f, ECombatHitboxCategory::All, TArray<AActor*>(), Hits);
+		const bool bFound = Hits.ContainsByPredicate([&Shape](const FHitResult& Hit)
+			{
+				return Hit.GetActor() == Shape.Actor.Get() && Hit.GetComponent() == Shape.Component.Get() && Hit.BoneName == Shape.Bone;
+			});
+		if (!bFound)
+		{
+			++Missed;
+			UE_LOG(LogTemp, Warning, TEXT("Combat hitbox: sweep onto shape %d (%s %s) missed it"), ShapeIndex, *Shape.Actor->GetName(), *Shape.Bone.ToString());
+		}
+	}
+	UE_LOG(LogTemp, Log, TEXT("Combat hitbox: %d of %d shapes found by a sweep onto their centre"), Tested - Missed, Tested);
+	return Missed;
+}
+
+static FAutoConsoleCommandWithWorld CVarVerifyCombatHitboxes(
+	TEXT("combat.Hitbox.Verify"),
+	TEXT("Sweep onto the centre of every enabled hitbox shape, starting with shape 0, and log the shapes the BVH query misses."),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+		{
+			if (UCombatHitboxSubsystem* Hitboxes = World ? World->GetSubsystem<UCombatHitboxSubsystem>() : nullptr) Hitboxes->VerifyShapeQueries();
+		}));
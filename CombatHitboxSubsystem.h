@@ -0,0 +1,222 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "CombatSocketCache.h"
+#include "CombatHitboxSubsystem.generated.h"
+
+class ACharacter;
+class UPrimitiveComponent;
+
+enum class ECombatHitboxCategory : uint8
+{
+	None = 0,
+	Character = 1 << 0,
+	Building = 1 << 1,
+	Resource = 1 << 2,
+	All = Character | Building | Resource,
+};
+ENUM_CLASS_FLAGS(ECombatHitboxCategory)
+
+/**
+ * Combat-only collision world, kept apart from the physics scene so damage traces don't compete with
+ * movement sweeps and world geometry. Characters are a few capsules between bones, read from their
+ * combat socket cache; buildings and resources are oriented boxes. Every character that can be damaged
+ * is registered as it spawns, with a socket cache of its own unless its damage component registers it
+ * with the cache it already keeps. Everything sits in a 4-wide BVH with child bounds stored as SoA,
+ * refit on the first query of each frame and rebuilt when shapes are added or removed, or once a second
+ * as characters move. Queries are swept spheres and swept boxes. With
+ * combat.Hitbox.PhysicsFallback set, static world geometry is also swept in the physics scene.
+ *
+ * On the server, character capsules are also recorded every net tick into a ring buffer covering
+ * HistorySeconds, quantized relative to the character, in blocks pooled across characters. Hits claimed
+ * by clients are checked by rewinding the target to what the client saw and re-sweeping against it.
+ */
+UCLASS()
+class EALOND_API UCombatHitboxSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/** The hitbox world if combat.Hitbox.Enable is set, otherwise null and damage traces use physics. */
+	static UCombatHitboxSubsystem* GetActive(const UWorld* World);
+
+	/** Capsules for the character's bone groups, refit from the socket cache. The cache must outlive the registration. */
+	void RegisterCharacter(ACharacter* Character, FCombatSocketCache& SocketCache, const UObject* CacheOwner);
+	/** The same, with a socket cache owned by the registration; does nothing if the character is already registered. */
+	void RegisterCharacter(ACharacter* Character);
+	void Unregister(AActor* Actor);
+
+	bool SweepSphereSingle(const FVector& Start, const FVector& End, float Radius, ECombatHitboxCategory Categories, const TArray<AActor*>& IgnoredActors, FHitResult& OUT_Hit);
+	bool SweepBoxSingle(const FVector& Start, const FVector& End, const FVector& HalfExtent, const FQuat& Rotation, ECombatHitboxCategory Categories, const TArray<AActor*>& IgnoredActors, FHitResult& OUT_Hit);
+	/** Every shape the sphere passes through, nearest first, one hit per shape. */
+	bool SweepSphereMulti(const FVector& Start, const FVector& End, float Radius, ECombatHitboxCategory Categories, const TArray<AActor*>& IgnoredActors, TArray<FHitResult>& OUT_Hits);
+
+	/**
+	 * Whether the claimed sweep touches the target as it stood RewindSeconds ago, interpolated between
+	 * recorded ticks. Targets without hitbox history (buildings, resources) always pass. Tests at most
+	 * one pose of the target's capsules, whatever the history length.
+	 */
+	bool ValidateRewoundHit(const AActor* Target, const FVector& Start, const FVector& End, float Radius, float RewindSeconds);
+	/** Where the character stood RewindSeconds ago, interpolated between recorded ticks; false without history. */
+	bool GetRewoundLocation(const AActor* Character, float RewindSeconds, FVector& OUT_Location) const;
+
+	/** Sweeps down onto the centre of every enabled shape, logs the ones the sweep misses and returns their count. */
+	int32 VerifyShapeQueries();
+
+	static constexpr float RebuildInterval = 1.f;
+	static constexpr float HistorySeconds = .25f;
+	static constexpr int32 MaxHistoryFrames = 64;
+	// capsule ends are stored as int16 tenths of a unit from the character
+	static constexpr float HistoryQuantum = .1f;
+	static constexpr int32 EmptyChild = MIN_int32;
+
+private:
+	enum class EShapeType : uint8
+	{
+		Capsule,
+		Box,
+	};
+
+	struct FShape
+	{
+		TWeakObjectPtr<AActor> Actor;
+		TWeakObjectPtr<UPrimitiveComponent> Component;
+		FName Bone;
+		// capsule: segment A to B; box: centre A, rotation, half extent
+		FVector A = FVector::ZeroVector;
+		FVector B = FVector::ZeroVector;
+		FQuat Rotation = FQuat::Identity;
+		FVector Extent = FVector::ZeroVector;
+		float Radius = 0;
+		FBox Bounds = FBox(ForceInit);
+		EShapeType Type = EShapeType::Capsule;
+		ECombatHitboxCategory Category = ECombatHitboxCategory::None;
+		bool bInUse = false;
+		// hidden or collision off this frame, e.g. pooled pawns and razed buildings
+		bool bEnabled = true;
+	};
+
+	struct FBoneCapsule
+	{
+		int32 Shape = INDEX_NONE;
+		FName BoneA;
+		FName BoneB;
+		// B is pushed this fraction of A-B further out, for ends with no bone past them (top of the head)
+		float Extend = 0;
+	};
+
+	struct FCharacterHitboxes
+	{
+		TWeakObjectPtr<ACharacter> Character;
+		TWeakObjectPtr<const UObject> CacheOwner;
+		FCombatSocketCache* SocketCache = nullptr;
+		// set when the subsystem registered the character itself
+		TUniquePtr<FCombatSocketCache> OwnedSocketCache;
+		TArray<FBoneCapsule, TInlineAllocator<12>> Capsules;
+		// no bones resolved on the mesh: one capsule from the movement capsule
+		int32 BodyShape = INDEX_NONE;
+		// pooled pose history, servers only
+		int32 HistoryBlock = INDEX_NONE;
+
+		int32 NumShapes() const {return BodyShape != INDEX_NONE ? 1 : Capsules.Num();}
+		int32 GetShape(int32 Index) const {return BodyShape != INDEX_NONE ? BodyShape : Capsules[Index].Shape;}
+	};
+
+	struct FQuantizedPoint
+	{
+		int16 X = 0;
+		int16 Y = 0;
+		int16 Z = 0;
+	};
+
+	struct alignas(16) FNode
+	{
+		float MinX[4];
+		float MinY[4];
+		float MinZ[4];
+		float MaxX[4];
+		float MaxY[4];
+		float MaxZ[4];
+		// >= 0 child node, EmptyChild empty, otherwise a shape (~Child); shape 0 is ~0, so INDEX_NONE can't mark empty
+		int32 Children[4];
+	};
+
+	struct FCandidateHit
+	{
+		int32 Shape;
+		float Time;
+		FVector Normal;
+	};
+
+	struct FSweep
+	{
+		FVector Start;
+		FVector End;
+		float Radius = 0;
+		// zero for sphere sweeps
+		FVector BoxExtent = FVector::ZeroVector;
+		FQuat BoxRotation = FQuat::Identity;
+	};
+
+	int32 AllocateShape();
+	void FreeShape(int32 ShapeIndex);
+	void RegisterStaticBox(AActor* Actor, ECombatHitboxCategory Category);
+	void OnActorSpawned(AActor* SpawnedActor);
+	UFUNCTION()
+	void OnRegisteredActorDestroyed(AActor* DestroyedActor);
+
+	/** Moves character shapes to this frame's pose and refits or rebuilds the tree, once per frame. */
+	void EnsureUpToDate();
+	void UpdateCharacterShapes();
+	void Rebuild();
+	int32 BuildNode(TArray<int32>& Order, int32 Begin, int32 Count);
+	void Refit();
+
+	/** Collects shapes the sweep touches; Single stops looking past the nearest. */
+	void Query(const FSweep& Sweep, ECombatHitboxCategory Categories, const TArray<AActor*>& IgnoredActors, bool bSingle, TArray<FCandidateHit>& OUT_Hits) const;
+	bool TestShape(const FShape& Shape, const FSweep& Sweep, float& OUT_Time, FVector& OUT_Normal) const;
+	FHitResult MakeHitResult(const FCandidateHit& Candidate, const FSweep& Sweep) const;
+	/** Nearest static world geometry hit, when the physics fallback is on. */
+	bool SweepStaticGeometry(const FSweep& Sweep, const TArray<AActor*>& IgnoredActors, FHitResult& OUT_Hit) const;
+
+	int32 AllocateHistoryBlock();
+	void RecordHistory();
+	int32 GetHistoryIndex(int32 Block, int32 Frame) const {return Block * HistoryCapacity + Frame;}
+	FVector GetHistoryPoint(int32 Block, int32 Frame, int32 Capsule, int32 End) const;
+	/** The recorded frames either side of RewindSeconds ago, Newer INDEX_NONE if Older is the only one; false with no history. */
+	bool FindRewoundFrames(const FCharacterHitboxes& Entry, float RewindSeconds, int32& OUT_Older, int32& OUT_Newer, float& OUT_Alpha) const;
+
+	TArray<FShape> Shapes;
+	TArray<int32> FreeShapes;
+	TMap<TObjectKey<AActor>, int32> StaticShapes;
+	TArray<FCharacterHitboxes> Characters;
+	TArray<FNode> Nodes;
+
+	// pose history: one block of HistoryCapacity frames per character; the ring of frame times is shared
+	TArray<FVector3f> HistoryOrigins;
+	TArray<FQuantizedPoint> HistoryPoints;
+	TArray<uint32> HistorySerials;
+	TArray<int32> FreeHistoryBlocks;
+	TArray<double> FrameTimes;
+	TArray<uint32> FrameSerials;
+	int32 HistoryCapacity = 0;
+	int32 MaxCapsules = 0;
+	int32 HistoryHead = INDEX_NONE;
+	uint32 RecordSerial = 0;
+	double NextRecordTime = 0;
+	double RecordInterval = 0;
+	bool bRecordHistory = false;
+
+	FDelegateHandle ActorSpawnedHandle;
+	uint64 UpdatedFrame = MAX_uint64;
+	double LastRebuildTime = -MAX_dbl;
+	bool bTopologyDirty = true;
+};
@@ -0,0 +1,98 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "CombatSocketCache.h"
+#include "AITraceSubsystem.h"
+#include "Components/SkeletalMeshComponent.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Combat socket reads"), STAT_CombatSocketReads, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Combat socket evaluations"), STAT_CombatSocketEvaluations, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Combat socket lookups avoided"), STAT_CombatSocketLookupsAvoided, STATGROUP_EalondAI);
+
+FCombatSocketCache::~FCombatSocketCache()
+{
+	Reset();
+}
+
+void FCombatSocketCache::Register(USkeletalMeshComponent* Mesh, FName Socket)
+{
+	if (!Mesh) return;
+	FMeshSockets* Group = Groups.FindByPredicate([Mesh](const FMeshSockets& Candidate) {return Candidate.Mesh == Mesh;});
+	if (!Group)
+	{
+		Group = &Groups.AddDefaulted_GetRef();
+		Group->Mesh = Mesh;
+	}
+	if (Group->Names.Contains(Socket)) return;
+	Group->Names.Add(Socket);
+	Group->Locations.Add(FVector::ZeroVector);
+	Group->ReadFrames.Add(0);
+	Group->FilledFrame = MAX_uint64;
+}
+
+FVector FCombatSocketCache::GetSocketLocation(USkeletalMeshComponent* Mesh, FName Socket)
+{
+	INC_DWORD_STAT(STAT_CombatSocketReads);
+	const int32 GroupIndex = Groups.IndexOfByPredicate([Mesh](const FMeshSockets& Candidate) {return Candidate.Mesh == Mesh;});
+	const int32 SocketIndex = GroupIndex != INDEX_NONE ? Groups[GroupIndex].Names.IndexOfByKey(Socket) : INDEX_NONE;
+	if (SocketIndex == INDEX_NONE)
+	{
+		INC_DWORD_STAT(STAT_CombatSocketEvaluations);
+		return Mesh ? Mesh->GetSocketLocation(Socket) : FVector::ZeroVector;
+	}
+
+	FMeshSockets& Group = Groups[GroupIndex];
+	if (Group.FilledFrame != GFrameCounter) Fill(Group);
+	if (!Group.FinalizedHandle.IsValid())
+	{
+		// refresh after every pose from now on, for as long as the sockets keep being read
+		Group.FinalizedHandle = Mesh->RegisterOnBoneTransformsFinalizedDelegate(
+			FOnBoneTransformsFinalizedMultiCast::FDelegate::CreateRaw(this, &FCombatSocketCache::OnBoneTransformsFinalized, GroupIndex));
+	}
+	Group.LastReadFrame = GFrameCounter;
+	// a repeat read of the same socket this frame would have walked the mesh's transforms again
+	if (Group.ReadFrames[SocketIndex] == GFrameCounter) INC_DWORD_STAT(STAT_CombatSocketLookupsAvoided);
+	Group.ReadFrames[SocketIndex] = GFrameCounter;
+	return Group.Locations[SocketIndex];
+}
+
+void FCombatSocketCache::Fill(FMeshSockets& Group)
+{
+	USkeletalMeshComponent* Mesh = Group.Mesh.Get();
+	if (!Mesh) return;
+	for (int32 i = 0; i < Group.Names.Num(); i++)
+	{
+		Group.Locations[i] = Mesh->GetSocketLocation(Group.Names[i]);
+	}
+	Group.FilledFrame = GFrameCounter;
+	INC_DWORD_STAT_BY(STAT_CombatSocketEvaluations, Group.Names.Num());
+}
+
+void FCombatSocketCache::OnBoneTransformsFinalized(int32 GroupIndex)
+{
+	if (!Groups.IsValidIndex(GroupIndex)) return;
+	FMeshSockets& Group = Groups[GroupIndex];
+	// nothing read last frame: the swing is over, go quiet until the next read
+	if (Group.LastReadFrame + 1 < GFrameCounter)
+	{
+		StopRefreshing(Group);
+		return;
+	}
+	Fill(Group);
+}
+
+void FCombatSocketCache::StopRefreshing(FMeshSockets& Group)
+{
+	if (!Group.FinalizedHandle.IsValid()) return;
+	if (USkeletalMeshComponent* Mesh = Group.Mesh.Get()) Mesh->UnregisterOnBoneTransformsFinalizedDelegate(Group.FinalizedHandle);
+	Group.FinalizedHandle.Reset();
+}
+
+void FCombatSocketCache::Reset()
+{
+	for (FMeshSockets& Group : Groups)
+	{
+		StopRefreshing(Group);
+	}
+	Groups.Reset();
+}
@@ -0,0 +1,45 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class USkeletalMeshComponent;
+
+/**
+ * Per-character cache of the socket locations combat traces read. Registered sockets are evaluated once
+ * per frame, right after the mesh finalizes its bone transforms, and every damage query that frame reads
+ * the cached value. A mesh only refreshes after its bones finalize while its sockets were read the frame
+ * before, so idle characters pay nothing; the first read after a quiet spell fills on demand.
+ */
+class EALOND_API FCombatSocketCache
+{
+public:
+	FCombatSocketCache() = default;
+	~FCombatSocketCache();
+	FCombatSocketCache(const FCombatSocketCache&) = delete;
+	FCombatSocketCache& operator=(const FCombatSocketCache&) = delete;
+
+	void Register(USkeletalMeshComponent* Mesh, FName Socket);
+	/** Socket location this frame; sockets that weren't registered are read from the mesh. */
+	FVector GetSocketLocation(USkeletalMeshComponent* Mesh, FName Socket);
+	void Reset();
+
+private:
+	struct FMeshSockets
+	{
+		TWeakObjectPtr<USkeletalMeshComponent> Mesh;
+		TArray<FName, TInlineAllocator<4>> Names;
+		TArray<FVector, TInlineAllocator<4>> Locations;
+		TArray<uint64, TInlineAllocator<4>> ReadFrames;
+		uint64 FilledFrame = MAX_uint64;
+		uint64 LastReadFrame = 0;
+		FDelegateHandle FinalizedHandle;
+	};
+
+	void Fill(FMeshSockets& Group);
+	void OnBoneTransformsFinalized(int32 GroupIndex);
+	void StopRefreshing(FMeshSockets& Group);
+
+	TArray<FMeshSockets, TInlineAllocator<2>> Groups;
+};
@@ -1,5 +1,17 @@
+#include "GroundHeightSubsystem.h"
+
 float UCustomMathLibrary::GetLandscapeHeightAtLocation(UWorld* WorldRef, FVector Location)
 {
+	// cached heightmap first; trace only while the tile under the location is still being built
+	if (UGroundHeightSubsystem* GroundHeights = WorldRef->GetSubsystem<UGroundHeightSubsystem>())
+	{
+		float CachedZ;
+		if (GroundHeights->TryGetHeight(Location, EGroundHeightLayer::Landscape, CachedZ))
+		{
+			// keep the old trace's reach so callers see the same result for points far above or below the landscape
+			return FMath::Abs(CachedZ - Location.Z) <= 1000.f ? CachedZ : 0.0f;
+		}
+	}
 	FHitResult HitResult;
 	FCollisionQueryParams Params;
 	//Params.AddIgnoredActor(this);
@@ -6,6 +6,15 @@
 #include "../AI/AIBaseCharacter.h"
 #include "../AI/Villager.h"
 #include "../AI/NPCAIController.h"
+#include "../AI/AITraceSubsystem.h"
+#include "../AI/ArmorResistanceTable.h"
+#include "../AI/CombatHitboxSubsystem.h"
+#include "../AI/CombatHitDescriptor.h"
+#include "../AI/DamageQueueSubsystem.h"
+#include "../AI/HitFXSubsystem.h"
+#include "../AI/StatusEffectSubsystem.h"
+#include "../AI/CombatSocketCache.h"
+#include "../AI/WeaponSwingBake.h"
 #include "../Interfaces/PlayerAIInteractionInterface.h"
 #include "../Interfaces/FXAudioInterface.h"
 #include "../Items/EquippableItem.h"
@@ -18,7 +27,11 @@
 #include "../Progress/CharacterProgressComponent.h"
 #include "../World/EalondCharacterBase.h"
 #include "../World/ResourceActor.h"
+#include "Animation/AnimInstance.h"
+#include "Animation/AnimMontage.h"
+#include "Components/CapsuleComponent.h"
 #include "GameFramework/DamageType.h"
+#include "GameFramework/PlayerState.h"
 #include "GameFramework/ProjectileMovementComponent.h"
 #include "GenericTeamAgentInterface.h"
 #include "Kismet/GameplayStatics.h"
@@ -27,6 +40,83 @@
 #include "NiagaraSystem.h"
 #include "NiagaraFunctionLibrary.h"
 
+static TAutoConsoleVariable<bool> CVarWeaponTraceAsync(
+	TEXT("combat.WeaponTrace.Async"),
+	true,
+	TEXT("Issue each frame's melee weapon sweeps as one async physics batch and resolve the hits next frame, instead of sweeping synchronously. Only used with combat.Hitbox.Enable off; hitbox queries replace the batch."));
+
+static TAutoConsoleVariable<int32> CVarWeaponTraceMaxLatencyFrames(
+	TEXT("combat.WeaponTrace.MaxLatencyFrames"),
+	2,
+	TEXT("Async weapon sweep results older than this many frames are thrown away rather than applied. Counted in frames so a low frame rate doesn't drop every result."));
+
+static TAutoConsoleVariable<bool> CVarLagCompensationEnable(
+	TEXT("combat.LagCompensation.Enable"),
+	true,
+	TEXT("On the server, only apply hits claimed by clients if the claimed sweep touches the target as the client saw it."));
+
+static TAutoConsoleVariable<float> CVarLagCompensationInterpDelay(
+	TEXT("combat.LagCompensation.InterpDelay"),
+	.1f,
+	TEXT("How far behind their latest update clients draw other characters, in seconds; added to the round trip when rewinding."));
+
+static TAutoConsoleVariable<float> CVarLagCompensationTolerance(
+	TEXT("combat.LagCompensation.Tolerance"),
+	15.f,
+	TEXT("Extra radius given to rewound hit checks, for pose differences between client and server."));
+
+namespace DamageTrace
+{
+	// what each damage trace channel responds to, in hitbox world terms
+	static ECombatHitboxCategory GetHitboxCategories(ECollisionChannel Channel)
+	{
+		return Channel == ECC_GameTraceChannel6 ? ECombatHitboxCategory::Resource : ECombatHitboxCategory::All;
+	}
+
+	/**
+	 * False for a hit claimed by a remote client whose impact point is off the target as that client saw it,
+	 * or further from where the attacker stood then than Reach plus its capsule. A negative Reach is unbounded.
+	 */
+	static bool IsClaimedHitValid(const AEalondCharacterBase* Attacker, const FCombatHitDescriptor& Hit, float Reach)
+	{
+		// the server's own traces (its players and all AI) already ran against the present
+		if (!CVarLagCompensationEnable.GetValueOnGameThread() || !Attacker || !Attacker->HasAuthority() || !Attacker->IsPlayerControlled() || Attacker->IsLocallyControlled()) return true;
+		UCombatHitboxSubsystem* Hitboxes = Attacker->GetWorld()->GetSubsystem<UCombatHitboxSubsystem>();
+		if (!Hit.Target.IsValid()) return true;
+
+		// the client swung when its stamp says, at everyone else as they were half a round trip plus its
+		// interpolation delay before that; its ping bounds how far back the stamp may ask for
+		const APlayerState* PlayerState = Attacker->GetPlayerState();
+		const float Ping = PlayerState ? PlayerState->GetPingInMilliseconds() / 1000.f : 0.f;
+		const double Now = Attacker->GetWorld()->GetTimeSeconds();
+		const float SinceSent = FMath::Clamp(float(Now - Hit.GetTimestampSeconds(Now)), 0.f, Ping);
+		const float RewindSeconds = SinceSent + Ping * .5f + CVarLagCompensationInterpDelay.GetValueOnGameThread();
+		const float Tolerance = CVarLagCompensationTolerance.GetValueOnGameThread();
+
+		// the hitbox check alone would pass any target's own location, sent from anywhere on the map
+		FVector AttackerLocation = Attacker->GetActorLocation();
+		if (Hitboxes) Hitboxes->GetRewoundLocation(Attacker, RewindSeconds, AttackerLocation);
+		// measured from the capsule's axis, so a swing at the feet reaches as far as one at the chest
+		const UCapsuleComponent* Capsule = Attacker->GetCapsuleComponent();
+		const FVector Axis(0, 0, Capsule->GetScaledCapsuleHalfHeight_WithoutHemisphere());
+		const float MaxDistance = Reach + Capsule->GetScaledCapsuleRadius() + Tolerance;
+		if (Reach >= 0 && FMath::PointDistToSegment(Hit.ImpactPoint, AttackerLocation - Axis, AttackerLocation + Axis) > MaxDistance) return false;
+
+		// impact points sit on the hit surface, so the check only needs the tolerance around the rewound capsules
+		return !Hitboxes || Hitboxes->ValidateRewoundHit(Hit.Target.Get(), Hit.ImpactPoint, Hit.ImpactPoint, Tolerance, RewindSeconds);
+	}
+
+	// pooled and budgeted where the impact material has a hit FX pool, otherwise the hit actor plays it. A listen server's
+	// impacts, its own player's included, all go through PlayFXOnHit, the replicated path, so remote clients see them
+	static void PlayHitFX(AActor* HitActor, const FFXData& FXData, AEalondCharacterBase* Instigator)
+	{
+		const ENetMode NetMode = HitActor->GetNetMode();
+		const bool bLocalOnly = NetMode == NM_Standalone || NetMode == NM_Client;
+		if (bLocalOnly && UHitFXSubsystem::PlayImpact(HitActor->GetWorld(), FXData, Instigator)) return;
+		IFXAudioInterface::Execute_PlayFXOnHit(HitActor, FXData, Instigator);
+	}
+}
+
 
 // Sets default values for this component's properties
 UPlayerDamageComponent::UPlayerDamageComponent()
@@ -46,6 +136,56 @@ void UPlayerDamageComponent::BeginPlay()
 	{
 		ProgComp = PlayerCharacter->ProgressComponent;
 	}
+	// everything WeaponTrace reads, so a swing evaluates each once per frame
+	if (PlayerCharacter)
+	{
+		SocketCache.Register(PlayerCharacter->CharacterMesh, TEXT("righthand"));
+		SocketCache.Register(PlayerCharacter->CharacterMesh, TEXT("weapontraceoffset"));
+		SocketCache.Register(PlayerCharacter->GetMesh(), TEXT("shield"));
+		SocketCache.Register(PlayerCharacter->GetMesh(), TEXT("spine_01"));
+		if (UCombatHitboxSubsystem* Hitboxes = GetWorld()->GetSubsystem<UCombatHitboxSubsystem>())
+		{
+			Hitboxes->RegisterCharacter(PlayerCharacter, SocketCache, this);
+		}
+	}
+}
+
+void UPlayerDamageComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (UCombatHitboxSubsystem* Hitboxes = GetWorld()->GetSubsystem<UCombatHitboxSubsystem>())
+	{
+		Hitboxes->Unregister(GetOwner());
+	}
+	SocketCache.Reset();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+bool UPlayerDamageComponent::CombatSweepSingle(const FVector& Start, const FVector& End, float Radius, ECollisionChannel Channel, FHitResult& OUT_HitResult)
+{
+	if (UCombatHitboxSubsystem* Hitboxes = UCombatHitboxSubsystem::GetActive(GetWorld()))
+	{
+		return Hitboxes->SweepSphereSingle(Start, End, Radius, DamageTrace::GetHitboxCategories(Channel), IgnoredActors, OUT_HitResult);
+	}
+	return UKismetSystemLibrary::SphereTraceSingle(GetWorld(), Start, End, Radius, UEngineTypes::ConvertToTraceType(Channel), false, IgnoredActors, EDrawDebugTrace::None, OUT_HitResult, true);
+}
+
+bool UPlayerDamageComponent::CombatBoxSweepSingle(const FVector& Start, const FVector& End, const FVector& HalfSize, const FRotator& Orientation, ECollisionChannel Channel, FHitResult& OUT_HitResult)
+{
+	if (UCombatHitboxSubsystem* Hitboxes = UCombatHitboxSubsystem::GetActive(GetWorld()))
+	{
+		return Hitboxes->SweepBoxSingle(Start, End, HalfSize, Orientation.Quaternion(), DamageTrace::GetHitboxCategories(Channel), IgnoredActors, OUT_HitResult);
+	}
+	return UKismetSystemLibrary::BoxTraceSingle(GetWorld(), Start, End, HalfSize, Orientation, UEngineTypes::ConvertToTraceType(Channel), false, IgnoredActors, EDrawDebugTrace::None, OUT_HitResult, true);
+}
+
+bool UPlayerDamageComponent::CombatSweepMulti(const FVector& Start, const FVector& End, float Radius, ECollisionChannel Channel, TArray<FHitResult>& OUT_HitResults)
+{
+	if (UCombatHitboxSubsystem* Hitboxes = UCombatHitboxSubsystem::GetActive(GetWorld()))
+	{
+		return Hitboxes->SweepSphereMulti(Start, End, Radius, DamageTrace::GetHitboxCategories(Channel), IgnoredActors, OUT_HitResults);
+	}
+	return UKismetSystemLibrary::SphereTraceMulti(GetWorld(), Start, End, Radius, UEngineTypes::ConvertToTraceType(Channel), false, IgnoredActors, EDrawDebugTrace::None, OUT_HitResults, true);
 }
 
 void UPlayerDamageComponent::WeaponTrace()
@@ -60,13 +200,13 @@ void UPlayerDamageComponent::WeaponTrace()
 		IgnoredActors.AddUnique(PlayerCharacter);
 		if (PlayerCharacter->bIsBlocking)
 		{
-			FVector TraceStart = PlayerCharacter->GetMesh()->GetSocketLocation(TEXT("shield"));
+			FVector TraceStart = SocketCache.GetSocketLocation(PlayerCharacter->GetMesh(), TEXT("shield"));
 			FVector BoxExtent = FVector(CurrentWeapon->DamageStats.WeaponWidth, CurrentWeapon->DamageStats.WeaponLength, 0);
 			FRotator BoxRot = FRotator(PlayerCharacter->ShieldMesh->GetComponentRotation());
 			// add traces if weapon swing too quick
-			FRotator TraceOrientation = UKismetMathLibrary::FindLookAtRotation(PlayerCharacter->GetMesh()->GetSocketLocation(TEXT("spine_01")), TraceStart);
+			FRotator TraceOrientation = UKismetMathLibrary::FindLookAtRotation(SocketCache.GetSocketLocation(PlayerCharacter->GetMesh(), TEXT("spine_01")), TraceStart);
 			TraceEnd = TraceOrientation.Vector() * 20.f + TraceStart;
-			bool bHitSuccess = UKismetSystemLibrary::BoxTraceSingle(GetWorld(), TraceStart, TraceEnd, BoxExtent, FRotator(90.f, BoxRot.Pitch, BoxRot.Yaw), UEngineTypes::ConvertToTraceType(ECollisionChannel::ECC_GameTraceChannel4), false, IgnoredActors, EDrawDebugTrace::None, HitResult, true);
+			bool bHitSuccess = CombatBoxSweepSingle(TraceStart, TraceEnd, BoxExtent, FRotator(90.f, BoxRot.Pitch, BoxRot.Yaw), ECollisionChannel::ECC_GameTraceChannel4, HitResult);
 			if (bHitSuccess && HitResult.GetActor())
 			{
 				FVector LastEndPoint = LastStartPosition + LastDirection * CurrentWeapon->DamageStats.WeaponLength;
@@ -79,57 +219,188 @@ void UPlayerDamageComponent::WeaponTrace()
 		}
 		else
 		{
-			FVector TraceStart = PlayerCharacter->CharacterMesh->GetSocketLocation(TEXT("righthand"));
-			float TraceDistance = FVector::Distance(TraceStart, LastStartPosition);
-			TraceStart = PlayerCharacter->CharacterMesh->GetSocketLocation(TEXT("righthand"));
-			FRotator TraceDirection = UKismetMathLibrary::FindLookAtRotation(TraceStart, PlayerCharacter->CharacterMesh->GetSocketLocation(TEXT("weapontraceoffset")));
-			TraceEnd = TraceDirection.Vector() * CurrentWeapon->DamageStats.WeaponLength + TraceStart;
-			// add traces if weapon swing too quick
-			if (LastEndPosition != FVector(0, 0, 0))
+			// sub-steps first, then the blade where it is now, so hits resolve in swing order either way
+			TArray<FAITraceRequest> Sweeps;
+			TArray<FVector> HitDirections;
+			FVector TraceStart;
+			if (!GetBakedSwingSweeps(Sweeps, HitDirections, TraceStart, TraceEnd))
 			{
-				float TraceDiff = FVector::Distance(LastEndPosition, TraceEnd);
-				if (TraceDiff > 20.f)
+				TraceStart = SocketCache.GetSocketLocation(PlayerCharacter->CharacterMesh, TEXT("righthand"));
+				FRotator TraceDirection = UKismetMathLibrary::FindLookAtRotation(TraceStart, SocketCache.GetSocketLocation(PlayerCharacter->CharacterMesh, TEXT("weapontraceoffset")));
+				TraceEnd = TraceDirection.Vector() * CurrentWeapon->DamageStats.WeaponLength + TraceStart;
+				FVector LastEndPoint = LastStartPosition + LastDirection * CurrentWeapon->DamageStats.WeaponLength;
+				const FCollisionShape Blade = FCollisionShape::MakeSphere(CurrentWeapon->DamageStats.WeaponWidth);
+				// add traces if weapon swing too quick
+				if (LastEndPosition != FVector(0, 0, 0))
 				{
-					int32 TotalIts = FMath::DivideAndRoundUp(TraceDiff, 20.f);
-					for (int32 i = 1; i < TotalIts; i++)
+					float TraceDiff = FVector::Distance(LastEndPosition, TraceEnd);
+					if (TraceDiff > 20.f)
 					{
-						FVector NewTraceStart;
-						FVector NewTraceEnd;
-						GetTraceMidpoints(LastStartPosition, TraceStart, LastEndPosition, TraceEnd, TotalIts, i, NewTraceStart, NewTraceEnd);
-						bool bHitSuccess = UKismetSystemLibrary::SphereTraceSingle(GetWorld(), NewTraceStart, NewTraceEnd, CurrentWeapon->DamageStats.WeaponWidth, UEngineTypes::ConvertToTraceType(ECollisionChannel::ECC_GameTraceChannel4), false, IgnoredActors, EDrawDebugTrace::None, HitResult, true);
-						if (bHitSuccess && HitResult.GetActor())
+						int32 TotalIts = FMath::Min(FMath::DivideAndRoundUp(TraceDiff, 20.f), UAITraceSubsystem::MaxTracesPerBatch);
+						for (int32 i = 1; i < TotalIts; i++)
 						{
-							FVector LastEndPoint = LastStartPosition + LastDirection * CurrentWeapon->DamageStats.WeaponLength;
-							FVector HitDirection = (NewTraceEnd - LastEndPoint).GetSafeNormal();
-							OnHitActor(HitResult, HitDirection);
-							bHasHit = true;
+							FVector NewTraceStart;
+							FVector NewTraceEnd;
+							GetTraceMidpoints(LastStartPosition, TraceStart, LastEndPosition, TraceEnd, TotalIts, i, NewTraceStart, NewTraceEnd);
+							Sweeps.Emplace(NewTraceStart, NewTraceEnd, ECollisionChannel::ECC_GameTraceChannel4, Blade);
+							HitDirections.Add((NewTraceEnd - LastEndPoint).GetSafeNormal());
 						}
 					}
 				}
+				Sweeps.Emplace(TraceStart, TraceEnd, ECollisionChannel::ECC_GameTraceChannel4, Blade);
+				// calculations for physical animation
+				HitDirections.Add((TraceEnd - LastEndPoint) * FMath::Clamp(FVector::Distance(LastEndPoint, TraceEnd) / GetWorld()->GetDeltaSeconds(), 0, 5000.f));
 			}
-			bool bHitSuccess = UKismetSystemLibrary::SphereTraceSingle(GetWorld(), TraceStart, TraceEnd, CurrentWeapon->DamageStats.WeaponWidth, UEngineTypes::ConvertToTraceType(ECollisionChannel::ECC_GameTraceChannel4), false, IgnoredActors, EDrawDebugTrace::None, HitResult, true);
-			if (bHitSuccess && HitResult.GetActor())
+
+			// the hitbox world replaces the async batch: its queries are cheap enough to resolve straight away, and
+			// the batch only sweeps the physics scene; only physics sweeps are worth deferring
+			const bool bDeferSweeps = !UCombatHitboxSubsystem::GetActive(GetWorld()) && CVarWeaponTraceAsync.GetValueOnGameThread();
+			if (!bDeferSweeps || !RequestWeaponSweeps(Sweeps, MoveTemp(HitDirections)))
 			{
-				// calculations for physical animation
-				FVector LastEndPoint = LastStartPosition + LastDirection * CurrentWeapon->DamageStats.WeaponLength;
-				FVector HitVelocity = (TraceEnd - LastEndPoint) * FMath::Clamp(FVector::Distance(LastEndPoint, TraceEnd) / GetWorld()->GetDeltaSeconds(), 0, 5000.f);
-				OnHitActor(HitResult, HitVelocity);
-				bHasHit = true;
+				// synchronous path; each hit joins IgnoredActors before the next sweep runs
+				for (int32 i = 0; i < Sweeps.Num(); i++)
+				{
+					bool bHitSuccess = CombatSweepSingle(Sweeps[i].Start, Sweeps[i].End, CurrentWeapon->DamageStats.WeaponWidth, ECollisionChannel::ECC_GameTraceChannel4, HitResult);
+					if (bHitSuccess && HitResult.GetActor())
+					{
+						OnHitActor(HitResult, HitDirections[i]);
+						bHasHit = true;
+					}
+				}
 			}
 			LastStartPosition = TraceStart;
 			LastEndPosition = TraceEnd;
-			LastDirection = TraceDirection.Vector();
+			LastDirection = (TraceEnd - TraceStart).GetSafeNormal();
 		}
 	}
 }
 
+bool UPlayerDamageComponent::GetBakedSwingSweeps(TArray<FAITraceRequest>& OUT_Sweeps, TArray<FVector>& OUT_HitDirections, FVector& OUT_Start, FVector& OUT_End)
+{
+	UAnimInstance* AnimInstance = PlayerCharacter->GetMesh()->GetAnimInstance();
+	UAnimMontage* Montage = PlayerCharacter->GetCurrentMontage();
+	const UWeaponSwingBake* Bake = Montage ? Montage->GetAssetUserData<UWeaponSwingBake>() : nullptr;
+	if (!Bake || !AnimInstance)
+	{
+		LastSwingMontage = nullptr;
+		return false;
+	}
+	const float Position = AnimInstance->Montage_GetPosition(Montage);
+	FVector LocalStart;
+	FVector LocalDirection;
+	if (!Bake->Sample(Position, LocalStart, LocalDirection))
+	{
+		LastSwingMontage = nullptr;
+		return false;
+	}
+	const FTransform ComponentTransform = PlayerCharacter->CharacterMesh->GetComponentTransform();
+	const float Length = CurrentWeapon->DamageStats.WeaponLength;
+	const FCollisionShape Blade = FCollisionShape::MakeSphere(CurrentWeapon->DamageStats.WeaponWidth);
+	OUT_Start = ComponentTransform.TransformPosition(LocalStart);
+	OUT_End = OUT_Start + ComponentTransform.TransformVectorNoScale(LocalDirection) * Length;
+	FVector LastEndPoint = LastStartPosition + LastDirection * Length;
+
+	// sweep the baked poses crossed since last frame, moved along with the character between the two frames
+	if (LastSwingMontage == Montage && LastEndPosition != FVector(0, 0, 0))
+	{
+		TArray<float> SampleTimes;
+		Bake->GetSampleTimesBetween(LastSwingPosition, Position, UAITraceSubsystem::MaxTracesPerBatch - 1, SampleTimes);
+		for (float Time : SampleTimes)
+		{
+			FVector SampleStart;
+			FVector SampleDirection;
+			if (!Bake->Sample(Time, SampleStart, SampleDirection)) continue;
+			FTransform SampleTransform;
+			SampleTransform.Blend(LastSwingTransform, ComponentTransform, (Time - LastSwingPosition) / (Position - LastSwingPosition));
+			SampleStart = SampleTransform.TransformPosition(SampleStart);
+			const FVector SampleEnd = SampleStart + SampleTransform.TransformVectorNoScale(SampleDirection) * Length;
+			OUT_Sweeps.Emplace(SampleStart, SampleEnd, ECollisionChannel::ECC_GameTraceChannel4, Blade);
+			OUT_HitDirections.Add((SampleEnd - LastEndPoint).GetSafeNormal());
+		}
+	}
+	OUT_Sweeps.Emplace(OUT_Start, OUT_End, ECollisionChannel::ECC_GameTraceChannel4, Blade);
+	// calculations for physical animation
+	OUT_HitDirections.Add((OUT_End - LastEndPoint) * FMath::Clamp(FVector::Distance(LastEndPoint, OUT_End) / GetWorld()->GetDeltaSeconds(), 0, 5000.f));
+
+	LastSwingMontage = Montage;
+	LastSwingPosition = Position;
+	LastSwingTransform = ComponentTransform;
+	return true;
+}
+
+bool UPlayerDamageComponent::RequestWeaponSweeps(const TArray<FAITraceRequest>& Sweeps, TArray<FVector>&& HitDirections)
+{
+	UAITraceSubsystem* TraceSubsystem = GetWorld()->GetSubsystem<UAITraceSubsystem>();
+	if (!TraceSubsystem) return false;
+	// same query the kismet sweeps build, so both paths hit the same things
+	FCollisionQueryParams Params(SCENE_QUERY_STAT(WeaponTrace), false);
+	Params.bReturnPhysicalMaterial = true;
+	Params.AddIgnoredActors(IgnoredActors);
+	Params.AddIgnoredActor(GetOwner());
+	const uint32 Serial = ++WeaponSweepSerial;
+	if (!TraceSubsystem->RequestTraces(Sweeps, Params, FOnAITraceBatchComplete::CreateUObject(this, &UPlayerDamageComponent::OnWeaponSweepsComplete, Serial))) return false;
+
+	FPendingWeaponSweeps& Pending = PendingWeaponSweeps.AddDefaulted_GetRef();
+	Pending.Serial = Serial;
+	Pending.HitDirections = MoveTemp(HitDirections);
+	Pending.Weapon = CurrentWeapon;
+	Pending.RequestFrame = GFrameCounter;
+	Pending.SwingId = WeaponSwingId;
+	return true;
+}
+
+void UPlayerDamageComponent::OnWeaponSweepsComplete(const TArray<FHitResult>& Results, uint32 Serial)
+{
+	const int32 PendingIndex = PendingWeaponSweeps.IndexOfByPredicate([Serial](const FPendingWeaponSweeps& Pending) {return Pending.Serial == Serial;});
+	if (PendingIndex == INDEX_NONE) return;
+	FPendingWeaponSweeps Pending = MoveTemp(PendingWeaponSweeps[PendingIndex]);
+	PendingWeaponSweeps.RemoveAt(PendingIndex);
+
+	// the owner has to still be holding the weapon that was swept, and the result has to be fresh; the
+	// swing it came from may have just ended, but not the one before
+	const uint64 Age = GFrameCounter - Pending.RequestFrame;
+	const bool bCurrentSwing = Pending.SwingId == WeaponSwingId;
+	const bool bValid = PlayerCharacter && GetWeapon() && CurrentWeapon == Pending.Weapon.Get() && Age <= uint64(FMath::Max(CVarWeaponTraceMaxLatencyFrames.GetValueOnGameThread(), 0))
+		&& (bCurrentSwing || Pending.SwingId + 1 == WeaponSwingId);
+	if (!bValid)
+	{
+		UE_LOG(LogTemp, Verbose, TEXT("%s: dropped weapon sweep results %llu frames old"), *GetNameSafe(GetOwner()), Age);
+		return;
+	}
+
+	// a finished swing's late results dedup against, and add to, that swing's hits rather than the new one's
+	if (!bCurrentSwing) Swap(IgnoredActors, PreviousSwingIgnoredActors);
+	for (int32 i = 0; i < Results.Num() && i < Pending.HitDirections.Num(); i++)
+	{
+		FHitResult HitResult = Results[i];
+		AActor* HitActor = HitResult.GetActor();
+		if (!HitResult.bBlockingHit || !IsValid(HitActor)) continue;
+		// the synchronous path ignores an actor as soon as it is hit, so its sweep carries on to whatever is behind;
+		// this one was batched before the hit was known, so sweep it again now with the hit ignored
+		if (IgnoredActors.Contains(HitActor))
+		{
+			HitResult = FHitResult();
+			if (!CombatSweepSingle(Results[i].TraceStart, Results[i].TraceEnd, CurrentWeapon->DamageStats.WeaponWidth, ECollisionChannel::ECC_GameTraceChannel4, HitResult)
+				|| !HitResult.GetActor()) continue;
+		}
+		OnHitActor(HitResult, Pending.HitDirections[i]);
+		if (bCurrentSwing) bHasHit = true;
+	}
+	if (!bCurrentSwing) Swap(IgnoredActors, PreviousSwingIgnoredActors);
+}
+
 void UPlayerDamageComponent::ResetTraceVariables()
 {
-	IgnoredActors.Empty();
+	// the swing's last sweeps may still be in flight; they dedup against this swing's hits, the next swing
+	// starts clean
+	Swap(IgnoredActors, PreviousSwingIgnoredActors);
+	IgnoredActors.Reset();
+	bHasHit = false;
+	++WeaponSwingId;
 	LastStartPosition = FVector(0, 0, 0);
 	LastEndPosition = FVector(0, 0, 0);
 	LastDirection = FVector(0, 0, 0);
-	bHasHit = false;
+	LastSwingMontage = nullptr;
 }
 
 void UPlayerDamageComponent::OnHitActor(FHitResult IN_HitResult, FVector HitDirection)
@@ -163,21 +434,21 @@ void UPlayerDamageComponent::OnHitActor(FHitResult IN_HitResult, FVector HitDire
 					{
 						if (Resource->HasAcceptedTool(Cast<UToolItem>(PlayerCharacter->EquippedItems[EEquippableSlot::EIS_Tool])))
 						{
-							ApplyDamage(IN_HitResult, HitDirection, CalculateDamage(PlayerCharacter->EquippedItems[EEquippableSlot::EIS_Tool]));
+							ApplyDamage(FCombatHitDescriptor::Make(IN_HitResult, CalculateDamage(PlayerCharacter->EquippedItems[EEquippableSlot::EIS_Tool]), ECombatHitType::Tool, GetWorld()));
 						}
 					}
 					else if (ABuilding* Building = Cast<ABuilding>(IN_HitResult.GetActor()))
 					{
 						if (Building->HasAcceptedTool(Cast<UToolItem>(PlayerCharacter->EquippedItems[EEquippableSlot::EIS_Tool])))
 						{
-							ApplyDamage(IN_HitResult, HitDirection, CalculateDamage(PlayerCharacter->EquippedItems[EEquippableSlot::EIS_Tool]));
+							ApplyDamage(FCombatHitDescriptor::Make(IN_HitResult, CalculateDamage(PlayerCharacter->EquippedItems[EEquippableSlot::EIS_Tool]), ECombatHitType::Tool, GetWorld()));
 						}
 					}
 				}
 			}
 			else if (IN_HitResult.GetActor()->IsA(AAnimal::StaticClass()))
 			{
-				ApplyDamage(IN_HitResult, IN_HitResult.GetActor()->GetActorLocation() - GetOwner()->GetActorLocation(), CalculateDamage(CurrentWeapon));
+				ApplyDamage(FCombatHitDescriptor::Make(IN_HitResult, CalculateDamage(CurrentWeapon), ECombatHitType::Melee, GetWorld()));
 			}
 		}
 		// play fx
@@ -188,7 +459,7 @@ void UPlayerDamageComponent::OnHitActor(FHitResult IN_HitResult, FVector HitDire
 			FXData.HitLocation = IN_HitResult.Location;
 			FXData.HitNormal = IN_HitResult.Normal;
 			FXData.BoneHit = IN_HitResult.BoneName;
-			if (!IN_HitResult.GetActor()->IsA(ACharacter::StaticClass())) IntHitObj->Execute_PlayFXOnHit(Cast<UObject>(IntHitObj), FXData, PlayerCharacter);
+			if (!IN_HitResult.GetActor()->IsA(ACharacter::StaticClass())) DamageTrace::PlayHitFX(IN_HitResult.GetActor(), FXData, PlayerCharacter);
 			// hit characters if tool not equipped; fx played from child character OnTakeHit function
 			else if (!PlayerCharacter->bToolEquipped)
 			{
@@ -207,7 +478,7 @@ void UPlayerDamageComponent::OnHitActor(FHitResult IN_HitResult, FVector HitDire
 						{
 							CurrentWeapon->DamageStats.bImpulseDamage = false;
 						}
-						ApplyDamage(IN_HitResult, HitDirection, CalculateDamage(CurrentWeapon));
+						ApplyDamage(FCombatHitDescriptor::Make(IN_HitResult, CalculateDamage(CurrentWeapon), ECombatHitType::Melee, GetWorld()));
 						return;
 					}
 					else
@@ -219,34 +490,48 @@ void UPlayerDamageComponent::OnHitActor(FHitResult IN_HitResult, FVector HitDire
 			// hit building
 			if (bCanDamageBuilding && IN_HitResult.GetActor()->IsA(ABuilding::StaticClass()))
 			{
-				ApplyDamage(IN_HitResult, HitDirection, CalculateDamage(CurrentWeapon));
+				ApplyDamage(FCombatHitDescriptor::Make(IN_HitResult, CalculateDamage(CurrentWeapon), ECombatHitType::Melee, GetWorld()));
 			}
 		}
 	}
 }
 
-void UPlayerDamageComponent::ApplyDamage_Implementation(FHitResult IN_HitResult, FVector HitDirection, float TotalDamage)
+void UPlayerDamageComponent::ApplyDamage_Implementation(FCombatHitDescriptor Hit)
 {
-	if (GetOwner())
+	AActor* HitActor = Hit.Target.Get();
+	if (GetOwner() && HitActor)
 	{
+		// reach comes from what is equipped, not CurrentWeapon, which is only set when this side ran the trace: tool hits
+		// reach as far as the tool, melee as far as the weapon or a shield bash; arrows fly, so only the hitbox check bounds them
+		float Reach = -1.f;
+		if (Hit.Type != ECombatHitType::Ranged)
+		{
+			auto GetSlotReach = [this](EEquippableSlot Slot)
+				{
+					auto* Item = PlayerCharacter->GetEquippedItems().Find(Slot);
+					return Item && *Item ? (*Item)->DamageStats.WeaponLength : 0.f;
+				};
+			if (Hit.Type == ECombatHitType::Tool) Reach = GetSlotReach(EEquippableSlot::EIS_Tool);
+			else Reach = FMath::Max(GetSlotReach(EEquippableSlot::EIS_Weapon), GetSlotReach(EEquippableSlot::EIS_Shield));
+		}
+		if (!DamageTrace::IsClaimedHitValid(PlayerCharacter, Hit, Reach)) return;
+		const float TotalDamage = Hit.Damage;
 		// check opposite "team"
-		if (auto ActorTeamID = Cast<IGenericTeamAgentInterface>(IN_HitResult.GetActor()))
+		if (auto ActorTeamID = Cast<IGenericTeamAgentInterface>(HitActor))
 		{
 			if (ActorTeamID->GetGenericTeamId() != PlayerCharacter->GetGenericTeamId())
 			{
-				float DamageDealth = UGameplayStatics::ApplyDamage(IN_HitResult.GetActor(), TotalDamage, PlayerCharacter->GetInstigatorController(), PlayerCharacter, UEalondDamageType::StaticClass());
-				float XPToAward = FMath::DivideAndRoundDown(int32(DamageDealth), 10);
-				// increase depending on weapon
-				if (ProgComp) ProgComp->IncreaseXP(PlayerCharacter, EXPType::EXP_Combat, XPToAward, false);
+				// XP is a tenth of the damage dealt, awarded when the queue applies it
+				UDamageQueueSubsystem::ApplyDamage(GetWorld(), HitActor, TotalDamage, PlayerCharacter->GetInstigatorController(), PlayerCharacter, UEalondDamageType::StaticClass(), ProgComp);
 			}
 			else
 			{
-				UGameplayStatics::ApplyDamage(IN_HitResult.GetActor(), TotalDamage, PlayerCharacter->GetInstigatorController(), PlayerCharacter, UEalondDamageType::StaticClass());
+				UDamageQueueSubsystem::ApplyDamage(GetWorld(), HitActor, TotalDamage, PlayerCharacter->GetInstigatorController(), PlayerCharacter, UEalondDamageType::StaticClass());
 			}
 		}
-		else if (IN_HitResult.GetActor()->IsA(ABuilding::StaticClass()) || IN_HitResult.GetActor()->IsA(AResourceActor::StaticClass()))
+		else if (HitActor->IsA(ABuilding::StaticClass()) || HitActor->IsA(AResourceActor::StaticClass()))
 		{
-				UGameplayStatics::ApplyDamage(IN_HitResult.GetActor(), TotalDamage, PlayerCharacter->GetController(), PlayerCharacter, UEalondDamageType::StaticClass());
+				UDamageQueueSubsystem::ApplyDamage(GetWorld(), HitActor, TotalDamage, PlayerCharacter->GetController(), PlayerCharacter, UEalondDamageType::StaticClass());
 		}
 	}
 }
@@ -277,7 +562,7 @@ void UPlayerDamageComponent::RangedTrace(AProjectileBase* ProjectileObject, FVec
 			FHitResult HitResult;
 			FRotator ArrowRotation = ProjectileObject->GetActorRotation();
 			FVector TraceEnd = ArrowRotation.Vector() * EquippedArrow->DamageStats.WeaponLength + SweepHitLocation;
-			bool HitSuccess = UKismetSystemLibrary::SphereTraceSingle(GetWorld(), SweepHitLocation, TraceEnd, EquippedArrow->DamageStats.WeaponWidth, UEngineTypes::ConvertToTraceType(ECollisionChannel::ECC_GameTraceChannel4), false, IgnoredActors, EDrawDebugTrace::None, HitResult, true);
+			bool HitSuccess = CombatSweepSingle(SweepHitLocation, TraceEnd, EquippedArrow->DamageStats.WeaponWidth, ECollisionChannel::ECC_GameTraceChannel4, HitResult);
 			if (HitSuccess && HitResult.GetActor())
 			{
 				if (HitResult.GetActor()->IsA(ACharacter::StaticClass()))
@@ -288,11 +573,11 @@ void UPlayerDamageComponent::RangedTrace(AProjectileBase* ProjectileObject, FVec
 					{
 						if (HitResult.BoneName == FName("head"))
 						{
-							ApplyDamage(HitResult, ArrowRotation.Vector(), ArrowDamage);
+							ApplyDamage(FCombatHitDescriptor::Make(HitResult, ArrowDamage, ECombatHitType::Ranged, GetWorld()));
 						}
 						else
 						{
-							ApplyDamage(HitResult, ArrowRotation.Vector(), ArrowDamage);						}
+							ApplyDamage(FCombatHitDescriptor::Make(HitResult, ArrowDamage, ECombatHitType::Ranged, GetWorld()));						}
 						}
 					FAttachmentTransformRules AttachRules = FAttachmentTransformRules(EAttachmentRule::KeepWorld, EAttachmentRule::KeepWorld, EAttachmentRule::KeepWorld, true);
 					FVector StickLoc = ProjectileObject->GetActorForwardVector() * -5.f + HitResult.Location;
@@ -304,7 +589,7 @@ void UPlayerDamageComponent::RangedTrace(AProjectileBase* ProjectileObject, FVec
 						FXData.ImpactMaterial = EIM_WoodProjectile;
 						FXData.HitLocation = HitResult.Location;
 						FXData.HitNormal = HitResult.Normal;
-						Int_HitActor->Execute_PlayFXOnHit(Cast<UObject>(Int_HitActor), FXData, PlayerCharacter);
+						DamageTrace::PlayHitFX(HitResult.GetActor(), FXData, PlayerCharacter);
 					}
 				}
 				// check for penetrable building material
@@ -316,7 +601,7 @@ void UPlayerDamageComponent::RangedTrace(AProjectileBase* ProjectileObject, FVec
 						FXData.HitLocation = HitResult.Location;
 						FXData.HitNormal = HitResult.Normal;
 						FXData.ImpactMaterial = EIM_WoodProjectile;
-						Int_HitBuilding->Execute_PlayFXOnHit(Cast<UObject>(Int_HitBuilding), FXData, PlayerCharacter);
+						DamageTrace::PlayHitFX(HitResult.GetActor(), FXData, PlayerCharacter);
 					}
 					if (HitBuilding->BuildingType == EBuildingType::BT_Wood)
 					{
@@ -357,7 +642,7 @@ void UPlayerDamageComponent::RangedTrace(AProjectileBase* ProjectileObject, FVec
 						FXData.HitLocation = HitResult.Location;
 						FXData.HitNormal = HitResult.Normal;
 						FXData.ImpactMaterial = EIM_WoodProjectile;
-						Int_HitResource->Execute_PlayFXOnHit(Cast<UObject>(Int_HitResource), FXData, PlayerCharacter);
+						DamageTrace::PlayHitFX(HitResult.GetActor(), FXData, PlayerCharacter);
 					}
 					if (HitResource->ResourceMaterial == EResourceMaterial::RM_Wood)
 					{
@@ -404,7 +689,7 @@ void UPlayerDamageComponent::ResourceTrace_Implementation()
 		FVector SweepTraceStart = Offset1 + PlayerCharacter->GetActorRotation().Vector() * 150.f;
 		FVector Offset2 = FVector(PlayerCharacter->GetActorLocation().X, PlayerCharacter->GetActorLocation().Y, PlayerCharacter->GetActorLocation().Z - 50.f);
 		FVector SweepTraceEnd = Offset2 + PlayerCharacter->GetActorRotation().Vector() * 150.f;
-		bool HitSuccess = UKismetSystemLibrary::SphereTraceMulti(GetWorld(), SweepTraceStart, SweepTraceEnd, 50.f, UEngineTypes::ConvertToTraceType(ECC_GameTraceChannel6), false, IgnoredActors, EDrawDebugTrace::None, HitResults, true);
+		bool HitSuccess = CombatSweepMulti(SweepTraceStart, SweepTraceEnd, 50.f, ECC_GameTraceChannel6, HitResults);
 		if (HitSuccess && HitResults.Num())
 		{
 			// add impulse?
@@ -413,7 +698,7 @@ void UPlayerDamageComponent::ResourceTrace_Implementation()
 			{
 				if (Result.GetActor() && Result.GetActor()->IsA(AResourceActor::StaticClass()))
 				{
-					UGameplayStatics::ApplyDamage(Result.GetActor(), 10.f, PlayerCharacter->GetController(), PlayerCharacter, UEalondDamageType::StaticClass());
+					UDamageQueueSubsystem::ApplyDamage(GetWorld(), Result.GetActor(), 10.f, PlayerCharacter->GetController(), PlayerCharacter, UEalondDamageType::StaticClass());
 					return;
 				}
 			}
@@ -421,93 +706,79 @@ void UPlayerDamageComponent::ResourceTrace_Implementation()
 	}
 }
 
-float UPlayerDamageComponent::CalculateIncomingDamage(float BaseDamage, FDamageInfo DamageInfo, UGearItem* ArmorHit)
+float UPlayerDamageComponent::CalculateIncomingDamage(float BaseDamage, FDamageInfo DamageInfo, UGearItem* ArmorHit, AController* DamageInstigator, AActor* DamageCauser)
 {
-	float TotalDamage = BaseDamage;
-	if (!ArmorHit) {return TotalDamage;}
-	bool bIsShoulder = ArmorHit->Slot == EEquippableSlot::EIS_Shoulders;
-	float TotalResistance;
-	float EffectChance = FMath::RandRange(0.f, 1.f);
-	
+	const int32 Cell = ResistanceTable.GetCell(GetResistanceRow(ArmorHit), DamageInfo.DamageType);
+	float TotalDamage = ResistanceTable.CalculateIncomingDamage(BaseDamage, DamageInfo.DamageTypeDamage, Cell);
+	if (!ArmorHit || DamageInfo.DamageEffect == EDamageEffect::EDE_NULL) return TotalDamage;
+
+	// only hits that can cause an effect roll for one
+	const float Probability = DamageInfo.EffectProbability * ResistanceTable.GetResistance(Cell);
+	if (Probability <= FMath::RandRange(0.f, 1.f)) return TotalDamage;
 	switch (DamageInfo.DamageType)
 	{
 	case EDT_FireDamage:
-		if (bIsShoulder) {TotalResistance = CalculateAdditiveResistance(ArmorHit, EDT_FireDamage);}
-		else {TotalResistance = ArmorHit->ArmorResistanceStats.FireResistance;}
-		TotalDamage += DamageInfo.DamageTypeDamage - (DamageInfo.DamageTypeDamage * TotalResistance);
-		if (DamageInfo.DamageEffect != EDamageEffect::EDE_NULL)
-		{
-			float Probability = DamageInfo.EffectProbability * TotalResistance;
-			if (Probability > EffectChance)
-			{
-				Server_SetOnFire(PlayerCharacter, DamageInfo.EffectDuration, DamageInfo.DamagePerSecond);
-			}
-		}
+		ApplyStatusEffect(EStatusEffect::Burn, DamageInfo, DamageInstigator, DamageCauser);
 		break;
 	case EDT_BluntDamage:
-		if (bIsShoulder) {TotalResistance = CalculateAdditiveResistance(ArmorHit, EDT_BluntDamage);}
-		else {TotalResistance = ArmorHit->ArmorResistanceStats.BluntResistance;}
-		TotalDamage += DamageInfo.DamageTypeDamage - (DamageInfo.DamageTypeDamage * TotalResistance);
-		if (DamageInfo.DamageEffect != EDamageEffect::EDE_NULL)
-		{
-			float Probability = DamageInfo.EffectProbability * TotalResistance;
-			if (Probability > EffectChance)
-			{
-				Server_BreakBone(PlayerCharacter, DamageInfo.BoneHit);
-			}
-		}
+		Server_BreakBone(PlayerCharacter, DamageInfo.BoneHit);
 		break;
 	case EDT_PiercingDamage:
-		if (bIsShoulder) {TotalResistance = CalculateAdditiveResistance(ArmorHit, EDT_PiercingDamage);}
-		else {TotalResistance = ArmorHit->ArmorResistanceStats.PierceResistance;}
-		TotalDamage += DamageInfo.DamageTypeDamage - (DamageInfo.DamageTypeDamage * TotalResistance);
-		if (DamageInfo.DamageEffect != EDamageEffect::EDE_NULL)
-		{
-			float Probability = DamageInfo.EffectProbability * TotalResistance;
-			if (Probability > EffectChance)
-			{
-				TotalDamage += DamageInfo.DamageTypeDamage;
-			}
-		}
+		TotalDamage += DamageInfo.DamageTypeDamage;
 		break;
 	case EDT_SlashDamage:
-		if (bIsShoulder) {TotalResistance = CalculateAdditiveResistance(ArmorHit, EDT_SlashDamage);}
-		else {TotalResistance = ArmorHit->ArmorResistanceStats.SlashResistance;}
-		TotalDamage += DamageInfo.DamageTypeDamage - (DamageInfo.DamageTypeDamage * TotalResistance);
-		if (DamageInfo.DamageEffect != EDamageEffect::EDE_NULL)
-		{
-			float Probability = DamageInfo.EffectProbability * TotalResistance;
-			if (Probability > EffectChance)
-			{
-				Server_Bleed(PlayerCharacter, DamageInfo.EffectDuration, DamageInfo.DamagePerSecond);
-			}
-		}
+		ApplyStatusEffect(EStatusEffect::Bleed, DamageInfo, DamageInstigator, DamageCauser);
 		break;
 	case EDT_PoisonDamage:
-		if (bIsShoulder) {TotalResistance = CalculateAdditiveResistance(ArmorHit, EDT_PoisonDamage);}
-		else {TotalResistance = ArmorHit->ArmorResistanceStats.PoisonResistance;}
-		TotalDamage += DamageInfo.DamageTypeDamage - (DamageInfo.DamageTypeDamage * TotalResistance);
-		if (DamageInfo.DamageEffect != EDamageEffect::EDE_NULL)
-		{
-			float Probability = DamageInfo.EffectProbability * TotalResistance;
-			if (Probability > EffectChance)
-			{
-				Server_Poison(PlayerCharacter, DamageInfo.EffectDuration, DamageInfo.DamagePerSecond);
-			}
-		}
+		ApplyStatusEffect(EStatusEffect::Poison, DamageInfo, DamageInstigator, DamageCauser);
 		break;
-	case EDT_ChoppingDamage:
-		if (bIsShoulder) {TotalResistance = CalculateAdditiveResistance(ArmorHit, EDT_ChoppingDamage);}
-		else {TotalResistance = ArmorHit->ArmorResistanceStats.ChoppingResistance;}
-		TotalDamage += DamageInfo.DamageTypeDamage - (DamageInfo.DamageTypeDamage * TotalResistance);
-		break;
-	case EDT_NULL:
-		TotalDamage += DamageInfo.DamageTypeDamage;
+	default:
 		break;
 	}
+	return TotalDamage;
+}
 
+void UPlayerDamageComponent::ApplyStatusEffect(EStatusEffect Effect, const FDamageInfo& DamageInfo, AController* DamageInstigator, AActor* DamageCauser)
+{
+	// incoming damage is worked out where it is taken, on the server. The effect is credited to whoever dealt the hit,
+	// so kills over time count for their XP and aggro; null when the hit came from nobody
+	UStatusEffectSubsystem* StatusEffects = GetWorld()->GetSubsystem<UStatusEffectSubsystem>();
+	if (!StatusEffects) return;
+	// only player characters earn XP, as in BeginPlay
+	AEalondCharacterBase* Attacker = Cast<AEalondCharacterBase>(DamageCauser);
+	UCharacterProgressComponent* XPRecipient = Attacker && !Attacker->IsA(AAIBaseCharacter::StaticClass()) ? Attacker->ProgressComponent : nullptr;
+	StatusEffects->ApplyEffect(PlayerCharacter, Effect, GetWorld()->GetTimeSeconds() + DamageInfo.EffectDuration, DamageInfo.DamagePerSecond,
+		DamageInstigator, DamageCauser, UEalondDamageType::StaticClass(), nullptr, XPRecipient);
+}
 
-	return TotalDamage;
+int32 UPlayerDamageComponent::GetResistanceRow(UGearItem* ArmorHit)
+{
+	if (!PlayerCharacter) return 0;
+	// rebuilt when the equipped gear changes, or for a piece hit that isn't equipped
+	TArray<const UGearItem*, TInlineAllocator<FArmorResistanceTable::MaxRows>> Gear;
+	uint32 Signature = 0;
+	for (const auto& Pair : PlayerCharacter->GetEquippedItems())
+	{
+		if (const UGearItem* Piece = Cast<UGearItem>(Pair.Value))
+		{
+			Gear.Add(Piece);
+			Signature = HashCombineFast(Signature, GetTypeHash(Piece));
+		}
+	}
+	int32 Row = Signature == ResistanceTableSignature ? ResistanceTable.FindRow(ArmorHit) : INDEX_NONE;
+	if (Row == INDEX_NONE)
+	{
+		UGearItem* ChestPiece = nullptr;
+		if (IPlayerAIInteractionInterface* IntCharacter = Cast<IPlayerAIInteractionInterface>(PlayerCharacter))
+		{
+			ChestPiece = IntCharacter->Execute_GetChestPiece(Cast<UObject>(IntCharacter));
+		}
+		if (ArmorHit) Gear.AddUnique(ArmorHit);
+		ResistanceTable.Build(Gear, ChestPiece);
+		ResistanceTableSignature = Signature;
+		Row = FMath::Max(ResistanceTable.FindRow(ArmorHit), 0);
+	}
+	return Row;
 }
 
 void UPlayerDamageComponent::GetTraceMidpoints(const FVector LastStartPoint, const FVector NewestStartPoint, const FVector LastEndPoint, const FVector NewestEndPoint, int32 numit, int32 it, FVector& OUT_Start, FVector& OUT_End)
@@ -570,24 +841,15 @@ UEquippableItem* UPlayerDamageComponent::GetEquippedArrow() const
 
 void UPlayerDamageComponent::ApplyTimedDamage_Implementation(AActor* Enemy, float DamagePerSec, float StartTime, float Duration, FTimerHandle INTimer, UNiagaraSystem* Particle, UNiagaraComponent* EffectsComp)
 {
-	float Timer = GetWorld()->DeltaTimeSeconds;
-	if (Timer - StartTime < Duration)
-	{
-		if (Particle)
-		{
-			EffectsComp = UNiagaraFunctionLibrary::SpawnSystemAtLocation(GetWorld(), Particle, Enemy->GetActorLocation(), FRotator(0, 0, 0), FVector(0, 0, 0));
-			EffectsComp->Activate();
-		}
-		UGameplayStatics::ApplyDamage(Enemy, DamagePerSec, PlayerCharacter->GetInstigatorController(), PlayerCharacter, UEalondDamageType::StaticClass());
-	}
-	else
-	{
-		if (Particle)
-		{
-			EffectsComp->Deactivate();
-		}
-		GetWorld()->GetTimerManager().ClearTimer(INTimer);
-	}
+	// the status effect subsystem ticks the damage and owns the FX from here; the caller's timer isn't needed
+	GetWorld()->GetTimerManager().ClearTimer(INTimer);
+	UStatusEffectSubsystem* StatusEffects = GetWorld()->GetSubsystem<UStatusEffectSubsystem>();
+	if (!StatusEffects || !Enemy) return;
+	// StartTime is when the effect began, so repeat calls for the same effect don't push its end back
+	const double Now = GetWorld()->GetTimeSeconds();
+	const double EffectStart = StartTime > 0 && StartTime <= Now ? StartTime : Now;
+	StatusEffects->ApplyEffect(Enemy, EStatusEffect::Timed, EffectStart + Duration, DamagePerSec, PlayerCharacter->GetInstigatorController(), PlayerCharacter,
+		UEalondDamageType::StaticClass(), Particle, ProgComp);
 }
 
 float UPlayerDamageComponent::CalculateAdditiveResistance(UGearItem* ShoulderPiece, EDamageType DamageType)
@@ -0,0 +1,101 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "DamageQueueSubsystem.h"
+#include "AITraceSubsystem.h"
+#include "GameFramework/Controller.h"
+#include "GameFramework/DamageType.h"
+#include "Kismet/GameplayStatics.h"
+#include "../Progress/CharacterProgressComponent.h"
+#include "../World/EalondCharacterBase.h"
+
+DECLARE_CYCLE_STAT(TEXT("Damage queue flush"), STAT_DamageQueueFlush, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Damage events queued"), STAT_DamageQueueEvents, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Damage resolutions"), STAT_DamageQueueResolutions, STATGROUP_EalondAI);
+
+static TAutoConsoleVariable<bool> CVarDamageQueueEnable(
+	TEXT("combat.DamageQueue.Enable"),
+	true,
+	TEXT("Collect each frame's damage and apply it once per target and instigator at the end of the frame, instead of per hit."));
+
+void UDamageQueueSubsystem::Deinitialize()
+{
+	Queue.Empty();
+	Resolving.Empty();
+
+	Super::Deinitialize();
+}
+
+TStatId UDamageQueueSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UDamageQueueSubsystem, STATGROUP_Tickables);
+}
+
+void UDamageQueueSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	Flush();
+}
+
+void UDamageQueueSubsystem::ApplyDamage(UWorld* World, AActor* Target, float Damage, AController* Instigator, AActor* Causer,
+	TSubclassOf<UDamageType> DamageTypeClass, UCharacterProgressComponent* XPRecipient)
+{
+	if (!Target) return;
+	FQueuedDamage Queued;
+	Queued.Target = Target;
+	Queued.Instigator = Instigator;
+	Queued.Causer = Causer;
+	Queued.XPRecipient = XPRecipient;
+	Queued.DamageTypeClass = DamageTypeClass;
+	Queued.Damage = Damage;
+
+	UDamageQueueSubsystem* DamageQueue = World ? World->GetSubsystem<UDamageQueueSubsystem>() : nullptr;
+	if (!DamageQueue || !CVarDamageQueueEnable.GetValueOnGameThread())
+	{
+		Resolve(Queued);
+		return;
+	}
+	DamageQueue->Queue.Add(Queued);
+	INC_DWORD_STAT(STAT_DamageQueueEvents);
+}
+
+void UDamageQueueSubsystem::Flush()
+{
+	if (Queue.IsEmpty()) return;
+	SCOPE_CYCLE_COUNTER(STAT_DamageQueueFlush);
+	// anything TakeDamage queues in turn (thorns, chain hits) waits for the next frame
+	Swap(Queue, Resolving);
+
+	auto Key = [](const FQueuedDamage& Damage)
+	{
+		return MakeTuple(UPTRINT(Damage.Target.Get()), UPTRINT(Damage.Instigator.Get()), UPTRINT(Damage.Causer.Get()),
+			UPTRINT(Damage.DamageTypeClass.Get()), UPTRINT(Damage.XPRecipient.Get()));
+	};
+	Resolving.Sort([&Key](const FQueuedDamage& Left, const FQueuedDamage& Right) {return Key(Left) < Key(Right);});
+
+	for (int32 Begin = 0; Begin < Resolving.Num();)
+	{
+		FQueuedDamage Total = Resolving[Begin];
+		int32 End = Begin + 1;
+		for (; End < Resolving.Num() && Key(Resolving[End]) == Key(Total); End++)
+		{
+			Total.Damage += Resolving[End].Damage;
+		}
+		Resolve(Total);
+		Begin = End;
+	}
+	Resolving.Reset();
+}
+
+void UDamageQueueSubsystem::Resolve(const FQueuedDamage& Damage)
+{
+	AActor* Target = Damage.Target.Get();
+	if (!Target) return;
+	INC_DWORD_STAT(STAT_DamageQueueResolutions);
+	const float DamageDealt = UGameplayStatics::ApplyDamage(Target, Damage.Damage, Damage.Instigator.Get(), Damage.Causer.Get(), Damage.DamageTypeClass);
+	if (UCharacterProgressComponent* Progress = Damage.XPRecipient.Get())
+	{
+		Progress->IncreaseXP(Cast<AEalondCharacterBase>(Damage.Causer.Get()), EXPType::EXP_Combat, FMath::DivideAndRoundDown(int32(DamageDealt), 10), false);
+	}
+}
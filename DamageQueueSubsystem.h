@@ -0,0 +1,56 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "DamageQueueSubsystem.generated.h"
+
+class AController;
+class UCharacterProgressComponent;
+class UDamageType;
+
+/**
+ * Collects the frame's damage instead of applying each hit as it is traced. After every actor, timer and
+ * anim notify has run, queued damage is sorted by target and each target takes one ApplyDamage per
+ * instigator with the summed amount. TakeDamage, armor, resistances and aggro are then resolved once per
+ * pair, however many blade sub-steps, multi-hits or arrows landed. Combat XP goes out in the same pass,
+ * from the damage actually dealt.
+ */
+UCLASS()
+class EALOND_API UDamageQueueSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/**
+	 * Queues the damage, or applies it now with combat.DamageQueue.Enable off. XPRecipient, if given, is
+	 * awarded combat XP for a tenth of the damage the target ends up taking.
+	 */
+	static void ApplyDamage(UWorld* World, AActor* Target, float Damage, AController* Instigator, AActor* Causer,
+		TSubclassOf<UDamageType> DamageTypeClass, UCharacterProgressComponent* XPRecipient = nullptr);
+
+	/** Applies everything queued so far. */
+	void Flush();
+
+private:
+	struct FQueuedDamage
+	{
+		TWeakObjectPtr<AActor> Target;
+		TWeakObjectPtr<AController> Instigator;
+		TWeakObjectPtr<AActor> Causer;
+		TWeakObjectPtr<UCharacterProgressComponent> XPRecipient;
+		TSubclassOf<UDamageType> DamageTypeClass;
+		float Damage = 0;
+	};
+
+	static void Resolve(const FQueuedDamage& Damage);
+
+	// kept between frames so queuing never allocates once the busiest frame has been seen
+	TArray<FQueuedDamage> Queue;
+	TArray<FQueuedDamage> Resolving;
+};
@@ -3,6 +3,16 @@
 
 #include "EnemyAIController.h"
 #include "AIBaseCharacter.h"
+#include "AIPoolSubsystem.h"
+#include "AICombatTask.h"
+#include "AISchedulerSubsystem.h"
+#include "AITraceSubsystem.h"
+#include "EnemyBrainComponents.h"
+#include "EvadeFeasibilitySubsystem.h"
+#include "HordeSimulationSubsystem.h"
+#include "SiegeFlowFieldSubsystem.h"
+#include "SiegeOccupancySubsystem.h"
+#include "TacticalPositionSubsystem.h"
 #include "Goblin.h"
 #include "Components/CapsuleComponent.h"
 #include "GameFramework/CharacterMovementComponent.h"
@@ -20,18 +30,43 @@
 #include "Perception/AISenseConfig_Sight.h"
 #include "Perception/AISenseConfig_Hearing.h"
 #include "Perception/AIPerceptionComponent.h"
+#include "Perception/AIPerceptionSystem.h"
 #include "PhysicsEngine/PhysicsSettings.h"
 #include "Navigation/PathFollowingComponent.h"
+#include "NavigationSystem.h"
 #include "BrainComponent.h"
+#include "BehaviorTree/BlackboardComponent.h"
 
 #define OUT
 
+static TAutoConsoleVariable<bool> CVarUseStateTreeBrain(
+    TEXT("ai.Brain.UseStateTree"),
+    false,
+    TEXT("Start enemy AI on the state tree combat brain instead of the behaviour tree. Read when each AI's brain starts."));
+
+int32 AEnemyAIController::GetPathRequestsPerSecond() const
+{
+    const UAISchedulerSubsystem* Scheduler = GetWorld()->GetSubsystem<UAISchedulerSubsystem>();
+    return Scheduler ? Scheduler->GetPathRequestsPerSecond() : 0;
+}
+
+int32 AEnemyAIController::GetSquadFollowsPerSecond() const
+{
+    const UAISchedulerSubsystem* Scheduler = GetWorld()->GetSubsystem<UAISchedulerSubsystem>();
+    return Scheduler ? Scheduler->GetSquadFollowsPerSecond() : 0;
+}
+
 AEnemyAIController::AEnemyAIController() 
 {
     PrimaryActorTick.bCanEverTick = true;
 
     InitPerception();
 
+    // both brains exist on every controller; StartBrain picks which one runs
+    BehaviorTreeBrain = CreateDefaultSubobject<UEnemyBehaviorTreeComponent>(TEXT("Behavior Tree Brain"));
+    StateTreeBrain = CreateDefaultSubobject<UEnemyStateTreeComponent>(TEXT("State Tree Brain"));
+    StateTreeBrain->SetStartLogicAutomatically(false);
+
     SetGenericTeamId(FGenericTeamId(1));
     TeamId = FGenericTeamId(1);
 }
@@ -50,6 +85,8 @@ void AEnemyAIController::OnPossess(APawn* InPawn)
     PerceptionComp->Activate();
     ControlledCharacter = Cast<AAIBaseCharacter>(InPawn);
     ControlledCharacter->AIController = this;
+    // pooled pawns were spawned unpossessed, so their memory component never picked up its controller
+    ControlledCharacter->MemoryComp->OwningEnemyController = this;
     ControlledCharacter->GetMesh()->SetVisibility(false);
     AEalondGameMode* GameMode = Cast<AEalondGameMode>(GetWorld()->GetAuthGameMode());
     if (ControlledCharacter && GameMode)
@@ -63,6 +100,8 @@ void AEnemyAIController::OnPossess(APawn* InPawn)
 
     // check components set up correctly
     PathComp = GetPathFollowingComponent();
+    // deactivated when the last pawn left play, for pooled controllers
+    PathComp->Activate();
     PathComp->SetBlockDetectionState(true);
     PathComp->SetStopMovementOnFinish(false);
     
@@ -70,28 +109,137 @@ void AEnemyAIController::OnPossess(APawn* InPawn)
 
     if (!PerceptionComp) {UE_LOG(LogTemp, Warning, TEXT("Couldn't find perception component for controller %s"), *this->GetName());}
 
+    if (UAISchedulerSubsystem* Scheduler = GetWorld()->GetSubsystem<UAISchedulerSubsystem>())
+    {
+        Scheduler->RegisterController(this);
+    }
+    if (UHordeSimulationSubsystem* Horde = GetWorld()->GetSubsystem<UHordeSimulationSubsystem>())
+    {
+        Horde->RegisterFullAI(this);
+    }
+    // pooled and promoted pawns were taken off the sight sense when they last left play
+    UAIPerceptionSystem::RegisterPerceptionStimuliSource(this, UAISense_Sight::StaticClass(), InPawn);
+
     if (SpawnAnimation)
     {
-        FTimerHandle AnimTimer;
-        FTimerDelegate AnimDelegate;
-        AnimDelegate.BindLambda([this]()
-            {
-                if (AIBehaviorTree) {RunBehaviorTree(AIBehaviorTree);}
-                else {UE_LOG(LogTemp, Warning, TEXT("Couldn't find BT for controller %s"), *this->GetName());}
-            });
-        FTimerHandle VisTimer;
-        FTimerDelegate VisDelegate;
-        VisDelegate.BindLambda([this]()
-            {
-                ControlledCharacter->GetMesh()->SetVisibility(true);
-            });
         float PlayRate = FMath::RandRange(0.9, 1.1);
-        GetWorld()->GetTimerManager().SetTimer(VisTimer, VisDelegate, .75f, false);
-        GetWorld()->GetTimerManager().SetTimer(AnimTimer, AnimDelegate,SpawnAnimation->GetPlayLength() * PlayRate, false);
+        ScheduleAction(EAIScheduledAction::RevealMesh, .75f);
+        ScheduleAction(EAIScheduledAction::StartBehaviorTree, SpawnAnimation->GetPlayLength() * PlayRate);
         ControlledCharacter->Server_PlayAnim(SpawnAnimation, PlayRate);
     }
 }
 
+void AEnemyAIController::OnUnPossess()
+{
+    ClearScheduledActions();
+
+    Super::OnUnPossess();
+}
+
+bool AEnemyAIController::ScheduleAction(EAIScheduledAction Type, float Delay, AActor* Target, const FVector& Payload)
+{
+    if (!ActionQueue.Reschedule(Type, GetWorld()->GetTimeSeconds() + Delay, Target, Payload))
+    {
+        UE_LOG(LogTemp, Warning, TEXT("AI Controller %s: action queue full, dropped action %d"), *this->GetName(), int32(Type));
+        return false;
+    }
+    return true;
+}
+
+bool AEnemyAIController::PostponeAction(EAIScheduledAction Type, float ExtraDelay)
+{
+    return ExtraDelay > 0 && ActionQueue.Postpone(Type, ExtraDelay);
+}
+
+void AEnemyAIController::DelayBrainStart(float Delay)
+{
+    if (Delay <= 0) {return;}
+    // with a spawn animation the start is still queued behind it
+    if (PostponeAction(EAIScheduledAction::StartBehaviorTree, Delay)) {return;}
+    // without one the blueprint started the brain on possession; stop it and start it again once the delay is up
+    UBrainComponent* Brain = GetBrainComponent();
+    if (!Brain || !Brain->IsRunning()) {return;}
+    Brain->StopLogic(TEXT("Delayed brain start"));
+    ScheduleAction(EAIScheduledAction::StartBehaviorTree, Delay);
+}
+
+void AEnemyAIController::ClearScheduledActions()
+{
+    ActionQueue.Reset();
+    CombatTasks.CancelAll();
+    if (UTacticalPositionSubsystem* TacticalPositions = GetWorld()->GetSubsystem<UTacticalPositionSubsystem>())
+    {
+        TacticalPositions->ReleaseClaims(this);
+    }
+    if (UAISchedulerSubsystem* Scheduler = GetWorld()->GetSubsystem<UAISchedulerSubsystem>())
+    {
+        Scheduler->UnregisterController(this);
+    }
+    if (UHordeSimulationSubsystem* Horde = GetWorld()->GetSubsystem<UHordeSimulationSubsystem>())
+    {
+        Horde->UnregisterFullAI(this);
+    }
+}
+
+int32 AEnemyAIController::TickScheduledActions(float Now)
+{
+    FAIActionQueue::FActionArray DueActions;
+    ActionQueue.PopDue(Now, DueActions);
+    for (const FAIScheduledAction& Action : DueActions)
+    {
+        // an earlier action this tick may have killed or released the pawn
+        if (!ControlledCharacter || GetPawn() != ControlledCharacter) {break;}
+        ExecuteScheduledAction(Action);
+    }
+    int32 NumResumed = 0;
+    if (ControlledCharacter && GetPawn() == ControlledCharacter) {NumResumed = CombatTasks.Tick(Now);}
+    return DueActions.Num() + NumResumed;
+}
+
+void AEnemyAIController::StartCombatTask(EAICombatTaskSlot Slot, FAICombatTask&& Task)
+{
+    CombatTasks.Start(Slot, MoveTemp(Task), GetWorld()->GetTimeSeconds());
+}
+
+void AEnemyAIController::ExecuteScheduledAction(const FAIScheduledAction& Action)
+{
+    switch (Action.Type)
+    {
+    case EAIScheduledAction::RevealMesh:
+        ControlledCharacter->GetMesh()->SetVisibility(true);
+        break;
+    case EAIScheduledAction::StartBehaviorTree:
+        StartBrain();
+        break;
+    case EAIScheduledAction::EndGazeOverride:
+        ControlledCharacter->bOverrideProceduralGaze = false;
+        break;
+    case EAIScheduledAction::EndTargetSelectionCooldown:
+        bCanReselectTarget = true;
+        break;
+    case EAIScheduledAction::ProcessPerception:
+        ProcessPerceptionBatch();
+        break;
+    default:
+        break;
+    }
+}
+
+void AEnemyAIController::StartBrain()
+{
+    if (CVarUseStateTreeBrain.GetValueOnGameThread() && StateTreeBrain)
+    {
+        BrainComponent = StateTreeBrain;
+        StateTreeBrain->StartLogic();
+        if (StateTreeBrain->IsRunning()) {return;}
+        UE_LOG(LogTemp, Warning, TEXT("Couldn't start state tree for controller %s, falling back to BT"), *this->GetName());
+    }
+    // RunBehaviorTree reuses the brain component if it is already a behaviour tree one
+    BrainComponent = BehaviorTreeBrain;
+    if (AIBehaviorTree) {RunBehaviorTree(AIBehaviorTree);}
+    else {UE_LOG(LogTemp, Warning, TEXT("Couldn't find BT for controller %s"), *this->GetName());}
+}
+
 void AEnemyAIController::Tick(float DeltaTime)
 {
     Super::Tick(DeltaTime);
@@ -121,21 +269,19 @@ void AEnemyAIController::Tick(float DeltaTime)
         }
         else if (bInDanger) bInDanger = false;
 
-        if (((EnemyTarget && EnemyTarget->IsValidLowLevelFast()) || (ActorToFocusOn && ActorToFocusOn->IsValidLowLevelFast())) && !GetFocusActor() && !ControlledCharacter->bOverrideProceduralGaze && !(ControlledCharacter->bIsHurt || ControlledCharacter->bIsDead))
+        // the anim instance works the gaze out on the animation thread; only publish what to look at
+        if (!ControlledCharacter->bOverrideProceduralGaze)
         {
-            FVector MeshForwardVector = ControlledCharacter->GetActorForwardVector();
-            AActor* GazeFocus;
-            EnemyTarget ? GazeFocus = EnemyTarget : GazeFocus = ActorToFocusOn;
-            FVector VectorBetweenUs = (GazeFocus->GetActorLocation() - GetPawn()->GetActorLocation()).GetSafeNormal();
-            bool bTargetInFront = VectorBetweenUs.Dot(MeshForwardVector) > .2;
-            if (bTargetInFront)
-            {
-                ControlledCharacter->GazeFocusLocation = UKismetMathLibrary::VInterpTo(ControlledCharacter->GazeFocusLocation, GazeFocus->GetActorLocation(), DeltaTime, 4.f);
-            }
-            else
+            AActor* GazeFocus = EnemyTarget ? EnemyTarget : ActorToFocusOn;
+            if (GetFocusActor() || (GazeFocus && !GazeFocus->IsValidLowLevelFast())) GazeFocus = nullptr;
+            if (ControlledCharacter->GazeFocusActor != GazeFocus) ControlledCharacter->GazeFocusActor = GazeFocus;
+        }
+        // keep the evade lookup warm for flankers in melee range so Dodge rarely finds it missing
+        if (EnemyTarget && DistanceFromEnemy < 300.f && IsFlankUnit())
+        {
+            if (UEvadeFeasibilitySubsystem* EvadeMap = GetWorld()->GetSubsystem<UEvadeFeasibilitySubsystem>())
             {
-                FVector LookAtLocation = ControlledCharacter->GetActorLocation() + MeshForwardVector * 100.f;
-                ControlledCharacter->GazeFocusLocation = LookAtLocation;
+                EvadeMap->Query(ControlledCharacter->GetActorLocation(), ControlledCharacter->GetActorRotation().Yaw);
             }
         }
         if (ControlledCharacter->bIsBlocking && EnemyTarget && EnemyTarget->IsValidLowLevelFast())
@@ -176,101 +322,114 @@ void AEnemyAIController::OnUpdateHearing(AActor* actor, FAIStimulus stimulus)
 {
 }
 
-void AEnemyAIController::UpdatePerceivedActors(const TArray<AActor*>& PerceivedActors) 
+void AEnemyAIController::UpdatePerceivedActors(const TArray<AActor*>& UpdatedActors) 
 {
-    if (ControlledCharacter && GetBrainComponent())
+    // perception can fire several times a frame; queue the touched actors and handle them all at once
+    PerceivedActors.AddPending(UpdatedActors);
+    if (PerceivedActors.HasPending() && !ActionQueue.IsScheduled(EAIScheduledAction::ProcessPerception))
     {
-        TArray<AActor*> HostilesInRange;
-        PerceptionComp->GetCurrentlyPerceivedActors(SightConfig->GetSenseImplementation(), HostilesInRange);
-        // start decaying any enemies that leave perception
-        ControlledCharacter->MemoryComp->CheckUnperceivedEnemies(HostilesInRange);
-        if (HostilesInRange.IsEmpty())
-        {
-            return;
-        }
-        bool bEnemyFound = false;
-        bool bBuildingFound = false;
+        ScheduleAction(EAIScheduledAction::ProcessPerception, 0.f);
+    }
+}
 
-        // get data
-        for (auto& HostileActor : HostilesInRange)
+void AEnemyAIController::ProcessPerceptionBatch()
+{
+    if (!ControlledCharacter || !GetBrainComponent()) {return;}
+    const FAISenseID SightID = SightConfig->GetSenseID();
+    TArray<AActor*> NewlySeen;
+    TArray<AActor*> NewlyLost;
+    PerceivedActors.Apply(
+        [this, SightID](AActor* Actor)
+        {
+            const FActorPerceptionInfo* Info = PerceptionComp->GetActorInfo(*Actor);
+            return Info && Info->IsSenseActive(SightID);
+        },
+        [this](AActor* Actor)
         {
-            if (!HostileActor->IsValidLowLevelFast()) continue;
-            if (auto EnemyActor = Cast<IGenericTeamAgentInterface>(HostileActor))
+            if (const IGenericTeamAgentInterface* TeamAgent = Cast<IGenericTeamAgentInterface>(Actor))
             {
-                if (EnemyActor && EnemyActor->GetGenericTeamId() != ControlledCharacter->GetGenericTeamId())
-                {
-                    bEnemyFound = true;
-                    // add any new enemies to memory
-                    if (auto IntHostileActor = Cast<IMemoryInterface>(HostileActor)) IntHostileActor->Execute_GetEnemyData(Cast<UObject>(EnemyActor), ControlledCharacter->MemoryComp);
-                    // share data with teammates who will switch to combat mode after delay (see ShareData definition)
-                    ControlledCharacter->MemoryComp->ShareData();
-                    // turn head to face new enemy if in front
-                    if (ControlledCharacter->GetActorForwardVector().Dot(HostileActor->GetActorLocation().GetSafeNormal()) > 0.2)
-                    {
-                        ControlledCharacter->bOverrideProceduralGaze = true;
-                        ControlledCharacter->GazeFocusLocation = HostileActor->GetActorLocation();
-                        FTimerHandle GazeTimer;
-                        FTimerDelegate GazeDelegate;
-                        GazeDelegate.BindLambda([this]()
-                            {
-                                if (ControlledCharacter) ControlledCharacter->bOverrideProceduralGaze = false;
-                            });
-                        GetWorld()->GetTimerManager().SetTimer(GazeTimer, GazeDelegate, .5, false);
-                    }
-                }
+                return TeamAgent->GetGenericTeamId() != ControlledCharacter->GetGenericTeamId() ? EAIPerceivedKind::Enemy : EAIPerceivedKind::Other;
             }
-            else if (auto EnemyBuilding = Cast<IBuildingInterface>(HostileActor))
+            return Cast<IBuildingInterface>(Actor) ? EAIPerceivedKind::Building : EAIPerceivedKind::Other;
+        },
+        NewlySeen, NewlyLost);
+
+    // start decaying enemies that left perception, stop decaying those that came back
+    ControlledCharacter->MemoryComp->UpdatePerceivedEnemies(NewlySeen, [this](const AActor* Actor) {return PerceivedActors.Contains(Actor);});
+    if (!PerceivedActors.Num()) {return;}
+
+    // get data
+    bool bNewEnemy = false;
+    bool bGazeSet = false;
+    for (AActor* HostileActor : NewlySeen)
+    {
+        const EAIPerceivedKind Kind = PerceivedActors.GetKind(HostileActor);
+        if (Kind == EAIPerceivedKind::Enemy)
+        {
+            bNewEnemy = true;
+            // add any new enemies to memory
+            if (auto IntHostileActor = Cast<IMemoryInterface>(HostileActor)) IntHostileActor->Execute_GetEnemyData(HostileActor, ControlledCharacter->MemoryComp);
+            // turn head to face the first new enemy in front
+            if (!bGazeSet && ControlledCharacter->GetActorForwardVector().Dot((HostileActor->GetActorLocation() - ControlledCharacter->GetActorLocation()).GetSafeNormal()) > 0.2)
             {
-                // return if direct path to monument found
-                bBuildingFound = true;
-                EnemyBuilding->Execute_GetBuildingData(Cast<UObject>(EnemyBuilding), ControlledCharacter->MemoryComp);
-                // TODO share data
+                bGazeSet = true;
+                ControlledCharacter->bOverrideProceduralGaze = true;
+                ControlledCharacter->GazeFocusActor = HostileActor;
+                ScheduleAction(EAIScheduledAction::EndGazeOverride, .5f);
             }
         }
-        // if enemy found, get into combat mode, else exit
-        if (bEnemyFound)
+        else if (Kind == EAIPerceivedKind::Building)
+        {
+            IBuildingInterface::Execute_GetBuildingData(HostileActor, ControlledCharacter->MemoryComp);
+            // TODO share data
+        }
+    }
+    // share data with teammates who will switch to combat mode after delay (see ShareData definition), once per batch
+    if (bNewEnemy) {ControlledCharacter->MemoryComp->ShareData();}
+
+    // if enemy in view, get into combat mode, else exit
+    if (PerceivedActors.Num(EAIPerceivedKind::Enemy))
+    {
+        // when entering combat mode state
+        if (!ControlledCharacter->bInCombatMode)
         {
-            // when entering combat mode state
-            if (!ControlledCharacter->bInCombatMode)
+            ActorToFocusOn = ControlledCharacter->MemoryComp->GetNearestEnemy();
+            ControlledCharacter->Server_SetInCombatMode(true);
+            if (!bInDanger) bInDanger = ControlledCharacter->MemoryComp->CheckInDanger();
+            // notify teammates of danger
+            if (bInDanger)
             {
-                ActorToFocusOn = ControlledCharacter->MemoryComp->GetNearestEnemy();
-                ControlledCharacter->Server_SetInCombatMode(true);
-                if (!bInDanger) bInDanger = ControlledCharacter->MemoryComp->CheckInDanger();
-                // notify teammates of danger
-                if (bInDanger)
+                if (ControlledCharacter->MemoryComp->TeamHasLeader()) ControlledCharacter->MemoryComp->GetLeader()->OwningEnemyController->TeamSelectTarget();
+                else Engage(ControlledCharacter->MemoryComp->SelectEnemyTarget());
+            }
+            else if (ControlledCharacter->MemoryComp->bIsLeader)
+            {
+                ControlledCharacter->bControllerOverrideMovement = true;
+                ControlledCharacter->SetWalkSpeed(0);
+                GetBrainComponent()->PauseLogic(TEXT("Play animation"));
+                if (EngageAnimation)
                 {
-                    if (ControlledCharacter->MemoryComp->TeamHasLeader()) ControlledCharacter->MemoryComp->GetLeader()->OwningEnemyController->TeamSelectTarget();
-                    else Engage(ControlledCharacter->MemoryComp->SelectEnemyTarget());
-                }
-                else if (ControlledCharacter->MemoryComp->bIsLeader)
-                {
-                    ControlledCharacter->bControllerOverrideMovement = true;
-                    ControlledCharacter->SetWalkSpeed(0);
-                    GetBrainComponent()->PauseLogic(TEXT("Play animation"));
-                    if (EngageAnimation)
-                    {
-                        ControlledCharacter->PlayAnimMontage(EngageAnimation, 1.f);
-                        FTimerHandle ReengageTimer;
-                        FTimerDelegate ReengageDelegate;
-                        ReengageDelegate.BindLambda([this]()
-                            {
-                                ControlledCharacter->bControllerOverrideMovement = false;
-                                GetBrainComponent()->ResumeLogic(TEXT("Animation finished"));
-                            });
-                        GetWorld()->GetTimerManager().SetTimer(ReengageTimer, ReengageDelegate, EngageAnimation->GetPlayLength(), false);
-                    }
+                    ControlledCharacter->PlayAnimMontage(EngageAnimation, 1.f);
+                    StartCombatTask(EAICombatTaskSlot::Engage, EngageAnimationRoutine());
                 }
             }
         }
-        else if (!EnemyTarget && !StaticTarget && bBuildingFound)
-        {
-            SetStaticTarget();
-        }
+    }
+    else if (!EnemyTarget && !StaticTarget && PerceivedActors.Num(EAIPerceivedKind::Building))
+    {
+        SetStaticTarget();
     }
 }
 
 float AEnemyAIController::GetPathToMonument() 
 {
+    // shared flow field answers for the whole wave; own path is only used until it's ready
+    if (USiegeFlowFieldSubsystem* FlowField = GetWorld()->GetSubsystem<USiegeFlowFieldSubsystem>())
+    {
+        FlowField->EnsureBuilt(ControlledCharacter->GetMonument());
+        float FlowPathLength = FlowField->GetPathLengthToMonument(ControlledCharacter->GetActorLocation());
+        if (FlowPathLength >= 0) {return FlowPathLength;}
+    }
     if (PathComp->HasValidPath() && ControlledCharacter->GetMonument())
     {
        return PathComp->GetPath()->GetLength();
@@ -278,16 +437,46 @@ float AEnemyAIController::GetPathToMonument()
     else return 0;
 }
 
+FPathFollowingRequestResult AEnemyAIController::MoveAlongMonumentFlow(float AcceptanceRadius)
+{
+    // the fallback below moves to the monument itself, which MoveTo would otherwise send straight back here
+    TGuardValue<bool> FlowGuard(bMovingAlongFlow, true);
+    USiegeFlowFieldSubsystem* FlowField = GetWorld()->GetSubsystem<USiegeFlowFieldSubsystem>();
+    if (!FlowField || !FlowField->IsReady())
+    {
+        // field still building; path there the usual way
+        FAIMoveRequest MoveRequest(ControlledCharacter->GetMonument());
+        MoveRequest.SetAcceptanceRadius(AcceptanceRadius);
+        return MoveWithSquad(MoveRequest);
+    }
+    // steer straight at a point a few cells down the field; no path query
+    FAIMoveRequest MoveRequest(FlowField->GetFlowGoal(ControlledCharacter->GetActorLocation(), 6));
+    MoveRequest.SetUsePathfinding(false);
+    MoveRequest.SetAcceptanceRadius(AcceptanceRadius);
+    return MoveWithSquad(MoveRequest);
+}
+
 AActor* AEnemyAIController::CheckBlocked()
 {
-    FHitResult HitResult;
-    FVector StartLocation = ControlledCharacter->GetActorLocation();
-    FVector EndLocation = ControlledCharacter->GetActorRotation().Vector() * 200.f + StartLocation;
-    FCollisionQueryParams Params;
-	Params.AddIgnoredActor(ControlledCharacter);
-    bool bHitSuccess = GetWorld()->LineTraceSingleByChannel(HitResult, StartLocation, EndLocation, ECollisionChannel::ECC_GameTraceChannel1, Params);
-    if (HitResult.GetActor()) {return HitResult.GetActor();}
-    else {return nullptr;}
+    // answer with the last resolved query and queue the next one; results arrive a frame later
+    UAITraceSubsystem* TraceSubsystem = GetWorld()->GetSubsystem<UAITraceSubsystem>();
+    if (TraceSubsystem && !TraceSubsystem->IsBatchPending(BlockedTraceBatch))
+    {
+        FVector StartLocation = ControlledCharacter->GetActorLocation();
+        FVector EndLocation = ControlledCharacter->GetActorRotation().Vector() * 200.f + StartLocation;
+        FCollisionQueryParams Params;
+        Params.AddIgnoredActor(ControlledCharacter);
+        BlockedTraceBatch = TraceSubsystem->RequestTraces({FAITraceRequest(StartLocation, EndLocation, ECollisionChannel::ECC_GameTraceChannel1)}, Params,
+            FOnAITraceBatchComplete::CreateUObject(this, &AEnemyAIController::OnBlockedTraceComplete));
+    }
+    if (GetWorld()->GetTimeSeconds() - BlockedTraceTime > .5f) {return nullptr;}
+    return BlockingActor.Get();
+}
+
+void AEnemyAIController::OnBlockedTraceComplete(const TArray<FHitResult>& Results)
+{
+    BlockingActor = Results[0].GetActor();
+    BlockedTraceTime = GetWorld()->GetTimeSeconds();
 }
 
 void AEnemyAIController::CheckStaticTargets(bool CheckBlocked, float CheckCone) 
@@ -303,63 +492,108 @@ void AEnemyAIController::CheckStaticTargets(bool CheckBlocked, float CheckCone)
             UE_LOG(LogTemp, Warning, TEXT("AI Controller error: Trace cone cannot be less than 10 or greater than 180 degrees."));
             return;
         }
-        FHitResult HitResult;
         FVector StartLocation = ControlledCharacter->GetActorLocation();
-        FVector EndLocation = ControlledCharacter->GetMonument()->GetActorLocation();
-        // get world rotation of AI relative to monument
-        FRotator OriginalRotation = UKismetMathLibrary::FindLookAtRotation(StartLocation, EndLocation);
-        float DistanceToMonument = FVector::Distance(StartLocation, EndLocation);
+        FVector MonumentLocation = ControlledCharacter->GetMonument()->GetActorLocation();
+        // walk the building raster when it's available; no physics queries needed
+        USiegeOccupancySubsystem* OccupancyMap = GetWorld()->GetSubsystem<USiegeOccupancySubsystem>();
+        if (OccupancyMap && OccupancyMap->EnsureBuilt(ControlledCharacter->GetMonument()))
+        {
+            TArray<AActor*> FirstHits;
+            // check if direct path to monument
+            if (!CheckBlocked)
+            {
+                FirstHits.Add(OccupancyMap->RaycastFirstBlocker(StartLocation, MonumentLocation));
+            }
+            for (const TWeakObjectPtr<AActor>& RayHit : OccupancyMap->SweepCone(StartLocation, CheckCone))
+            {
+                FirstHits.Add(RayHit.Get());
+            }
+            // players aren't rasterised; pick up any inside the cone with a clear line to us
+            for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+            {
+                APawn* PlayerPawn = It->Get() ? It->Get()->GetPawn() : nullptr;
+                if (!PlayerPawn || FVector::Distance(StartLocation, PlayerPawn->GetActorLocation()) > FVector::Distance(StartLocation, MonumentLocation)) {continue;}
+                float YawToPlayer = UKismetMathLibrary::FindLookAtRotation(StartLocation, PlayerPawn->GetActorLocation()).Yaw;
+                float YawToMonument = UKismetMathLibrary::FindLookAtRotation(StartLocation, MonumentLocation).Yaw;
+                if (FMath::Abs(FRotator::NormalizeAxis(YawToPlayer - YawToMonument)) <= CheckCone / 2 && !OccupancyMap->RaycastFirstBlocker(StartLocation, PlayerPawn->GetActorLocation()))
+                {
+                    FirstHits.Add(PlayerPawn);
+                }
+            }
+            ProcessStaticSweepHits(FirstHits);
+            return;
+        }
+        // only one sweep in flight per controller
+        UAITraceSubsystem* TraceSubsystem = GetWorld()->GetSubsystem<UAITraceSubsystem>();
+        if (!TraceSubsystem || TraceSubsystem->IsBatchPending(StaticSweepBatch)) {return;}
         FCollisionQueryParams Params;
         Params.AddIgnoredActor(ControlledCharacter);
+        TArray<FAITraceRequest> Requests;
         // check if direct path to monument
         if (!CheckBlocked)
         {
-            bool bHitSuccess = GetWorld()->LineTraceSingleByChannel(HitResult, StartLocation, EndLocation, ECollisionChannel::ECC_GameTraceChannel1, Params);
-            if (HitResult.GetActor() == ControlledCharacter->GetMonument())
-            {
-                StaticTarget = nullptr;
-                //return;
-            }
+            Requests.Emplace(StartLocation, MonumentLocation, ECollisionChannel::ECC_GameTraceChannel1);
         }
-        // get total traces to be fired based on passed in cone
-        int32 Iterations = FMath::FloorToInt32(CheckCone / 5);
-        // first angle should be half a cone to the left of OriginRotation
-        float FirstAngle = CheckCone / -2;
-        for (int32 i = 0; i < Iterations; i++)
+        TArray<FVector> RayEnds;
+        USiegeOccupancySubsystem::GetSweepRayEnds(StartLocation, MonumentLocation, CheckCone, RayEnds);
+        for (const FVector& RayEnd : RayEnds)
         {
-            FRotator NewRotation = FRotator(OriginalRotation.Pitch, OriginalRotation.Yaw + FirstAngle, OriginalRotation.Roll);
-            EndLocation = NewRotation.Vector() * DistanceToMonument + StartLocation;
-            bool bHitSuccess = GetWorld()->LineTraceSingleByChannel(HitResult, StartLocation, EndLocation, ECollisionChannel::ECC_GameTraceChannel1, Params);
-            if (bHitSuccess && HitResult.GetActor())
+            Requests.Emplace(StartLocation, RayEnd, ECollisionChannel::ECC_GameTraceChannel1);
+        }
+        StaticSweepBatch = TraceSubsystem->RequestTraces(Requests, Params, FOnAITraceBatchComplete::CreateUObject(this, &AEnemyAIController::OnStaticTargetSweepComplete));
+    }
+}
+
+void AEnemyAIController::OnStaticTargetSweepComplete(const TArray<FHitResult>& Results)
+{
+    TArray<AActor*> FirstHits;
+    for (const FHitResult& HitResult : Results)
+    {
+        if (HitResult.bBlockingHit) {FirstHits.Add(HitResult.GetActor());}
+    }
+    ProcessStaticSweepHits(FirstHits);
+}
+
+void AEnemyAIController::ProcessStaticSweepHits(const TArray<AActor*>& FirstHits)
+{
+    if (!ControlledCharacter || !ControlledCharacter->GetMonument()) {return;}
+    // rays are resolved independently, so a building spanning several rays is only added to memory once
+    TArray<AActor*, TInlineAllocator<8>> BuildingsFound;
+    for (AActor* HitActor : FirstHits)
+    {
+        if (!HitActor) {continue;}
+        // if direct path to monument, stop looking for or attacking building and switch to monument
+        if (HitActor == ControlledCharacter->GetMonument()) { StaticTarget = nullptr; }
+        // attack player if found
+        else if (Cast<AEalondCharacter>(HitActor)) { Engage(HitActor); }
+        // add building data if found
+        else if (!BuildingsFound.Contains(HitActor))
+        {
+            auto BuildingInterface = Cast<IBuildingInterface>(HitActor);
+            if (BuildingInterface && BuildingInterface->Execute_CheckIfBuilding(Cast<UObject>(BuildingInterface), HitActor))
             {
-                // if direct path to monument, stop looking for or attacking building and switch to monument
-                if (HitResult.GetActor() == ControlledCharacter->GetMonument()) { StaticTarget = nullptr; }
-                // attack player if found
-                else if (Cast<AEalondCharacter>(HitResult.GetActor())) { Engage(HitResult.GetActor()); }
-                // add building data if found
-                else
-                {
-                    auto BuildingInterface = Cast<IBuildingInterface>(HitResult.GetActor());
-                    if (BuildingInterface && BuildingInterface->Execute_CheckIfBuilding(Cast<UObject>(BuildingInterface), HitResult.GetActor()))
-                    {
-                        BuildingInterface->Execute_GetBuildingData(Cast<UObject>(BuildingInterface), ControlledCharacter->MemoryComp);
-                        Params.AddIgnoredActor(HitResult.GetActor());
-                    }
-                }
+                BuildingInterface->Execute_GetBuildingData(Cast<UObject>(BuildingInterface), ControlledCharacter->MemoryComp);
+                BuildingsFound.Add(HitActor);
             }
-
-            // continue the sweep
-            FirstAngle += 5.f;
         }
     }
 }
 
+ABuilding* AEnemyAIController::GetBuildingBlockingMonument() const
+{
+    USiegeOccupancySubsystem* OccupancyMap = GetWorld()->GetSubsystem<USiegeOccupancySubsystem>();
+    if (!OccupancyMap || !OccupancyMap->IsBuilt() || !ControlledCharacter->GetMonument()) {return nullptr;}
+    return Cast<ABuilding>(OccupancyMap->RaycastFirstBlocker(ControlledCharacter->GetActorLocation(), ControlledCharacter->GetMonument()->GetActorLocation()));
+}
+
 void AEnemyAIController::SetStaticTarget(bool bCharacterBlocked)
 {
     // auto select target if stationary
     if (bCharacterBlocked)
     {
         StaticTarget = ControlledCharacter->MemoryComp->SelectBuildingTarget();
+        // nothing in memory yet; fall back to whatever the raster says is in the way
+        if (!StaticTarget) {StaticTarget = GetBuildingBlockingMonument();}
         return;
     }
     // check for short, direct path to monument
@@ -367,6 +601,13 @@ void AEnemyAIController::SetStaticTarget(bool bCharacterBlocked)
     if (PathToMonument > ControlledCharacter->GetDistanceTo(ControlledCharacter->GetMonument()) * 1.5)
     {
         ABuilding* Target = ControlledCharacter->MemoryComp->SelectBuildingTarget();
+        // prefer the building sitting on the cheapest route, then whatever is directly in the way
+        if (!Target)
+        {
+            USiegeFlowFieldSubsystem* FlowField = GetWorld()->GetSubsystem<USiegeFlowFieldSubsystem>();
+            if (FlowField) {Target = FlowField->GetBlockingBuilding(ControlledCharacter->GetActorLocation());}
+        }
+        if (!Target) {Target = GetBuildingBlockingMonument();}
         if (Target)
         {
             ControlledCharacter->bBlockedByTarget= false;
@@ -450,16 +691,16 @@ void AEnemyAIController::Engage(AActor* TargetCandidate, bool bOverrideCooldown)
         ControlledCharacter->Server_SetInCombatMode(true);
         // set enemy selection cooldown
         bCanReselectTarget = false;
-        FTimerDelegate DisableEnemySelection;
-        DisableEnemySelection.BindLambda([this]()
-            {
-                bCanReselectTarget = true;
-            });
-        GetWorld()->GetTimerManager().SetTimer(TargetSelectionCooldownTimer, DisableEnemySelection, 15.f, false);
+        ScheduleAction(EAIScheduledAction::EndTargetSelectionCooldown, 15.f);
     }
 }
 
 ECombatDecision AEnemyAIController::MakeCombatDecision(AActor* Target) 
+{
+    return ExecuteCombatDecision(Target, ChooseCombatDecision(Target));
+}
+
+ECombatDecision AEnemyAIController::ChooseCombatDecision(AActor* Target) 
 {
     if (!ControlledCharacter || ControlledCharacter->bIsHurt || ControlledCharacter->bIsRolling || ControlledCharacter->bIsDodging || ControlledCharacter->bIsAttacking || ControlledCharacter->GetCharacterMovement()->IsFalling())
     {
@@ -494,23 +735,10 @@ ECombatDecision AEnemyAIController::MakeCombatDecision(AActor* Target)
                 if (DistanceFromEnemy > 750.f) return ECD_NoAttack;
                 else if (DistanceFromEnemy < 200.f)
                 {
-                    if (bTargetFacingMe && (EalondCharTarget->bAttackPressed || EalondCharTarget->bIsAttacking) && DiceThrow > 4.f)
-                    {
-                        Block(Target);
-                        return ECD_Block;
-                    }
-                    else
-                    {
-                        Attack(Target, ECD_CloseAttack);
-                        return ECD_CloseAttack;
-                    }
-                }
-                else if ((ControlledCharacter->IsPartyLeader() && DiceThrow > 13.f) || (!ControlledCharacter->IsPartyLeader() && DiceThrow > 17.f))
-                {
-                    ControlledCharacter->bIsCharging = true;
-                    Attack(Target, ECD_DistanceAttack);
-                    return ECD_DistanceAttack;
+                    if (bTargetFacingMe && (EalondCharTarget->bAttackPressed || EalondCharTarget->bIsAttacking) && DiceThrow > 4.f) return ECD_Block;
+                    else return ECD_CloseAttack;
                 }
+                else if ((ControlledCharacter->IsPartyLeader() && DiceThrow > 13.f) || (!ControlledCharacter->IsPartyLeader() && DiceThrow > 17.f)) return ECD_DistanceAttack;
             }
             else if (ControlledCharacter->MemoryComp->TeamRole == TR_FlankMelee)
             {
@@ -528,40 +756,43 @@ ECombatDecision AEnemyAIController::MakeCombatDecision(AActor* Target)
                     // small chance of dodging if target moving towards me, 100% chance if moving towards and attacking
                     if (bTargetMovingTowardsMe && !(EalondCharTarget->bAttackPressed || EalondCharTarget->bIsAttacking))
                     {
-                        if (DiceThrow > 16.f && Dodge(FMath::RandBool())) return ECD_Evade;
-                        else
-                        {
-                            Attack(Target, ECD_CloseAttack);
-                            return ECD_CloseAttack;
-                        }
-                    }
-                    else if (EalondCharTarget->bAttackPressed || EalondCharTarget->bIsAttacking)
-                    {
-                        if (Dodge(FMath::RandBool())) return ECD_Evade;
-                        else
-                        {
-                            Attack(Target, ECD_CloseAttack);
-                            return ECD_CloseAttack;
-                        }
-                    }
-                    else
-                    {
-                        Attack(Target, ECD_CloseAttack);
-                        return ECD_CloseAttack;
+                        return DiceThrow > 16.f ? ECD_Evade : ECD_CloseAttack;
                     }
+                    else if (EalondCharTarget->bAttackPressed || EalondCharTarget->bIsAttacking) return ECD_Evade;
+                    else return ECD_CloseAttack;
                 }
-                else if ((ControlledCharacter->IsPartyLeader() && DiceThrow > 10.f) || (!ControlledCharacter->IsPartyLeader() && DiceThrow > 14.f))
-                {
-                    ControlledCharacter->bIsCharging = true;
-                    Attack(Target, ECD_DistanceAttack);
-                    return ECD_DistanceAttack;
-                }
+                else if ((ControlledCharacter->IsPartyLeader() && DiceThrow > 10.f) || (!ControlledCharacter->IsPartyLeader() && DiceThrow > 14.f)) return ECD_DistanceAttack;
             }
         }
     }
     return ECD_NoAttack;
 }
 
+ECombatDecision AEnemyAIController::ExecuteCombatDecision(AActor* Target, ECombatDecision Decision) 
+{
+    if (!Target) {return ECD_NoAttack;}
+    switch (Decision)
+    {
+    case ECD_Block:
+        Block(Target);
+        return ECD_Block;
+    case ECD_Evade:
+        // no clear way out: stand and fight instead
+        if (Dodge(FMath::RandBool())) {return ECD_Evade;}
+        Attack(Target, ECD_CloseAttack);
+        return ECD_CloseAttack;
+    case ECD_CloseAttack:
+        Attack(Target, ECD_CloseAttack);
+        return ECD_CloseAttack;
+    case ECD_DistanceAttack:
+        ControlledCharacter->bIsCharging = true;
+        Attack(Target, ECD_DistanceAttack);
+        return ECD_DistanceAttack;
+    default:
+        return ECD_NoAttack;
+    }
+}
+
 void AEnemyAIController::ResetAttackState()
 {
     ControlledCharacter->bIsAttacking = false;
@@ -581,6 +812,10 @@ bool AEnemyAIController::IsFlankUnit() const
 FVector AEnemyAIController::GetFlankPosition(AActor* Target)
 {
     if (!Target) return FVector(0,0,0);
+    // claimed slot on the target's flank ring, already on the navmesh and clear of other flankers
+    FVector ClaimedPosition;
+    UTacticalPositionSubsystem* TacticalPositions = GetWorld()->GetSubsystem<UTacticalPositionSubsystem>();
+    if (TacticalPositions && TacticalPositions->ClaimFlankPosition(this, Target, ClaimedPosition)) return ClaimedPosition;
     // determine side to flank
     FVector VectorBetweenUs = ControlledCharacter->GetActorLocation() - Target->GetActorLocation();
     bool bFlankRight = (VectorBetweenUs.Dot(Target->GetActorRightVector()) >= 0);
@@ -594,72 +829,67 @@ FVector AEnemyAIController::GetFlankPosition(AActor* Target)
 bool AEnemyAIController::Dodge(bool bCanRoll)
 {
     if (ControlledCharacter->GetCharacterMovement()->IsFalling()) {return false;}
+    // static obstacles and landing heights come from the shared evade lookup; a spot it hasn't probed yet is checked here and now
+    UEvadeFeasibilitySubsystem* EvadeMap = GetWorld()->GetSubsystem<UEvadeFeasibilitySubsystem>();
+    const FEvadeFeasibility* Evade = EvadeMap ? EvadeMap->Query(ControlledCharacter->GetActorLocation(), ControlledCharacter->GetActorRotation().Yaw) : nullptr;
+    FEvadeFeasibility ProbedEvade;
+    if (!Evade && EvadeMap)
+    {
+        EvadeMap->ProbeNow(ControlledCharacter->GetActorLocation(), ControlledCharacter->GetActorRotation().Yaw, ProbedEvade);
+        Evade = &ProbedEvade;
+    }
+    if (!Evade || !Evade->ClearMask) {return false;}
+    // pawns in the way are checked against what this AI perceives; fetched once for every direction
+    TArray<AActor*> PerceivedActors;
+    if (PerceptionComp) {PerceptionComp->GetCurrentlyPerceivedActors(nullptr, PerceivedActors);}
     bool bCanDodge = false;
-    FVector Start = ControlledCharacter->GetActorLocation();
-    TArray<FVector> EndPoints;
-    FHitResult HitResult;
-    FCollisionQueryParams Params;
-    bool HitSuccess;
-    Params.AddIgnoredActor(ControlledCharacter);
-    // get trace checks for each direction
-    EndPoints.Add(Start + GetPawn()->GetActorRightVector() * -500.f);
-    EndPoints.Add(Start + GetPawn()->GetActorRightVector() * 500.f);
-    EndPoints.Add(Start + GetPawn()->GetActorForwardVector() * -500.f);
-    TArray<int32> Directions = {0, 1, 2};
+    // directions are left, right and back
+    TArray<int32, TInlineAllocator<3>> Directions;
+    for (int32 Dir = 0; Dir < int32(EEvadeDirection::MAX); Dir++)
+    {
+        if (Evade->IsClear(EEvadeDirection(Dir))) {Directions.Add(Dir);}
+    }
     // shuffle directions
-    int32 LastIndex = EndPoints.Num() - 1;
+    int32 LastIndex = Directions.Num() - 1;
     for (int32 i = 0; i <= LastIndex; ++i)
     {
         int32 Index = FMath::RandRange(i, LastIndex);
         if (i != Index)
         {
-            EndPoints.Swap(i, Index);
             Directions.Swap(i, Index);
         }
     }
-    for (int32 i = 0; i < EndPoints.Num(); i++)
+    for (int32 Dir : Directions)
     {
-        int32 Dir = Directions[i];
         float JumpAngle = 10.f;
-        HitSuccess = GetWorld()->LineTraceSingleByChannel(HitResult, Start, EndPoints[i], ECC_Visibility, Params);
-        if (HitSuccess)
+        // check blocked by another pawn; the shared lookup ignores them
+        if (IsPawnInEvadePath(EEvadeDirection(Dir), PerceivedActors))
         {
-            // check blocked by actor
-            if (HitResult.GetActor() && HitResult.Distance < 400.f)
-            {
-               continue;
-            }
+            continue;
         }
         // check ground height
-        FVector NewStartPoint = EndPoints[i] + FVector(0, 0, 350.f);
-        FVector NewEndPoint = EndPoints[i] + FVector(0, 0, -350.f);
-        bool bHitResultGround = GetWorld()->LineTraceSingleByChannel(HitResult, NewStartPoint, NewEndPoint, ECC_Visibility, Params);
-        if (bHitResultGround)
-        {
-            float ZDifference = HitResult.Location.Z - ControlledCharacter->GetActorLocation().Z;
-            // too steep
-            if (ZDifference < -300.f || ZDifference > 300.f)
-            {
-                continue;
-            }
-            // jump higher
-            else if (ZDifference > 150.f)
-            {
-                bCanDodge = true;
-                JumpAngle = 30.f;
-            }
-            // jump lower
-            else if (ZDifference < 150.f)
-            {
-                bCanDodge = true;
-                JumpAngle = 5.f;
-            }
-            else
-            {
-                bCanDodge = true;
-            }
+        float ZDifference = Evade->LandingZ[Dir] - ControlledCharacter->GetActorLocation().Z;
+        // too steep
+        if (ZDifference < -300.f || ZDifference > 300.f)
+        {
+            continue;
+        }
+        // jump higher
+        else if (ZDifference > 150.f)
+        {
+            bCanDodge = true;
+            JumpAngle = 30.f;
+        }
+        // jump lower
+        else if (ZDifference < 150.f)
+        {
+            bCanDodge = true;
+            JumpAngle = 5.f;
+        }
+        else
+        {
+            bCanDodge = true;
         }
-        else bCanDodge = false;
         if (bCanDodge)
         {
             if (!bCanRoll)
@@ -667,21 +897,11 @@ bool AEnemyAIController::Dodge(bool bCanRoll)
                 FVector LaunchTarget;
                 if (Dir == 0) LaunchTarget = GetPawn()->GetActorLocation() + GetPawn()->GetActorRightVector() * -500.f;
                 else if (Dir == 1) LaunchTarget = GetPawn()->GetActorLocation() + (GetPawn()->GetActorRightVector() * -1.f) * 500.f;
-                else
-                {
-                    LaunchTarget = GetPawn()->GetActorLocation() + GetPawn()->GetActorForwardVector() * -500.f;
-                    Dir = 2;
-                }
+                else LaunchTarget = GetPawn()->GetActorLocation() + GetPawn()->GetActorForwardVector() * -500.f;
                 FVector LaunchVelocity = ControlledCharacter->GetLaunchVelocityToObject(ControlledCharacter->GetActorLocation(), LaunchTarget, JumpAngle);
                 ControlledCharacter->DodgeDirection = Dir;
                 ControlledCharacter->Server_SetIsDodging(true);
-                FTimerHandle DodgeTimer;
-                FTimerDelegate DodgeDelegate;
-                DodgeDelegate.BindLambda([this, LaunchVelocity]()
-                    {
-                        ControlledCharacter->Server_LaunchCharacter(LaunchVelocity);
-                    });
-                GetWorld()->GetTimerManager().SetTimer(DodgeTimer, DodgeDelegate, .2, false);
+                StartCombatTask(EAICombatTaskSlot::Dodge, DodgeRoutine(LaunchVelocity));
                 return true;
             }
             else
@@ -695,6 +915,22 @@ bool AEnemyAIController::Dodge(bool bCanRoll)
     return false;
 }
 
+bool AEnemyAIController::IsPawnInEvadePath(EEvadeDirection Dir, const TArray<AActor*>& PerceivedActors) const
+{
+    const FVector Start = ControlledCharacter->GetActorLocation();
+    const FVector End = UEvadeFeasibilitySubsystem::GetLandingPoint(Start, ControlledCharacter->GetActorRotation().Yaw, Dir);
+    const FVector ReachEnd = Start + (End - Start).GetSafeNormal() * UEvadeFeasibilitySubsystem::ObstacleReach;
+    // only pawns this AI can see are tested, against the stretch the old obstacle trace treated as blocking
+    for (const AActor* Actor : PerceivedActors)
+    {
+        const APawn* Pawn = Cast<APawn>(Actor);
+        if (!Pawn || Pawn == ControlledCharacter) {continue;}
+        const float Radius = Pawn->GetSimpleCollisionRadius() + ControlledCharacter->GetSimpleCollisionRadius();
+        if (FMath::PointDistToSegmentSquared(Pawn->GetActorLocation(), Start, ReachEnd) < FMath::Square(Radius)) {return true;}
+    }
+    return false;
+}
+
 void AEnemyAIController::CheckFlee()
 {
     float DiceRoll = FMath::RandRange(0.f, 1.f);
@@ -706,14 +942,102 @@ void AEnemyAIController::CheckFlee()
 
 void AEnemyAIController::OnPawnDead()
 {
+    AAIBaseCharacter* DeadCharacter = LeavePlay(TEXT("Pawn dead"));
+    if (UAIPoolSubsystem* Pool = GetWorld()->GetSubsystem<UAIPoolSubsystem>())
+    {
+        Pool->Release(DeadCharacter, this);
+    }
+}
+
+AAIBaseCharacter* AEnemyAIController::LeavePlay(const FString& Reason)
+{
+    ClearScheduledActions();
+    if (UAITraceSubsystem* TraceSubsystem = GetWorld()->GetSubsystem<UAITraceSubsystem>())
+    {
+        TraceSubsystem->CancelBatch(BlockedTraceBatch);
+        TraceSubsystem->CancelBatch(StaticSweepBatch);
+    }
     UAIPerceptionSystem::GetCurrent(GetWorld())->UnregisterSource(*ControlledCharacter, UAISense_Sight::StaticClass());
     ResetAttackState();
     ClearFocus(EAIFocusPriority::Default);
-    GetBrainComponent()->StopLogic(TEXT("Pawn dead"));
+    GetBrainComponent()->StopLogic(Reason);
     if (PathComp) PathComp->Deactivate();
     if (AEalondGameMode* GameMode = Cast<AEalondGameMode>(GetWorld()->GetAuthGameMode())) GameMode->RemoveAIFromMap(ControlledCharacter);
     if (PerceptionComp) PerceptionComp->Deactivate();
+    AAIBaseCharacter* LeavingCharacter = ControlledCharacter;
     UnPossess();
+    return LeavingCharacter;
+}
+
+bool AEnemyAIController::CanDemoteToHorde() const
+{
+    // only AI with nothing to fight; a building target is fine, it is re-picked on promotion
+    if (!ControlledCharacter || ControlledCharacter->bIsDead || ControlledCharacter->bInCombatMode || EnemyTarget) {return false;}
+    const UBrainComponent* Brain = GetBrainComponent();
+    return Brain && Brain->IsRunning();
+}
+
+void AEnemyAIController::DemoteToHorde()
+{
+    AAIBaseCharacter* DemotedCharacter = LeavePlay(TEXT("Demoted to horde"));
+    if (UAIPoolSubsystem* Pool = GetWorld()->GetSubsystem<UAIPoolSubsystem>())
+    {
+        Pool->Release(DemotedCharacter, this, 0.f);
+    }
+    else
+    {
+        DemotedCharacter->Destroy();
+        Destroy();
+    }
+}
+
+void AEnemyAIController::ResumeFromHorde()
+{
+    // a promoted AI was already marching; skip the spawn animation OnPossess started
+    ControlledCharacter->StopAnimMontage();
+    ScheduleAction(EAIScheduledAction::RevealMesh, 0.f);
+    ScheduleAction(EAIScheduledAction::StartBehaviorTree, 0.f);
+}
+
+void AEnemyAIController::ResetForPool(AAIBaseCharacter* PooledCharacter)
+{
+    ClearScheduledActions();
+    EnemyTarget = nullptr;
+    StaticTarget = nullptr;
+    ActorToFocusOn = nullptr;
+    DamageByActor.Empty();
+    PerceivedActors.Reset();
+    bInDanger = false;
+    bCanReselectTarget = true;
+    CombatType = ECD_NoAttack;
+    BlockingActor.Reset();
+    ClearFocus(EAIFocusPriority::Gameplay);
+    if (UBlackboardComponent* BlackboardComp = GetBlackboardComponent())
+    {
+        for (int32 KeyIndex = 0; KeyIndex < BlackboardComp->GetNumKeys(); KeyIndex++)
+        {
+            BlackboardComp->ClearValue(FBlackboard::FKey(KeyIndex));
+        }
+    }
+    if (!PooledCharacter) {return;}
+    const AAIBaseCharacter* Defaults = PooledCharacter->GetClass()->GetDefaultObject<AAIBaseCharacter>();
+    // the corpse went into the pool at zero health
+    PooledCharacter->SetHealth(PooledCharacter->GetMaxHealth());
+    PooledCharacter->bIsDead = false;
+    PooledCharacter->bIsHurt = false;
+    PooledCharacter->bIsFleeing = false;
+    PooledCharacter->FleeProbability = Defaults->FleeProbability;
+    PooledCharacter->bIsRolling = false;
+    PooledCharacter->bIsJumpAttack = false;
+    PooledCharacter->bIsAttacking = false;
+    PooledCharacter->bIsCharging = false;
+    PooledCharacter->bControllerOverrideMovement = false;
+    PooledCharacter->bOverrideProceduralGaze = false;
+    PooledCharacter->GazeFocusActor = nullptr;
+    PooledCharacter->Server_SetIsDodging(false);
+    PooledCharacter->Server_SetIsBlocking(false);
+    PooledCharacter->Server_SetInCombatMode(false);
+    PooledCharacter->MemoryComp->ResetForReuse();
 }
 
 FPathFollowingRequestResult AEnemyAIController::MoveTo(const FAIMoveRequest& MoveRequest, FNavPathSharedPtr* OutPath)
@@ -722,12 +1046,108 @@ FPathFollowingRequestResult AEnemyAIController::MoveTo(const FAIMoveRequest& Mov
     {
         UE_LOG(LogTemp, Warning, TEXT("%s, %s"), *MoveRequest.GetGoalActor()->GetName(), *MoveRequest.GetGoalActor()->GetActorLocation().ToString());
     }
+    // the behaviour tree marches with a plain move to the monument; steer it down the flow field with the squad instead
+    if (!bMovingAlongFlow && ControlledCharacter && MoveRequest.IsMoveToActorRequest() && MoveRequest.GetGoalActor() == ControlledCharacter->GetMonument())
+    {
+        return MoveAlongMonumentFlow(MoveRequest.GetAcceptanceRadius());
+    }
+    if (MoveRequest.IsUsingPathfinding())
+    {
+        if (UAISchedulerSubsystem* Scheduler = GetWorld()->GetSubsystem<UAISchedulerSubsystem>()) {Scheduler->RecordPathRequest();}
+    }
 
     return Super::MoveTo(MoveRequest, OutPath);
 }
 
+FPathFollowingRequestResult AEnemyAIController::MoveWithSquad(const FAIMoveRequest& MoveRequest)
+{
+    UMemoryComponentBase* MemComp = ControlledCharacter ? ControlledCharacter->MemoryComp : nullptr;
+    const UMemoryComponentBase* Leader = MemComp && MemComp->bIsInFormation ? MemComp->GetLeader() : nullptr;
+    // leaders and loners make their own move
+    if (!Leader || Leader == MemComp || !Leader->OwningEnemyController || !Leader->OwningEnemyController->GetPawn())
+    {
+        return MoveTo(MoveRequest);
+    }
+    FVector FormationPoint;
+    if (GetSquadFormationPoint(Leader->OwningEnemyController, FormationPoint))
+    {
+        // -1 asks for the path following default; the running follow move was issued with it, so it holds the resolved value
+        const bool bDefaultRadius = MoveRequest.GetAcceptanceRadius() == UPathFollowingComponent::DefaultAcceptanceRadius;
+        const float AcceptanceRadius = bDefaultRadius && PathComp ? PathComp->GetAcceptanceRadius() : FMath::Max(MoveRequest.GetAcceptanceRadius(), 0.f);
+        // still heading for a slot that has barely moved: keep the current move rather than issue another
+        if (PathComp && PathComp->GetStatus() == EPathFollowingStatus::Moving && PathComp->GetCurrentRequestId() == LastSquadFollowMoveId
+            && FVector::DistSquared(FormationPoint, LastSquadFollowPoint) <= FMath::Square(AcceptanceRadius))
+        {
+            FPathFollowingRequestResult Result;
+            Result.MoveId = PathComp->GetCurrentRequestId();
+            Result.Code = EPathFollowingRequestResult::RequestSuccessful;
+            return Result;
+        }
+        // steer straight at the slot; the leader's path already got us round anything in the way
+        FAIMoveRequest FollowRequest(FormationPoint);
+        FollowRequest.SetUsePathfinding(false);
+        FollowRequest.SetAcceptanceRadius(MoveRequest.GetAcceptanceRadius());
+        if (UAISchedulerSubsystem* Scheduler = GetWorld()->GetSubsystem<UAISchedulerSubsystem>()) {Scheduler->RecordSquadFollow();}
+        const FPathFollowingRequestResult Result = MoveTo(FollowRequest);
+        LastSquadFollowPoint = FormationPoint;
+        LastSquadFollowMoveId = Result.MoveId;
+        return Result;
+    }
+    // slot is off the navmesh, make the move alone
+    return MoveTo(MoveRequest);
+}
+
+bool AEnemyAIController::GetSquadFormationPoint(const AEnemyAIController* LeaderController, FVector& OUT_FormationPoint) const
+{
+    APawn* LeaderPawn = LeaderController->GetPawn();
+    FVector Anchor = LeaderPawn->GetActorLocation();
+    FVector Heading = LeaderPawn->GetActorForwardVector();
+    // face the formation along the leader's next path segment rather than where the leader happens to be looking
+    const UPathFollowingComponent* LeaderPathComp = LeaderController->GetPathFollowingComponent();
+    if (LeaderPathComp && LeaderPathComp->HasValidPath())
+    {
+        const TArray<FNavPathPoint>& PathPoints = LeaderPathComp->GetPath()->GetPathPoints();
+        int32 NextIndex = LeaderPathComp->GetNextPathIndex();
+        if (PathPoints.IsValidIndex(NextIndex))
+        {
+            FVector ToNext = (PathPoints[NextIndex].Location - Anchor).GetSafeNormal2D();
+            if (!ToNext.IsNearlyZero()) {Heading = ToNext;}
+        }
+    }
+    // slot offsets in leader space: x forward, y right
+    FVector SlotOffset;
+    switch (ControlledCharacter->MemoryComp->FormationPosition)
+    {
+    case EFP_Left:
+        SlotOffset = FVector(-150.f, -200.f, 0);
+        break;
+    case EFP_Right:
+        SlotOffset = FVector(-150.f, 200.f, 0);
+        break;
+    case EFP_CentreLeft:
+        SlotOffset = FVector(-120.f, -80.f, 0);
+        break;
+    case EFP_CentreRight:
+        SlotOffset = FVector(-120.f, 80.f, 0);
+        break;
+    default:
+        SlotOffset = FVector(-200.f, 0, 0);
+        break;
+    }
+    FVector Target = Anchor + FRotationMatrix(Heading.Rotation()).TransformVector(SlotOffset);
+    UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld());
+    FNavLocation NavLocation;
+    if (!NavSys || !NavSys->ProjectPointToNavigation(Target, NavLocation, FVector(50.f, 50.f, 200.f))) {return false;}
+    OUT_FormationPoint = NavLocation.Location;
+    return true;
+}
+
 void AEnemyAIController::Disengage(bool bExitCombatState) 
 {
+    if (UTacticalPositionSubsystem* TacticalPositions = GetWorld()->GetSubsystem<UTacticalPositionSubsystem>())
+    {
+        TacticalPositions->ReleaseClaims(this);
+    }
     EnemyTarget = nullptr;
     bCanReselectTarget = true;
     ControlledCharacter->bIsAttacking = false;
@@ -796,8 +1216,13 @@ void AEnemyAIController::Attack(AActor* Target, ECombatDecision CombatDecision)
         // if being approached, move away from target
         else if (TargetVelDot > .8)
         {
-            FVector VectorBetweenUs = (GetPawn()->GetActorLocation()- Target->GetActorLocation()).GetSafeNormal();
-            FVector MoveToLoc = GetPawn()->GetActorLocation() + VectorBetweenUs * 150.f;
+            FVector MoveToLoc;
+            UTacticalPositionSubsystem* TacticalPositions = GetWorld()->GetSubsystem<UTacticalPositionSubsystem>();
+            if (!TacticalPositions || !TacticalPositions->FindRetreatPosition(this, Target, MoveToLoc))
+            {
+                FVector VectorBetweenUs = (GetPawn()->GetActorLocation()- Target->GetActorLocation()).GetSafeNormal();
+                MoveToLoc = GetPawn()->GetActorLocation() + VectorBetweenUs * 150.f;
+            }
             MoveTo(MoveToLoc);
         }
         break;
@@ -814,63 +1239,103 @@ void AEnemyAIController::Attack(AActor* Target, ECombatDecision CombatDecision)
     }
 }
 
-void AEnemyAIController::Block(AActor* Target)
+FAICombatTask AEnemyAIController::DodgeRoutine(FVector LaunchVelocity)
 {
-    if (!Target || !Target->IsValidLowLevelFast() || !GetPawn()) return;
+    co_await FAIDelay(.2f);
+    ControlledCharacter->Server_LaunchCharacter(LaunchVelocity);
+}
+
+bool AEnemyAIController::IsTargetAttackingMe(AActor* Target) const
+{
+    if (!Target || !Target->IsValidLowLevelFast() || !GetPawn()) return false;
     const AEalondCharacterBase* EalondCharTarget = nullptr;
     if (auto IntTarget = Cast<IPlayerAIInteractionInterface>(Target))
     {
         EalondCharTarget = IntTarget->Execute_GetBaseCharRef(Cast<UObject>(IntTarget));
     }
-    if (!EalondCharTarget) return;
+    if (!EalondCharTarget) return false;
     FVector VectorBetweenUs = (GetPawn()->GetActorLocation() - Target->GetActorLocation()).GetSafeNormal();
     bool bIsFacingMe = Target->GetActorForwardVector().Dot(VectorBetweenUs) > .8f;
-    if (bIsFacingMe && (EalondCharTarget->bIsAttacking || EalondCharTarget->bAttackPressed))
+    return bIsFacingMe && (EalondCharTarget->bIsAttacking || EalondCharTarget->bAttackPressed);
+}
+
+void AEnemyAIController::Block(AActor* Target)
+{
+    if (!Target || !Target->IsValidLowLevelFast() || !GetPawn()) return;
+    if (IsTargetAttackingMe(Target))
     {
-        float BlockTime = FMath::RandRange(.5f, 2.f);
-        FTimerHandle BlockTimer;
-        FTimerDelegate BlockDelegate = FTimerDelegate::CreateUObject(this, &AEnemyAIController::Block, Target);
         ControlledCharacter->Server_SetIsBlocking(true);
         SetFocus(Target);
         ControlledCharacter->bUseControllerRotationYaw = true;
         ControlledCharacter->GetCharacterMovement()->bOrientRotationToMovement = false;
-        GetWorld()->GetTimerManager().SetTimer(BlockTimer, BlockDelegate, BlockTime, false);
+        if (!CombatTasks.IsRunning(EAICombatTaskSlot::Block)) StartCombatTask(EAICombatTaskSlot::Block, BlockRoutine(Target));
     }
     else
     {
-        ClearFocus(EAIFocusPriority::Gameplay);
-        ControlledCharacter->bUseControllerRotationYaw = true;
-        ControlledCharacter->GetCharacterMovement()->bOrientRotationToMovement = false;
-        ControlledCharacter->Server_SetIsBlocking(false);
+        CombatTasks.Cancel(EAICombatTaskSlot::Block);
+        EndBlock();
+    }
+}
+
+FAICombatTask AEnemyAIController::BlockRoutine(TWeakObjectPtr<AActor> Target)
+{
+    // hold the block for a random time, then keep holding for as long as the target is still swinging at us
+    do
+    {
+        co_await FAIDelay(FMath::RandRange(.5f, 2.f));
     }
+    while (IsTargetAttackingMe(Target.Get()));
+    EndBlock();
+}
+
+bool AEnemyAIController::IsCombatTaskRunning(EAICombatTaskSlot Slot) const
+{
+    return CombatTasks.IsRunning(Slot);
+}
+
+void AEnemyAIController::CancelBlock()
+{
+    CombatTasks.Cancel(EAICombatTaskSlot::Block);
+    EndBlock();
+}
+
+void AEnemyAIController::EndBlock()
+{
+    ClearFocus(EAIFocusPriority::Gameplay);
+    ControlledCharacter->bUseControllerRotationYaw = true;
+    ControlledCharacter->GetCharacterMovement()->bOrientRotationToMovement = false;
+    ControlledCharacter->Server_SetIsBlocking(false);
 }
 
 void AEnemyAIController::ShieldBash(AActor* Target)
 {
-    FTimerHandle FlipBoolTimer;
-    FTimerDelegate FlipBoolDelegate;
     ControlledCharacter->Server_SetIsBlocking(true);
     ControlledCharacter->Server_SetIsAttacking(true);
-    FlipBoolDelegate.BindLambda([this]()
-        {
-            ControlledCharacter->Server_SetIsAttacking(false);
-            ControlledCharacter->Server_SetIsBlocking(false);
-        });
-    GetWorld()->GetTimerManager().SetTimer(FlipBoolTimer, FlipBoolDelegate, 2.f, false);
+    StartCombatTask(EAICombatTaskSlot::Attack, ShieldBashRoutine());
+}
+
+FAICombatTask AEnemyAIController::ShieldBashRoutine()
+{
+    co_await FAIDelay(2.f);
+    ControlledCharacter->Server_SetIsAttacking(false);
+    ControlledCharacter->Server_SetIsBlocking(false);
 }
 
 void AEnemyAIController::JumpAttack(AActor* Target)
 {
-    FTimerHandle AttackTimer;
-    FTimerDelegate FlipAttackBools;
     ControlledCharacter->bIsJumpAttack = true;
     ControlledCharacter->bIsAttacking = true;
-    FlipAttackBools.BindLambda([this, Target]()
-        {
-            FVector JumpVelocity = ControlledCharacter->GetLaunchVelocityToObject(GetPawn()->GetActorLocation(), Target->GetActorLocation(), 10.f);
-            ControlledCharacter->Server_LaunchCharacter(JumpVelocity);
-        });
-    GetWorld()->GetTimerManager().SetTimer(AttackTimer, FlipAttackBools, .5f, false);
+    StartCombatTask(EAICombatTaskSlot::Attack, JumpAttackRoutine(Target));
+}
+
+FAICombatTask AEnemyAIController::JumpAttackRoutine(TWeakObjectPtr<AActor> Target)
+{
+    co_await FAIDelay(.5f);
+    if (AActor* JumpTarget = Target.Get())
+    {
+        FVector JumpVelocity = ControlledCharacter->GetLaunchVelocityToObject(GetPawn()->GetActorLocation(), JumpTarget->GetActorLocation(), 10.f);
+        ControlledCharacter->Server_LaunchCharacter(JumpVelocity);
+    }
 }
 
 void AEnemyAIController::ForceTargetRecheck(AActor* DeadTarget)
@@ -880,39 +1345,20 @@ void AEnemyAIController::ForceTargetRecheck(AActor* DeadTarget)
         if (EnemyTarget == DeadTarget)
         {
             float Delay = FMath::RandRange(0.2, 0.7);
-            float AnimLength = Delay;
+            UAnimMontage* KillAnimation = nullptr;
             GetBrainComponent()->PauseLogic(TEXT("Playing animation..."));
-            // if animation is valid, play after delay and set final delay to anim length; othwerwise total delay will be Delay variable
+            // if animation is valid, play after delay and wait for it to finish; othwerwise total delay will be Delay variable
             if (OnKilledEnemyAnimations.Num())
             {
                 int32 RandIndex = FMath::RandRange(0, OnKilledEnemyAnimations.Num() - 1);
                 if (OnKilledEnemyAnimations[RandIndex])
                 {
-                    ControlledCharacter->Server_PlayAnim(OnKilledEnemyAnimations[RandIndex], Delay);
-                    AnimLength = OnKilledEnemyAnimations[RandIndex]->GetPlayLength();
+                    KillAnimation = OnKilledEnemyAnimations[RandIndex];
+                    ControlledCharacter->Server_PlayAnim(KillAnimation, Delay);
                 }
             }
             // force recheck after animation finished
-            FTimerHandle RestartTimer;
-            FTimerDelegate RestartDelegate;
-            RestartDelegate.BindLambda([this]()
-                {
-                    GetBrainComponent()->ResumeLogic(TEXT("Animation finished"));
-                    AActor* NewTarget = ControlledCharacter->MemoryComp->SelectEnemyTarget();
-                    if (NewTarget)
-                    {
-                        Engage(NewTarget);
-                    }
-                    else if (ControlledCharacter->MemoryComp->GetEnemiesInMemory().IsEmpty())
-                    {
-                        Disengage(true);
-                    }
-                    else
-                    {
-                        Disengage(false);
-                    }
-                });
-            GetWorld()->GetTimerManager().SetTimer(RestartTimer, RestartDelegate, AnimLength, false);
+            StartCombatTask(EAICombatTaskSlot::Recover, ResumeAfterKillRoutine(KillAnimation, Delay));
         }
         else if (ControlledCharacter->MemoryComp->GetEnemiesInMemory().Num() <= 1)
         {
@@ -924,6 +1370,38 @@ void AEnemyAIController::ForceTargetRecheck(AActor* DeadTarget)
     }
 }
 
+FAICombatTask AEnemyAIController::ResumeAfterKillRoutine(UAnimMontage* KillAnimation, float Delay)
+{
+    if (KillAnimation) {co_await FAIWaitMontage(ControlledCharacter->GetMesh()->GetAnimInstance(), KillAnimation, KillAnimation->GetPlayLength());}
+    else {co_await FAIDelay(Delay);}
+    ResumeAfterKill();
+}
+
+FAICombatTask AEnemyAIController::EngageAnimationRoutine()
+{
+    co_await FAIWaitMontage(ControlledCharacter->GetMesh()->GetAnimInstance(), EngageAnimation, EngageAnimation->GetPlayLength());
+    ControlledCharacter->bControllerOverrideMovement = false;
+    if (GetBrainComponent()) {GetBrainComponent()->ResumeLogic(TEXT("Animation finished"));}
+}
+
+void AEnemyAIController::ResumeAfterKill()
+{
+    GetBrainComponent()->ResumeLogic(TEXT("Animation finished"));
+    AActor* NewTarget = ControlledCharacter->MemoryComp->SelectEnemyTarget();
+    if (NewTarget)
+    {
+        Engage(NewTarget);
+    }
+    else if (ControlledCharacter->MemoryComp->GetEnemiesInMemory().IsEmpty())
+    {
+        Disengage(true);
+    }
+    else
+    {
+        Disengage(false);
+    }
+}
+
 ETeamAttitude::Type AEnemyAIController::GetTeamAttitudeTowards(const AActor& Other) const
 {
     auto StimulusInterface = Cast<IGenericTeamAgentInterface>(&Other);
@@ -0,0 +1,23 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "EnemyBrainComponents.h"
+#include "AIBrainBenchmarkSubsystem.h"
+#include "AITraceSubsystem.h"
+
+DECLARE_CYCLE_STAT(TEXT("Behaviour tree brain tick"), STAT_EnemyBehaviorTreeTick, STATGROUP_EalondAI);
+DECLARE_CYCLE_STAT(TEXT("State tree brain tick"), STAT_EnemyStateTreeTick, STATGROUP_EalondAI);
+
+void UEnemyBehaviorTreeComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	SCOPE_CYCLE_COUNTER(STAT_EnemyBehaviorTreeTick);
+	FAIBrainTickScope BenchmarkScope(EAIBrainKind::BehaviorTree);
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+}
+
+void UEnemyStateTreeComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	SCOPE_CYCLE_COUNTER(STAT_EnemyStateTreeTick);
+	FAIBrainTickScope BenchmarkScope(EAIBrainKind::StateTree);
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+}
@@ -0,0 +1,32 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "BehaviorTree/BehaviorTreeComponent.h"
+#include "Components/StateTreeAIComponent.h"
+#include "EnemyBrainComponents.generated.h"
+
+/** Behaviour tree brain for enemy AI. Only adds tick timing, so both brains are measured the same way. */
+UCLASS()
+class EALOND_API UEnemyBehaviorTreeComponent : public UBehaviorTreeComponent
+{
+	GENERATED_BODY()
+
+public:
+	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+};
+
+/**
+ * State tree brain for enemy AI, an alternative to the behaviour tree. Combat states are explicit tree
+ * states built from the nodes in EnemyCombatStateTreeNodes.h. The tree asset is set on the controller
+ * blueprint, and ai.Brain.UseStateTree picks this brain when the AI starts.
+ */
+UCLASS()
+class EALOND_API UEnemyStateTreeComponent : public UStateTreeAIComponent
+{
+	GENERATED_BODY()
+
+public:
+	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+};
@@ -0,0 +1,173 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "EnemyCombatStateTreeNodes.h"
+#include "AIBaseCharacter.h"
+#include "AICombatTask.h"
+#include "StateTreeExecutionContext.h"
+#include "GameFramework/CharacterMovementComponent.h"
+#include "Navigation/PathFollowingComponent.h"
+#include "NavigationSystem.h"
+#include "../Components/MemoryComponentBase.h"
+
+void FEnemyCombatEvaluator::TreeStart(FStateTreeExecutionContext& Context) const
+{
+	FInstanceDataType& Data = Context.GetInstanceData(*this);
+	Data.Character = Data.Controller ? Data.Controller->ControlledCharacter : nullptr;
+	Data.Memory = Data.Character ? Data.Character->MemoryComp : nullptr;
+	Data.NextMemoryReadTime = 0;
+}
+
+void FEnemyCombatEvaluator::Tick(FStateTreeExecutionContext& Context, const float DeltaTime) const
+{
+	FInstanceDataType& Data = Context.GetInstanceData(*this);
+	AEnemyAIController* Controller = Data.Controller;
+	AAIBaseCharacter* Character = Data.Character;
+	if (!Controller || !Character || Controller->GetPawn() != Character) return;
+
+	Data.EnemyTarget = Controller->EnemyTarget;
+	Data.CurrentTarget = Controller->GetCurrentTarget();
+	Data.DistanceToEnemy = Data.EnemyTarget ? Controller->DistanceFromEnemy : MAX_flt;
+	Data.bInCombat = Character->bInCombatMode;
+	Data.bInDanger = Controller->bInDanger;
+	Data.bIsBusy = Character->bIsHurt || Character->bIsRolling || Character->bIsDodging || Character->bIsAttacking
+		|| Character->GetCharacterMovement()->IsFalling();
+	Data.bTargetAttackingMe = Data.EnemyTarget && Controller->IsTargetAttackingMe(Data.EnemyTarget);
+	Data.bShouldFlee = Character->bIsFleeing;
+	Data.bIsFlankUnit = Controller->IsFlankUnit();
+
+	const float MaxHealth = Character->GetMaxHealth();
+	Data.HealthFraction = MaxHealth > 0 ? Character->GetHealth() / MaxHealth : 1.f;
+
+	const float Now = Controller->GetWorld()->GetTimeSeconds();
+	if (Data.Memory && Now >= Data.NextMemoryReadTime)
+	{
+		Data.NearestEnemy = Data.bInCombat ? Data.Memory->GetNearestEnemy() : nullptr;
+		Data.NextMemoryReadTime = Now + MemoryReadInterval;
+	}
+}
+
+EStateTreeRunStatus FEnemyCombatDecisionTask::EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const
+{
+	FInstanceDataType& Data = Context.GetInstanceData(*this);
+	Data.Decision = Data.Controller ? Data.Controller->ChooseCombatDecision(Data.Target) : ECD_NoAttack;
+	return Data.Decision == ECD_NoAttack ? EStateTreeRunStatus::Failed : EStateTreeRunStatus::Succeeded;
+}
+
+EStateTreeRunStatus FEnemyAttackTask::EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const
+{
+	FInstanceDataType& Data = Context.GetInstanceData(*this);
+	Data.Elapsed = 0;
+	if (!Data.Controller || !Data.Target) return EStateTreeRunStatus::Failed;
+	const ECombatDecision Decision = Data.Decision == ECD_DistanceAttack ? ECD_DistanceAttack : ECD_CloseAttack;
+	return Data.Controller->ExecuteCombatDecision(Data.Target, Decision) == ECD_NoAttack ? EStateTreeRunStatus::Failed : EStateTreeRunStatus::Running;
+}
+
+EStateTreeRunStatus FEnemyAttackTask::Tick(FStateTreeExecutionContext& Context, const float DeltaTime) const
+{
+	FInstanceDataType& Data = Context.GetInstanceData(*this);
+	AAIBaseCharacter* Character = Data.Controller ? Data.Controller->ControlledCharacter : nullptr;
+	if (!Character) return EStateTreeRunStatus::Failed;
+	Data.Elapsed += DeltaTime;
+	// the attack montage clears the flags through ResetAttackState; the cap covers a montage that got interrupted
+	const bool bAttacking = Character->bIsAttacking || Character->bIsCharging || Data.Controller->IsCombatTaskRunning(EAICombatTaskSlot::Attack);
+	if (!bAttacking) return EStateTreeRunStatus::Succeeded;
+	return Data.Elapsed < Data.MaxDuration ? EStateTreeRunStatus::Running : EStateTreeRunStatus::Failed;
+}
+
+EStateTreeRunStatus FEnemyBlockTask::EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const
+{
+	FInstanceDataType& Data = Context.GetInstanceData(*this);
+	if (!Data.Controller || !Data.Target) return EStateTreeRunStatus::Failed;
+	Data.Controller->Block(Data.Target);
+	// Block only raises the shield if the target is swinging at us
+	return Data.Controller->IsCombatTaskRunning(EAICombatTaskSlot::Block) ? EStateTreeRunStatus::Running : EStateTreeRunStatus::Failed;
+}
+
+EStateTreeRunStatus FEnemyBlockTask::Tick(FStateTreeExecutionContext& Context, const float DeltaTime) const
+{
+	const FInstanceDataType& Data = Context.GetInstanceData(*this);
+	if (!Data.Controller) return EStateTreeRunStatus::Failed;
+	return Data.Controller->IsCombatTaskRunning(EAICombatTaskSlot::Block) ? EStateTreeRunStatus::Running : EStateTreeRunStatus::Succeeded;
+}
+
+void FEnemyBlockTask::ExitState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const
+{
+	const FInstanceDataType& Data = Context.GetInstanceData(*this);
+	if (Data.Controller && Data.Controller->IsCombatTaskRunning(EAICombatTaskSlot::Block)) Data.Controller->CancelBlock();
+}
+
+EStateTreeRunStatus FEnemyDodgeTask::EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const
+{
+	FInstanceDataType& Data = Context.GetInstanceData(*this);
+	Data.Elapsed = 0;
+	if (!Data.Controller) return EStateTreeRunStatus::Failed;
+	const bool bCanRoll = Data.bRandomRoll ? FMath::RandBool() : Data.bCanRoll;
+	return Data.Controller->Dodge(bCanRoll) ? EStateTreeRunStatus::Running : EStateTreeRunStatus::Failed;
+}
+
+EStateTreeRunStatus FEnemyDodgeTask::Tick(FStateTreeExecutionContext& Context, const float DeltaTime) const
+{
+	FInstanceDataType& Data = Context.GetInstanceData(*this);
+	AAIBaseCharacter* Character = Data.Controller ? Data.Controller->ControlledCharacter : nullptr;
+	if (!Character) return EStateTreeRunStatus::Failed;
+	Data.Elapsed += DeltaTime;
+	const bool bDodging = Character->bIsDodging || Character->bIsRolling || Data.Controller->IsCombatTaskRunning(EAICombatTaskSlot::Dodge);
+	if (!bDodging) return EStateTreeRunStatus::Succeeded;
+	return Data.Elapsed < Data.MaxDuration ? EStateTreeRunStatus::Running : EStateTreeRunStatus::Failed;
+}
+
+EStateTreeRunStatus FEnemyFleeTask::EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const
+{
+	const FInstanceDataType& Data = Context.GetInstanceData(*this);
+	AEnemyAIController* Controller = Data.Controller;
+	APawn* Pawn = Controller ? Controller->GetPawn() : nullptr;
+	if (!Pawn || !Data.Threat) return EStateTreeRunStatus::Failed;
+
+	const FVector Away = (Pawn->GetActorLocation() - Data.Threat->GetActorLocation()).GetSafeNormal2D();
+	FVector FleeGoal = Pawn->GetActorLocation() + (Away.IsNearlyZero() ? -Pawn->GetActorForwardVector() : Away) * Data.FleeDistance;
+	if (UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(Controller->GetWorld()))
+	{
+		FNavLocation Projected;
+		if (!NavSys->ProjectPointToNavigation(FleeGoal, Projected, FVector(300.f, 300.f, 500.f))) return EStateTreeRunStatus::Failed;
+		FleeGoal = Projected.Location;
+	}
+	FAIMoveRequest MoveRequest(FleeGoal);
+	MoveRequest.SetAcceptanceRadius(Data.AcceptanceRadius);
+	const FPathFollowingRequestResult Result = Controller->MoveTo(MoveRequest);
+	if (Result.Code == EPathFollowingRequestResult::AlreadyAtGoal) return EStateTreeRunStatus::Succeeded;
+	return Result.Code == EPathFollowingRequestResult::RequestSuccessful ? EStateTreeRunStatus::Running : EStateTreeRunStatus::Failed;
+}
+
+EStateTreeRunStatus FEnemyFleeTask::Tick(FStateTreeExecutionContext& Context, const float DeltaTime) const
+{
+	const FInstanceDataType& Data = Context.GetInstanceData(*this);
+	const UPathFollowingComponent* PathFollowing = Data.Controller ? Data.Controller->GetPathFollowingComponent() : nullptr;
+	if (!PathFollowing) return EStateTreeRunStatus::Failed;
+	return PathFollowing->GetStatus() == EPathFollowingStatus::Moving ? EStateTreeRunStatus::Running : EStateTreeRunStatus::Succeeded;
+}
+
+void FEnemyFleeTask::ExitState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const
+{
+	const FInstanceDataType& Data = Context.GetInstanceData(*this);
+	if (Data.Controller) Data.Controller->StopMovement();
+}
+
+EStateTreeRunStatus FEnemyMarchTask::EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const
+{
+	const FInstanceDataType& Data = Context.GetInstanceData(*this);
+	if (!Data.Controller || !Data.Controller->GetPawn()) return EStateTreeRunStatus::Failed;
+	Data.Controller->MoveAlongMonumentFlow(Data.AcceptanceRadius);
+	return EStateTreeRunStatus::Running;
+}
+
+EStateTreeRunStatus FEnemyMarchTask::Tick(FStateTreeExecutionContext& Context, const float DeltaTime) const
+{
+	const FInstanceDataType& Data = Context.GetInstanceData(*this);
+	AEnemyAIController* Controller = Data.Controller;
+	if (!Controller || !Controller->GetPawn()) return EStateTreeRunStatus::Failed;
+	// flow goals are only a few cells ahead; steer at the next one once the current move is done
+	const UPathFollowingComponent* PathFollowing = Controller->GetPathFollowingComponent();
+	if (PathFollowing && PathFollowing->GetStatus() != EPathFollowingStatus::Moving) Controller->MoveAlongMonumentFlow(Data.AcceptanceRadius);
+	return EStateTreeRunStatus::Running;
+}
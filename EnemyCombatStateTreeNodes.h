@@ -0,0 +1,255 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "StateTreeEvaluatorBase.h"
+#include "StateTreeTaskBase.h"
+#include "EnemyAIController.h"
+#include "EnemyCombatStateTreeNodes.generated.h"
+
+class AAIBaseCharacter;
+class UMemoryComponentBase;
+
+/*
+ * State tree nodes for the enemy combat brain. The evaluator publishes what the controller, character
+ * and memory component know, once per tick. Tasks drive the controller's existing combat actions and
+ * report Running until the action is over, so the tree's states stand in for the old brain pauses and
+ * flags. A typical tree: Flee > Recover (busy) > Combat (Decide, then Attack / Block / Dodge by decision) > March.
+ */
+
+USTRUCT()
+struct FEnemyCombatEvaluatorInstanceData
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, Category = "Context")
+	TObjectPtr<AEnemyAIController> Controller = nullptr;
+
+	// cached on tree start so ticks don't look them up again
+	UPROPERTY()
+	TObjectPtr<AAIBaseCharacter> Character = nullptr;
+	UPROPERTY()
+	TObjectPtr<UMemoryComponentBase> Memory = nullptr;
+
+	UPROPERTY(EditAnywhere, Category = "Output")
+	TObjectPtr<AActor> EnemyTarget = nullptr;
+	/** Enemy target, else building, else the monument. */
+	UPROPERTY(EditAnywhere, Category = "Output")
+	TObjectPtr<AActor> CurrentTarget = nullptr;
+	UPROPERTY(EditAnywhere, Category = "Output")
+	TObjectPtr<AActor> NearestEnemy = nullptr;
+	UPROPERTY(EditAnywhere, Category = "Output")
+	float DistanceToEnemy = MAX_flt;
+	UPROPERTY(EditAnywhere, Category = "Output")
+	float HealthFraction = 1.f;
+	UPROPERTY(EditAnywhere, Category = "Output")
+	bool bInCombat = false;
+	UPROPERTY(EditAnywhere, Category = "Output")
+	bool bInDanger = false;
+	/** Hurt, dodging, rolling, attacking or in the air; nothing new should start. */
+	UPROPERTY(EditAnywhere, Category = "Output")
+	bool bIsBusy = false;
+	UPROPERTY(EditAnywhere, Category = "Output")
+	bool bTargetAttackingMe = false;
+	UPROPERTY(EditAnywhere, Category = "Output")
+	bool bShouldFlee = false;
+	UPROPERTY(EditAnywhere, Category = "Output")
+	bool bIsFlankUnit = false;
+
+	float NextMemoryReadTime = 0;
+};
+
+/** Publishes the enemy's combat situation for transitions and task inputs. */
+USTRUCT(meta = (DisplayName = "Enemy Combat State", Category = "Ealond|Combat"))
+struct EALOND_API FEnemyCombatEvaluator : public FStateTreeEvaluatorCommonBase
+{
+	GENERATED_BODY()
+
+	using FInstanceDataType = FEnemyCombatEvaluatorInstanceData;
+
+	virtual const UStruct* GetInstanceDataType() const override {return FInstanceDataType::StaticStruct();}
+	virtual void TreeStart(FStateTreeExecutionContext& Context) const override;
+	virtual void Tick(FStateTreeExecutionContext& Context, const float DeltaTime) const override;
+
+	// memory queries walk the remembered enemies, so they are refreshed at this rate rather than every tick
+	static constexpr float MemoryReadInterval = .25f;
+};
+
+USTRUCT()
+struct FEnemyCombatDecisionTaskInstanceData
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, Category = "Context")
+	TObjectPtr<AEnemyAIController> Controller = nullptr;
+
+	UPROPERTY(EditAnywhere, Category = "Input")
+	TObjectPtr<AActor> Target = nullptr;
+
+	UPROPERTY(EditAnywhere, Category = "Output")
+	TEnumAsByte<ECombatDecision> Decision = ECD_NoAttack;
+};
+
+/** Rolls the controller's combat decision against the target without acting on it; fails on no attack. */
+USTRUCT(meta = (DisplayName = "Enemy Combat Decision", Category = "Ealond|Combat"))
+struct EALOND_API FEnemyCombatDecisionTask : public FStateTreeTaskCommonBase
+{
+	GENERATED_BODY()
+
+	using FInstanceDataType = FEnemyCombatDecisionTaskInstanceData;
+
+	virtual const UStruct* GetInstanceDataType() const override {return FInstanceDataType::StaticStruct();}
+	virtual EStateTreeRunStatus EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const override;
+};
+
+USTRUCT()
+struct FEnemyAttackTaskInstanceData
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, Category = "Context")
+	TObjectPtr<AEnemyAIController> Controller = nullptr;
+
+	UPROPERTY(EditAnywhere, Category = "Input")
+	TObjectPtr<AActor> Target = nullptr;
+
+	/** Close or distance attack. */
+	UPROPERTY(EditAnywhere, Category = "Parameter")
+	TEnumAsByte<ECombatDecision> Decision = ECD_CloseAttack;
+
+	/** Gives up if the attack flags haven't cleared by then. */
+	UPROPERTY(EditAnywhere, Category = "Parameter")
+	float MaxDuration = 3.f;
+
+	float Elapsed = 0;
+};
+
+/** Attacks the target and runs until the character's attack is over. */
+USTRUCT(meta = (DisplayName = "Enemy Attack", Category = "Ealond|Combat"))
+struct EALOND_API FEnemyAttackTask : public FStateTreeTaskCommonBase
+{
+	GENERATED_BODY()
+
+	using FInstanceDataType = FEnemyAttackTaskInstanceData;
+
+	virtual const UStruct* GetInstanceDataType() const override {return FInstanceDataType::StaticStruct();}
+	virtual EStateTreeRunStatus EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const override;
+	virtual EStateTreeRunStatus Tick(FStateTreeExecutionContext& Context, const float DeltaTime) const override;
+};
+
+USTRUCT()
+struct FEnemyBlockTaskInstanceData
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, Category = "Context")
+	TObjectPtr<AEnemyAIController> Controller = nullptr;
+
+	UPROPERTY(EditAnywhere, Category = "Input")
+	TObjectPtr<AActor> Target = nullptr;
+};
+
+/** Raises the block while the target swings at us; the block drops if the state is left early. */
+USTRUCT(meta = (DisplayName = "Enemy Block", Category = "Ealond|Combat"))
+struct EALOND_API FEnemyBlockTask : public FStateTreeTaskCommonBase
+{
+	GENERATED_BODY()
+
+	using FInstanceDataType = FEnemyBlockTaskInstanceData;
+
+	virtual const UStruct* GetInstanceDataType() const override {return FInstanceDataType::StaticStruct();}
+	virtual EStateTreeRunStatus EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const override;
+	virtual EStateTreeRunStatus Tick(FStateTreeExecutionContext& Context, const float DeltaTime) const override;
+	virtual void ExitState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const override;
+};
+
+USTRUCT()
+struct FEnemyDodgeTaskInstanceData
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, Category = "Context")
+	TObjectPtr<AEnemyAIController> Controller = nullptr;
+
+	/** Roll instead of hop away; if unset, picked at random as the combat decision does. */
+	UPROPERTY(EditAnywhere, Category = "Parameter")
+	bool bRandomRoll = true;
+	UPROPERTY(EditAnywhere, Category = "Parameter", meta = (EditCondition = "!bRandomRoll"))
+	bool bCanRoll = false;
+
+	UPROPERTY(EditAnywhere, Category = "Parameter")
+	float MaxDuration = 2.f;
+
+	float Elapsed = 0;
+};
+
+/** Dodges out of the way; fails straight away if no direction is clear. */
+USTRUCT(meta = (DisplayName = "Enemy Dodge", Category = "Ealond|Combat"))
+struct EALOND_API FEnemyDodgeTask : public FStateTreeTaskCommonBase
+{
+	GENERATED_BODY()
+
+	using FInstanceDataType = FEnemyDodgeTaskInstanceData;
+
+	virtual const UStruct* GetInstanceDataType() const override {return FInstanceDataType::StaticStruct();}
+	virtual EStateTreeRunStatus EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const override;
+	virtual EStateTreeRunStatus Tick(FStateTreeExecutionContext& Context, const float DeltaTime) const override;
+};
+
+USTRUCT()
+struct FEnemyFleeTaskInstanceData
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, Category = "Context")
+	TObjectPtr<AEnemyAIController> Controller = nullptr;
+
+	/** What to run from; usually bound to the evaluator's nearest enemy. */
+	UPROPERTY(EditAnywhere, Category = "Input")
+	TObjectPtr<AActor> Threat = nullptr;
+
+	UPROPERTY(EditAnywhere, Category = "Parameter")
+	float FleeDistance = 1500.f;
+	UPROPERTY(EditAnywhere, Category = "Parameter")
+	float AcceptanceRadius = 100.f;
+};
+
+/** Runs directly away from the threat to a point on the navmesh; succeeds on arrival. */
+USTRUCT(meta = (DisplayName = "Enemy Flee", Category = "Ealond|Combat"))
+struct EALOND_API FEnemyFleeTask : public FStateTreeTaskCommonBase
+{
+	GENERATED_BODY()
+
+	using FInstanceDataType = FEnemyFleeTaskInstanceData;
+
+	virtual const UStruct* GetInstanceDataType() const override {return FInstanceDataType::StaticStruct();}
+	virtual EStateTreeRunStatus EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const override;
+	virtual EStateTreeRunStatus Tick(FStateTreeExecutionContext& Context, const float DeltaTime) const override;
+	virtual void ExitState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const override;
+};
+
+USTRUCT()
+struct FEnemyMarchTaskInstanceData
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, Category = "Context")
+	TObjectPtr<AEnemyAIController> Controller = nullptr;
+
+	UPROPERTY(EditAnywhere, Category = "Parameter")
+	float AcceptanceRadius = 100.f;
+};
+
+/** Follows the monument flow field while there is nothing to fight; never finishes on its own. */
+USTRUCT(meta = (DisplayName = "Enemy March", Category = "Ealond|Combat"))
+struct EALOND_API FEnemyMarchTask : public FStateTreeTaskCommonBase
+{
+	GENERATED_BODY()
+
+	using FInstanceDataType = FEnemyMarchTaskInstanceData;
+
+	virtual const UStruct* GetInstanceDataType() const override {return FInstanceDataType::StaticStruct();}
+	virtual EStateTreeRunStatus EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const override;
+	virtual EStateTreeRunStatus Tick(FStateTreeExecutionContext& Context, const float DeltaTime) const override;
+};
@@ -0,0 +1,248 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "EvadeFeasibilitySubsystem.h"
+#include "AITraceSubsystem.h"
+#include "GroundHeightSubsystem.h"
+#include "SiegeOccupancySubsystem.h"
+
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Evade feasibility entries"), STAT_EvadeEntries, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Evade feasibility probes"), STAT_EvadeProbes, STATGROUP_EalondAI);
+
+namespace EvadeFeasibility
+{
+	static constexpr int32 MaxProbesPerTick = 16;
+	// entries in use are re-probed this often to pick up moved props and doors
+	static constexpr float RefreshAge = 2.f;
+	// entries nobody has asked for in this long are dropped
+	static constexpr float EvictAge = 10.f;
+}
+
+void UEvadeFeasibilitySubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	TraceSubsystem = Collection.InitializeDependency<UAITraceSubsystem>();
+	GroundHeights = Collection.InitializeDependency<UGroundHeightSubsystem>();
+	OccupancyMap = Collection.InitializeDependency<USiegeOccupancySubsystem>();
+	if (OccupancyMap)
+	{
+		OccupancyChangedHandle = OccupancyMap->OnOccupancyChanged.AddUObject(this, &UEvadeFeasibilitySubsystem::OnOccupancyChanged);
+	}
+}
+
+void UEvadeFeasibilitySubsystem::Deinitialize()
+{
+	if (OccupancyMap) OccupancyMap->OnOccupancyChanged.Remove(OccupancyChangedHandle);
+	if (TraceSubsystem)
+	{
+		for (const TPair<uint64, FEvadeFeasibility>& Pair : Entries)
+		{
+			TraceSubsystem->CancelBatch(Pair.Value.PendingBatch);
+		}
+	}
+	Entries.Empty();
+	PendingKeys.Empty();
+
+	Super::Deinitialize();
+}
+
+TStatId UEvadeFeasibilitySubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UEvadeFeasibilitySubsystem, STATGROUP_Tickables);
+}
+
+uint64 UEvadeFeasibilitySubsystem::MakeKey(const FVector& Location, float Yaw)
+{
+	// 24 bits each for X and Y cells, 12 for the height layer, 4 for the facing sector
+	const uint64 CellX = uint64(FMath::FloorToInt32(Location.X / CellSize)) & 0xFFFFFF;
+	const uint64 CellY = uint64(FMath::FloorToInt32(Location.Y / CellSize)) & 0xFFFFFF;
+	const uint64 Layer = uint64(FMath::FloorToInt32(Location.Z / LayerHeight)) & 0xFFF;
+	const float SectorSize = 360.f / FacingSectors;
+	const uint64 Sector = uint64(FMath::RoundToInt32(FRotator::ClampAxis(Yaw) / SectorSize) % FacingSectors);
+	return CellX << 40 | CellY << 16 | Layer << 4 | Sector;
+}
+
+FVector UEvadeFeasibilitySubsystem::GetLandingPoint(const FVector& Location, float Yaw, EEvadeDirection Dir)
+{
+	const FRotator Facing(0, Yaw, 0);
+	switch (Dir)
+	{
+	case EEvadeDirection::Left:
+		return Location + FRotationMatrix(Facing).GetUnitAxis(EAxis::Y) * -DodgeDistance;
+	case EEvadeDirection::Right:
+		return Location + FRotationMatrix(Facing).GetUnitAxis(EAxis::Y) * DodgeDistance;
+	default:
+		return Location + Facing.Vector() * -DodgeDistance;
+	}
+}
+
+const FEvadeFeasibility* UEvadeFeasibilitySubsystem::Query(const FVector& Location, float Yaw)
+{
+	const uint64 Key = MakeKey(Location, Yaw);
+	const float Now = GetWorld()->GetTimeSeconds();
+	FEvadeFeasibility* Entry = Entries.Find(Key);
+	if (!Entry)
+	{
+		Entry = &Entries.Add(Key);
+		Entry->ProbeLocation = FVector((FMath::FloorToFloat(Location.X / CellSize) + .5f) * CellSize, (FMath::FloorToFloat(Location.Y / CellSize) + .5f) * CellSize, Location.Z);
+		Entry->ProbeYaw = (Key & 0xF) * (360.f / FacingSectors);
+		SET_DWORD_STAT(STAT_EvadeEntries, Entries.Num());
+	}
+	Entry->LastQueryTime = Now;
+	if (!Entry->bQueued && !Entry->PendingBatch && (!Entry->IsBuilt() || Now - Entry->BuildTime > EvadeFeasibility::RefreshAge))
+	{
+		QueueProbe(Key, *Entry);
+	}
+	// a stale entry is still the best answer until its refresh lands
+	return Entry->IsBuilt() ? Entry : nullptr;
+}
+
+void UEvadeFeasibilitySubsystem::ProbeNow(const FVector& Location, float Yaw, FEvadeFeasibility& OUT_Result) const
+{
+	OUT_Result = FEvadeFeasibility();
+	OUT_Result.ProbeLocation = Location;
+	OUT_Result.ProbeYaw = Yaw;
+	UWorld* World = GetWorld();
+	// same query as the async probe, so both answers agree
+	const FCollisionQueryParams Params(SCENE_QUERY_STAT(EvadeProbe), false);
+	FCollisionResponseParams ResponseParams;
+	ResponseParams.CollisionResponse.SetResponse(ECC_Pawn, ECR_Ignore);
+	for (int32 Dir = 0; Dir < int32(EEvadeDirection::MAX); Dir++)
+	{
+		const FVector LandingPoint = GetLandingPoint(Location, Yaw, EEvadeDirection(Dir));
+		FHitResult ObstacleHit;
+		World->LineTraceSingleByChannel(ObstacleHit, Location, LandingPoint, ECC_Visibility, Params, ResponseParams);
+		const bool bBlocked = ObstacleHit.bBlockingHit && ObstacleHit.GetActor() && ObstacleHit.Distance < ObstacleReach;
+		bool bHasGround = false;
+		float GroundZ;
+		if (GroundHeights && GroundHeights->TryGetHeight(LandingPoint, EGroundHeightLayer::Ground, GroundZ))
+		{
+			OUT_Result.LandingZ[Dir] = GroundZ;
+			bHasGround = FMath::Abs(GroundZ - LandingPoint.Z) <= GroundReach;
+		}
+		else
+		{
+			FHitResult GroundHit;
+			bHasGround = World->LineTraceSingleByChannel(GroundHit, LandingPoint + FVector(0, 0, GroundReach), LandingPoint - FVector(0, 0, GroundReach), ECC_Visibility, Params, ResponseParams);
+			OUT_Result.LandingZ[Dir] = GroundHit.Location.Z;
+		}
+		if (bHasGround && !bBlocked) OUT_Result.ClearMask |= 1 << Dir;
+	}
+	OUT_Result.BuildTime = World->GetTimeSeconds();
+}
+
+void UEvadeFeasibilitySubsystem::QueueProbe(uint64 Key, FEvadeFeasibility& Entry)
+{
+	Entry.bQueued = true;
+	PendingKeys.Add(Key);
+}
+
+void UEvadeFeasibilitySubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	int32 NumSubmitted = 0;
+	int32 NumConsumed = 0;
+	for (; NumConsumed < PendingKeys.Num() && NumSubmitted < EvadeFeasibility::MaxProbesPerTick; NumConsumed++)
+	{
+		const uint64 Key = PendingKeys[NumConsumed];
+		// entry may have been evicted or invalidated while it waited
+		FEvadeFeasibility* Entry = Entries.Find(Key);
+		if (!Entry || !Entry->bQueued) continue;
+		Entry->bQueued = false;
+		SubmitProbe(Key, *Entry);
+		++NumSubmitted;
+	}
+	PendingKeys.RemoveAt(0, NumConsumed, false);
+
+	const float Now = GetWorld()->GetTimeSeconds();
+	if (Now - LastEvictionTime > 1.f)
+	{
+		LastEvictionTime = Now;
+		for (auto It = Entries.CreateIterator(); It; ++It)
+		{
+			const FEvadeFeasibility& Entry = It.Value();
+			if (!Entry.bQueued && !Entry.PendingBatch && Now - Entry.LastQueryTime > EvadeFeasibility::EvictAge) It.RemoveCurrent();
+		}
+		SET_DWORD_STAT(STAT_EvadeEntries, Entries.Num());
+	}
+}
+
+void UEvadeFeasibilitySubsystem::SubmitProbe(uint64 Key, FEvadeFeasibility& Entry)
+{
+	if (!TraceSubsystem) return;
+	FVector LandingPoints[int32(EEvadeDirection::MAX)];
+	TArray<FAITraceRequest> Requests;
+	for (int32 Dir = 0; Dir < int32(EEvadeDirection::MAX); Dir++)
+	{
+		LandingPoints[Dir] = GetLandingPoint(Entry.ProbeLocation, Entry.ProbeYaw, EEvadeDirection(Dir));
+		Requests.Emplace(Entry.ProbeLocation, LandingPoints[Dir], ECC_Visibility);
+	}
+	// ground comes from the height cache; only directions it can't answer yet get a vertical trace
+	FVector CachedGroundZ(NAN, NAN, NAN);
+	for (int32 Dir = 0; Dir < int32(EEvadeDirection::MAX); Dir++)
+	{
+		float GroundZ;
+		if (GroundHeights && GroundHeights->TryGetHeight(LandingPoints[Dir], EGroundHeightLayer::Ground, GroundZ))
+		{
+			CachedGroundZ[Dir] = GroundZ;
+		}
+		else
+		{
+			Requests.Emplace(LandingPoints[Dir] + FVector(0, 0, GroundReach), LandingPoints[Dir] - FVector(0, 0, GroundReach), ECC_Visibility);
+		}
+	}
+	// the cached answer is shared by the whole crowd, so it must not depend on where other pawns stand
+	FCollisionResponseParams ResponseParams;
+	ResponseParams.CollisionResponse.SetResponse(ECC_Pawn, ECR_Ignore);
+	Entry.PendingBatch = TraceSubsystem->RequestTraces(Requests, FCollisionQueryParams(SCENE_QUERY_STAT(EvadeProbe), false),
+		FOnAITraceBatchComplete::CreateUObject(this, &UEvadeFeasibilitySubsystem::OnProbeComplete, Key, CachedGroundZ), ResponseParams);
+	INC_DWORD_STAT(STAT_EvadeProbes);
+}
+
+void UEvadeFeasibilitySubsystem::OnProbeComplete(const TArray<FHitResult>& Results, uint64 Key, FVector CachedGroundZ)
+{
+	FEvadeFeasibility* Entry = Entries.Find(Key);
+	if (!Entry) return;
+	Entry->PendingBatch = 0;
+	Entry->ClearMask = 0;
+	int32 GroundTraceIndex = int32(EEvadeDirection::MAX);
+	for (int32 Dir = 0; Dir < int32(EEvadeDirection::MAX); Dir++)
+	{
+		bool bHasGround = false;
+		const float LandingZ = GetLandingPoint(Entry->ProbeLocation, Entry->ProbeYaw, EEvadeDirection(Dir)).Z;
+		if (!FMath::IsNaN(CachedGroundZ[Dir]))
+		{
+			Entry->LandingZ[Dir] = CachedGroundZ[Dir];
+			bHasGround = FMath::Abs(CachedGroundZ[Dir] - LandingZ) <= GroundReach;
+		}
+		else
+		{
+			const FHitResult& GroundHit = Results[GroundTraceIndex++];
+			Entry->LandingZ[Dir] = GroundHit.Location.Z;
+			bHasGround = GroundHit.bBlockingHit;
+		}
+		const FHitResult& ObstacleHit = Results[Dir];
+		const bool bBlocked = ObstacleHit.bBlockingHit && ObstacleHit.GetActor() && ObstacleHit.Distance < ObstacleReach;
+		if (bHasGround && !bBlocked) Entry->ClearMask |= 1 << Dir;
+	}
+	Entry->BuildTime = GetWorld()->GetTimeSeconds();
+}
+
+void UEvadeFeasibilitySubsystem::OnOccupancyChanged(const FIntRect& ChangedCells)
+{
+	if (ChangedCells.IsEmpty()) return;
+	// any entry whose evades could reach into the changed footprint is re-probed from scratch
+	const float Margin = USiegeOccupancySubsystem::CellSize / 2.f + DodgeDistance;
+	const FVector Min = OccupancyMap->CellToWorld(ChangedCells.Min) - FVector(Margin, Margin, 0);
+	const FVector Max = OccupancyMap->CellToWorld(ChangedCells.Max - FIntPoint(1, 1)) + FVector(Margin, Margin, 0);
+	const FBox2D Area(FVector2D(Min), FVector2D(Max));
+	for (auto It = Entries.CreateIterator(); It; ++It)
+	{
+		if (!Area.IsInside(FVector2D(It.Value().ProbeLocation))) continue;
+		if (TraceSubsystem) TraceSubsystem->CancelBatch(It.Value().PendingBatch);
+		It.RemoveCurrent();
+	}
+	SET_DWORD_STAT(STAT_EvadeEntries, Entries.Num());
+}
@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "EvadeFeasibilitySubsystem.generated.h"
+
+class UAITraceSubsystem;
+class UGroundHeightSubsystem;
+class USiegeOccupancySubsystem;
+
+/** Dodge directions in the order AEnemyAIController::Dodge uses them. */
+enum class EEvadeDirection : uint8
+{
+	Left,
+	Right,
+	Back,
+	MAX,
+};
+
+/** Which evades out of a spot are free of static obstacles, and the ground height where each lands. */
+struct FEvadeFeasibility
+{
+	// cell centre at the height of the first AI to ask, and the sector's facing; every probe for the key starts here
+	FVector ProbeLocation = FVector::ZeroVector;
+	float ProbeYaw = 0;
+	float LandingZ[int32(EEvadeDirection::MAX)] = {0, 0, 0};
+	float BuildTime = -1.f;
+	float LastQueryTime = 0;
+	uint32 PendingBatch = 0;
+	bool bQueued = false;
+	// bit per direction: no static obstacle within reach and ground found at the landing point
+	uint8 ClearMask = 0;
+
+	bool IsBuilt() const {return BuildTime >= 0;}
+	bool IsClear(EEvadeDirection Dir) const {return (ClearMask & (1 << int32(Dir))) != 0;}
+};
+
+/**
+ * Evade feasibility shared by every AI, keyed by quantized position and facing. The first query for a key
+ * queues an async obstacle probe; later queries are a map lookup. Until it lands, callers can run the same
+ * probe synchronously with ProbeNow. Entries refresh in the background while
+ * they are in use, expire when nothing asks for them, and are dropped when buildings change nearby.
+ * Pawns are not part of the cached result; callers check them against the crowd around them.
+ */
+UCLASS()
+class EALOND_API UEvadeFeasibilitySubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/** Returns the entry for the spot, or nullptr until its first probe has come back. Queues a probe for missing or stale entries. */
+	const FEvadeFeasibility* Query(const FVector& Location, float Yaw);
+	/** The probe Query queues, run now from exactly Location and not cached; for a spot whose cached entry hasn't landed yet. */
+	void ProbeNow(const FVector& Location, float Yaw, FEvadeFeasibility& OUT_Result) const;
+
+	/** Landing point of an evade from Location at Yaw, DodgeDistance away. */
+	static FVector GetLandingPoint(const FVector& Location, float Yaw, EEvadeDirection Dir);
+
+	static constexpr float CellSize = 100.f;
+	static constexpr float LayerHeight = 200.f;
+	static constexpr int32 FacingSectors = 16;
+	static constexpr float DodgeDistance = 500.f;
+	// matches the old per-dodge obstacle check: anything closer than this blocks the direction
+	static constexpr float ObstacleReach = 400.f;
+	// ground further than this above or below the landing point counts as none
+	static constexpr float GroundReach = 350.f;
+
+private:
+	static uint64 MakeKey(const FVector& Location, float Yaw);
+
+	void QueueProbe(uint64 Key, FEvadeFeasibility& Entry);
+	void SubmitProbe(uint64 Key, FEvadeFeasibility& Entry);
+	/** CachedGroundZ holds the height cache's answer per direction, NaN where a ground trace was added to the batch instead. */
+	void OnProbeComplete(const TArray<FHitResult>& Results, uint64 Key, FVector CachedGroundZ);
+	void OnOccupancyChanged(const FIntRect& ChangedCells);
+
+	TMap<uint64, FEvadeFeasibility> Entries;
+	// keys waiting for a probe slot; probes are spread over frames
+	TArray<uint64> PendingKeys;
+	float LastEvictionTime = 0;
+
+	UPROPERTY()
+	TObjectPtr<UAITraceSubsystem> TraceSubsystem;
+	UPROPERTY()
+	TObjectPtr<UGroundHeightSubsystem> GroundHeights;
+	UPROPERTY()
+	TObjectPtr<USiegeOccupancySubsystem> OccupancyMap;
+	FDelegateHandle OccupancyChangedHandle;
+};
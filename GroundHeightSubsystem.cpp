@@ -0,0 +1,254 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GroundHeightSubsystem.h"
+#include "AITraceSubsystem.h"
+#include "SiegeOccupancySubsystem.h"
+#include "EngineUtils.h"
+#include "LandscapeProxy.h"
+#include "GameFramework/Pawn.h"
+
+DECLARE_CYCLE_STAT(TEXT("Ground height tile build"), STAT_GroundHeightTileBuild, STATGROUP_EalondAI);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Ground height tiles cached"), STAT_GroundHeightTiles, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Ground height cache misses"), STAT_GroundHeightMisses, STATGROUP_EalondAI);
+
+namespace GroundHeight
+{
+	// tiles built per frame; a tile is 33 x 33 heightmap samples plus traces only where static geometry overlaps
+	static constexpr int32 MaxTilesPerTick = 2;
+	static constexpr float StaticQueryHalfHeight = 100000.f;
+	// seconds before a tile with missing samples is rebuilt; tiles off the edge of the map stay incomplete for good
+	static constexpr double MissingRetryDelay = 2.0;
+}
+
+void UGroundHeightSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	OccupancyMap = Collection.InitializeDependency<USiegeOccupancySubsystem>();
+	if (OccupancyMap)
+	{
+		OccupancyChangedHandle = OccupancyMap->OnOccupancyChanged.AddUObject(this, &UGroundHeightSubsystem::OnOccupancyChanged);
+	}
+}
+
+void UGroundHeightSubsystem::Deinitialize()
+{
+	if (OccupancyMap) OccupancyMap->OnOccupancyChanged.Remove(OccupancyChangedHandle);
+	InvalidateAll();
+	{
+		FScopeLock Lock(&PendingLock);
+		PendingTiles.Empty();
+		PendingSet.Empty();
+	}
+
+	Super::Deinitialize();
+}
+
+TStatId UGroundHeightSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGroundHeightSubsystem, STATGROUP_Tickables);
+}
+
+bool UGroundHeightSubsystem::TryGetHeight(const FVector& Location, EGroundHeightLayer Layer, float& OUT_Height) const
+{
+	{
+		FReadScopeLock ReadLock(TilesLock);
+		if (SampleLocked(Location.X, Location.Y, Layer, OUT_Height)) return true;
+	}
+	INC_DWORD_STAT(STAT_GroundHeightMisses);
+	RequestTile(GetTileCoord(Location.X, Location.Y));
+	return false;
+}
+
+int32 UGroundHeightSubsystem::GetHeights(TConstArrayView<FVector> Locations, EGroundHeightLayer Layer, TArray<float>& OUT_Heights) const
+{
+	OUT_Heights.SetNumUninitialized(Locations.Num());
+	TArray<FIntPoint, TInlineAllocator<8>> MissedTiles;
+	{
+		FReadScopeLock ReadLock(TilesLock);
+		for (int32 i = 0; i < Locations.Num(); i++)
+		{
+			if (!SampleLocked(Locations[i].X, Locations[i].Y, Layer, OUT_Heights[i]))
+			{
+				OUT_Heights[i] = NAN;
+				MissedTiles.AddUnique(GetTileCoord(Locations[i].X, Locations[i].Y));
+			}
+		}
+	}
+	int32 NumMisses = 0;
+	for (float Height : OUT_Heights)
+	{
+		if (FMath::IsNaN(Height)) ++NumMisses;
+	}
+	INC_DWORD_STAT_BY(STAT_GroundHeightMisses, NumMisses);
+	for (const FIntPoint& TileCoord : MissedTiles)
+	{
+		RequestTile(TileCoord);
+	}
+	return NumMisses;
+}
+
+bool UGroundHeightSubsystem::SampleLocked(float X, float Y, EGroundHeightLayer Layer, float& OUT_Height) const
+{
+	const FIntPoint TileCoord = GetTileCoord(X, Y);
+	const TUniquePtr<FHeightTile>* Tile = Tiles.Find(TileCoord);
+	if (!Tile) return false;
+	const float* Heights = Layer == EGroundHeightLayer::Landscape ? (*Tile)->Landscape : (*Tile)->Ground;
+	// bilinear between the four samples around the point; the border row means X0 + 1 is always in the tile
+	const float U = (X - TileCoord.X * TileSize) / SampleSpacing;
+	const float V = (Y - TileCoord.Y * TileSize) / SampleSpacing;
+	const int32 X0 = FMath::Clamp(FMath::FloorToInt32(U), 0, TileCells - 1);
+	const int32 Y0 = FMath::Clamp(FMath::FloorToInt32(V), 0, TileCells - 1);
+	const float FracX = U - X0;
+	const float FracY = V - Y0;
+	const int32 Index = Y0 * FHeightTile::Stride + X0;
+	const float H00 = Heights[Index];
+	const float H10 = Heights[Index + 1];
+	const float H01 = Heights[Index + FHeightTile::Stride];
+	const float H11 = Heights[Index + FHeightTile::Stride + 1];
+	// any missing corner means the cache doesn't know this spot; NaN propagates through the blend
+	OUT_Height = FMath::BiLerp(H00, H10, H01, H11, FracX, FracY);
+	return !FMath::IsNaN(OUT_Height);
+}
+
+void UGroundHeightSubsystem::RequestTile(const FIntPoint& TileCoord) const
+{
+	FScopeLock Lock(&PendingLock);
+	bool bAlreadyPending = false;
+	PendingSet.Add(TileCoord, &bAlreadyPending);
+	if (!bAlreadyPending) PendingTiles.Add(TileCoord);
+}
+
+void UGroundHeightSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	for (int32 i = 0; i < GroundHeight::MaxTilesPerTick; i++)
+	{
+		FIntPoint TileCoord;
+		{
+			FScopeLock Lock(&PendingLock);
+			if (PendingTiles.IsEmpty()) break;
+			TileCoord = PendingTiles[0];
+			PendingTiles.RemoveAt(0, 1, false);
+			PendingSet.Remove(TileCoord);
+		}
+		{
+			// complete tiles are never rebuilt on a miss, incomplete ones only once the landscape has had time to stream
+			FReadScopeLock ReadLock(TilesLock);
+			const TUniquePtr<FHeightTile>* Existing = Tiles.Find(TileCoord);
+			if (Existing && (!(*Existing)->bHasMissingSamples || GetWorld()->GetTimeSeconds() - (*Existing)->BuildTime < GroundHeight::MissingRetryDelay)) continue;
+		}
+		TUniquePtr<FHeightTile> Tile = MakeUnique<FHeightTile>();
+		BuildTile(TileCoord, *Tile);
+		FWriteScopeLock WriteLock(TilesLock);
+		Tiles.Add(TileCoord, MoveTemp(Tile));
+		SET_DWORD_STAT(STAT_GroundHeightTiles, Tiles.Num());
+	}
+}
+
+float UGroundHeightSubsystem::SampleLandscape(const TArray<ALandscapeProxy*>& Landscapes, float X, float Y)
+{
+	for (ALandscapeProxy* Landscape : Landscapes)
+	{
+		TOptional<float> Height = Landscape->GetHeightAtLocation(FVector(X, Y, 0));
+		if (Height.IsSet()) return Height.GetValue();
+	}
+	return NAN;
+}
+
+void UGroundHeightSubsystem::BuildTile(const FIntPoint& TileCoord, FHeightTile& OUT_Tile) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_GroundHeightTileBuild);
+	UWorld* World = GetWorld();
+	const FVector2D TileOrigin(TileCoord.X * TileSize, TileCoord.Y * TileSize);
+	const FBox2D TileBox(TileOrigin, TileOrigin + FVector2D(TileSize, TileSize));
+	OUT_Tile.bHasMissingSamples = false;
+	OUT_Tile.BuildTime = World->GetTimeSeconds();
+
+	TArray<ALandscapeProxy*> Landscapes;
+	for (TActorIterator<ALandscapeProxy> It(World); It; ++It)
+	{
+		Landscapes.Add(*It);
+	}
+
+	// gather bounds of the static geometry over the tile so only samples under it pay for a trace
+	FCollisionObjectQueryParams ObjectParams;
+	ObjectParams.AddObjectTypesToQuery(ECC_WorldStatic);
+	ObjectParams.AddObjectTypesToQuery(ECC_WorldDynamic);
+	TArray<FOverlapResult> Overlaps;
+	const FVector2D TileCentre = TileBox.GetCenter();
+	World->OverlapMultiByObjectType(Overlaps, FVector(TileCentre.X, TileCentre.Y, 0), FQuat::Identity, ObjectParams,
+		FCollisionShape::MakeBox(FVector(TileSize / 2.f + SampleSpacing, TileSize / 2.f + SampleSpacing, GroundHeight::StaticQueryHalfHeight)));
+	TArray<FBox> StaticBounds;
+	for (const FOverlapResult& Overlap : Overlaps)
+	{
+		const UPrimitiveComponent* Component = Overlap.GetComponent();
+		const AActor* Owner = Overlap.GetActor();
+		if (!Component || !Owner || Owner->IsA(ALandscapeProxy::StaticClass()) || Owner->IsA(APawn::StaticClass())) continue;
+		StaticBounds.Add(Component->Bounds.GetBox());
+	}
+
+	FCollisionQueryParams Params(SCENE_QUERY_STAT(GroundHeightTile), false);
+	for (int32 Y = 0; Y < FHeightTile::Stride; Y++)
+	{
+		for (int32 X = 0; X < FHeightTile::Stride; X++)
+		{
+			const int32 Index = Y * FHeightTile::Stride + X;
+			const float SampleX = TileOrigin.X + X * SampleSpacing;
+			const float SampleY = TileOrigin.Y + Y * SampleSpacing;
+			const float LandscapeZ = SampleLandscape(Landscapes, SampleX, SampleY);
+			OUT_Tile.Landscape[Index] = LandscapeZ;
+			OUT_Tile.Ground[Index] = LandscapeZ;
+			if (FMath::IsNaN(LandscapeZ))
+			{
+				OUT_Tile.bHasMissingSamples = true;
+				continue;
+			}
+			float TopZ = -MAX_flt;
+			for (const FBox& Bounds : StaticBounds)
+			{
+				if (SampleX >= Bounds.Min.X && SampleX <= Bounds.Max.X && SampleY >= Bounds.Min.Y && SampleY <= Bounds.Max.Y) TopZ = FMath::Max(TopZ, Bounds.Max.Z);
+			}
+			if (TopZ <= LandscapeZ) continue;
+			FHitResult Hit;
+			if (World->LineTraceSingleByObjectType(Hit, FVector(SampleX, SampleY, TopZ + 10.f), FVector(SampleX, SampleY, LandscapeZ), ObjectParams, Params))
+			{
+				OUT_Tile.Ground[Index] = FMath::Max(LandscapeZ, Hit.ImpactPoint.Z);
+			}
+		}
+	}
+}
+
+void UGroundHeightSubsystem::InvalidateArea(const FBox2D& Area)
+{
+	// samples on a tile edge are shared with the neighbour, so pad by one sample
+	const FIntPoint MinTile = GetTileCoord(Area.Min.X - SampleSpacing, Area.Min.Y - SampleSpacing);
+	const FIntPoint MaxTile = GetTileCoord(Area.Max.X + SampleSpacing, Area.Max.Y + SampleSpacing);
+	FWriteScopeLock WriteLock(TilesLock);
+	for (int32 Y = MinTile.Y; Y <= MaxTile.Y; Y++)
+	{
+		for (int32 X = MinTile.X; X <= MaxTile.X; X++)
+		{
+			Tiles.Remove(FIntPoint(X, Y));
+		}
+	}
+	SET_DWORD_STAT(STAT_GroundHeightTiles, Tiles.Num());
+}
+
+void UGroundHeightSubsystem::InvalidateAll()
+{
+	FWriteScopeLock WriteLock(TilesLock);
+	Tiles.Empty();
+	SET_DWORD_STAT(STAT_GroundHeightTiles, 0);
+}
+
+void UGroundHeightSubsystem::OnOccupancyChanged(const FIntRect& ChangedCells)
+{
+	if (ChangedCells.IsEmpty()) return;
+	const float HalfCell = USiegeOccupancySubsystem::CellSize / 2.f;
+	const FVector Min = OccupancyMap->CellToWorld(ChangedCells.Min) - FVector(HalfCell, HalfCell, 0);
+	const FVector Max = OccupancyMap->CellToWorld(ChangedCells.Max - FIntPoint(1, 1)) + FVector(HalfCell, HalfCell, 0);
+	InvalidateArea(FBox2D(FVector2D(Min), FVector2D(Max)));
+}
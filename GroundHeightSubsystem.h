@@ -0,0 +1,85 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "GroundHeightSubsystem.generated.h"
+
+class ALandscapeProxy;
+class USiegeOccupancySubsystem;
+
+enum class EGroundHeightLayer : uint8
+{
+	// landscape heightmap only, what GetLandscapeHeightAtLocation used to trace for
+	Landscape,
+	// highest of landscape and static geometry, including buildings
+	Ground,
+};
+
+/**
+ * Tiled cache of ground heights sampled from the landscape heightmaps plus static geometry. Tiles are built
+ * lazily on the game thread the first time they are queried and dropped when buildings are placed or
+ * destroyed over them. Queries are lock-shared reads and safe from any thread; a miss returns false and
+ * queues the tile, so callers fall back to a trace that one time. Tiles built before their landscape streamed
+ * in are kept, but a miss on one rebuilds it again after a short wait.
+ */
+UCLASS()
+class EALOND_API UGroundHeightSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/** Bilinear height at the location's XY. Returns false on a cache miss. Thread-safe. */
+	bool TryGetHeight(const FVector& Location, EGroundHeightLayer Layer, float& OUT_Height) const;
+
+	/** Samples every location under one lock. Misses are written as NaN; returns the number of misses. Thread-safe. */
+	int32 GetHeights(TConstArrayView<FVector> Locations, EGroundHeightLayer Layer, TArray<float>& OUT_Heights) const;
+
+	/** Drops every tile overlapping the box so it is rebuilt on next query. */
+	void InvalidateArea(const FBox2D& Area);
+	void InvalidateAll();
+
+	// 32 x 32 cells of 100 units per tile, stored with a shared border row so sampling never crosses tiles
+	static constexpr int32 TileCells = 32;
+	static constexpr float SampleSpacing = 100.f;
+	static constexpr float TileSize = TileCells * SampleSpacing;
+
+private:
+	struct FHeightTile
+	{
+		static constexpr int32 Stride = TileCells + 1;
+		// NaN where no ground was found, e.g. landscape section not loaded
+		float Landscape[Stride * Stride];
+		float Ground[Stride * Stride];
+		// some landscape sample was missing when built; a miss on the tile retries it after MissingRetryDelay
+		bool bHasMissingSamples = false;
+		double BuildTime = 0;
+	};
+
+	FIntPoint GetTileCoord(float X, float Y) const {return FIntPoint(FMath::FloorToInt32(X / TileSize), FMath::FloorToInt32(Y / TileSize));}
+	/** Caller holds TilesLock for reading. */
+	bool SampleLocked(float X, float Y, EGroundHeightLayer Layer, float& OUT_Height) const;
+	void RequestTile(const FIntPoint& TileCoord) const;
+	/** Game thread only; uses world collision queries. */
+	void BuildTile(const FIntPoint& TileCoord, FHeightTile& OUT_Tile) const;
+	static float SampleLandscape(const TArray<ALandscapeProxy*>& Landscapes, float X, float Y);
+	void OnOccupancyChanged(const FIntRect& ChangedCells);
+
+	TMap<FIntPoint, TUniquePtr<FHeightTile>> Tiles;
+	mutable FRWLock TilesLock;
+
+	// tiles queried but not yet built; filled from any thread, drained on the game thread
+	mutable TArray<FIntPoint> PendingTiles;
+	mutable TSet<FIntPoint> PendingSet;
+	mutable FCriticalSection PendingLock;
+
+	UPROPERTY()
+	TObjectPtr<USiegeOccupancySubsystem> OccupancyMap;
+	FDelegateHandle OccupancyChangedHandle;
+};
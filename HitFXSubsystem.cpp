@@ -0,0 +1,204 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "HitFXSubsystem.h"
+#include "AITraceSubsystem.h"
+#include "NiagaraComponent.h"
+#include "NiagaraSystem.h"
+#include "Components/AudioComponent.h"
+#include "Engine/Engine.h"
+#include "GameFramework/PlayerController.h"
+#include "Sound/SoundBase.h"
+
+DECLARE_CYCLE_STAT(TEXT("Hit FX spawn"), STAT_HitFXSpawn, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Hit FX requested"), STAT_HitFXRequested, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Hit FX spawned"), STAT_HitFXSpawned, STATGROUP_EalondAI);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Hit FX culled"), STAT_HitFXCulled, STATGROUP_EalondAI);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Hit FX pooled components"), STAT_HitFXPooled, STATGROUP_EalondAI);
+
+static TAutoConsoleVariable<int32> CVarHitFXBudget(
+	TEXT("fx.HitFX.Budget"),
+	8,
+	TEXT("Most impact FX and sounds started per frame; the least significant of the frame's impacts are dropped."));
+
+static TAutoConsoleVariable<float> CVarHitFXMaxDistance(
+	TEXT("fx.HitFX.MaxDistance"),
+	4000.f,
+	TEXT("Impacts further than this from the local view are dropped without being queued."));
+
+namespace HitFX
+{
+	// added to the significance of the local player's own hits, so they always win the budget
+	static constexpr float LocalPlayerBoost = 1.f;
+	// impacts behind the camera are heard rather than seen
+	static constexpr float BehindViewScale = .5f;
+	// frame requests kept beyond the budget; past this the least significant is replaced
+	static constexpr int32 MaxPending = 64;
+}
+
+bool UHitFXSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	// nobody is watching on a dedicated server
+	return !IsRunningDedicatedServer() && Super::ShouldCreateSubsystem(Outer);
+}
+
+void UHitFXSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	if (InWorld.GetNetMode() == NM_DedicatedServer) return;
+	for (const FHitFXPoolSettings& Settings : Pools)
+	{
+		UNiagaraSystem* System = Settings.System.LoadSynchronous();
+		USoundBase* Sound = Settings.Sound.LoadSynchronous();
+		if ((!System && !Sound) || Settings.PoolSize <= 0) continue;
+
+		FPool& Pool = ActivePools.AddDefaulted_GetRef();
+		Pool.ImpactMaterial = Settings.ImpactMaterial;
+		Pool.First = NiagaraComponents.Num();
+		Pool.Num = Settings.PoolSize;
+		for (int32 i = 0; i < Settings.PoolSize; i++)
+		{
+			UNiagaraComponent* FX = nullptr;
+			if (System)
+			{
+				FX = NewObject<UNiagaraComponent>(&InWorld);
+				FX->SetAutoDestroy(false);
+				FX->SetAutoActivate(false);
+				FX->SetAsset(System);
+				FX->RegisterComponentWithWorld(&InWorld);
+			}
+			NiagaraComponents.Add(FX);
+
+			UAudioComponent* Audio = nullptr;
+			if (Sound)
+			{
+				Audio = NewObject<UAudioComponent>(&InWorld);
+				Audio->bAutoDestroy = false;
+				Audio->bAutoActivate = false;
+				Audio->SetSound(Sound);
+				Audio->RegisterComponentWithWorld(&InWorld);
+			}
+			AudioComponents.Add(Audio);
+		}
+	}
+	Pending.Reserve(HitFX::MaxPending);
+	SET_DWORD_STAT(STAT_HitFXPooled, NiagaraComponents.Num());
+}
+
+void UHitFXSubsystem::Deinitialize()
+{
+	for (UNiagaraComponent* FX : NiagaraComponents)
+	{
+		if (FX) FX->DestroyComponent();
+	}
+	for (UAudioComponent* Audio : AudioComponents)
+	{
+		if (Audio) Audio->DestroyComponent();
+	}
+	NiagaraComponents.Empty();
+	AudioComponents.Empty();
+	ActivePools.Empty();
+	Pending.Empty();
+	SET_DWORD_STAT(STAT_HitFXPooled, 0);
+
+	Super::Deinitialize();
+}
+
+TStatId UHitFXSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UHitFXSubsystem, STATGROUP_Tickables);
+}
+
+void UHitFXSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	if (Pending.IsEmpty()) return;
+	SCOPE_CYCLE_COUNTER(STAT_HitFXSpawn);
+	const int32 Budget = FMath::Max(CVarHitFXBudget.GetValueOnGameThread(), 0);
+	if (Pending.Num() > Budget)
+	{
+		Pending.Sort([](const FPendingImpact& Left, const FPendingImpact& Right) {return Left.Significance > Right.Significance;});
+		INC_DWORD_STAT_BY(STAT_HitFXCulled, Pending.Num() - Budget);
+	}
+	for (int32 i = 0; i < Pending.Num() && i < Budget; i++)
+	{
+		Spawn(Pending[i]);
+	}
+	Pending.Reset();
+}
+
+bool UHitFXSubsystem::PlayImpact(UWorld* World, const FFXData& FXData, const AActor* Instigator)
+{
+	UHitFXSubsystem* HitFX = World ? World->GetSubsystem<UHitFXSubsystem>() : nullptr;
+	return HitFX && HitFX->QueueImpact(FXData, Instigator);
+}
+
+bool UHitFXSubsystem::QueueImpact(const FFXData& FXData, const AActor* Instigator)
+{
+	const int32 Pool = ActivePools.IndexOfByPredicate([&FXData](const FPool& Candidate) {return Candidate.ImpactMaterial == FXData.ImpactMaterial;});
+	if (Pool == INDEX_NONE) return false;
+	INC_DWORD_STAT(STAT_HitFXRequested);
+
+	// significance falls off with distance from the view, and by half behind it
+	const APlayerController* LocalPlayer = GEngine->GetFirstLocalPlayerController(GetWorld());
+	if (!LocalPlayer)
+	{
+		INC_DWORD_STAT(STAT_HitFXCulled);
+		return true;
+	}
+	FVector ViewLocation;
+	FRotator ViewRotation;
+	LocalPlayer->GetPlayerViewPoint(ViewLocation, ViewRotation);
+	const FVector ToImpact = FXData.HitLocation - ViewLocation;
+	const float MaxDistance = CVarHitFXMaxDistance.GetValueOnGameThread();
+	const float Distance = ToImpact.Size();
+	if (Distance > MaxDistance)
+	{
+		INC_DWORD_STAT(STAT_HitFXCulled);
+		return true;
+	}
+	float Significance = 1.f - Distance / FMath::Max(MaxDistance, 1.f);
+	if ((ToImpact | ViewRotation.Vector()) < 0) Significance *= HitFX::BehindViewScale;
+	if (Instigator && (Instigator == LocalPlayer->GetPawn() || Instigator == LocalPlayer)) Significance += HitFX::LocalPlayerBoost;
+
+	FPendingImpact Impact;
+	Impact.Pool = Pool;
+	Impact.Location = FXData.HitLocation;
+	Impact.Normal = FXData.HitNormal.IsNearlyZero() ? FVector::UpVector : FXData.HitNormal;
+	Impact.Significance = Significance;
+	if (Pending.Num() < HitFX::MaxPending)
+	{
+		Pending.Add(Impact);
+		return true;
+	}
+	int32 Weakest = 0;
+	for (int32 i = 1; i < Pending.Num(); i++)
+	{
+		if (Pending[i].Significance < Pending[Weakest].Significance) Weakest = i;
+	}
+	if (Pending[Weakest].Significance < Significance) Pending[Weakest] = Impact;
+	INC_DWORD_STAT(STAT_HitFXCulled);
+	return true;
+}
+
+void UHitFXSubsystem::Spawn(const FPendingImpact& Impact)
+{
+	// the slot used longest ago is taken over, cutting its effect short if it's still playing
+	FPool& Pool = ActivePools[Impact.Pool];
+	const int32 Slot = Pool.First + Pool.Next;
+	Pool.Next = (Pool.Next + 1) % Pool.Num;
+	INC_DWORD_STAT(STAT_HitFXSpawned);
+
+	if (UNiagaraComponent* FX = NiagaraComponents[Slot])
+	{
+		FX->SetWorldLocationAndRotation(Impact.Location, Impact.Normal.Rotation());
+		FX->Activate(true);
+	}
+	if (UAudioComponent* Audio = AudioComponents[Slot])
+	{
+		Audio->SetWorldLocation(Impact.Location);
+		Audio->Play();
+	}
+}
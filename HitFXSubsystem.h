@@ -0,0 +1,86 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "../Interfaces/FXAudioInterface.h"
+#include "HitFXSubsystem.generated.h"
+
+class UAudioComponent;
+class UNiagaraComponent;
+class UNiagaraSystem;
+class USoundBase;
+
+/** Impact FX and sound for one impact material, with how many of each to keep ready. */
+USTRUCT()
+struct FHitFXPoolSettings
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	TEnumAsByte<EImpactMaterial> ImpactMaterial;
+	UPROPERTY()
+	TSoftObjectPtr<UNiagaraSystem> System;
+	UPROPERTY()
+	TSoftObjectPtr<USoundBase> Sound;
+	UPROPERTY()
+	int32 PoolSize = 8;
+};
+
+/**
+ * Pooled impact FX and audio for hits, keyed by impact material and set up under
+ * [/Script/Ealond.HitFXSubsystem] in the game ini. Every component is created at begin play and reused
+ * oldest first, so a big fight spawns no new objects. Impacts requested during a frame are scored by
+ * distance and direction from the local view, and by whether the local player dealt them. The best
+ * fx.HitFX.Budget of them play at the end of the frame and the rest are dropped. Not created on dedicated
+ * servers, where impacts go through PlayFXOnHit as before.
+ */
+UCLASS(Config = Game)
+class EALOND_API UHitFXSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/** Queues the impact if its material has a pool; false if the caller should play it some other way. */
+	static bool PlayImpact(UWorld* World, const FFXData& FXData, const AActor* Instigator);
+
+private:
+	struct FPool
+	{
+		EImpactMaterial ImpactMaterial;
+		// this pool's slice of NiagaraComponents and AudioComponents
+		int32 First = 0;
+		int32 Num = 0;
+		int32 Next = 0;
+	};
+
+	struct FPendingImpact
+	{
+		int32 Pool = INDEX_NONE;
+		FVector Location = FVector::ZeroVector;
+		FVector Normal = FVector::UpVector;
+		float Significance = 0;
+	};
+
+	bool QueueImpact(const FFXData& FXData, const AActor* Instigator);
+	void Spawn(const FPendingImpact& Impact);
+
+	UPROPERTY(Config)
+	TArray<FHitFXPoolSettings> Pools;
+
+	// one entry per pooled slot; either may be null where a material has no FX or no sound
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UNiagaraComponent>> NiagaraComponents;
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UAudioComponent>> AudioComponents;
+
+	TArray<FPool> ActivePools;
+	TArray<FPendingImpact> Pending;
+};
@@ -0,0 +1,344 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "HordeSimulationSubsystem.h"
+#include "AIBaseCharacter.h"
+#include "AIPoolSubsystem.h"
+#include "AITraceSubsystem.h"
+#include "EnemyAIController.h"
+#include "GroundHeightSubsystem.h"
+#include "SiegeFlowFieldSubsystem.h"
+#include "SiegeOccupancySubsystem.h"
+#include "StatusEffectSubsystem.h"
+#include "Villager.h"
+#include "Components/CapsuleComponent.h"
+#include "EngineUtils.h"
+#include "GameFramework/CharacterMovementComponent.h"
+#include "../Buildings/Building.h"
+
+DECLARE_CYCLE_STAT(TEXT("Horde simulation"), STAT_HordeSimulation, STATGROUP_EalondAI);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Horde simulated agents"), STAT_HordeAgents, STATGROUP_EalondAI);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Horde full AI"), STAT_HordeFullAI, STATGROUP_EalondAI);
+
+namespace HordeSimulation
+{
+	// players and villagers move, so their anchors are re-gathered this often
+	static constexpr float AnchorRefreshInterval = .5f;
+	// promotions spawn or activate an actor each, so only a few per frame
+	static constexpr int32 MaxPromotionsPerTick = 4;
+	static constexpr int32 MaxDemotionsPerTick = 2;
+	// full AI checked for demotion per frame
+	static constexpr int32 DemoteChecksPerTick = 32;
+	// a promoted AI stays full for at least this long, so agents on the edge of the radius don't flicker
+	static constexpr float MinFullTime = 10.f;
+	// flow cells followed per step; agents aim a little ahead so they round corners the way a path would
+	static constexpr int32 FlowLookahead = 2;
+}
+
+void UHordeSimulationSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	OccupancyMap = Collection.InitializeDependency<USiegeOccupancySubsystem>();
+	FlowField = Collection.InitializeDependency<USiegeFlowFieldSubsystem>();
+	GroundHeights = Collection.InitializeDependency<UGroundHeightSubsystem>();
+	if (OccupancyMap)
+	{
+		OccupancyChangedHandle = OccupancyMap->OnOccupancyChanged.AddUObject(this, &UHordeSimulationSubsystem::OnOccupancyChanged);
+	}
+}
+
+void UHordeSimulationSubsystem::Deinitialize()
+{
+	if (OccupancyMap) OccupancyMap->OnOccupancyChanged.Remove(OccupancyChangedHandle);
+	Agents.Empty();
+	Memories.Empty();
+	FullAI.Empty();
+	AnchorBuckets.Empty();
+
+	Super::Deinitialize();
+}
+
+TStatId UHordeSimulationSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UHordeSimulationSubsystem, STATGROUP_Tickables);
+}
+
+void UHordeSimulationSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	SCOPE_CYCLE_COUNTER(STAT_HordeSimulation);
+	if (GetWorld()->GetTimeSeconds() - AnchorRefreshTime > HordeSimulation::AnchorRefreshInterval) RefreshAnchors();
+	MoveAgents(DeltaTime);
+	PromoteAgents();
+	DemoteFullAI();
+	SET_DWORD_STAT(STAT_HordeAgents, Agents.Num());
+	SET_DWORD_STAT(STAT_HordeFullAI, FullAI.Num());
+}
+
+uint16 UHordeSimulationSubsystem::FindOrAddClass(UClass* PawnClass)
+{
+	const int32 Existing = PawnClasses.IndexOfByKey(PawnClass);
+	if (Existing != INDEX_NONE) return uint16(Existing);
+	const AAIBaseCharacter* Defaults = PawnClass->GetDefaultObject<AAIBaseCharacter>();
+	FHordeClass& Class = Classes.AddDefaulted_GetRef();
+	Class.Speed = Defaults->GetCharacterMovement()->MaxWalkSpeed;
+	Class.HalfHeight = Defaults->GetCapsuleComponent()->GetScaledCapsuleHalfHeight();
+	return uint16(PawnClasses.Add(PawnClass));
+}
+
+void UHordeSimulationSubsystem::AddAgent(TSubclassOf<AAIBaseCharacter> PawnClass, const FTransform& SpawnTransform)
+{
+	if (!PawnClass) return;
+	FHordeAgent& Agent = Agents.AddDefaulted_GetRef();
+	Agent.Location = FVector3f(SpawnTransform.GetLocation());
+	Agent.Yaw = SpawnTransform.Rotator().Yaw;
+	Agent.ClassIndex = FindOrAddClass(PawnClass);
+}
+
+bool UHordeSimulationSubsystem::IsDistant(const FVector& Location)
+{
+	// agents march on the occupancy grid around the monument; until a full AI has built it there is nothing to follow
+	if (!OccupancyMap || !OccupancyMap->IsBuilt()) return false;
+	if (AnchorRefreshTime < 0) RefreshAnchors();
+	return GetNearestAnchorDistSquared(Location) > FMath::Square(PromoteRadius);
+}
+
+void UHordeSimulationSubsystem::RegisterFullAI(AEnemyAIController* Controller)
+{
+	if (!Controller || FullAI.ContainsByPredicate([Controller](const FFullAI& Entry) {return Entry.Controller.Get() == Controller;})) return;
+	FFullAI& Entry = FullAI.AddDefaulted_GetRef();
+	Entry.Controller = Controller;
+	Entry.RegisterTime = GetWorld()->GetTimeSeconds();
+}
+
+void UHordeSimulationSubsystem::UnregisterFullAI(AEnemyAIController* Controller)
+{
+	FullAI.RemoveAllSwap([Controller](const FFullAI& Entry) {return !Entry.Controller.IsValid() || Entry.Controller.Get() == Controller;});
+}
+
+FIntPoint UHordeSimulationSubsystem::GetBucket(const FVector& Location) const
+{
+	return FIntPoint(FMath::FloorToInt32(Location.X / DemoteRadius), FMath::FloorToInt32(Location.Y / DemoteRadius));
+}
+
+void UHordeSimulationSubsystem::AddAnchor(const FBox& Bounds)
+{
+	if (!Bounds.IsValid) return;
+	const int32 AnchorIndex = Anchors.Add(Bounds);
+	const FIntPoint Min = GetBucket(Bounds.Min - FVector(DemoteRadius));
+	const FIntPoint Max = GetBucket(Bounds.Max + FVector(DemoteRadius));
+	for (int32 Y = Min.Y; Y <= Max.Y; Y++)
+	{
+		for (int32 X = Min.X; X <= Max.X; X++)
+		{
+			AnchorBuckets.FindOrAdd(FIntPoint(X, Y)).Add(AnchorIndex);
+		}
+	}
+}
+
+void UHordeSimulationSubsystem::RefreshBuildingAnchors()
+{
+	BuildingBounds.Reset();
+	bBuildingAnchorsDirty = false;
+	if (OccupancyMap && OccupancyMap->GetMonument()) BuildingBounds.Add(OccupancyMap->GetMonument()->GetComponentsBoundingBox());
+	for (TActorIterator<ABuilding> It(GetWorld()); It; ++It)
+	{
+		BuildingBounds.Add(It->GetComponentsBoundingBox());
+	}
+}
+
+void UHordeSimulationSubsystem::RefreshAnchors()
+{
+	UWorld* World = GetWorld();
+	AnchorRefreshTime = World->GetTimeSeconds();
+	if (bBuildingAnchorsDirty) RefreshBuildingAnchors();
+	Anchors.Reset();
+	for (TPair<FIntPoint, TArray<int32>>& Pair : AnchorBuckets)
+	{
+		Pair.Value.Reset();
+	}
+	for (const FBox& Bounds : BuildingBounds)
+	{
+		AddAnchor(Bounds);
+	}
+	for (FConstPlayerControllerIterator It = World->GetPlayerControllerIterator(); It; ++It)
+	{
+		if (const APawn* PlayerPawn = It->IsValid() ? (*It)->GetPawn() : nullptr) AddAnchor(FBox(PlayerPawn->GetActorLocation(), PlayerPawn->GetActorLocation()));
+	}
+	for (TActorIterator<AVillager> It(World); It; ++It)
+	{
+		AddAnchor(FBox(It->GetActorLocation(), It->GetActorLocation()));
+	}
+}
+
+float UHordeSimulationSubsystem::GetNearestAnchorDistSquared(const FVector& Location) const
+{
+	const TArray<int32>* Bucket = AnchorBuckets.Find(GetBucket(Location));
+	if (!Bucket) return MAX_flt;
+	float NearestDistSquared = MAX_flt;
+	for (int32 AnchorIndex : *Bucket)
+	{
+		// ground distance; a player on a wall is as close as one at its foot
+		const FBox& Bounds = Anchors[AnchorIndex];
+		const FVector Closest = Bounds.GetClosestPointTo(FVector(Location.X, Location.Y, Bounds.GetCenter().Z));
+		NearestDistSquared = FMath::Min(NearestDistSquared, FVector::DistSquared2D(Closest, Location));
+	}
+	return NearestDistSquared;
+}
+
+void UHordeSimulationSubsystem::MoveAgents(float DeltaTime)
+{
+	AActor* Monument = OccupancyMap ? OccupancyMap->GetMonument() : nullptr;
+	if (!Monument || Agents.IsEmpty()) return;
+	if (FlowField) FlowField->EnsureBuilt(Monument);
+	const bool bHasFlow = FlowField && FlowField->IsReady();
+	const FVector MonumentLocation = Monument->GetActorLocation();
+	HeightQueries.Reset(Agents.Num());
+	for (FHordeAgent& Agent : Agents)
+	{
+		const FVector Location(Agent.Location);
+		// no route on the flow field (or none yet): head straight for the monument and let promotion sort it out
+		FVector Goal = bHasFlow ? FlowField->GetFlowGoal(Location, HordeSimulation::FlowLookahead) : MonumentLocation;
+		if (Goal.Equals(Location, 1.f)) Goal = MonumentLocation;
+		const FVector Direction = (Goal - Location).GetSafeNormal2D();
+		const float Step = FMath::Min(Classes[Agent.ClassIndex].Speed * DeltaTime, FVector::Dist2D(Goal, Location));
+		const FVector NewLocation = Location + Direction * Step;
+		Agent.Location = FVector3f(NewLocation);
+		if (!Direction.IsNearlyZero()) Agent.Yaw = Direction.Rotation().Yaw;
+		HeightQueries.Add(NewLocation);
+	}
+	if (!GroundHeights) return;
+	// one lock for the whole horde; on a miss the agent keeps its height until the tile is built
+	GroundHeights->GetHeights(HeightQueries, EGroundHeightLayer::Ground, Heights);
+	for (int32 i = 0; i < Agents.Num(); i++)
+	{
+		if (!FMath::IsNaN(Heights[i])) Agents[i].Location.Z = Heights[i] + Classes[Agents[i].ClassIndex].HalfHeight;
+	}
+}
+
+void UHordeSimulationSubsystem::PromoteAgents()
+{
+	int32 NumPromotions = 0;
+	for (int32 i = Agents.Num() - 1; i >= 0 && NumPromotions < HordeSimulation::MaxPromotionsPerTick; i--)
+	{
+		if (GetNearestAnchorDistSquared(FVector(Agents[i].Location)) > FMath::Square(PromoteRadius)) continue;
+		const FHordeAgent Agent = Agents[i];
+		Agents.RemoveAtSwap(i, 1, false);
+		++NumPromotions;
+		if (Promote(Agent)) continue;
+		// keep it simulated rather than lose it; it lands past i, so it is tried again next tick, not this one
+		UE_LOG(LogTemp, Warning, TEXT("Horde simulation: failed to promote a %s, keeping it in the horde"), *PawnClasses[Agent.ClassIndex]->GetName());
+		Agents.Add(Agent);
+	}
+}
+
+bool UHordeSimulationSubsystem::Promote(const FHordeAgent& Agent)
+{
+	const FTransform SpawnTransform(FRotator(0, Agent.Yaw, 0), FVector(Agent.Location));
+	AAIBaseCharacter* Pawn = nullptr;
+	if (UAIPoolSubsystem* Pool = GetWorld()->GetSubsystem<UAIPoolSubsystem>())
+	{
+		Pawn = Pool->Acquire(PawnClasses[Agent.ClassIndex], SpawnTransform);
+	}
+	else
+	{
+		FActorSpawnParameters Params;
+		Params.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButAlwaysSpawn;
+		Pawn = GetWorld()->SpawnActor<AAIBaseCharacter>(PawnClasses[Agent.ClassIndex], SpawnTransform, Params);
+		if (Pawn && !Pawn->GetController()) Pawn->SpawnDefaultController();
+	}
+	AEnemyAIController* Controller = Pawn ? Cast<AEnemyAIController>(Pawn->GetController()) : nullptr;
+	if (!Controller)
+	{
+		// the agent stays in the horde, so don't leave a body standing in for it
+		if (Pawn) Pawn->Destroy();
+		return false;
+	}
+	// only taken once the promotion can't fail, so an agent kept in the horde keeps what it knew
+	FHordeMemory Memory;
+	if (Agent.MemoryId != INDEX_NONE) Memories.RemoveAndCopyValue(Agent.MemoryId, Memory);
+	Controller->ResumeFromHorde();
+	if (Pawn->MemoryComp) Pawn->MemoryComp->RestoreHordeMemory(Memory);
+	// the pool hands pawns back at full health; a wounded attacker comes back as wounded as it left
+	if (Memory.RemainingHealth > 0) Pawn->SetHealth(Memory.RemainingHealth);
+	++NumPromoted;
+	return true;
+}
+
+void UHordeSimulationSubsystem::DemoteFullAI()
+{
+	// controllers destroyed without unpossessing (level teardown, pool trims) never unregister
+	FullAI.RemoveAllSwap([](const FFullAI& Entry) {return !Entry.Controller.IsValid();});
+	if (FullAI.IsEmpty()) return;
+	const float Now = GetWorld()->GetTimeSeconds();
+	int32 NumDemotions = 0;
+	const int32 NumChecks = FMath::Min(HordeSimulation::DemoteChecksPerTick, FullAI.Num());
+	TArray<AEnemyAIController*, TInlineAllocator<HordeSimulation::MaxDemotionsPerTick>> ToDemote;
+	for (int32 Check = 0; Check < NumChecks && ToDemote.Num() < HordeSimulation::MaxDemotionsPerTick; Check++)
+	{
+		NextDemoteCheck = NextDemoteCheck % FullAI.Num();
+		const FFullAI& Entry = FullAI[NextDemoteCheck++];
+		AEnemyAIController* Controller = Entry.Controller.Get();
+		if (!Controller || Now - Entry.RegisterTime < HordeSimulation::MinFullTime || !Controller->CanDemoteToHorde()) continue;
+		if (GetNearestAnchorDistSquared(Controller->GetPawn()->GetActorLocation()) > FMath::Square(DemoteRadius)) ToDemote.Add(Controller);
+	}
+	// demoting unpossesses, which unregisters from FullAI, so it can't happen mid-scan
+	for (AEnemyAIController* Controller : ToDemote)
+	{
+		Demote(Controller);
+	}
+}
+
+void UHordeSimulationSubsystem::Demote(AEnemyAIController* Controller)
+{
+	AAIBaseCharacter* Pawn = Cast<AAIBaseCharacter>(Controller->GetPawn());
+	if (!Pawn) return;
+	FHordeAgent& Agent = Agents.AddDefaulted_GetRef();
+	Agent.Location = FVector3f(Pawn->GetActorLocation());
+	Agent.Yaw = Pawn->GetActorRotation().Yaw;
+	Agent.ClassIndex = FindOrAddClass(Pawn->GetClass());
+	if (Pawn->MemoryComp)
+	{
+		FHordeMemory Memory;
+		Pawn->MemoryComp->SaveHordeMemory(Memory);
+		Agent.MemoryId = NextMemoryId++;
+		Memories.Add(Agent.MemoryId, MoveTemp(Memory));
+	}
+	// burns and bleeds don't carry over into the simulation
+	if (UStatusEffectSubsystem* StatusEffects = GetWorld()->GetSubsystem<UStatusEffectSubsystem>()) StatusEffects->ClearEffects(Pawn);
+	++NumDemoted;
+	// the controller hands the pair back to the pool, or destroys it if there isn't one
+	Controller->DemoteToHorde();
+}
+
+void UHordeSimulationSubsystem::OnOccupancyChanged(const FIntRect& ChangedCells)
+{
+	// buildings only change on placement and destruction; gathering them again is cheap at that rate
+	bBuildingAnchorsDirty = true;
+	AnchorRefreshTime = -MAX_flt;
+}
+
+void UHordeSimulationSubsystem::DumpStats() const
+{
+	TArray<int32> PerClass;
+	PerClass.SetNumZeroed(PawnClasses.Num());
+	for (const FHordeAgent& Agent : Agents)
+	{
+		++PerClass[Agent.ClassIndex];
+	}
+	for (int32 i = 0; i < PawnClasses.Num(); i++)
+	{
+		UE_LOG(LogTemp, Log, TEXT("Horde simulation: %s, %d simulated"), PawnClasses[i] ? *PawnClasses[i]->GetName() : TEXT("none"), PerClass[i]);
+	}
+	UE_LOG(LogTemp, Log, TEXT("Horde simulation: %d simulated, %d full, %d with memory, %d promoted, %d demoted"), Agents.Num(), FullAI.Num(), Memories.Num(), NumPromoted, NumDemoted);
+}
+
+static FAutoConsoleCommandWithWorld CVarDumpHordeStats(
+	TEXT("ai.Horde.Stats"),
+	TEXT("Log simulated horde agent counts and promotion and demotion totals."),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+		{
+			if (UHordeSimulationSubsystem* Horde = World ? World->GetSubsystem<UHordeSimulationSubsystem>() : nullptr) Horde->DumpStats();
+		}));
@@ -0,0 +1,132 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "../Components/MemoryComponentBase.h"
+#include "HordeSimulationSubsystem.generated.h"
+
+class AAIBaseCharacter;
+class AEnemyAIController;
+class ABuilding;
+class UGroundHeightSubsystem;
+class USiegeFlowFieldSubsystem;
+class USiegeOccupancySubsystem;
+
+/** What a demoted AI remembers while it is simulated, handed back to its memory component on promotion. */
+struct FHordeMemory
+{
+	TArray<TPair<TWeakObjectPtr<AActor>, FAbsoluteEnemyData>> Enemies;
+	TArray<TPair<TWeakObjectPtr<ABuilding>, FAIBuildingData>> Buildings;
+	float RemainingHealth = -1.f;
+};
+
+/**
+ * Cheap simulation tier for attackers far from anything they could fight. Distant AI are kept as packed
+ * records marching along the monument flow field with no actor, perception, animation or behaviour tree.
+ * They are promoted to a full pawn and controller, taken from the AI pool, when a player, villager or
+ * building comes within PromoteRadius. Full AI with nothing to fight are demoted again once everything is
+ * beyond DemoteRadius.
+ */
+UCLASS()
+class EALOND_API UHordeSimulationSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/** Adds a simulated agent at the transform. */
+	void AddAgent(TSubclassOf<AAIBaseCharacter> PawnClass, const FTransform& SpawnTransform);
+
+	/** True if nothing the AI could fight is within PromoteRadius, so it can start out simulated. False until the siege grid is built. */
+	bool IsDistant(const FVector& Location);
+
+	/** Full AI register while possessed so they can be demoted when far from everything. */
+	void RegisterFullAI(AEnemyAIController* Controller);
+	void UnregisterFullAI(AEnemyAIController* Controller);
+
+	int32 GetNumAgents() const {return Agents.Num();}
+	/** Logs agent counts per class and promotion and demotion totals. */
+	void DumpStats() const;
+
+	// promoted when something is this close, demoted once everything is further than this
+	static constexpr float PromoteRadius = 4000.f;
+	static constexpr float DemoteRadius = 6000.f;
+
+private:
+	/** One simulated AI. Kept small; a siege holds over a thousand of these. */
+	struct FHordeAgent
+	{
+		FVector3f Location;
+		float Yaw = 0;
+		int32 MemoryId = INDEX_NONE;
+		uint16 ClassIndex = 0;
+	};
+
+	struct FHordeClass
+	{
+		float Speed = 0;
+		float HalfHeight = 0;
+	};
+
+	struct FFullAI
+	{
+		TWeakObjectPtr<AEnemyAIController> Controller;
+		float RegisterTime = 0;
+	};
+
+	uint16 FindOrAddClass(UClass* PawnClass);
+	void RefreshAnchors();
+	void RefreshBuildingAnchors();
+	void AddAnchor(const FBox& Bounds);
+	/** Squared distance from the location to the nearest anchor within DemoteRadius, or MAX_flt. */
+	float GetNearestAnchorDistSquared(const FVector& Location) const;
+	FIntPoint GetBucket(const FVector& Location) const;
+
+	void MoveAgents(float DeltaTime);
+	void PromoteAgents();
+	void DemoteFullAI();
+	bool Promote(const FHordeAgent& Agent);
+	void Demote(AEnemyAIController* Controller);
+
+	void OnOccupancyChanged(const FIntRect& ChangedCells);
+
+	UPROPERTY()
+	TObjectPtr<USiegeOccupancySubsystem> OccupancyMap;
+	UPROPERTY()
+	TObjectPtr<USiegeFlowFieldSubsystem> FlowField;
+	UPROPERTY()
+	TObjectPtr<UGroundHeightSubsystem> GroundHeights;
+
+	TArray<FHordeAgent> Agents;
+	// simulated agents hold the only reference to their class between waves
+	UPROPERTY()
+	TArray<TSubclassOf<AAIBaseCharacter>> PawnClasses;
+	TArray<FHordeClass> Classes;
+	TMap<int32, FHordeMemory> Memories;
+	int32 NextMemoryId = 0;
+
+	// players, villagers and building bounds, anything worth being a full AI near
+	TArray<FBox> Anchors;
+	TArray<FBox> BuildingBounds;
+	// anchors by DemoteRadius-sized bucket, each anchor listed in every bucket its radius reaches
+	TMap<FIntPoint, TArray<int32>> AnchorBuckets;
+	float AnchorRefreshTime = -MAX_flt;
+	bool bBuildingAnchorsDirty = true;
+
+	TArray<FFullAI> FullAI;
+	int32 NextDemoteCheck = 0;
+
+	// scratch for batched height lookups
+	TArray<FVector> HeightQueries;
+	TArray<float> Heights;
+
+	FDelegateHandle OccupancyChangedHandle;
+	int32 NumPromoted = 0;
+	int32 NumDemoted = 0;
+};
@@ -6,6 +6,7 @@
 #include "../AI/EnemyAIController.h"
 #include "../AI/Villager.h"
 #include "../AI/Goblin.h"
+#include "../AI/HordeSimulationSubsystem.h"
 #include "../Framework/EalondGameMode.h"
 #include "../Interfaces/MemoryInterface.h"
 #include "../Player/EalondCharacter.h"
@@ -293,7 +294,7 @@ void UMemoryComponentBase::AddEnemyData(FAbsoluteEnemyData DataToAdd)
 		float RandEngageDelay = FMath::RandRange(.05, .2);
 		FTimerHandle EnterCombatTimer;
 		FTimerDelegate EnterCombatDelegate;
-		EnterCombatDelegate.BindLambda([this]()
+		EnterCombatDelegate.BindWeakLambda(this, [this]()
 			{
 				OwningCharacter->Server_SetInCombatMode(true);
 			});
@@ -416,7 +417,63 @@ void UMemoryComponentBase::LeaveTeam()
 	{
 		for (auto Teammate : GetCurrentTeam())
 		{
-			Teammate->RemoveTeammate(Teammate);
+			Teammate->RemoveTeammate(this);
+		}
+	}
+}
+
+void UMemoryComponentBase::ResetForReuse()
+{
+	// pooled AI come back as a fresh recruit: no team, no memories, and no decay, aggro or engage
+	// timers still running for the last life
+	GetWorld()->GetTimerManager().ClearAllTimersForObject(this);
+	LeaveTeam();
+	CurrentTeam.Empty();
+	TetheredFriendlies.Empty();
+	EnemiesInMemory.Empty();
+	RelativeEnemyData.Empty();
+	TetheredEnemies.Empty();
+	BuildingMap.Empty();
+	BuildingData.Empty();
+	bIsLeader = false;
+	bIsInFormation = false;
+	bAggroEngaged = false;
+	MyData = FAbsoluteEnemyData();
+	MyData.Character = GetOwner();
+	UpdateMyData();
+}
+
+void UMemoryComponentBase::SaveHordeMemory(FHordeMemory& OUT_Memory) const
+{
+	for (const auto& Pair : EnemiesInMemory)
+	{
+		if (Pair.Key) OUT_Memory.Enemies.Emplace(Pair.Key, Pair.Value);
+	}
+	for (const auto& Pair : BuildingMap)
+	{
+		if (Pair.Key) OUT_Memory.Buildings.Emplace(Pair.Key, Pair.Value);
+	}
+	OUT_Memory.RemainingHealth = OwningCharacter ? OwningCharacter->GetHealth() : MyData.RemainingHealth;
+}
+
+void UMemoryComponentBase::RestoreHordeMemory(const FHordeMemory& Memory)
+{
+	// the pool has already reset us; put back what the AI knew before it was demoted, minus anything that has since gone
+	for (const auto& Pair : Memory.Enemies)
+	{
+		AActor* Enemy = Pair.Key.Get();
+		if (!Enemy || EnemiesInMemory.Num() >= 10) continue;
+		EnemiesInMemory.Add(Enemy, Pair.Value);
+		// not perceived on the way back in, so it decays from memory the same as an enemy that just went out of sight
+		FRelativeEnemyData& Data = RelativeEnemyData.Add(Enemy, FRelativeEnemyData(Enemy, false, FTimerHandle(), 0, 0, 0, 0));
+		GetWorld()->GetTimerManager().SetTimer(Data.TimerHandle, FTimerDelegate::CreateUObject(this, &UMemoryComponentBase::DecayMemory, Enemy, Data), 1.f, true, 1.f);
+	}
+	for (const auto& Pair : Memory.Buildings)
+	{
+		if (ABuilding* Building = Pair.Key.Get())
+		{
+			BuildingMap.Add(Building, Pair.Value);
+			BuildingData.Add(Pair.Value);
 		}
 	}
 }
@@ -629,41 +686,28 @@ UMemoryComponentBase* UMemoryComponentBase::GetNearestTeammateTo(AActor* Object,
 }
 
 // TARGET FUNCTIONS
-void UMemoryComponentBase::CheckUnperceivedEnemies(TArray<AActor*> ArrayToCheck)
+void UMemoryComponentBase::UpdatePerceivedEnemies(const TArray<AActor*>& NewlySeen, TFunctionRef<bool(const AActor*)> IsPerceived)
 {
 	if (!RelativeEnemyData.Num()) return;
-	for (auto& SeenActor : ArrayToCheck)
+	for (AActor* SeenActor : NewlySeen)
 	{
-		if (SeenActor && SeenActor->IsValidLowLevelFast())
+		if (FRelativeEnemyData* SeenData = RelativeEnemyData.Find(SeenActor))
 		{
-			if (RelativeEnemyData.Contains(SeenActor))
-			{
-				RelativeEnemyData[SeenActor].bIsCurrentlyPerceived = true;
-				RelativeEnemyData[SeenActor].TimeSincePerceived = 0;
-				if (GetWorld()->GetTimerManager().IsTimerActive(RelativeEnemyData[SeenActor].TimerHandle)) GetWorld()->GetTimerManager().ClearTimer(RelativeEnemyData[SeenActor].TimerHandle);
-			}
+			SeenData->bIsCurrentlyPerceived = true;
+			SeenData->TimeSincePerceived = 0;
+			GetWorld()->GetTimerManager().ClearTimer(SeenData->TimerHandle);
 		}
 	}
-	// compare perceived hostiles with enemies in memory, mark those not present in the latter for decay
-	TArray<AActor*> EnemiesToDecay;
+	// memory holds at most a handful of enemies, so checking each against the perceived set is cheap. This
+	// catches enemies that just left view and ones learned from a teammate that we never saw ourselves
 	for (auto& Pair : RelativeEnemyData)
 	{
-		if (!ArrayToCheck.Contains(Pair.Key))
+		if (!Pair.Value.bIsCurrentlyPerceived || IsPerceived(Pair.Key)) continue;
+		if (Pair.Key && Pair.Key->IsValidLowLevelFast())
 		{
-			EnemiesToDecay.Add(Pair.Key);
-		}
-	}
-
-	if (!EnemiesToDecay.IsEmpty())
-	{
-		// start memory decay
-		for (auto& Enemy : EnemiesToDecay)
-		{
-			if (Enemy && Enemy->IsValidLowLevelFast())
-			{
-				GetWorld()->GetTimerManager().SetTimer(RelativeEnemyData[Enemy].TimerHandle, FTimerDelegate::CreateUObject(this, &UMemoryComponentBase::DecayMemory, Enemy, RelativeEnemyData[Enemy]), 1.f, true, 1.f);
-				RelativeEnemyData[Enemy].bIsCurrentlyPerceived = false;
-			}
+			// start memory decay
+			GetWorld()->GetTimerManager().SetTimer(Pair.Value.TimerHandle, FTimerDelegate::CreateUObject(this, &UMemoryComponentBase::DecayMemory, Pair.Key, Pair.Value), 1.f, true, 1.f);
+			Pair.Value.bIsCurrentlyPerceived = false;
 		}
 	}
 }
@@ -827,7 +871,7 @@ AActor* UMemoryComponentBase::SelectEnemyTarget(AActor* EnemyToIgnore, bool Igno
 		if (AggroTarget)
 		{
 			FTimerDelegate AggroDelegate;
-			AggroDelegate.BindLambda([this]()
+			AggroDelegate.BindWeakLambda(this, [this]()
 				{
 					bAggroEngaged = false;
 				});
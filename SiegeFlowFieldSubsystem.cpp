@@ -0,0 +1,304 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "SiegeFlowFieldSubsystem.h"
+#include "AITraceSubsystem.h"
+#include "SiegeOccupancySubsystem.h"
+#include "NavigationSystem.h"
+#include "../Buildings/Building.h"
+
+DECLARE_CYCLE_STAT(TEXT("Siege flow field rebuild"), STAT_SiegeFlowFieldRebuild, STATGROUP_EalondAI);
+
+namespace SiegeFlowField
+{
+	static const FIntPoint NeighbourOffsets[8] = {FIntPoint(1, 0), FIntPoint(-1, 0), FIntPoint(0, 1), FIntPoint(0, -1), FIntPoint(1, 1), FIntPoint(1, -1), FIntPoint(-1, 1), FIntPoint(-1, -1)};
+	static constexpr uint8 NoDirection = 0xFF;
+}
+
+void USiegeFlowFieldSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	OccupancyMap = Collection.InitializeDependency<USiegeOccupancySubsystem>();
+	if (OccupancyMap)
+	{
+		OccupancyChangedHandle = OccupancyMap->OnOccupancyChanged.AddUObject(this, &USiegeFlowFieldSubsystem::OnOccupancyChanged);
+	}
+}
+
+void USiegeFlowFieldSubsystem::Deinitialize()
+{
+	if (OccupancyMap) OccupancyMap->OnOccupancyChanged.Remove(OccupancyChangedHandle);
+	OpenList.Empty();
+	bHasField = false;
+	Phase = EFlowBuildPhase::Idle;
+
+	Super::Deinitialize();
+}
+
+TStatId USiegeFlowFieldSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(USiegeFlowFieldSubsystem, STATGROUP_Tickables);
+}
+
+void USiegeFlowFieldSubsystem::EnsureBuilt(AActor* Monument)
+{
+	// already built or building
+	if (!Walkable.IsEmpty() || !OccupancyMap || !OccupancyMap->EnsureBuilt(Monument)) return;
+	const int32 NumCells = USiegeOccupancySubsystem::GridDim * USiegeOccupancySubsystem::GridDim;
+	Walkable.Init(false, NumCells);
+	WalkabilityCell = 0;
+	Phase = EFlowBuildPhase::Walkability;
+}
+
+void USiegeFlowFieldSubsystem::OnOccupancyChanged(const FIntRect& ChangedCells)
+{
+	// coalesce every change until the current pass finishes
+	if (!Walkable.IsEmpty()) bRebuildPending = true;
+}
+
+void USiegeFlowFieldSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	SCOPE_CYCLE_COUNTER(STAT_SiegeFlowFieldRebuild);
+	int32 Budget = NodesPerFrame;
+	switch (Phase)
+	{
+	case EFlowBuildPhase::Walkability:
+	{
+		// terrain only; buildings come from the occupancy raster so this never needs redoing
+		UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld());
+		AActor* Monument = OccupancyMap->GetMonument();
+		if (!NavSys || !Monument) return;
+		const FVector QueryExtent(USiegeOccupancySubsystem::CellSize / 2.f, USiegeOccupancySubsystem::CellSize / 2.f, 2000.f);
+		// one projection per cell adds up over the grid, so it is spread over a few seconds rather than a few frames
+		const int32 LastCell = FMath::Min(WalkabilityCell + WalkabilityCellsPerFrame, Walkable.Num());
+		for (; WalkabilityCell < LastCell; WalkabilityCell++)
+		{
+			const FIntPoint Cell(WalkabilityCell % USiegeOccupancySubsystem::GridDim, WalkabilityCell / USiegeOccupancySubsystem::GridDim);
+			FVector CellCentre = OccupancyMap->CellToWorld(Cell);
+			CellCentre.Z = Monument->GetActorLocation().Z;
+			FNavLocation NavLocation;
+			Walkable[WalkabilityCell] = NavSys->ProjectPointToNavigation(CellCentre, NavLocation, QueryExtent);
+		}
+		if (WalkabilityCell >= Walkable.Num()) StartIntegration();
+		break;
+	}
+	case EFlowBuildPhase::Clear:
+		if (StepIntegration(false, Budget))
+		{
+			SeedOpenList(BreachCostBack, OpenList);
+			Phase = EFlowBuildPhase::Breach;
+		}
+		break;
+	case EFlowBuildPhase::Breach:
+		if (StepIntegration(true, Budget)) FinishIntegration();
+		break;
+	case EFlowBuildPhase::Idle:
+		if (bRebuildPending) StartIntegration();
+		break;
+	}
+}
+
+void USiegeFlowFieldSubsystem::StartIntegration()
+{
+	const int32 NumCells = USiegeOccupancySubsystem::GridDim * USiegeOccupancySubsystem::GridDim;
+	bRebuildPending = false;
+	ClearCostBack.Init(MAX_uint32, NumCells);
+	BreachCostBack.Init(MAX_uint32, NumCells);
+	BreachBlockerCellBack.Init(INDEX_NONE, NumCells);
+	SeedOpenList(ClearCostBack, OpenList);
+	Phase = EFlowBuildPhase::Clear;
+}
+
+void USiegeFlowFieldSubsystem::SeedOpenList(TArray<uint32>& Field, TArray<FFlowOpenNode>& Open)
+{
+	Open.Reset();
+	AActor* Monument = OccupancyMap->GetMonument();
+	if (!Monument) return;
+	// every cell under the monument footprint is a goal
+	for (int32 Index = 0; Index < Field.Num(); Index++)
+	{
+		const FIntPoint Cell(Index % USiegeOccupancySubsystem::GridDim, Index / USiegeOccupancySubsystem::GridDim);
+		if (OccupancyMap->GetCellBlocker(Cell) == Monument)
+		{
+			Field[Index] = 0;
+			Open.HeapPush(FFlowOpenNode{0, Index});
+		}
+	}
+	const FIntPoint MonumentCell = OccupancyMap->WorldToCell(Monument->GetActorLocation());
+	if (OccupancyMap->IsValidCell(MonumentCell) && Field[OccupancyMap->CellIndex(MonumentCell)] != 0)
+	{
+		Field[OccupancyMap->CellIndex(MonumentCell)] = 0;
+		Open.HeapPush(FFlowOpenNode{0, OccupancyMap->CellIndex(MonumentCell)});
+	}
+}
+
+uint32 USiegeFlowFieldSubsystem::GetStepCost(int32 CellIndex, bool bAllowBreach, bool bDiagonal) const
+{
+	const uint32 BaseCost = bDiagonal ? uint32(USiegeOccupancySubsystem::CellSize * UE_SQRT_2) : uint32(USiegeOccupancySubsystem::CellSize);
+	const FIntPoint Cell(CellIndex % USiegeOccupancySubsystem::GridDim, CellIndex / USiegeOccupancySubsystem::GridDim);
+	AActor* Blocker = OccupancyMap->GetCellBlocker(Cell);
+	if (Blocker && Blocker != OccupancyMap->GetMonument())
+	{
+		return bAllowBreach ? BaseCost + BreachCostPerCell : MAX_uint32;
+	}
+	// building footprints are usually cut out of the navmesh, so walkability only matters for open ground
+	return Blocker || Walkable[CellIndex] ? BaseCost : MAX_uint32;
+}
+
+bool USiegeFlowFieldSubsystem::StepIntegration(bool bAllowBreach, int32& Budget)
+{
+	TArray<uint32>& Field = bAllowBreach ? BreachCostBack : ClearCostBack;
+	while (OpenList.Num() && Budget-- > 0)
+	{
+		FFlowOpenNode Node;
+		OpenList.HeapPop(Node, false);
+		// stale entry, cell was reached more cheaply after this was pushed
+		if (Node.Cost > Field[Node.Index]) continue;
+		const FIntPoint Cell(Node.Index % USiegeOccupancySubsystem::GridDim, Node.Index / USiegeOccupancySubsystem::GridDim);
+		for (int32 i = 0; i < 8; i++)
+		{
+			const FIntPoint NextCell = Cell + SiegeFlowField::NeighbourOffsets[i];
+			if (!OccupancyMap->IsValidCell(NextCell)) continue;
+			const int32 NextIndex = OccupancyMap->CellIndex(NextCell);
+			const uint32 StepCost = GetStepCost(NextIndex, bAllowBreach, i >= 4);
+			if (StepCost == MAX_uint32) continue;
+			const uint32 NewCost = Node.Cost + StepCost;
+			if (NewCost < Field[NextIndex])
+			{
+				Field[NextIndex] = NewCost;
+				if (bAllowBreach)
+				{
+					// first building met walking from this cell towards the monument
+					AActor* Blocker = OccupancyMap->GetCellBlocker(NextCell);
+					bool bIsBuilding = Blocker && Blocker != OccupancyMap->GetMonument();
+					BreachBlockerCellBack[NextIndex] = bIsBuilding ? NextIndex : BreachBlockerCellBack[Node.Index];
+				}
+				OpenList.HeapPush(FFlowOpenNode{NewCost, NextIndex});
+			}
+		}
+	}
+	return OpenList.IsEmpty();
+}
+
+void USiegeFlowFieldSubsystem::FinishIntegration()
+{
+	Swap(ClearCost, ClearCostBack);
+	Swap(BreachCost, BreachCostBack);
+	Swap(BreachBlockerCell, BreachBlockerCellBack);
+	// direction field follows the walk-around route where there is one, the breach route otherwise
+	FlowDirections.SetNumUninitialized(ClearCost.Num());
+	for (int32 Index = 0; Index < ClearCost.Num(); Index++)
+	{
+		const FIntPoint Cell(Index % USiegeOccupancySubsystem::GridDim, Index / USiegeOccupancySubsystem::GridDim);
+		int32 Direction = GetCheapestNeighbour(ClearCost[Index] != MAX_uint32 ? ClearCost : BreachCost, Cell);
+		FlowDirections[Index] = Direction != INDEX_NONE ? uint8(Direction) : SiegeFlowField::NoDirection;
+	}
+	bHasField = true;
+	Phase = EFlowBuildPhase::Idle;
+}
+
+int32 USiegeFlowFieldSubsystem::GetCheapestNeighbour(const TArray<uint32>& Field, const FIntPoint& Cell) const
+{
+	const int32 Index = OccupancyMap->CellIndex(Cell);
+	uint32 BestCost = Field[Index];
+	int32 BestDirection = INDEX_NONE;
+	for (int32 i = 0; i < 8; i++)
+	{
+		const FIntPoint NextCell = Cell + SiegeFlowField::NeighbourOffsets[i];
+		if (!OccupancyMap->IsValidCell(NextCell)) continue;
+		const uint32 NextCost = Field[OccupancyMap->CellIndex(NextCell)];
+		if (NextCost < BestCost)
+		{
+			BestCost = NextCost;
+			BestDirection = i;
+		}
+	}
+	return BestDirection;
+}
+
+float USiegeFlowFieldSubsystem::GetPathLengthToMonument(const FVector& Location) const
+{
+	if (!bHasField) return -1.f;
+	const FIntPoint Cell = OccupancyMap->WorldToCell(Location);
+	if (!OccupancyMap->IsValidCell(Cell)) return -1.f;
+	int32 Index = OccupancyMap->CellIndex(Cell);
+	// AI pressed against a wall stand in its padded footprint, which has no route of its own
+	AActor* Blocker = OccupancyMap->GetCellBlocker(Cell);
+	if (ClearCost[Index] == MAX_uint32 && ((Blocker && Blocker != OccupancyMap->GetMonument()) || !Walkable[Index]))
+	{
+		const int32 SnappedIndex = FindNearestReachableCell(Cell);
+		if (SnappedIndex != INDEX_NONE) Index = SnappedIndex;
+	}
+	const uint32 Cost = ClearCost[Index];
+	return Cost == MAX_uint32 ? TNumericLimits<float>::Max() : float(Cost);
+}
+
+int32 USiegeFlowFieldSubsystem::FindNearestReachableCell(const FIntPoint& Cell) const
+{
+	// rings of growing radius, closest cell by distance within the first ring that has one
+	for (int32 Radius = 1; Radius <= MaxSnapCells; Radius++)
+	{
+		int32 BestIndex = INDEX_NONE;
+		int32 BestDistSq = MAX_int32;
+		for (int32 Y = -Radius; Y <= Radius; Y++)
+		{
+			for (int32 X = -Radius; X <= Radius; X++)
+			{
+				if (FMath::Max(FMath::Abs(X), FMath::Abs(Y)) != Radius) continue;
+				const FIntPoint NextCell = Cell + FIntPoint(X, Y);
+				if (!OccupancyMap->IsValidCell(NextCell)) continue;
+				const int32 NextIndex = OccupancyMap->CellIndex(NextCell);
+				const int32 DistSq = X * X + Y * Y;
+				if (ClearCost[NextIndex] != MAX_uint32 && DistSq < BestDistSq)
+				{
+					BestDistSq = DistSq;
+					BestIndex = NextIndex;
+				}
+			}
+		}
+		if (BestIndex != INDEX_NONE) return BestIndex;
+	}
+	return INDEX_NONE;
+}
+
+FVector USiegeFlowFieldSubsystem::GetFlowDirection(const FVector& Location) const
+{
+	if (!bHasField) return FVector::ZeroVector;
+	const FIntPoint Cell = OccupancyMap->WorldToCell(Location);
+	if (!OccupancyMap->IsValidCell(Cell)) return FVector::ZeroVector;
+	const uint8 Direction = FlowDirections[OccupancyMap->CellIndex(Cell)];
+	if (Direction == SiegeFlowField::NoDirection) return FVector::ZeroVector;
+	const FIntPoint Offset = SiegeFlowField::NeighbourOffsets[Direction];
+	return FVector(Offset.X, Offset.Y, 0).GetSafeNormal();
+}
+
+FVector USiegeFlowFieldSubsystem::GetFlowGoal(const FVector& Location, int32 LookaheadCells) const
+{
+	if (!bHasField) return Location;
+	FIntPoint Cell = OccupancyMap->WorldToCell(Location);
+	if (!OccupancyMap->IsValidCell(Cell)) return Location;
+	for (int32 i = 0; i < LookaheadCells; i++)
+	{
+		const uint8 Direction = FlowDirections[OccupancyMap->CellIndex(Cell)];
+		if (Direction == SiegeFlowField::NoDirection) break;
+		Cell += SiegeFlowField::NeighbourOffsets[Direction];
+	}
+	FVector Goal = OccupancyMap->CellToWorld(Cell);
+	Goal.Z = Location.Z;
+	return Goal;
+}
+
+ABuilding* USiegeFlowFieldSubsystem::GetBlockingBuilding(const FVector& Location) const
+{
+	if (!bHasField) return nullptr;
+	const FIntPoint Cell = OccupancyMap->WorldToCell(Location);
+	if (!OccupancyMap->IsValidCell(Cell)) return nullptr;
+	const int32 Index = OccupancyMap->CellIndex(Cell);
+	// walking round is no dearer than breaking through
+	if (BreachCost[Index] >= ClearCost[Index] || BreachBlockerCell[Index] == INDEX_NONE) return nullptr;
+	const int32 BlockerIndex = BreachBlockerCell[Index];
+	return Cast<ABuilding>(OccupancyMap->GetCellBlocker(FIntPoint(BlockerIndex % USiegeOccupancySubsystem::GridDim, BlockerIndex / USiegeOccupancySubsystem::GridDim)));
+}
@@ -0,0 +1,103 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "SiegeFlowFieldSubsystem.generated.h"
+
+class ABuilding;
+class USiegeOccupancySubsystem;
+
+/**
+ * Shared flow field towards the monument, laid out on the siege occupancy grid. Two integration fields are kept:
+ * one routing around buildings (path length to the monument) and one allowed to break through them at a cost
+ * (which building sits on the cheapest route). Rebuilds are coalesced and time-sliced into back buffers, and
+ * every AI in the wave reads the same fields.
+ */
+UCLASS()
+class EALOND_API USiegeFlowFieldSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/** Starts building the field around the monument if it hasn't been already. */
+	void EnsureBuilt(AActor* Monument);
+	bool IsReady() const {return bHasField;}
+
+	/**
+	 * Walking distance to the monument around buildings. Returns -1 if unknown, TNumericLimits<float>::Max() if walled off.
+	 * Locations inside a building footprint or off the navmesh read the nearest reachable cell instead.
+	 */
+	float GetPathLengthToMonument(const FVector& Location) const;
+	/** Unit direction of the cheapest step towards the monument, or zero if the cell has no route. */
+	FVector GetFlowDirection(const FVector& Location) const;
+	/** Follows the direction field up to LookaheadCells cells and returns the world point reached. */
+	FVector GetFlowGoal(const FVector& Location, int32 LookaheadCells) const;
+	/** First building on the cheapest route when breaking through is cheaper than walking around, otherwise nullptr. */
+	ABuilding* GetBlockingBuilding(const FVector& Location) const;
+
+	// extra cost of crossing one cell of building; roughly the walk a goblin would take rather than break a wall
+	static constexpr uint32 BreachCostPerCell = 1000;
+	// integration nodes expanded per frame while rebuilding
+	static constexpr int32 NodesPerFrame = 20000;
+	// cells projected to the navmesh per frame on the first build
+	static constexpr int32 WalkabilityCellsPerFrame = 256;
+	// how far a query standing against a wall looks for a cell with a route, covers the padded footprint of a wall piece
+	static constexpr int32 MaxSnapCells = 6;
+
+private:
+	enum class EFlowBuildPhase : uint8
+	{
+		Idle,
+		Walkability,
+		Clear,
+		Breach,
+	};
+
+	struct FFlowOpenNode
+	{
+		uint32 Cost;
+		int32 Index;
+
+		bool operator<(const FFlowOpenNode& Other) const {return Cost < Other.Cost;}
+	};
+
+	void OnOccupancyChanged(const FIntRect& ChangedCells);
+	void StartIntegration();
+	void SeedOpenList(TArray<uint32>& Field, TArray<FFlowOpenNode>& Open);
+	/** Expands up to Budget nodes, returns true once the open list is exhausted. */
+	bool StepIntegration(bool bAllowBreach, int32& Budget);
+	void FinishIntegration();
+	uint32 GetStepCost(int32 CellIndex, bool bAllowBreach, bool bDiagonal) const;
+	int32 GetCheapestNeighbour(const TArray<uint32>& Field, const FIntPoint& Cell) const;
+	/** Index of the closest cell within MaxSnapCells that has a route around buildings, or INDEX_NONE. */
+	int32 FindNearestReachableCell(const FIntPoint& Cell) const;
+
+	UPROPERTY()
+	TObjectPtr<USiegeOccupancySubsystem> OccupancyMap;
+
+	// front buffers, read by queries
+	TArray<uint32> ClearCost;
+	TArray<uint32> BreachCost;
+	TArray<int32> BreachBlockerCell;
+	TArray<uint8> FlowDirections;
+
+	// back buffers, filled while a rebuild is in progress
+	TArray<uint32> ClearCostBack;
+	TArray<uint32> BreachCostBack;
+	TArray<int32> BreachBlockerCellBack;
+	TArray<FFlowOpenNode> OpenList;
+
+	TBitArray<> Walkable;
+	int32 WalkabilityCell = 0;
+	EFlowBuildPhase Phase = EFlowBuildPhase::Idle;
+	FDelegateHandle OccupancyChangedHandle;
+	bool bHasField = false;
+	bool bRebuildPending = false;
+};
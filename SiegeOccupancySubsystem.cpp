@@ -0,0 +1,303 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "SiegeOccupancySubsystem.h"
+#include "AIBaseCharacter.h"
+#include "EnemyAIController.h"
+#include "EngineUtils.h"
+#include "../Buildings/Building.h"
+#include "../Interfaces/BuildingInterface.h"
+#include "Kismet/KismetMathLibrary.h"
+
+void USiegeOccupancySubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	ActorSpawnedHandle = InWorld.AddOnActorSpawnedHandler(FOnActorSpawned::FDelegate::CreateUObject(this, &USiegeOccupancySubsystem::OnActorSpawned));
+}
+
+void USiegeOccupancySubsystem::Deinitialize()
+{
+	if (GetWorld()) GetWorld()->RemoveOnActorSpawnedHandler(ActorSpawnedHandle);
+	CellOwners.Empty();
+	Blockers.Empty();
+	BlockerRects.Empty();
+	BlockerSlots.Empty();
+	SweepCache.Empty();
+	bIsBuilt = false;
+
+	Super::Deinitialize();
+}
+
+bool USiegeOccupancySubsystem::EnsureBuilt(AActor* InMonument)
+{
+	if (bIsBuilt) return true;
+	if (!InMonument) return false;
+
+	Monument = InMonument;
+	GridOrigin = InMonument->GetActorLocation() - FVector(GridDim * CellSize / 2.f, GridDim * CellSize / 2.f, 0);
+	CellOwners.Init(INDEX_NONE, GridDim * GridDim);
+	bIsBuilt = true;
+
+	// monument goes in first so rays reaching it report it rather than a building overlapping its footprint
+	AddBlocker(InMonument);
+	for (TActorIterator<ABuilding> It(GetWorld()); It; ++It)
+	{
+		AddBlocker(*It);
+	}
+	return true;
+}
+
+FIntPoint USiegeOccupancySubsystem::WorldToCell(const FVector& Location) const
+{
+	return FIntPoint(FMath::FloorToInt32((Location.X - GridOrigin.X) / CellSize), FMath::FloorToInt32((Location.Y - GridOrigin.Y) / CellSize));
+}
+
+FVector USiegeOccupancySubsystem::CellToWorld(const FIntPoint& Cell) const
+{
+	return FVector(GridOrigin.X + (Cell.X + .5f) * CellSize, GridOrigin.Y + (Cell.Y + .5f) * CellSize, GridOrigin.Z);
+}
+
+AActor* USiegeOccupancySubsystem::GetCellBlocker(const FIntPoint& Cell) const
+{
+	if (!bIsBuilt || !IsValidCell(Cell)) return nullptr;
+	const int32 Slot = CellOwners[CellIndex(Cell)];
+	return Slot != INDEX_NONE ? Blockers[Slot].Get() : nullptr;
+}
+
+void USiegeOccupancySubsystem::AddBlocker(AActor* Blocker)
+{
+	if (!bIsBuilt || !Blocker || BlockerSlots.Contains(Blocker)) return;
+	int32 Slot;
+	if (FreeSlots.Num())
+	{
+		Slot = FreeSlots.Pop();
+		Blockers[Slot] = Blocker;
+	}
+	else
+	{
+		Slot = Blockers.Add(Blocker);
+		BlockerRects.AddDefaulted();
+	}
+	BlockerSlots.Add(Blocker, Slot);
+	BlockerRects[Slot] = RasterizeBlocker(Blocker, Slot);
+	Blocker->OnDestroyed.AddUniqueDynamic(this, &USiegeOccupancySubsystem::OnBlockerDestroyed);
+	MarkChanged(BlockerRects[Slot]);
+}
+
+void USiegeOccupancySubsystem::RemoveBlocker(AActor* Blocker)
+{
+	int32 Slot;
+	if (!BlockerSlots.RemoveAndCopyValue(Blocker, Slot)) return;
+	const FIntRect Rect = BlockerRects[Slot];
+	for (int32 Y = Rect.Min.Y; Y < Rect.Max.Y; Y++)
+	{
+		for (int32 X = Rect.Min.X; X < Rect.Max.X; X++)
+		{
+			int32& Owner = CellOwners[CellIndex(FIntPoint(X, Y))];
+			if (Owner == Slot) Owner = INDEX_NONE;
+		}
+	}
+	Blockers[Slot].Reset();
+	BlockerRects[Slot] = FIntRect();
+	FreeSlots.Add(Slot);
+	// let any overlapping neighbour reclaim the cells it shared with the removed footprint
+	for (int32 i = 0; i < Blockers.Num(); i++)
+	{
+		if (Blockers[i].IsValid() && BlockerRects[i].Intersect(Rect))
+		{
+			RasterizeBlocker(Blockers[i].Get(), i);
+		}
+	}
+	MarkChanged(Rect);
+}
+
+FIntRect USiegeOccupancySubsystem::RasterizeBlocker(AActor* Blocker, int32 Slot)
+{
+	// footprint is the actor's local bounds rotated into the grid, padded by half a cell so thin walls are not skipped
+	const FTransform ActorTransform = Blocker->GetActorTransform();
+	const FBox LocalBox = Blocker->CalculateComponentsBoundingBoxInLocalSpace().ExpandBy(FVector(CellSize / 2.f, CellSize / 2.f, 0));
+	FVector Origin;
+	FVector Extent;
+	Blocker->GetActorBounds(false, Origin, Extent);
+	const FIntPoint MinCell = WorldToCell(Origin - Extent);
+	const FIntPoint MaxCell = WorldToCell(Origin + Extent);
+	const FIntRect Rect(FIntPoint(FMath::Max(MinCell.X, 0), FMath::Max(MinCell.Y, 0)), FIntPoint(FMath::Min(MaxCell.X + 1, GridDim), FMath::Min(MaxCell.Y + 1, GridDim)));
+	for (int32 Y = Rect.Min.Y; Y < Rect.Max.Y; Y++)
+	{
+		for (int32 X = Rect.Min.X; X < Rect.Max.X; X++)
+		{
+			int32& Owner = CellOwners[CellIndex(FIntPoint(X, Y))];
+			if (Owner != INDEX_NONE) continue;
+			FVector LocalPoint = ActorTransform.InverseTransformPosition(CellToWorld(FIntPoint(X, Y)));
+			if (LocalPoint.X >= LocalBox.Min.X && LocalPoint.X <= LocalBox.Max.X && LocalPoint.Y >= LocalBox.Min.Y && LocalPoint.Y <= LocalBox.Max.Y)
+			{
+				Owner = Slot;
+			}
+		}
+	}
+	return Rect;
+}
+
+void USiegeOccupancySubsystem::MarkChanged(const FIntRect& ChangedCells)
+{
+	++Revision;
+	SweepCache.Reset();
+	OnOccupancyChanged.Broadcast(ChangedCells);
+}
+
+void USiegeOccupancySubsystem::OnActorSpawned(AActor* SpawnedActor)
+{
+	if (SpawnedActor && SpawnedActor->IsA(ABuilding::StaticClass())) AddBlocker(SpawnedActor);
+}
+
+void USiegeOccupancySubsystem::OnBlockerDestroyed(AActor* DestroyedActor)
+{
+	RemoveBlocker(DestroyedActor);
+}
+
+AActor* USiegeOccupancySubsystem::RaycastFirstBlocker(const FVector& Start, const FVector& End) const
+{
+	if (!bIsBuilt) return nullptr;
+	// 2D DDA in cell units; t runs from 0 at Start to 1 at End
+	const FVector2D From((Start.X - GridOrigin.X) / CellSize, (Start.Y - GridOrigin.Y) / CellSize);
+	const FVector2D To((End.X - GridOrigin.X) / CellSize, (End.Y - GridOrigin.Y) / CellSize);
+	const FVector2D Dir = To - From;
+	FIntPoint Cell(FMath::FloorToInt32(From.X), FMath::FloorToInt32(From.Y));
+	const FIntPoint EndCell(FMath::FloorToInt32(To.X), FMath::FloorToInt32(To.Y));
+	const int32 StepX = Dir.X >= 0 ? 1 : -1;
+	const int32 StepY = Dir.Y >= 0 ? 1 : -1;
+	const float DeltaX = Dir.X != 0 ? FMath::Abs(1.f / Dir.X) : BIG_NUMBER;
+	const float DeltaY = Dir.Y != 0 ? FMath::Abs(1.f / Dir.Y) : BIG_NUMBER;
+	float MaxX = Dir.X != 0 ? (StepX > 0 ? Cell.X + 1 - From.X : From.X - Cell.X) * DeltaX : BIG_NUMBER;
+	float MaxY = Dir.Y != 0 ? (StepY > 0 ? Cell.Y + 1 - From.Y : From.Y - Cell.Y) * DeltaY : BIG_NUMBER;
+	const int32 TotalSteps = FMath::Abs(EndCell.X - Cell.X) + FMath::Abs(EndCell.Y - Cell.Y);
+	for (int32 i = 0; i <= TotalSteps; i++)
+	{
+		if (IsValidCell(Cell))
+		{
+			const int32 Slot = CellOwners[CellIndex(Cell)];
+			if (Slot != INDEX_NONE && Blockers[Slot].IsValid()) return Blockers[Slot].Get();
+		}
+		if (MaxX < MaxY)
+		{
+			MaxX += DeltaX;
+			Cell.X += StepX;
+		}
+		else
+		{
+			MaxY += DeltaY;
+			Cell.Y += StepY;
+		}
+	}
+	return nullptr;
+}
+
+void USiegeOccupancySubsystem::GetSweepRayEnds(const FVector& Start, const FVector& MonumentLocation, float CheckCone, TArray<FVector>& OUT_Ends)
+{
+	// get world rotation of AI relative to monument
+	FRotator OriginalRotation = UKismetMathLibrary::FindLookAtRotation(Start, MonumentLocation);
+	float DistanceToMonument = FVector::Distance(Start, MonumentLocation);
+	// get total traces to be fired based on passed in cone
+	int32 Iterations = FMath::FloorToInt32(CheckCone / 5);
+	// first angle should be half a cone to the left of OriginRotation
+	float FirstAngle = CheckCone / -2;
+	OUT_Ends.Reset(Iterations);
+	for (int32 i = 0; i < Iterations; i++)
+	{
+		FRotator NewRotation = FRotator(OriginalRotation.Pitch, OriginalRotation.Yaw + FirstAngle, OriginalRotation.Roll);
+		OUT_Ends.Add(NewRotation.Vector() * DistanceToMonument + Start);
+		FirstAngle += 5.f;
+	}
+}
+
+const TArray<TWeakObjectPtr<AActor>>& USiegeOccupancySubsystem::SweepCone(const FVector& Start, float CheckCone)
+{
+	const FIntPoint StartCell = WorldToCell(Start);
+	if (!IsValidCell(StartCell))
+	{
+		SweepConeUncached(Start, CheckCone, OffGridSweep);
+		return OffGridSweep;
+	}
+	// blocked AI bunch up in front of the same walls, so most sweeps are answered from a neighbour's result
+	const uint64 Key = (uint64(uint32(CellIndex(StartCell))) << 8) | uint64(FMath::FloorToInt32(CheckCone / 5) & 0xFF);
+	if (const TArray<TWeakObjectPtr<AActor>>* Cached = SweepCache.Find(Key))
+	{
+		return *Cached;
+	}
+	// sweep from the cell centre so every AI sharing the cell gets the same fan
+	FVector CellStart = CellToWorld(StartCell);
+	CellStart.Z = Start.Z;
+	// starting over is cheap next to tracking recency; the cells still in use refill within a few sweeps
+	if (SweepCache.Num() >= MaxSweepCacheEntries) SweepCache.Reset();
+	TArray<TWeakObjectPtr<AActor>>& Results = SweepCache.Add(Key);
+	SweepConeUncached(CellStart, CheckCone, Results);
+	return Results;
+}
+
+void USiegeOccupancySubsystem::SweepConeUncached(const FVector& Start, float CheckCone, TArray<TWeakObjectPtr<AActor>>& OUT_Results) const
+{
+	OUT_Results.Reset();
+	if (!Monument.IsValid()) return;
+	TArray<FVector> RayEnds;
+	GetSweepRayEnds(Start, Monument->GetActorLocation(), CheckCone, RayEnds);
+	OUT_Results.Reserve(RayEnds.Num());
+	for (const FVector& RayEnd : RayEnds)
+	{
+		OUT_Results.Add(RaycastFirstBlocker(Start, RayEnd));
+	}
+}
+
+// Compares the raster sweep, both exact from the AI and the cached cell-centre fan CheckStaticTargets reads, against
+// the trace-based sweep for every enemy AI in the world and logs rays that disagree
+static FAutoConsoleCommandWithWorldAndArgs CVarVerifySiegeOccupancySweep(
+	TEXT("ai.SiegeOccupancy.VerifySweep"),
+	TEXT("Compare raster cone sweeps, exact and the cached per-cell fan, with line trace sweeps for all enemy AI. Optional arg: cone angle (default 90)."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			USiegeOccupancySubsystem* OccupancyMap = World ? World->GetSubsystem<USiegeOccupancySubsystem>() : nullptr;
+			if (!OccupancyMap) return;
+			float CheckCone = Args.Num() ? FCString::Atof(*Args[0]) : 90.f;
+			int32 TotalRays = 0;
+			int32 Mismatches = 0;
+			int32 CachedMismatches = 0;
+			for (TActorIterator<AEnemyAIController> It(World); It; ++It)
+			{
+				AAIBaseCharacter* AICharacter = Cast<AAIBaseCharacter>(It->GetPawn());
+				if (!AICharacter || !OccupancyMap->EnsureBuilt(AICharacter->GetMonument())) continue;
+				FVector Start = AICharacter->GetActorLocation();
+				TArray<FVector> RayEnds;
+				USiegeOccupancySubsystem::GetSweepRayEnds(Start, AICharacter->GetMonument()->GetActorLocation(), CheckCone, RayEnds);
+				// copied, since the next call may replace an off-grid result
+				const TArray<TWeakObjectPtr<AActor>> CachedFan = OccupancyMap->SweepCone(Start, CheckCone);
+				FCollisionQueryParams Params;
+				Params.AddIgnoredActor(AICharacter);
+				for (int32 Ray = 0; Ray < RayEnds.Num(); Ray++)
+				{
+					const FVector& RayEnd = RayEnds[Ray];
+					FHitResult HitResult;
+					World->LineTraceSingleByChannel(HitResult, Start, RayEnd, ECollisionChannel::ECC_GameTraceChannel1, Params);
+					// only buildings and the monument are rasterised; anything else the trace hits counts as clear
+					AActor* TraceBlocker = HitResult.GetActor();
+					bool bIsRasterised = TraceBlocker && (TraceBlocker == AICharacter->GetMonument() || TraceBlocker->IsA(ABuilding::StaticClass()));
+					if (!bIsRasterised) TraceBlocker = nullptr;
+					AActor* RasterBlocker = OccupancyMap->RaycastFirstBlocker(Start, RayEnd);
+					++TotalRays;
+					if (TraceBlocker != RasterBlocker)
+					{
+						++Mismatches;
+						UE_LOG(LogTemp, Warning, TEXT("Siege occupancy: %s ray to %s traced %s, raster %s"), *It->GetName(), *RayEnd.ToString(),
+							TraceBlocker ? *TraceBlocker->GetName() : TEXT("none"), RasterBlocker ? *RasterBlocker->GetName() : TEXT("none"));
+					}
+					AActor* CachedBlocker = CachedFan.IsValidIndex(Ray) ? CachedFan[Ray].Get() : nullptr;
+					if (TraceBlocker != CachedBlocker)
+					{
+						++CachedMismatches;
+						UE_LOG(LogTemp, Warning, TEXT("Siege occupancy: %s ray to %s traced %s, cached fan %s"), *It->GetName(), *RayEnd.ToString(),
+							TraceBlocker ? *TraceBlocker->GetName() : TEXT("none"), CachedBlocker ? *CachedBlocker->GetName() : TEXT("none"));
+					}
+				}
+			}
+			UE_LOG(LogTemp, Log, TEXT("Siege occupancy: %d of %d sweep rays matched the trace sweep exactly, %d from the cached cell fan"),
+				TotalRays - Mismatches, TotalRays, TotalRays - CachedMismatches);
+		}));
@@ -0,0 +1,89 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "SiegeOccupancySubsystem.generated.h"
+
+DECLARE_MULTICAST_DELEGATE_OneParam(FOnSiegeOccupancyChanged, const FIntRect& /*ChangedCells*/);
+
+/**
+ * 2D raster of building footprints centred on the monument. Cells hold the first blocker rasterised into them,
+ * so cone sweeps towards the monument become grid walks instead of physics traces. Buildings are added as they
+ * spawn and removed when destroyed, touching only the cells under their footprint.
+ */
+UCLASS()
+class EALOND_API USiegeOccupancySubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	virtual void Deinitialize() override;
+
+	/** Builds the raster around the monument on first call. Returns false if there is nothing to build around. */
+	bool EnsureBuilt(AActor* Monument);
+	bool IsBuilt() const {return bIsBuilt;}
+
+	/** Walks the cells under the segment and returns the first blocker, or nullptr if the line is clear. */
+	AActor* RaycastFirstBlocker(const FVector& Start, const FVector& End) const;
+
+	/**
+	 * First blocker per ray of the CheckStaticTargets fan. Cached per start cell until the raster changes; starts
+	 * off the grid are swept from where they are each call, and the result only lasts until the next call.
+	 */
+	const TArray<TWeakObjectPtr<AActor>>& SweepCone(const FVector& Start, float CheckCone);
+
+	/** Ray end points of the static target fan: CheckCone / 5 rays at 5 degree steps, centred on the monument. */
+	static void GetSweepRayEnds(const FVector& Start, const FVector& MonumentLocation, float CheckCone, TArray<FVector>& OUT_Ends);
+
+	void AddBlocker(AActor* Blocker);
+	void RemoveBlocker(AActor* Blocker);
+
+	AActor* GetMonument() const {return Monument.Get();}
+	uint32 GetRevision() const {return Revision;}
+
+	// grid helpers, also used by systems sharing the raster layout
+	FIntPoint WorldToCell(const FVector& Location) const;
+	FVector CellToWorld(const FIntPoint& Cell) const;
+	bool IsValidCell(const FIntPoint& Cell) const {return Cell.X >= 0 && Cell.Y >= 0 && Cell.X < GridDim && Cell.Y < GridDim;}
+	int32 CellIndex(const FIntPoint& Cell) const {return Cell.Y * GridDim + Cell.X;}
+	/** Blocker rasterised into the cell, or nullptr. */
+	AActor* GetCellBlocker(const FIntPoint& Cell) const;
+
+	FOnSiegeOccupancyChanged OnOccupancyChanged;
+
+	static constexpr float CellSize = 50.f;
+	// 400 x 400 cells covers 20000 units either side of the monument
+	static constexpr int32 GridDim = 400;
+
+private:
+	void OnActorSpawned(AActor* SpawnedActor);
+	UFUNCTION()
+	void OnBlockerDestroyed(AActor* DestroyedActor);
+
+	/** Writes Slot into every free cell under the blocker's footprint and returns the touched cell range. */
+	FIntRect RasterizeBlocker(AActor* Blocker, int32 Slot);
+	void MarkChanged(const FIntRect& ChangedCells);
+	void SweepConeUncached(const FVector& Start, float CheckCone, TArray<TWeakObjectPtr<AActor>>& OUT_Results) const;
+
+	TArray<int32> CellOwners;
+	TArray<TWeakObjectPtr<AActor>> Blockers;
+	TArray<FIntRect> BlockerRects;
+	TArray<int32> FreeSlots;
+	TMap<AActor*, int32> BlockerSlots;
+
+	// sweep results keyed by start cell and cone, dropped whenever the raster changes or the cache fills up
+	TMap<uint64, TArray<TWeakObjectPtr<AActor>>> SweepCache;
+	// a wave only spans a few hundred cells; a quiet siege where nothing is built would otherwise cache the whole grid
+	static constexpr int32 MaxSweepCacheEntries = 4096;
+	// off-grid starts all share INDEX_NONE as a cell, so their results can't be cached
+	TArray<TWeakObjectPtr<AActor>> OffGridSweep;
+
+	TWeakObjectPtr<AActor> Monument;
+	FVector GridOrigin = FVector::ZeroVector;
+	FDelegateHandle ActorSpawnedHandle;
+	uint32 Revision = 0;
+	bool bIsBuilt = false;
+};
@@ -0,0 +1,264 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "StatusEffectSubsystem.h"
+#include "AITraceSubsystem.h"
+#include "DamageQueueSubsystem.h"
+#include "NiagaraComponent.h"
+#include "NiagaraSystem.h"
+#include "GameFramework/Controller.h"
+#include "GameFramework/DamageType.h"
+#include "Net/UnrealNetwork.h"
+
+DECLARE_CYCLE_STAT(TEXT("Status effect step"), STAT_StatusEffectStep, STATGROUP_EalondAI);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Status effects active"), STAT_StatusEffectsActive, STATGROUP_EalondAI);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Status effect FX pooled"), STAT_StatusEffectFXPooled, STATGROUP_EalondAI);
+
+static_assert(int32(EStatusEffect::MAX) == 4, "UStatusEffectStateComponent keeps one system and FX slot per effect");
+
+namespace StatusEffect
+{
+	// enough for a settlement on fire without growing mid-attack
+	static constexpr int32 ReservedEffects = 256;
+}
+
+void UStatusEffectSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	LoadedDefaultSystems.SetNumZeroed(int32(EStatusEffect::MAX));
+	for (int32 Effect = 0; Effect < int32(EStatusEffect::MAX) && Effect < DefaultSystems.Num(); Effect++)
+	{
+		LoadedDefaultSystems[Effect] = DefaultSystems[Effect].LoadSynchronous();
+	}
+	Targets.Reserve(StatusEffect::ReservedEffects);
+	Types.Reserve(StatusEffect::ReservedEffects);
+	DamagesPerSecond.Reserve(StatusEffect::ReservedEffects);
+	Expiries.Reserve(StatusEffect::ReservedEffects);
+	Instigators.Reserve(StatusEffect::ReservedEffects);
+	Causers.Reserve(StatusEffect::ReservedEffects);
+	XPRecipients.Reserve(StatusEffect::ReservedEffects);
+	DamageTypes.Reserve(StatusEffect::ReservedEffects);
+	StepDamage.Reserve(StatusEffect::ReservedEffects);
+}
+
+void UStatusEffectSubsystem::Deinitialize()
+{
+	Targets.Empty();
+	Types.Empty();
+	DamagesPerSecond.Empty();
+	Expiries.Empty();
+	Instigators.Empty();
+	Causers.Empty();
+	XPRecipients.Empty();
+	DamageTypes.Empty();
+	EffectIndices.Empty();
+	for (UNiagaraComponent* Component : FreeFX)
+	{
+		if (Component) Component->DestroyComponent();
+	}
+	FreeFX.Empty();
+
+	Super::Deinitialize();
+}
+
+TStatId UStatusEffectSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UStatusEffectSubsystem, STATGROUP_Tickables);
+}
+
+void UStatusEffectSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	const double Now = GetWorld()->GetTimeSeconds();
+	if (Targets.IsEmpty() || Now < NextStepTime) return;
+	NextStepTime = Now + TickInterval;
+	Step(float(Now));
+}
+
+void UStatusEffectSubsystem::ApplyEffect(AActor* Target, EStatusEffect Effect, double ExpiryTime, float DamagePerSecond, AController* Instigator, AActor* Causer,
+	TSubclassOf<UDamageType> DamageTypeClass, UNiagaraSystem* System, UCharacterProgressComponent* XPRecipient)
+{
+	if (!Target || !Target->HasAuthority() || Effect == EStatusEffect::MAX || ExpiryTime <= GetWorld()->GetTimeSeconds()) return;
+	const FEffectKey Key(Target, Effect);
+	if (const int32* Existing = EffectIndices.Find(Key))
+	{
+		// the same effect again runs on from whichever lasts longer, at the stronger rate
+		Expiries[*Existing] = FMath::Max(Expiries[*Existing], float(ExpiryTime));
+		DamagesPerSecond[*Existing] = FMath::Max(DamagesPerSecond[*Existing], DamagePerSecond);
+		// the latest attacker gets the credit, unless this application came from nobody
+		if (Instigator) Instigators[*Existing] = Instigator;
+		if (Causer) Causers[*Existing] = Causer;
+		if (XPRecipient) XPRecipients[*Existing] = XPRecipient;
+		return;
+	}
+	EffectIndices.Add(Key, Targets.Num());
+	Targets.Add(Target);
+	Types.Add(Effect);
+	DamagesPerSecond.Add(DamagePerSecond);
+	Expiries.Add(float(ExpiryTime));
+	Instigators.Add(Instigator);
+	Causers.Add(Causer);
+	XPRecipients.Add(XPRecipient);
+	DamageTypes.Add(DamageTypeClass ? DamageTypeClass : TSubclassOf<UDamageType>(UDamageType::StaticClass()));
+	SET_DWORD_STAT(STAT_StatusEffectsActive, Targets.Num());
+
+	UStatusEffectStateComponent* State = Target->FindComponentByClass<UStatusEffectStateComponent>();
+	if (!State)
+	{
+		State = NewObject<UStatusEffectStateComponent>(Target);
+		State->RegisterComponent();
+	}
+	State->SetEffect(Effect, System ? System : LoadedDefaultSystems[int32(Effect)].Get(), true);
+}
+
+void UStatusEffectSubsystem::ClearEffects(AActor* Target)
+{
+	for (int32 Effect = 0; Effect < int32(EStatusEffect::MAX); Effect++)
+	{
+		if (const int32* Index = EffectIndices.Find(FEffectKey(Target, EStatusEffect(Effect)))) RemoveEffect(*Index);
+	}
+}
+
+void UStatusEffectSubsystem::Step(float Now)
+{
+	SCOPE_CYCLE_COUNTER(STAT_StatusEffectStep);
+	const int32 Num = Targets.Num();
+	StepDamage.SetNumUninitialized(Num, false);
+
+	// damage for the coming step, cut short where an effect runs out inside it
+	const VectorRegister4Float NowVector = VectorSetFloat1(Now);
+	const VectorRegister4Float StepVector = VectorSetFloat1(TickInterval);
+	int32 i = 0;
+	for (; i + 4 <= Num; i += 4)
+	{
+		const VectorRegister4Float Remaining = VectorMin(VectorMax(VectorSubtract(VectorLoad(&Expiries[i]), NowVector), VectorZeroFloat()), StepVector);
+		VectorStore(VectorMultiply(VectorLoad(&DamagesPerSecond[i]), Remaining), &StepDamage[i]);
+	}
+	for (; i < Num; i++)
+	{
+		StepDamage[i] = DamagesPerSecond[i] * FMath::Clamp(Expiries[i] - Now, 0.f, TickInterval);
+	}
+
+	UWorld* World = GetWorld();
+	for (i = 0; i < Num; i++)
+	{
+		if (StepDamage[i] > 0) UDamageQueueSubsystem::ApplyDamage(World, Targets[i].ResolveObjectPtr(), StepDamage[i], Instigators[i].Get(), Causers[i].Get(), DamageTypes[i],
+			XPRecipients[i].Get());
+	}
+	// back to front, so swapped-in effects have already been looked at
+	for (i = Num - 1; i >= 0; i--)
+	{
+		if (Expiries[i] <= Now + TickInterval || !Targets[i].ResolveObjectPtr()) RemoveEffect(i);
+	}
+}
+
+void UStatusEffectSubsystem::RemoveEffect(int32 Index)
+{
+	AActor* Target = Targets[Index].ResolveObjectPtr();
+	if (UStatusEffectStateComponent* State = Target ? Target->FindComponentByClass<UStatusEffectStateComponent>() : nullptr)
+	{
+		State->SetEffect(Types[Index], nullptr, false);
+	}
+	EffectIndices.Remove(FEffectKey(Targets[Index], Types[Index]));
+
+	const int32 Last = Targets.Num() - 1;
+	Targets.RemoveAtSwap(Index, 1, false);
+	Types.RemoveAtSwap(Index, 1, false);
+	DamagesPerSecond.RemoveAtSwap(Index, 1, false);
+	Expiries.RemoveAtSwap(Index, 1, false);
+	Instigators.RemoveAtSwap(Index, 1, false);
+	Causers.RemoveAtSwap(Index, 1, false);
+	XPRecipients.RemoveAtSwap(Index, 1, false);
+	DamageTypes.RemoveAtSwap(Index, 1, false);
+	if (Index != Last)
+	{
+		EffectIndices.FindChecked(FEffectKey(Targets[Index], Types[Index])) = Index;
+	}
+	SET_DWORD_STAT(STAT_StatusEffectsActive, Targets.Num());
+}
+
+UNiagaraComponent* UStatusEffectSubsystem::AcquireFX(AActor* Target, UNiagaraSystem* System)
+{
+	if (!Target || !System || !Target->GetRootComponent()) return nullptr;
+	UNiagaraComponent* Component = nullptr;
+	while (FreeFX.Num() && !Component)
+	{
+		Component = FreeFX.Pop(false);
+	}
+	if (!Component)
+	{
+		Component = NewObject<UNiagaraComponent>(GetWorld());
+		Component->SetAutoDestroy(false);
+		Component->SetAutoActivate(false);
+		Component->RegisterComponentWithWorld(GetWorld());
+	}
+	Component->SetAsset(System);
+	Component->AttachToComponent(Target->GetRootComponent(), FAttachmentTransformRules::SnapToTargetNotIncludingScale);
+	Component->Activate(true);
+	SET_DWORD_STAT(STAT_StatusEffectFXPooled, FreeFX.Num());
+	return Component;
+}
+
+void UStatusEffectSubsystem::ReleaseFX(UNiagaraComponent* FX)
+{
+	if (!FX) return;
+	FX->Deactivate();
+	FX->DetachFromComponent(FDetachmentTransformRules::KeepWorldTransform);
+	FreeFX.Add(FX);
+	SET_DWORD_STAT(STAT_StatusEffectFXPooled, FreeFX.Num());
+}
+
+UStatusEffectStateComponent::UStatusEffectStateComponent()
+{
+	PrimaryComponentTick.bCanEverTick = false;
+	SetIsReplicatedByDefault(true);
+}
+
+void UStatusEffectStateComponent::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	DOREPLIFETIME(UStatusEffectStateComponent, ActiveEffects);
+	DOREPLIFETIME(UStatusEffectStateComponent, Systems);
+}
+
+void UStatusEffectStateComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	ActiveEffects = 0;
+	UpdateFX();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void UStatusEffectStateComponent::SetEffect(EStatusEffect Effect, UNiagaraSystem* System, bool bActive)
+{
+	const uint8 Bit = 1 << uint8(Effect);
+	ActiveEffects = bActive ? ActiveEffects | Bit : ActiveEffects & ~Bit;
+	if (bActive) Systems[int32(Effect)] = System;
+	// listen servers and standalone games see their own effects too
+	UpdateFX();
+}
+
+void UStatusEffectStateComponent::OnRep_Effects()
+{
+	UpdateFX();
+}
+
+void UStatusEffectStateComponent::UpdateFX()
+{
+	UWorld* World = GetWorld();
+	UStatusEffectSubsystem* StatusEffects = World ? World->GetSubsystem<UStatusEffectSubsystem>() : nullptr;
+	if (!StatusEffects || World->GetNetMode() == NM_DedicatedServer) return;
+	for (int32 Effect = 0; Effect < int32(EStatusEffect::MAX); Effect++)
+	{
+		const bool bWanted = HasEffect(EStatusEffect(Effect)) && Systems[Effect] && HasBegunPlay() && !IsBeingDestroyed();
+		if (FX[Effect] && (!bWanted || FX[Effect]->GetAsset() != Systems[Effect]))
+		{
+			StatusEffects->ReleaseFX(FX[Effect]);
+			FX[Effect] = nullptr;
+		}
+		if (bWanted && !FX[Effect]) FX[Effect] = StatusEffects->AcquireFX(GetOwner(), Systems[Effect]);
+	}
+}
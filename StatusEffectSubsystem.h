@@ -0,0 +1,118 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/ActorComponent.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "StatusEffectSubsystem.generated.h"
+
+class AController;
+class UCharacterProgressComponent;
+class UDamageType;
+class UNiagaraComponent;
+class UNiagaraSystem;
+
+UENUM()
+enum class EStatusEffect : uint8
+{
+	Burn,
+	Bleed,
+	Poison,
+	// untyped damage over time from ApplyTimedDamage
+	Timed,
+	MAX UMETA(Hidden)
+};
+
+/**
+ * Damage over time for every burning, bleeding and poisoned actor, run by the server. Active effects are
+ * stored as parallel arrays (target, type, damage per second, expiry). Every TickInterval one vector pass
+ * works out each effect's damage, and the damage goes through the damage queue. Reapplying an effect an
+ * actor already has extends it rather than stacking. Clients learn which effects an actor has from its
+ * UStatusEffectStateComponent and show one pooled looping FX component per actor and effect.
+ */
+UCLASS(Config = Game)
+class EALOND_API UStatusEffectSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/**
+	 * Starts or extends the effect, until ExpiryTime (world seconds). With no System, the effect's default FX are used.
+	 * Reapplying credits the new instigator, causer and XP recipient, but keeps the old ones where the new are null. Server only.
+	 */
+	void ApplyEffect(AActor* Target, EStatusEffect Effect, double ExpiryTime, float DamagePerSecond, AController* Instigator = nullptr, AActor* Causer = nullptr,
+		TSubclassOf<UDamageType> DamageTypeClass = nullptr, UNiagaraSystem* System = nullptr, UCharacterProgressComponent* XPRecipient = nullptr);
+	void ClearEffects(AActor* Target);
+	int32 GetNumActiveEffects() const {return Targets.Num();}
+
+	UNiagaraComponent* AcquireFX(AActor* Target, UNiagaraSystem* System);
+	void ReleaseFX(UNiagaraComponent* FX);
+
+	static constexpr float TickInterval = .25f;
+
+private:
+	using FEffectKey = TPair<TObjectKey<AActor>, EStatusEffect>;
+
+	void Step(float Now);
+	void RemoveEffect(int32 Index);
+
+	// FX by effect, used when ApplyEffect isn't given any, from [/Script/Ealond.StatusEffectSubsystem] in the game ini
+	UPROPERTY(Config)
+	TArray<TSoftObjectPtr<UNiagaraSystem>> DefaultSystems;
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UNiagaraSystem>> LoadedDefaultSystems;
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UNiagaraComponent>> FreeFX;
+
+	// active effects, one index across all of these
+	TArray<TObjectKey<AActor>> Targets;
+	TArray<EStatusEffect> Types;
+	TArray<float> DamagesPerSecond;
+	TArray<float> Expiries;
+	TArray<TWeakObjectPtr<AController>> Instigators;
+	TArray<TWeakObjectPtr<AActor>> Causers;
+	TArray<TWeakObjectPtr<UCharacterProgressComponent>> XPRecipients;
+	TArray<TSubclassOf<UDamageType>> DamageTypes;
+	TMap<FEffectKey, int32> EffectIndices;
+	// this step's damage per effect, kept allocated between steps
+	TArray<float> StepDamage;
+	double NextStepTime = 0;
+};
+
+/**
+ * The effects an actor currently has, replicated as a bitmask plus the FX asset per effect, and the pooled
+ * FX components playing them. Added to an actor by the status effect subsystem the first time it is hit.
+ */
+UCLASS()
+class EALOND_API UStatusEffectStateComponent : public UActorComponent
+{
+	GENERATED_BODY()
+
+public:
+	UStatusEffectStateComponent();
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	void SetEffect(EStatusEffect Effect, UNiagaraSystem* System, bool bActive);
+	bool HasEffect(EStatusEffect Effect) const {return (ActiveEffects >> uint8(Effect)) & 1;}
+
+private:
+	UFUNCTION()
+	void OnRep_Effects();
+	/** Plays or stops pooled FX to match ActiveEffects; nothing on a dedicated server. */
+	void UpdateFX();
+
+	UPROPERTY(ReplicatedUsing = OnRep_Effects)
+	uint8 ActiveEffects = 0;
+	// one per EStatusEffect
+	UPROPERTY(ReplicatedUsing = OnRep_Effects)
+	TObjectPtr<UNiagaraSystem> Systems[4];
+	UPROPERTY(Transient)
+	TObjectPtr<UNiagaraComponent> FX[4];
+};
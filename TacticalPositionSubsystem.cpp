@@ -0,0 +1,232 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TacticalPositionSubsystem.h"
+#include "AITraceSubsystem.h"
+#include "SiegeOccupancySubsystem.h"
+#include "GameFramework/Controller.h"
+#include "GameFramework/Pawn.h"
+#include "NavigationSystem.h"
+
+DECLARE_CYCLE_STAT(TEXT("Tactical ring build"), STAT_TacticalRingBuild, STATGROUP_EalondAI);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Tactical targets"), STAT_TacticalTargets, STATGROUP_EalondAI);
+
+namespace TacticalPositions
+{
+	// rings are re-projected this often, or sooner once the target has moved this far from the ring centre
+	static constexpr float RebuildInterval = 1.f;
+	static constexpr float RebuildDistance = 100.f;
+	// rings nobody has asked about in this long are dropped
+	static constexpr float EvictAge = 5.f;
+	static constexpr int32 MaxRebuildsPerTick = 4;
+	// how long a retreat slot is held, and how long a flank claim survives without being renewed
+	static constexpr float RetreatHold = 1.f;
+	static constexpr float FlankHold = 3.f;
+	static constexpr float RingRadii[int32(ETacticalRing::MAX)] = {UTacticalPositionSubsystem::RetreatRadius, UTacticalPositionSubsystem::FlankRadius};
+}
+
+void UTacticalPositionSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	OccupancyMap = Collection.InitializeDependency<USiegeOccupancySubsystem>();
+	if (OccupancyMap)
+	{
+		OccupancyChangedHandle = OccupancyMap->OnOccupancyChanged.AddUObject(this, &UTacticalPositionSubsystem::OnOccupancyChanged);
+	}
+}
+
+void UTacticalPositionSubsystem::Deinitialize()
+{
+	if (OccupancyMap) OccupancyMap->OnOccupancyChanged.Remove(OccupancyChangedHandle);
+	TargetRings.Empty();
+
+	Super::Deinitialize();
+}
+
+TStatId UTacticalPositionSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UTacticalPositionSubsystem, STATGROUP_Tickables);
+}
+
+void UTacticalPositionSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	// refresh rings in use, a few per frame; the rest keep serving their last projection
+	const float Now = GetWorld()->GetTimeSeconds();
+	int32 NumRebuilt = 0;
+	for (auto It = TargetRings.CreateIterator(); It; ++It)
+	{
+		FTargetRings& Rings = It.Value();
+		if (!Rings.Target.IsValid() || Now - Rings.LastQueryTime > TacticalPositions::EvictAge)
+		{
+			It.RemoveCurrent();
+			continue;
+		}
+		if (NumRebuilt < TacticalPositions::MaxRebuildsPerTick && NeedsRebuild(Rings, Now))
+		{
+			BuildRings(Rings);
+			++NumRebuilt;
+		}
+	}
+	SET_DWORD_STAT(STAT_TacticalTargets, TargetRings.Num());
+}
+
+bool UTacticalPositionSubsystem::NeedsRebuild(const FTargetRings& Rings, float Now) const
+{
+	const AActor* Target = Rings.Target.Get();
+	return Target && (Now - Rings.BuildTime > TacticalPositions::RebuildInterval || FVector::DistSquared2D(Rings.Centre, Target->GetActorLocation()) > FMath::Square(TacticalPositions::RebuildDistance));
+}
+
+UTacticalPositionSubsystem::FTargetRings* UTacticalPositionSubsystem::FindOrBuildRings(AActor* Target)
+{
+	if (!Target) return nullptr;
+	FTargetRings* Rings = TargetRings.Find(Target);
+	// a stale entry can outlive its target by a frame and see the address reused
+	if (!Rings || Rings->Target.Get() != Target)
+	{
+		Rings = &TargetRings.Add(Target, FTargetRings());
+		Rings->Target = Target;
+	}
+	Rings->LastQueryTime = GetWorld()->GetTimeSeconds();
+	// the first query for a target can't wait for the tick
+	if (Rings->BuildTime < 0) BuildRings(*Rings);
+	return Rings;
+}
+
+void UTacticalPositionSubsystem::BuildRings(FTargetRings& Rings)
+{
+	SCOPE_CYCLE_COUNTER(STAT_TacticalRingBuild);
+	AActor* Target = Rings.Target.Get();
+	if (!Target) return;
+	UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld());
+	Rings.Centre = Target->GetActorLocation();
+	Rings.BuildTime = GetWorld()->GetTimeSeconds();
+	const bool bUseOccupancy = OccupancyMap && OccupancyMap->IsBuilt();
+	for (int32 Ring = 0; Ring < int32(ETacticalRing::MAX); Ring++)
+	{
+		for (int32 i = 0; i < SlotsPerRing; i++)
+		{
+			// slot angles are fixed in world space so claims stay on the same side as the target moves
+			FTacticalSlot& Slot = Rings.Slots[Ring][i];
+			const float Angle = 2.f * PI * i / SlotsPerRing;
+			const FVector Candidate = Rings.Centre + FVector(FMath::Cos(Angle), FMath::Sin(Angle), 0) * TacticalPositions::RingRadii[Ring];
+			FNavLocation Projected;
+			Slot.bValid = NavSys && NavSys->ProjectPointToNavigation(Candidate, Projected, FVector(50.f, 50.f, 200.f));
+			if (!Slot.bValid) continue;
+			Slot.Location = Projected.Location;
+			// nothing built in the way between the target and the slot, and the slot itself isn't inside a footprint
+			if (bUseOccupancy && OccupancyMap->RaycastFirstBlocker(Rings.Centre, Slot.Location)) Slot.bValid = false;
+		}
+	}
+}
+
+float UTacticalPositionSubsystem::ScoreSlot(const FTargetRings& Rings, ETacticalRing Ring, int32 SlotIndex, const AController* Querier, const FVector& QuerierLocation, float Now) const
+{
+	const FTacticalSlot& Slot = Rings.Slots[int32(Ring)][SlotIndex];
+	if (!Slot.bValid) return MAX_flt;
+	if (Slot.Claimant.IsValid() && Slot.Claimant.Get() != Querier && Slot.ClaimExpiry > Now) return MAX_flt;
+	const AActor* Target = Rings.Target.Get();
+	const FVector FromTarget = (Slot.Location - Rings.Centre).GetSafeNormal2D();
+	const float FacingDot = Target->GetActorForwardVector().GetSafeNormal2D().Dot(FromTarget);
+	// travel in ring radii, so both rings weigh distance the same way
+	float Score = FVector::Dist2D(QuerierLocation, Slot.Location) / TacticalPositions::RingRadii[int32(Ring)];
+	if (Ring == ETacticalRing::Flank)
+	{
+		// threat: flankers want the target's sides and back, never its front
+		Score += FMath::Max(FacingDot, 0.f) * 2.f + FMath::Abs(FacingDot) * .5f;
+	}
+	// crowding: neighbouring slots held by others make this one a worse fit
+	const int32 Prev = (SlotIndex + SlotsPerRing - 1) % SlotsPerRing;
+	const int32 Next = (SlotIndex + 1) % SlotsPerRing;
+	for (int32 Neighbour : {Prev, Next})
+	{
+		const FTacticalSlot& Other = Rings.Slots[int32(Ring)][Neighbour];
+		if (Other.Claimant.IsValid() && Other.Claimant.Get() != Querier && Other.ClaimExpiry > Now) Score += .5f;
+	}
+	return Score;
+}
+
+int32 UTacticalPositionSubsystem::PickSlot(FTargetRings& Rings, ETacticalRing Ring, AController* Querier, float Now) const
+{
+	const APawn* Pawn = Querier->GetPawn();
+	if (!Pawn) return INDEX_NONE;
+	const FVector QuerierLocation = Pawn->GetActorLocation();
+	int32 BestSlot = INDEX_NONE;
+	float BestScore = MAX_flt;
+	for (int32 i = 0; i < SlotsPerRing; i++)
+	{
+		const float Score = ScoreSlot(Rings, Ring, i, Querier, QuerierLocation, Now);
+		if (Score < BestScore)
+		{
+			BestScore = Score;
+			BestSlot = i;
+		}
+	}
+	return BestSlot;
+}
+
+bool UTacticalPositionSubsystem::ClaimFlankPosition(AController* Querier, AActor* Target, FVector& OUT_Location)
+{
+	FTargetRings* Rings = Querier ? FindOrBuildRings(Target) : nullptr;
+	if (!Rings) return false;
+	const float Now = GetWorld()->GetTimeSeconds();
+	FTacticalSlot* Slots = Rings->Slots[int32(ETacticalRing::Flank)];
+	// stick with the current slot while it is still reachable and not in front of the target
+	for (int32 i = 0; i < SlotsPerRing; i++)
+	{
+		if (Slots[i].Claimant.Get() != Querier) continue;
+		const FVector FromTarget = (Slots[i].Location - Rings->Centre).GetSafeNormal2D();
+		if (Slots[i].bValid && Target->GetActorForwardVector().GetSafeNormal2D().Dot(FromTarget) < .5f)
+		{
+			Slots[i].ClaimExpiry = Now + TacticalPositions::FlankHold;
+			OUT_Location = Slots[i].Location;
+			return true;
+		}
+		Slots[i].Claimant.Reset();
+	}
+	const int32 SlotIndex = PickSlot(*Rings, ETacticalRing::Flank, Querier, Now);
+	if (SlotIndex == INDEX_NONE) return false;
+	Slots[SlotIndex].Claimant = Querier;
+	Slots[SlotIndex].ClaimExpiry = Now + TacticalPositions::FlankHold;
+	OUT_Location = Slots[SlotIndex].Location;
+	return true;
+}
+
+bool UTacticalPositionSubsystem::FindRetreatPosition(AController* Querier, AActor* Target, FVector& OUT_Location)
+{
+	FTargetRings* Rings = Querier ? FindOrBuildRings(Target) : nullptr;
+	if (!Rings) return false;
+	const float Now = GetWorld()->GetTimeSeconds();
+	const int32 SlotIndex = PickSlot(*Rings, ETacticalRing::Retreat, Querier, Now);
+	if (SlotIndex == INDEX_NONE) return false;
+	FTacticalSlot& Slot = Rings->Slots[int32(ETacticalRing::Retreat)][SlotIndex];
+	Slot.Claimant = Querier;
+	Slot.ClaimExpiry = Now + TacticalPositions::RetreatHold;
+	OUT_Location = Slot.Location;
+	return true;
+}
+
+void UTacticalPositionSubsystem::ReleaseClaims(AController* Querier)
+{
+	for (TPair<AActor*, FTargetRings>& Pair : TargetRings)
+	{
+		for (int32 Ring = 0; Ring < int32(ETacticalRing::MAX); Ring++)
+		{
+			for (FTacticalSlot& Slot : Pair.Value.Slots[Ring])
+			{
+				if (Slot.Claimant.Get() == Querier) Slot.Claimant.Reset();
+			}
+		}
+	}
+}
+
+void UTacticalPositionSubsystem::OnOccupancyChanged(const FIntRect& ChangedCells)
+{
+	// cheap enough to re-project every ring on the next ticks rather than work out which ones the change touches
+	for (TPair<AActor*, FTargetRings>& Pair : TargetRings)
+	{
+		Pair.Value.BuildTime = -MAX_flt;
+	}
+}
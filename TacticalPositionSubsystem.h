@@ -0,0 +1,82 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "TacticalPositionSubsystem.generated.h"
+
+class AController;
+class USiegeOccupancySubsystem;
+
+enum class ETacticalRing : uint8
+{
+	// close ring melee units back off to
+	Retreat,
+	// wide ring flankers spread around
+	Flank,
+	MAX,
+};
+
+/**
+ * Candidate combat positions around engaged targets. Each target gets rings of candidates that are projected
+ * to the navmesh and checked against the occupancy map once per interval, shared by every AI fighting it.
+ * Queries score the prepared candidates for threat, travel and crowding; flank positions are claimed so
+ * flankers spread out instead of queueing for the same point.
+ */
+UCLASS()
+class EALOND_API UTacticalPositionSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/** Keeps the querier's current flank slot while it stays usable, otherwise claims the best free one. */
+	bool ClaimFlankPosition(AController* Querier, AActor* Target, FVector& OUT_Location);
+
+	/** Best reachable point on the retreat ring on the querier's side of the target. Held briefly so two AI don't back into each other. */
+	bool FindRetreatPosition(AController* Querier, AActor* Target, FVector& OUT_Location);
+
+	/** Frees every slot the querier holds, on any target. */
+	void ReleaseClaims(AController* Querier);
+
+	static constexpr int32 SlotsPerRing = 16;
+	static constexpr float RetreatRadius = 350.f;
+	static constexpr float FlankRadius = 500.f;
+
+private:
+	struct FTacticalSlot
+	{
+		FVector Location = FVector::ZeroVector;
+		TWeakObjectPtr<AController> Claimant;
+		float ClaimExpiry = 0;
+		bool bValid = false;
+	};
+
+	struct FTargetRings
+	{
+		TWeakObjectPtr<AActor> Target;
+		FVector Centre = FVector::ZeroVector;
+		float BuildTime = -MAX_flt;
+		float LastQueryTime = 0;
+		FTacticalSlot Slots[int32(ETacticalRing::MAX)][SlotsPerRing];
+	};
+
+	FTargetRings* FindOrBuildRings(AActor* Target);
+	void BuildRings(FTargetRings& Rings);
+	bool NeedsRebuild(const FTargetRings& Rings, float Now) const;
+	/** Lower is better. Returns MAX_flt for unusable slots. */
+	float ScoreSlot(const FTargetRings& Rings, ETacticalRing Ring, int32 SlotIndex, const AController* Querier, const FVector& QuerierLocation, float Now) const;
+	int32 PickSlot(FTargetRings& Rings, ETacticalRing Ring, AController* Querier, float Now) const;
+	void OnOccupancyChanged(const FIntRect& ChangedCells);
+
+	TMap<AActor*, FTargetRings> TargetRings;
+
+	UPROPERTY()
+	TObjectPtr<USiegeOccupancySubsystem> OccupancyMap;
+	FDelegateHandle OccupancyChangedHandle;
+};
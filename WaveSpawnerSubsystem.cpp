@@ -0,0 +1,182 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "WaveSpawnerSubsystem.h"
+#include "AIActionQueue.h"
+#include "AIBaseCharacter.h"
+#include "AIPoolSubsystem.h"
+#include "AITraceSubsystem.h"
+#include "EnemyAIController.h"
+#include "HordeSimulationSubsystem.h"
+#include "BrainComponent.h"
+#include "Engine/AssetManager.h"
+#include "Engine/StreamableManager.h"
+
+DECLARE_CYCLE_STAT(TEXT("Wave activation"), STAT_WaveActivation, STATGROUP_EalondAI);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Waves in progress"), STAT_WavesInProgress, STATGROUP_EalondAI);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Last wave trigger to active (ms)"), STAT_WaveTriggerToActiveMs, STATGROUP_EalondAI);
+
+void UWaveSpawnerSubsystem::Deinitialize()
+{
+	for (TPair<int32, FWave>& Pair : Waves)
+	{
+		if (Pair.Value.AssetHandle.IsValid()) Pair.Value.AssetHandle->CancelHandle();
+	}
+	Waves.Empty();
+
+	Super::Deinitialize();
+}
+
+TStatId UWaveSpawnerSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UWaveSpawnerSubsystem, STATGROUP_Tickables);
+}
+
+int32 UWaveSpawnerSubsystem::StartWave(const TArray<FWaveSpawnEntry>& Entries, FOnWaveActive OnActive, const TArray<FSoftObjectPath>& ExtraAssets)
+{
+	const int32 WaveId = NextWaveId++;
+	FWave& Wave = Waves.Add(WaveId);
+	Wave.Entries = Entries;
+	Wave.OnActive = OnActive;
+	Wave.TriggerTime = FPlatformTime::Seconds();
+
+	// loading the pawn classes pulls in their controllers' animations and behaviour trees with them
+	TArray<FSoftObjectPath> AssetsToLoad = ExtraAssets;
+	for (const FWaveSpawnEntry& Entry : Entries)
+	{
+		if (!Entry.PawnClass.IsNull()) AssetsToLoad.AddUnique(Entry.PawnClass.ToSoftObjectPath());
+	}
+	Wave.AssetHandle = UAssetManager::GetStreamableManager().RequestAsyncLoad(AssetsToLoad, FStreamableDelegate::CreateUObject(this, &UWaveSpawnerSubsystem::OnWaveAssetsLoaded, WaveId));
+	// nothing to load, or everything was already resident; the delegate doesn't fire for a null handle
+	if (!Wave.AssetHandle.IsValid()) OnWaveAssetsLoaded(WaveId);
+	SET_DWORD_STAT(STAT_WavesInProgress, Waves.Num());
+	return WaveId;
+}
+
+void UWaveSpawnerSubsystem::OnWaveAssetsLoaded(int32 WaveId)
+{
+	FWave* Wave = Waves.Find(WaveId);
+	if (!Wave || Wave->bAssetsLoaded) return;
+	Wave->bAssetsLoaded = true;
+	// top the pool up with whatever this wave needs beyond what is already dormant
+	if (UAIPoolSubsystem* Pool = GetWorld()->GetSubsystem<UAIPoolSubsystem>())
+	{
+		TMap<UClass*, int32> Needed;
+		for (const FWaveSpawnEntry& Entry : Wave->Entries)
+		{
+			if (UClass* PawnClass = Entry.PawnClass.Get()) ++Needed.FindOrAdd(PawnClass);
+		}
+		for (const TPair<UClass*, int32>& Pair : Needed)
+		{
+			Pool->Prewarm(Pair.Key, Pair.Value - Pool->GetNumDormant(Pair.Key));
+		}
+	}
+}
+
+void UWaveSpawnerSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	SCOPE_CYCLE_COUNTER(STAT_WaveActivation);
+	const double BudgetEndTime = FPlatformTime::Seconds() + ActivationBudgetMs / 1000.0;
+	int32 ActivationsLeft = MaxActivationsPerTick;
+	for (auto It = Waves.CreateIterator(); It; ++It)
+	{
+		FWave& Wave = It.Value();
+		if (!Wave.bAssetsLoaded) continue;
+		if (Wave.NextEntry < Wave.Entries.Num())
+		{
+			ActivationsLeft -= ActivateEntries(Wave, ActivationsLeft, BudgetEndTime);
+			if (Wave.NextEntry >= Wave.Entries.Num()) Wave.ActivatedTime = FPlatformTime::Seconds();
+			continue;
+		}
+		int32 NumAlive = 0;
+		int32 NumRunning = 0;
+		CountRunningAI(Wave, NumAlive, NumRunning);
+		// past the timeout, AI that never start a brain stop holding the wave up, but one still has to be running
+		const bool bTimedOut = FPlatformTime::Seconds() - Wave.ActivatedTime >= ActiveTimeoutSeconds;
+		if (NumRunning < NumAlive && (!bTimedOut || NumRunning == 0)) continue;
+
+		const double TriggerToActiveMs = (FPlatformTime::Seconds() - Wave.TriggerTime) * 1000.0;
+		SET_FLOAT_STAT(STAT_WaveTriggerToActiveMs, TriggerToActiveMs);
+		UE_LOG(LogTemp, Log, TEXT("Wave %d: %d of %d AI running, %d simulated, %.1f ms after trigger"), It.Key(), NumRunning, NumAlive, Wave.NumSimulated, TriggerToActiveMs);
+		TArray<AAIBaseCharacter*> SpawnedAI;
+		for (const TWeakObjectPtr<AAIBaseCharacter>& Pawn : Wave.Spawned)
+		{
+			if (Pawn.IsValid()) SpawnedAI.Add(Pawn.Get());
+		}
+		FOnWaveActive OnActive = Wave.OnActive;
+		It.RemoveCurrent();
+		OnActive.ExecuteIfBound(SpawnedAI);
+	}
+	SET_DWORD_STAT(STAT_WavesInProgress, Waves.Num());
+}
+
+int32 UWaveSpawnerSubsystem::ActivateEntries(FWave& Wave, int32 MaxActivations, double BudgetEndTime)
+{
+	UAIPoolSubsystem* Pool = GetWorld()->GetSubsystem<UAIPoolSubsystem>();
+	UHordeSimulationSubsystem* Horde = GetWorld()->GetSubsystem<UHordeSimulationSubsystem>();
+	int32 NumActivated = 0;
+	// always make progress: the first activation of a frame ignores the time budget
+	while (Wave.NextEntry < Wave.Entries.Num() && NumActivated < MaxActivations && (NumActivated == 0 || FPlatformTime::Seconds() < BudgetEndTime))
+	{
+		const int32 EntryIndex = Wave.NextEntry;
+		const FWaveSpawnEntry& Entry = Wave.Entries[EntryIndex];
+		UClass* PawnClass = Entry.PawnClass.Get();
+		if (!PawnClass)
+		{
+			++Wave.NextEntry;
+			UE_LOG(LogTemp, Warning, TEXT("Wave spawner: %s failed to load, skipping"), *Entry.PawnClass.ToString());
+			continue;
+		}
+		const bool bDistant = Horde && Horde->IsDistant(Entry.SpawnTransform.GetLocation());
+		// the pool is still prewarming this class: wait for it rather than spawn fresh and leave the prewarmed pawn idle
+		if (!bDistant && Pool && Pool->GetNumDormant(PawnClass) == 0 && Pool->GetNumPrewarming(PawnClass) > 0) break;
+		++Wave.NextEntry;
+		// AI spawning far from anything to fight start out simulated; they don't count against the budget
+		if (bDistant)
+		{
+			Horde->AddAgent(PawnClass, Entry.SpawnTransform);
+			++Wave.NumSimulated;
+			continue;
+		}
+		AAIBaseCharacter* Pawn = nullptr;
+		if (Pool)
+		{
+			Pawn = Pool->Acquire(PawnClass, Entry.SpawnTransform);
+		}
+		else
+		{
+			FActorSpawnParameters Params;
+			Params.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButAlwaysSpawn;
+			Pawn = GetWorld()->SpawnActor<AAIBaseCharacter>(PawnClass, Entry.SpawnTransform, Params);
+		}
+		++NumActivated;
+		if (!Pawn) continue;
+		Wave.Spawned.Add(Pawn);
+		// spread behaviour tree starts so the wave's first decisions and path requests don't land on one frame
+		if (AEnemyAIController* Controller = Cast<AEnemyAIController>(Pawn->GetController()))
+		{
+			Controller->DelayBrainStart((EntryIndex % StaggerSteps) * StaggerStep);
+		}
+	}
+	return NumActivated;
+}
+
+void UWaveSpawnerSubsystem::CountRunningAI(const FWave& Wave, int32& OUT_NumAlive, int32& OUT_NumRunning) const
+{
+	for (const TWeakObjectPtr<AAIBaseCharacter>& Pawn : Wave.Spawned)
+	{
+		// dead or despawned AI don't hold the wave up
+		const AEnemyAIController* Controller = Pawn.IsValid() ? Cast<AEnemyAIController>(Pawn->GetController()) : nullptr;
+		if (!Controller) continue;
+		++OUT_NumAlive;
+		const UBrainComponent* Brain = Controller->GetBrainComponent();
+		if (Brain && Brain->IsRunning()) ++OUT_NumRunning;
+	}
+}
+
+bool UWaveSpawnerSubsystem::IsWaveInProgress(int32 WaveId) const
+{
+	return Waves.Contains(WaveId);
+}
@@ -0,0 +1,78 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "WaveSpawnerSubsystem.generated.h"
+
+class AAIBaseCharacter;
+class AEnemyAIController;
+struct FStreamableHandle;
+
+DECLARE_DELEGATE_OneParam(FOnWaveActive, const TArray<AAIBaseCharacter*>& /*SpawnedAI*/);
+
+struct FWaveSpawnEntry
+{
+	TSoftClassPtr<AAIBaseCharacter> PawnClass;
+	FTransform SpawnTransform;
+};
+
+/**
+ * Spawns waves without a frame spike. A wave's pawn classes, and with them every asset they and their
+ * controllers hard-reference, are streamed in asynchronously first. The AI are then taken from the pool
+ * a few per frame under a time budget, with behaviour tree starts staggered across the wave.
+ */
+UCLASS()
+class EALOND_API UWaveSpawnerSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/**
+	 * Starts loading the wave and returns its id. OnActive fires once every AI in the wave is running its
+	 * behaviour tree (or has died trying). Entries far from anything to fight join the horde simulation
+	 * instead and are not part of the spawned list. ExtraAssets are loaded alongside the pawn classes and kept for the wave's lifetime.
+	 */
+	int32 StartWave(const TArray<FWaveSpawnEntry>& Entries, FOnWaveActive OnActive = FOnWaveActive(), const TArray<FSoftObjectPath>& ExtraAssets = TArray<FSoftObjectPath>());
+
+	/** True while the wave is still loading, activating or waiting for its behaviour trees to start. */
+	bool IsWaveInProgress(int32 WaveId) const;
+
+	// activations per frame, and the frame time they may use between them
+	static constexpr int32 MaxActivationsPerTick = 4;
+	static constexpr double ActivationBudgetMs = 2.0;
+	// behaviour tree starts are spread over this many steps of this length
+	static constexpr int32 StaggerSteps = 8;
+	static constexpr float StaggerStep = .1f;
+	// a wave where some AI never start a behaviour tree is reported active after this long, as long as one has
+	static constexpr double ActiveTimeoutSeconds = 30.0;
+
+private:
+	struct FWave
+	{
+		TArray<FWaveSpawnEntry> Entries;
+		TArray<TWeakObjectPtr<AAIBaseCharacter>> Spawned;
+		TSharedPtr<FStreamableHandle> AssetHandle;
+		FOnWaveActive OnActive;
+		double TriggerTime = 0;
+		double ActivatedTime = 0;
+		int32 NextEntry = 0;
+		// entries handed to the horde simulation instead of spawned
+		int32 NumSimulated = 0;
+		bool bAssetsLoaded = false;
+	};
+
+	void OnWaveAssetsLoaded(int32 WaveId);
+	/** Activates entries until the budget runs out; returns the number activated. */
+	int32 ActivateEntries(FWave& Wave, int32 MaxActivations, double BudgetEndTime);
+	/** Counts the wave's AI that are still possessed, and how many of those are running their brain. */
+	void CountRunningAI(const FWave& Wave, int32& OUT_NumAlive, int32& OUT_NumRunning) const;
+
+	TMap<int32, FWave> Waves;
+	int32 NextWaveId = 1;
+};
@@ -0,0 +1,175 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "WeaponSwingBake.h"
+#include "Animation/AnimMontage.h"
+#include "Animation/AnimSequence.h"
+#include "Engine/SkeletalMesh.h"
+#include "Engine/SkeletalMeshSocket.h"
+
+int32 UWeaponSwingBake::FindSection(float MontagePosition) const
+{
+	for (int32 i = 0; i < Sections.Num(); i++)
+	{
+		if (MontagePosition >= Sections[i].StartTime && MontagePosition <= Sections[i].EndTime) return i;
+	}
+	return INDEX_NONE;
+}
+
+bool UWeaponSwingBake::Sample(float MontagePosition, FVector& OUT_Start, FVector& OUT_Direction) const
+{
+	const int32 SectionIndex = FindSection(MontagePosition);
+	if (SectionIndex == INDEX_NONE) return false;
+	const FBakedSwingSection& Section = Sections[SectionIndex];
+	const int32 NumSamples = Section.BladeStarts.Num();
+	if (!NumSamples || Section.BladeDirections.Num() != NumSamples) return false;
+
+	const float SampleIndex = (MontagePosition - Section.StartTime) * SampleRate;
+	const int32 Index = FMath::Clamp(FMath::FloorToInt(SampleIndex), 0, NumSamples - 1);
+	const int32 NextIndex = FMath::Min(Index + 1, NumSamples - 1);
+	const float Alpha = FMath::Clamp(SampleIndex - Index, 0.f, 1.f);
+	OUT_Start = FVector(FMath::Lerp(Section.BladeStarts[Index], Section.BladeStarts[NextIndex], Alpha));
+	OUT_Direction = FVector(FMath::Lerp(Section.BladeDirections[Index], Section.BladeDirections[NextIndex], Alpha)).GetSafeNormal();
+	return true;
+}
+
+void UWeaponSwingBake::GetSampleTimesBetween(float FromPosition, float ToPosition, int32 MaxSamples, TArray<float>& OUT_Times) const
+{
+	OUT_Times.Reset();
+	const int32 SectionIndex = FindSection(ToPosition);
+	if (SectionIndex == INDEX_NONE || FindSection(FromPosition) != SectionIndex || ToPosition <= FromPosition || MaxSamples <= 0) return;
+	const FBakedSwingSection& Section = Sections[SectionIndex];
+
+	const int32 First = FMath::FloorToInt((FromPosition - Section.StartTime) * SampleRate) + 1;
+	const int32 Last = FMath::CeilToInt((ToPosition - Section.StartTime) * SampleRate) - 1;
+	const int32 NumTimes = Last - First + 1;
+	if (NumTimes <= 0) return;
+	// far more samples crossed than allowed (a long hitch): spread the allowance evenly over the arc
+	const float Step = NumTimes > MaxSamples ? float(NumTimes) / MaxSamples : 1.f;
+	for (float Sample = First; Sample <= Last && OUT_Times.Num() < MaxSamples; Sample += Step)
+	{
+		OUT_Times.Add(Section.StartTime + FMath::FloorToInt(Sample) / SampleRate);
+	}
+}
+
+#if WITH_EDITOR
+
+namespace WeaponSwingBake
+{
+	/** Root pose the mesh actually shows while the sequence plays: root motion moves the capsule, not the root bone. */
+	static FTransform GetLockedRoot(const UAnimSequence* Sequence, const FReferenceSkeleton& RefSkeleton, int32 SkeletonBone)
+	{
+		switch (Sequence->RootMotionRootLock)
+		{
+		case ERootMotionRootLock::AnimFirstFrame:
+		{
+			FTransform FirstFrame = RefSkeleton.GetRefBonePose()[0];
+			if (SkeletonBone != INDEX_NONE) Sequence->GetBoneTransform(FirstFrame, FSkeletonPoseBoneIndex(SkeletonBone), FAnimExtractContext(0.0), false);
+			return FirstFrame;
+		}
+		case ERootMotionRootLock::Zero:
+			return FTransform::Identity;
+		default:
+			return RefSkeleton.GetRefBonePose()[0];
+		}
+	}
+
+	static FTransform GetComponentSpaceBone(const UAnimSequence* Sequence, const USkeletalMesh* Mesh, int32 MeshBoneIndex, double Time)
+	{
+		const FReferenceSkeleton& RefSkeleton = Mesh->GetRefSkeleton();
+		const USkeleton* Skeleton = Sequence->GetSkeleton();
+		const FAnimExtractContext ExtractContext(Time);
+		const bool bLockRoot = Sequence->bEnableRootMotion || Sequence->bForceRootLock;
+		FTransform ComponentSpace = FTransform::Identity;
+		for (int32 Bone = MeshBoneIndex; Bone != INDEX_NONE; Bone = RefSkeleton.GetParentIndex(Bone))
+		{
+			// sequence tracks are indexed by skeleton bone, which need not match the mesh's bone order
+			const int32 SkeletonBone = Skeleton ? Skeleton->GetSkeletonBoneIndexFromMeshBoneIndex(Mesh, Bone) : INDEX_NONE;
+			FTransform Local = RefSkeleton.GetRefBonePose()[Bone];
+			if (Bone == 0 && bLockRoot) Local = GetLockedRoot(Sequence, RefSkeleton, SkeletonBone);
+			else if (SkeletonBone != INDEX_NONE) Sequence->GetBoneTransform(Local, FSkeletonPoseBoneIndex(SkeletonBone), ExtractContext, false);
+			ComponentSpace = ComponentSpace * Local;
+		}
+		return ComponentSpace;
+	}
+
+	/** Socket (or bone of that name) in component space at a montage position; false if the montage has no sequence there. */
+	static bool GetSocketAtTime(const UAnimMontage* Montage, const USkeletalMesh* Mesh, FName SocketName, float MontagePosition, FVector& OUT_Location)
+	{
+		if (!Montage->SlotAnimTracks.Num()) return false;
+		const FAnimSegment* Segment = Montage->SlotAnimTracks[0].AnimTrack.GetSegmentAtTime(MontagePosition);
+		const UAnimSequence* Sequence = Segment ? Cast<UAnimSequence>(Segment->GetAnimReference()) : nullptr;
+		if (!Sequence) return false;
+
+		FTransform SocketLocal = FTransform::Identity;
+		FName BoneName = SocketName;
+		if (const USkeletalMeshSocket* Socket = Mesh->FindSocket(SocketName))
+		{
+			SocketLocal = FTransform(Socket->RelativeRotation, Socket->RelativeLocation, Socket->RelativeScale);
+			BoneName = Socket->BoneName;
+		}
+		const int32 BoneIndex = Mesh->GetRefSkeleton().FindBoneIndex(BoneName);
+		if (BoneIndex == INDEX_NONE) return false;
+		const double SequenceTime = Segment->ConvertTrackPosToAnimPos(MontagePosition);
+		OUT_Location = (SocketLocal * GetComponentSpaceBone(Sequence, Mesh, BoneIndex, SequenceTime)).GetLocation();
+		return true;
+	}
+}
+
+UWeaponSwingBake* UWeaponSwingBake::BakeMontage(UAnimMontage* Montage, const USkeletalMesh* Mesh, FName HandSocket, FName OffsetSocket)
+{
+	if (!Montage || !Mesh) return nullptr;
+	Montage->Modify();
+	UWeaponSwingBake* Bake = Montage->GetAssetUserData<UWeaponSwingBake>();
+	if (!Bake)
+	{
+		Bake = NewObject<UWeaponSwingBake>(Montage, NAME_None, RF_Public | RF_Transactional);
+		Montage->AddAssetUserData(Bake);
+	}
+	Bake->Modify();
+	Bake->Sections.Reset();
+
+	for (int32 SectionIndex = 0; SectionIndex < Montage->CompositeSections.Num(); SectionIndex++)
+	{
+		FBakedSwingSection& Section = Bake->Sections.AddDefaulted_GetRef();
+		Montage->GetSectionStartAndEndTime(SectionIndex, Section.StartTime, Section.EndTime);
+		const int32 NumSamples = FMath::FloorToInt((Section.EndTime - Section.StartTime) * Bake->SampleRate) + 1;
+		Section.BladeStarts.Reserve(NumSamples);
+		Section.BladeDirections.Reserve(NumSamples);
+		for (int32 i = 0; i < NumSamples; i++)
+		{
+			const float Time = FMath::Min(Section.StartTime + i / Bake->SampleRate, Section.EndTime);
+			FVector Hand = FVector::ZeroVector;
+			FVector Offset = FVector::ForwardVector;
+			WeaponSwingBake::GetSocketAtTime(Montage, Mesh, HandSocket, Time, Hand);
+			WeaponSwingBake::GetSocketAtTime(Montage, Mesh, OffsetSocket, Time, Offset);
+			Section.BladeStarts.Add(FVector3f(Hand));
+			Section.BladeDirections.Add(FVector3f((Offset - Hand).GetSafeNormal()));
+		}
+	}
+	Montage->MarkPackageDirty();
+	UE_LOG(LogTemp, Log, TEXT("Weapon swing bake: %s, %d sections"), *Montage->GetName(), Bake->Sections.Num());
+	return Bake;
+}
+
+static FAutoConsoleCommand CVarBakeWeaponSwings(
+	TEXT("combat.WeaponSwing.Bake"),
+	TEXT("Bake weapon blade arcs onto attack montages. Args: skeletal mesh path, then one or more montage paths. Save the montages afterwards."),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+		{
+			const USkeletalMesh* Mesh = Args.Num() > 1 ? LoadObject<USkeletalMesh>(nullptr, *Args[0]) : nullptr;
+			if (!Mesh)
+			{
+				UE_LOG(LogTemp, Warning, TEXT("Weapon swing bake: usage combat.WeaponSwing.Bake <mesh> <montage> [<montage>...]"));
+				return;
+			}
+			for (int32 i = 1; i < Args.Num(); i++)
+			{
+				if (!UWeaponSwingBake::BakeMontage(LoadObject<UAnimMontage>(nullptr, *Args[i]), Mesh))
+				{
+					UE_LOG(LogTemp, Warning, TEXT("Weapon swing bake: couldn't load montage %s"), *Args[i]);
+				}
+			}
+		}));
+
+#endif
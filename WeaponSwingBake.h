@@ -0,0 +1,58 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/AssetUserData.h"
+#include "WeaponSwingBake.generated.h"
+
+class UAnimMontage;
+class USkeletalMesh;
+
+/** Blade samples for one montage section, at the bake's fixed rate from the section start. */
+USTRUCT()
+struct FBakedSwingSection
+{
+	GENERATED_BODY()
+
+	UPROPERTY(VisibleAnywhere, Category = "Swing")
+	float StartTime = 0;
+	UPROPERTY(VisibleAnywhere, Category = "Swing")
+	float EndTime = 0;
+
+	// component space hand position and unit blade direction; the weapon's length is applied at runtime
+	UPROPERTY()
+	TArray<FVector3f> BladeStarts;
+	UPROPERTY()
+	TArray<FVector3f> BladeDirections;
+};
+
+/**
+ * Weapon blade arc baked from an attack montage, stored on the montage as asset user data. Sampled at a
+ * high fixed rate offline, so melee traces can sweep the real arc between two frames without evaluating
+ * sockets, whatever the tick rate. Bake with combat.WeaponSwing.Bake in the editor.
+ */
+UCLASS()
+class EALOND_API UWeaponSwingBake : public UAssetUserData
+{
+	GENERATED_BODY()
+
+public:
+	/** Blade at a montage position, in component space. False outside any baked section. */
+	bool Sample(float MontagePosition, FVector& OUT_Start, FVector& OUT_Direction) const;
+	/** Section index holding a montage position, or INDEX_NONE. */
+	int32 FindSection(float MontagePosition) const;
+	/** Baked sample times strictly between two positions in the same section, oldest first, at most MaxSamples. */
+	void GetSampleTimesBetween(float FromPosition, float ToPosition, int32 MaxSamples, TArray<float>& OUT_Times) const;
+
+#if WITH_EDITOR
+	/** Samples every section of the montage on the mesh and stores the result on it, replacing any older bake. */
+	static UWeaponSwingBake* BakeMontage(UAnimMontage* Montage, const USkeletalMesh* Mesh, FName HandSocket = TEXT("righthand"), FName OffsetSocket = TEXT("weapontraceoffset"));
+#endif
+
+	UPROPERTY(VisibleAnywhere, Category = "Swing")
+	float SampleRate = 120.f;
+
+	UPROPERTY(VisibleAnywhere, Category = "Swing")
+	TArray<FBakedSwingSection> Sections;
+};